@@ -55,6 +55,9 @@
 							 memory_order_relaxed)
 #define atomic_load_consume(ptr) \
 	atomic_load_explicit(ptr, memory_order_consume)
+#define atomic_load_acquire(ptr) \
+	atomic_load_explicit(ptr, memory_order_acquire)
+#define atomic_fence() atomic_thread_fence(memory_order_seq_cst)
 
 #define atomic_dec_release(ptr) \
 	atomic_fetch_sub_explicit(ptr, 1, memory_order_release)
@@ -77,6 +80,10 @@
  */
 #define atomic_load_consume(ptr) atomic_fetch_add(ptr, 0)
 #define atomic_dec_release(ptr) __sync_fetch_and_sub(ptr, 1)
+#define atomic_load_acquire(ptr) __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+#define atomic_exchange(ptr, value) \
+	__atomic_exchange_n(ptr, value, __ATOMIC_SEQ_CST)
+#define atomic_fence() __sync_synchronize()
 #define ATOMIC
 
 #define atomic_add(ptr, value) atomic_fetch_add(ptr, value)
@@ -54,6 +54,7 @@
  * Features that don't require separate implementations:
  * Bit [0]	: 0=Read-Only, 1=Read-Write
  * Bit [1]	: Failover [0=Off, 1=On]
+ * Bit [6]	: Load Balanced Lookups [0=Off, 1=On]
  *
  * Features that may require separate implementations::
  * Bit [2]	: Striped Metadata [0=Off, 1=On]
@@ -75,7 +76,9 @@
 
 #define IOF_IS_WRITEABLE(FLAGS) ((FLAGS) & IOF_WRITEABLE)
 #define IOF_HAS_FAILOVER(FLAGS) ((FLAGS) & IOF_FAILOVER)
+#define IOF_FS_TYPE(FLAGS) ((FLAGS) & 0x30UL)
 
+#define IOF_LOAD_BALANCE		0x040UL
 #define IOF_CNSS_MT			0x080UL
 #define IOF_FUSE_READ_BUF		0x100UL
 #define IOF_FUSE_WRITE_BUF		0x200UL
@@ -122,6 +125,8 @@ struct ios_name {
 	((uint32_t)		(max_iov_write)		CRT_VAR)	\
 	((uint32_t)		(htable_size)		CRT_VAR)	\
 	((uint32_t)		(cnss_thread_count)	CRT_VAR)	\
+	((uint32_t)		(stripe_size)		CRT_VAR)	\
+	((uint32_t)		(stripe_count)		CRT_VAR)	\
 	((int)			(id)			CRT_VAR)	\
 
 CRT_GEN_STRUCT(iof_fs_info, IOF_FS_INFO)
@@ -129,6 +134,7 @@ CRT_GEN_STRUCT(iof_fs_info, IOF_FS_INFO)
 #define IOF_SQ_OUT							\
 	((uint32_t)		(poll_interval)		CRT_VAR)	\
 	((bool)			(progress_callback)	CRT_VAR)	\
+	((uint32_t)		(ctx_count)		CRT_VAR)	\
 	((struct iof_fs_info)	(info)			CRT_ARRAY)
 
 CRT_RPC_DECLARE(iof_query, ,IOF_SQ_OUT)
@@ -200,6 +206,14 @@ struct iof_open_in {
 	uint32_t flags;
 };
 
+/* Open a file by a path relative to a directory, with open(2) flags */
+struct iof_open_path_in {
+	struct ios_gah gah;
+	d_string_t path;
+	uint32_t flags;
+	uint32_t mode;
+};
+
 struct iof_unlink_in {
 	struct ios_name name;
 	struct ios_gah gah;
@@ -262,6 +276,41 @@ struct iof_gah_in {
 	struct ios_gah gah;
 };
 
+/* Current load of a projection on one IONSS rank */
+struct iof_load_out {
+	uint32_t active_reads;
+	uint32_t active_writes;
+	uint32_t queued;
+	uint32_t open_handles;
+	int rc;
+	int err;
+};
+
+/* Copy a range from the file with gah to the file with dst_gah, which must
+ * both be open on the rank the request is sent to.
+ */
+struct iof_copy_in {
+	struct ios_gah gah;
+	struct ios_gah dst_gah;
+	uint64_t src_off;
+	uint64_t dst_off;
+	uint64_t len;
+};
+
+struct iof_copy_out {
+	uint64_t len;
+	int rc;
+	int err;
+};
+
+/* Allocate or free space in a file, mode takes the flags of fallocate() */
+struct iof_fallocate_in {
+	struct ios_gah gah;
+	uint64_t offset;
+	uint64_t len;
+	int mode;
+};
+
 struct iof_setattr_in {
 	struct ios_gah gah;
 	struct stat stat;
@@ -290,7 +339,12 @@ extern struct crt_req_format QUERY_RPC_FMT;
 	X(statfs,	gah_in,		iov_pair)	\
 	X(lookup,	gah_string_in,	entry_out)	\
 	X(setattr,	setattr_in,	attr_out)	\
-	X(imigrate,	imigrate_in,	entry_out)
+	X(imigrate,	imigrate_in,	entry_out)	\
+	X(open_path,	open_path_in,	entry_out)	\
+	X(getpath,	gah_in,		string_out)	\
+	X(load,		gah_in,		load_out)	\
+	X(copy,		copy_in,	copy_out)	\
+	X(fallocate,	fallocate_in,	status_out)
 
 #define X(a, b, c) DEF_RPC_TYPE(a),
 
@@ -311,6 +365,7 @@ CRT_GEN_STRUCT(iof_xtvec, IOF_STRUCT_XTVEC);
 	((struct iof_xtvec)	(xtvec)		CRT_VAR)	\
 	((uint64_t)		(xtvec_len)	CRT_VAR)	\
 	((uint64_t)		(bulk_len)	CRT_VAR)	\
+	((uint64_t)		(bulk_off)	CRT_VAR)	\
 	((crt_bulk_t)		(xtvec_bulk)	CRT_VAR)	\
 	((crt_bulk_t)		(data_bulk)	CRT_VAR)
 
@@ -329,6 +384,7 @@ CRT_RPC_DECLARE(iof_readx, IOF_RPC_READX_IN, IOF_RPC_READX_OUT)
 	((struct iof_xtvec)	(xtvec)		CRT_VAR)	\
 	((uint64_t)		(xtvec_len)	CRT_VAR)	\
 	((uint64_t)		(bulk_len)	CRT_VAR)	\
+	((uint64_t)		(bulk_off)	CRT_VAR)	\
 	((crt_bulk_t)		(xtvec_bulk)	CRT_VAR)	\
 	((crt_bulk_t)		(data_bulk)	CRT_VAR)
 
@@ -342,7 +398,8 @@ CRT_RPC_DECLARE(iof_readx, IOF_RPC_READX_IN, IOF_RPC_READX_OUT)
 CRT_RPC_DECLARE(iof_writex, IOF_RPC_WRITEX_IN, IOF_RPC_WRITEX_OUT)
 
 int
-iof_write_register(crt_rpc_cb_t handlers[]);
+iof_write_register(struct crt_proto_format **proto,
+		   crt_rpc_cb_t handlers[]);
 
 int
 iof_io_register(struct crt_proto_format **proto,
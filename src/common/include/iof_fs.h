@@ -49,6 +49,7 @@ struct iof_service_group {
 	crt_group_t		*dest_grp; /* Server group */
 	crt_endpoint_t		psr_ep;    /* Server PSR endpoint */
 	ATOMIC uint32_t		pri_srv_rank;  /* Primary Service Rank */
+	uint32_t		ctx_count; /* Contexts on each server */
 	bool			enabled;   /* Indicates group is available */
 };
 
@@ -65,6 +66,8 @@ struct iof_projection {
 	crt_context_t			crt_ctx;
 	/** bulk threshold */
 	uint32_t			max_iov_write;
+	/** max read size */
+	uint32_t			max_read;
 	/** max write size */
 	uint32_t			max_write;
 	/** client projection id */
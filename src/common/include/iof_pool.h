@@ -43,6 +43,8 @@
 #include <pthread.h>
 #include <gurt/list.h>
 
+#include "iof_atomic.h"
+
 /* A datastructure used to describe and register a type */
 struct iof_pool_reg {
 	/* Perform any one-time setup or assigning constants.
@@ -73,6 +75,25 @@ struct iof_pool_reg {
  * however once max_desc is reached no more descriptors will be created.
  */
 
+/* Unbounded types also keep a small per-CPU magazine of free and released
+ * objects in front of the shared lists, so that acquire() and release()
+ * only touch the shared type lock when a magazine needs to be refilled from,
+ * or flushed to, the depot.  Objects are moved in batches of up to
+ * IOF_POOL_MAG_SIZE / 2 on refill and IOF_POOL_MAG_SIZE on flush.
+ *
+ * Types with either limit set bypass the magazines so that the limits stay
+ * exact.
+ */
+#define IOF_POOL_MAG_SIZE 32
+
+struct iof_pool_mag {
+	pthread_mutex_t		lock;
+	d_list_t		free_list;
+	d_list_t		pending_list;
+	int			free_count;
+	int			pending_count;
+} __attribute__((aligned(64)));
+
 #define POOL_TYPE_INIT(itype, imember) .size = sizeof(struct itype),	\
 		.offset = offsetof(struct itype, imember),		\
 		.name = #itype,
@@ -88,6 +109,10 @@ struct iof_pool_type {
 	pthread_mutex_t		lock;
 	struct iof_pool		*pool;
 
+	/* Per-CPU magazines, NULL for bounded types */
+	struct iof_pool_mag	*mags;
+	int			mag_count;
+
 	/* Counters for current number of objects */
 	int			count; /* Total currently created */
 	int			free_count; /* Number currently free */
@@ -102,8 +127,15 @@ struct iof_pool_type {
 	int			op_init; /* Number of on-path init calls */
 	int			op_reset; /* Number of on-path reset calls */
 	/* Number of sequental calls to acquire() without a call to restock() */
-	int			no_restock; /* Current count */
+	ATOMIC int		no_restock; /* Current count */
 	int			no_restock_hwm; /* High water mark */
+
+	/* Magazine and contention counters */
+	ATOMIC uint64_t		mag_hit; /* acquire() served by a magazine */
+	ATOMIC uint64_t		mag_miss; /* Magazine refilled from depot */
+	ATOMIC uint64_t		mag_flush; /* Magazine flushed to depot */
+	ATOMIC uint64_t		mag_contended; /* Waited for magazine lock */
+	ATOMIC uint64_t		depot_contended; /* Waited for type lock */
 };
 
 struct iof_pool {
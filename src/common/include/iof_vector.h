@@ -61,7 +61,21 @@ typedef struct {
  */
 int vector_init(vector_t *vector, int sizeof_entry, int max_entries);
 
-/* Destroy a vector
+/* Callback invoked with the user data of an entry when its last
+ * reference is dropped, before the entry is returned to the pool.
+ */
+typedef void (*vector_release_cb)(void *entry);
+
+/* Set a callback to release resources owned by entries
+ * \param vector[in] The vector
+ * \param release[in] The callback, or NULL for none
+ * \retval -DER_SUCCESS on success
+ * \retval -DER_INVAL Bad arguments
+ * \retval -DER_UNINIT Vector not initialized
+ */
+int vector_set_release(vector_t *vector, vector_release_cb release);
+
+/* Destroy a vector.  Entries still held only by the vector are released.
  * \param vector[in] The vector to destroy
  * \return 0 on success
  */
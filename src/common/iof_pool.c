@@ -40,6 +40,8 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <sched.h>
+#include <unistd.h>
 
 #include "log.h"
 #include <gurt/common.h>
@@ -61,6 +63,123 @@ debug_dump(struct iof_pool_type *type)
 			type->op_reset);
 	IOF_TRACE_DEBUG(type, "No restock: current %d hwm %d", type->no_restock,
 			type->no_restock_hwm);
+	if (type->mags) {
+		int mag_free = 0;
+		int mag_pending = 0;
+		int i;
+
+		for (i = 0; i < type->mag_count; i++) {
+			mag_free += type->mags[i].free_count;
+			mag_pending += type->mags[i].pending_count;
+		}
+		IOF_TRACE_DEBUG(type, "Magazines: %d free %d pending %d",
+				type->mag_count, mag_free, mag_pending);
+		IOF_TRACE_DEBUG(type, "Magazine: hit %lu miss %lu flush %lu",
+				type->mag_hit, type->mag_miss,
+				type->mag_flush);
+	}
+	IOF_TRACE_DEBUG(type, "Contention: depot %lu magazine %lu",
+			type->depot_contended, type->mag_contended);
+}
+
+/* Take a lock, counting the number of times it was already held */
+static void
+lock_counted(pthread_mutex_t *lock, ATOMIC uint64_t *contended)
+{
+	if (pthread_mutex_trylock(lock) == 0)
+		return;
+
+	atomic_inc(contended);
+	D_MUTEX_LOCK(lock);
+}
+
+/* Return the magazine for the calling CPU, or NULL if the type does not
+ * use magazines.
+ */
+static struct iof_pool_mag *
+mag_get(struct iof_pool_type *type)
+{
+	int cpu;
+
+	if (!type->mags)
+		return NULL;
+
+	cpu = sched_getcpu();
+	if (cpu < 0)
+		cpu = 0;
+
+	return &type->mags[cpu % type->mag_count];
+}
+
+/* Allocate the per-CPU magazines for a type
+ *
+ * Bounded types do not use magazines as objects cached there would not be
+ * visible to the limit checks.
+ */
+static int
+mags_init(struct iof_pool_type *type)
+{
+	long cpus;
+	int i;
+	int rc;
+
+	if (type->reg.max_desc != 0 || type->reg.max_free_desc != 0)
+		return -DER_SUCCESS;
+
+	cpus = sysconf(_SC_NPROCESSORS_CONF);
+	if (cpus < 1)
+		cpus = 1;
+
+	D_ALLOC_ARRAY(type->mags, cpus);
+	if (!type->mags)
+		return -DER_NOMEM;
+
+	for (i = 0; i < cpus; i++) {
+		struct iof_pool_mag *mag = &type->mags[i];
+
+		rc = D_MUTEX_INIT(&mag->lock, NULL);
+		if (rc != -DER_SUCCESS) {
+			while (--i >= 0)
+				D_MUTEX_DESTROY(&type->mags[i].lock);
+			D_FREE(type->mags);
+			return rc;
+		}
+		D_INIT_LIST_HEAD(&mag->free_list);
+		D_INIT_LIST_HEAD(&mag->pending_list);
+	}
+	type->mag_count = cpus;
+
+	return -DER_SUCCESS;
+}
+
+static void
+mags_fini(struct iof_pool_type *type)
+{
+	int i;
+
+	for (i = 0; i < type->mag_count; i++)
+		D_MUTEX_DESTROY(&type->mags[i].lock);
+	D_FREE(type->mags);
+	type->mag_count = 0;
+}
+
+/* Move all released objects in a magazine to the depot pending list.
+ *
+ * Should be called with the magazine lock held, takes the type lock.
+ */
+static void
+mag_flush(struct iof_pool_type *type, struct iof_pool_mag *mag)
+{
+	if (mag->pending_count == 0)
+		return;
+
+	lock_counted(&type->lock, &type->depot_contended);
+	d_list_splice_init(&mag->pending_list, &type->pending_list);
+	type->pending_count += mag->pending_count;
+	D_MUTEX_UNLOCK(&type->lock);
+
+	mag->pending_count = 0;
+	atomic_inc(&type->mag_flush);
 }
 
 /* Create an object pool */
@@ -108,6 +227,7 @@ iof_pool_destroy(struct iof_pool *pool)
 		if (type->count != 0)
 			IOF_TRACE_WARNING(type,
 					  "Freeing type with active objects");
+		mags_fini(type);
 		rc = pthread_mutex_destroy(&type->lock);
 		if (rc != 0)
 			IOF_TRACE_ERROR(type,
@@ -129,55 +249,83 @@ iof_pool_destroy(struct iof_pool *pool)
  * Migrates objects from the pending list to the free list.  Keeps going
  * until either there are count objects on the free list or there are
  * no more pending objects;
- * This function should be called with the type lock held.
+ * This function should be called with the type lock held.  For types without
+ * a max_free_desc limit the lock is dropped while the reset callbacks run so
+ * that other threads are not serialised behind them, so callers must not
+ * assume the lists are unchanged across the call.
  */
 static int
 restock(struct iof_pool_type *type, int count)
 {
+	d_list_t work;
 	d_list_t *entry, *enext;
+	bool drop_lock = (type->reg.max_free_desc == 0);
+	int want;
+	int failed = 0;
 	int reset_calls = 0;
 
 	if (type->free_count >= count)
 		return 0;
 
-	if (type->reg.max_free_desc != 0 &&
-	    type->free_count >= type->reg.max_free_desc) {
-		IOF_TRACE_DEBUG(type, "free_count %d, max_free_desc %d, "
-				"cannot append.",
-				type->free_count, type->reg.max_free_desc);
-		return 0;
+	want = count - type->free_count;
+
+	if (type->reg.max_free_desc != 0) {
+		if (type->free_count >= type->reg.max_free_desc) {
+			IOF_TRACE_DEBUG(type, "free_count %d, max_free_desc %d, "
+					"cannot append.",
+					type->free_count,
+					type->reg.max_free_desc);
+			return 0;
+		}
+		if (want > type->reg.max_free_desc - type->free_count)
+			want = type->reg.max_free_desc - type->free_count;
 	}
 
+	D_INIT_LIST_HEAD(&work);
 	d_list_for_each_safe(entry, enext, &type->pending_list) {
-		void *ptr = (void *)entry - type->reg.offset;
+		d_list_del(entry);
+		d_list_add_tail(entry, &work);
+		type->pending_count--;
+		if (--want == 0)
+			break;
+	}
+
+	if (d_list_empty(&work))
+		return 0;
+
+	if (drop_lock && type->reg.reset)
+		D_MUTEX_UNLOCK(&type->lock);
+
+	d_list_for_each_safe(entry, enext, &work) {
+		void *ptr = (char *)entry - type->reg.offset;
 		bool rcb = true;
 
 		IOF_TRACE_DEBUG(type, "Resetting %p", ptr);
 
-		d_list_del(entry);
-		type->pending_count--;
-
 		if (type->reg.reset) {
-			type->reset_count++;
 			reset_calls++;
 			rcb = type->reg.reset(ptr);
 		}
-		if (rcb) {
-			d_list_add(entry, &type->free_list);
-			type->free_count++;
-		} else {
+		if (!rcb) {
 			IOF_TRACE_INFO(ptr, "entry %p failed reset", ptr);
-			type->count--;
+			d_list_del(entry);
 			D_FREE(ptr);
+			failed++;
 		}
+	}
 
-		if (type->free_count == count)
-			return reset_calls;
+	if (drop_lock && type->reg.reset)
+		D_MUTEX_LOCK(&type->lock);
 
-		if (type->reg.max_free_desc != 0 &&
-		    type->free_count >= type->reg.max_free_desc)
-			return reset_calls;
+	d_list_for_each_safe(entry, enext, &work) {
+		d_list_del(entry);
+		d_list_add(entry, &type->free_list);
+		type->free_count++;
 	}
+
+	type->reset_count += reset_calls;
+	type->count -= failed;
+
 	return reset_calls;
 }
 
@@ -196,8 +344,24 @@ iof_pool_reclaim(struct iof_pool *pool)
 	d_list_for_each_entry(type, &pool->list, type_list) {
 		d_list_t *entry, *enext;
 
+		int i;
+
 		IOF_TRACE_DEBUG(type, "Resetting type");
 
+		/* Return everything held in magazines to the depot */
+		for (i = 0; i < type->mag_count; i++) {
+			struct iof_pool_mag *mag = &type->mags[i];
+
+			D_MUTEX_LOCK(&mag->lock);
+			mag_flush(type, mag);
+			D_MUTEX_LOCK(&type->lock);
+			d_list_splice_init(&mag->free_list, &type->free_list);
+			type->free_count += mag->free_count;
+			mag->free_count = 0;
+			D_MUTEX_UNLOCK(&type->lock);
+			D_MUTEX_UNLOCK(&mag->lock);
+		}
+
 		D_MUTEX_LOCK(&type->lock);
 
 		/* Reclaim any pending objects.  Count here just needs to be
@@ -319,6 +483,14 @@ iof_pool_register(struct iof_pool *pool, struct iof_pool_reg *reg)
 	type->count = 0;
 	type->reg = *reg;
 
+	rc = mags_init(type);
+	if (rc != -DER_SUCCESS) {
+		IOF_TRACE_DOWN(type);
+		D_MUTEX_DESTROY(&type->lock);
+		D_FREE(type);
+		return NULL;
+	}
+
 	create_many(type);
 
 	if (type->free_count == 0) {
@@ -332,6 +504,7 @@ iof_pool_register(struct iof_pool *pool, struct iof_pool_reg *reg)
 		 * injected fault would be ignored - failing the specific
 		 * test.
 		 */
+		mags_fini(type);
 		IOF_TRACE_DOWN(type);
 		D_MUTEX_DESTROY(&type->lock);
 		D_FREE(type);
@@ -345,27 +518,21 @@ iof_pool_register(struct iof_pool *pool, struct iof_pool_reg *reg)
 	return type;
 }
 
-/* Acquire a new object.
+/* Take an object from the depot, creating one if needed.
  *
- * This is to be considered on the critical path so should be as lightweight
- * as posslble.
+ * Released objects are reset and reused before any more are created.  As
+ * restock() may drop the lock another thread can take the object it moved,
+ * so this repeats until the free list has something or nothing is pending.
+ *
+ * Should be called with the type lock held.
  */
-void *
-iof_pool_acquire(struct iof_pool_type *type)
+static void *
+depot_acquire(struct iof_pool_type *type, bool *at_limit)
 {
-	void		*ptr = NULL;
-	d_list_t	*entry;
-	bool		at_limit = false;
+	d_list_t *entry;
 
-	D_MUTEX_LOCK(&type->lock);
-
-	type->no_restock++;
-
-	if (type->free_count == 0) {
-		int count = restock(type, 1);
-
-		type->op_reset += count;
-	}
+	while (d_list_empty(&type->free_list) && type->pending_count > 0)
+		type->op_reset += restock(type, 1);
 
 	if (!d_list_empty(&type->free_list)) {
 		entry = type->free_list.next;
@@ -373,18 +540,96 @@ iof_pool_acquire(struct iof_pool_type *type)
 		entry->next = NULL;
 		entry->prev = NULL;
 		type->free_count--;
-		ptr = (void *)entry - type->reg.offset;
-	} else {
-		if (!type->reg.max_desc || type->count < type->reg.max_desc) {
-			type->op_init++;
-			ptr = create(type);
-		} else {
-			at_limit = true;
-		}
+		return (char *)entry - type->reg.offset;
+	}
+
+	if (!type->reg.max_desc || type->count < type->reg.max_desc) {
+		type->op_init++;
+		return create(type);
+	}
+
+	*at_limit = true;
+	return NULL;
+}
+
+/* Refill a magazine from the depot free list.
+ *
+ * Objects released to the magazine are handed to the depot first so that
+ * they are reused rather than new ones created.
+ *
+ * Should be called with the magazine lock held, takes the type lock.
+ * Returns an object for the caller if one could be found or created.
+ */
+static void *
+mag_refill(struct iof_pool_type *type, struct iof_pool_mag *mag)
+{
+	bool	at_limit = false;
+	void	*ptr;
+	int	batch = IOF_POOL_MAG_SIZE / 2;
+
+	atomic_inc(&type->mag_miss);
+
+	lock_counted(&type->lock, &type->depot_contended);
+
+	if (mag->pending_count != 0) {
+		d_list_splice_init(&mag->pending_list, &type->pending_list);
+		type->pending_count += mag->pending_count;
+		mag->pending_count = 0;
+	}
+
+	ptr = depot_acquire(type, &at_limit);
+
+	while (type->free_count > 0 && mag->free_count < batch) {
+		d_list_t *entry = type->free_list.next;
+
+		d_list_del(entry);
+		d_list_add_tail(entry, &mag->free_list);
+		type->free_count--;
+		mag->free_count++;
 	}
 
 	D_MUTEX_UNLOCK(&type->lock);
 
+	return ptr;
+}
+
+/* Acquire a new object.
+ *
+ * This is to be considered on the critical path so should be as lightweight
+ * as posslble.  For types with magazines the type lock is only taken when
+ * the local magazine is empty.
+ */
+void *
+iof_pool_acquire(struct iof_pool_type *type)
+{
+	struct iof_pool_mag	*mag;
+	void			*ptr = NULL;
+	bool			at_limit = false;
+
+	atomic_inc(&type->no_restock);
+
+	mag = mag_get(type);
+	if (mag) {
+		lock_counted(&mag->lock, &type->mag_contended);
+		if (!d_list_empty(&mag->free_list)) {
+			d_list_t *entry = mag->free_list.next;
+
+			d_list_del(entry);
+			entry->next = NULL;
+			entry->prev = NULL;
+			mag->free_count--;
+			ptr = (char *)entry - type->reg.offset;
+			atomic_inc(&type->mag_hit);
+		} else {
+			ptr = mag_refill(type, mag);
+		}
+		D_MUTEX_UNLOCK(&mag->lock);
+	} else {
+		lock_counted(&type->lock, &type->depot_contended);
+		ptr = depot_acquire(type, &at_limit);
+		D_MUTEX_UNLOCK(&type->lock);
+	}
+
 	if (ptr)
 		IOF_TRACE_DEBUG(type, "Using %p", ptr);
 	else if (at_limit)
@@ -397,16 +642,29 @@ iof_pool_acquire(struct iof_pool_type *type)
 /* Release an object ready for reuse
  *
  * This is sometimes on the critical path, sometimes not so assume that
- * for all cases it is.
- *
+ * for all cases it is.  For types with magazines the object is held on the
+ * local magazine and handed to the depot in batches.
  */
 void
 iof_pool_release(struct iof_pool_type *type, void *ptr)
 {
+	struct iof_pool_mag *mag;
 	d_list_t *entry = ptr + type->reg.offset;
 
 	IOF_TRACE_DOWN(ptr);
-	D_MUTEX_LOCK(&type->lock);
+
+	mag = mag_get(type);
+	if (mag) {
+		lock_counted(&mag->lock, &type->mag_contended);
+		d_list_add_tail(entry, &mag->pending_list);
+		mag->pending_count++;
+		if (mag->pending_count >= IOF_POOL_MAG_SIZE)
+			mag_flush(type, mag);
+		D_MUTEX_UNLOCK(&mag->lock);
+		return;
+	}
+
+	lock_counted(&type->lock, &type->depot_contended);
 	type->pending_count++;
 	d_list_add_tail(entry, &type->pending_list);
 	D_MUTEX_UNLOCK(&type->lock);
@@ -426,15 +684,29 @@ iof_pool_release(struct iof_pool_type *type, void *ptr)
 void
 iof_pool_restock(struct iof_pool_type *type)
 {
+	struct iof_pool_mag *mag;
+	int no_restock;
+
 	IOF_TRACE_DEBUG(type, "Count (%d/%d/%d)", type->pending_count,
 			type->free_count, type->count);
 
+	/* Hand anything released on this CPU to the depot so it can be reset
+	 * here rather than on a later acquire().
+	 */
+	mag = mag_get(type);
+	if (mag) {
+		D_MUTEX_LOCK(&mag->lock);
+		mag_flush(type, mag);
+		D_MUTEX_UNLOCK(&mag->lock);
+	}
+
 	D_MUTEX_LOCK(&type->lock);
 
 	/* Update restock hwm metrics */
-	if (type->no_restock > type->no_restock_hwm)
-		type->no_restock_hwm = type->no_restock;
-	type->no_restock = 0;
+	no_restock = atomic_load_consume(&type->no_restock);
+	if (no_restock > type->no_restock_hwm)
+		type->no_restock_hwm = no_restock;
+	atomic_store_release(&type->no_restock, 0);
 
 	/* Move from pending to free list */
 	restock(type, type->no_restock_hwm + 1);
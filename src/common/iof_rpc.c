@@ -41,11 +41,11 @@
 #include "iof_fs.h"
 
 #define IOF_PROTO_SIGNON_BASE 0x02000000
-#define IOF_PROTO_SIGNON_VERSION 2
+#define IOF_PROTO_SIGNON_VERSION 4
 #define IOF_PROTO_WRITE_BASE 0x01000000
-#define IOF_PROTO_WRITE_VERSION 4
+#define IOF_PROTO_WRITE_VERSION 9
 #define IOF_PROTO_IO_BASE 0x03000000
-#define IOF_PROTO_IO_VERSION 1
+#define IOF_PROTO_IO_VERSION 2
 
 /*
  * Re-use the CMF_UUID type when using a GAH as they are both 128 bit types
@@ -145,6 +145,13 @@ struct crt_msg_field *open_in[] = {
 	&CMF_INT,	/* flags */
 };
 
+struct crt_msg_field *open_path_in[] = {
+	&CMF_GAH,	/* gah of directory */
+	&CMF_STRING,	/* path */
+	&CMF_INT,	/* flags */
+	&CMF_INT,	/* mode */
+};
+
 struct crt_msg_field *unlink_in[] = {
 	&CMF_IOF_NAME,	/* name */
 	&CMF_GAH,	/* gah */
@@ -216,6 +223,36 @@ struct crt_msg_field *writex_out[] = {
 	&CMF_UINT64,
 };
 
+struct crt_msg_field *load_out[] = {
+	&CMF_UINT32,	/* active_reads */
+	&CMF_UINT32,	/* active_writes */
+	&CMF_UINT32,	/* queued */
+	&CMF_UINT32,	/* open_handles */
+	&CMF_INT,	/* rc */
+	&CMF_INT,	/* err */
+};
+
+struct crt_msg_field *copy_in[] = {
+	&CMF_GAH,	/* gah */
+	&CMF_GAH,	/* dst_gah */
+	&CMF_UINT64,	/* src_off */
+	&CMF_UINT64,	/* dst_off */
+	&CMF_UINT64,	/* len */
+};
+
+struct crt_msg_field *copy_out[] = {
+	&CMF_UINT64,	/* len */
+	&CMF_INT,	/* rc */
+	&CMF_INT,	/* err */
+};
+
+struct crt_msg_field *fallocate_in[] = {
+	&CMF_GAH,	/* gah */
+	&CMF_UINT64,	/* offset */
+	&CMF_UINT64,	/* len */
+	&CMF_INT,	/* mode */
+};
+
 struct crt_msg_field *setattr_in[] = {
 	&CMF_GAH,	/* gah */
 	&CMF_IOF_STAT,	/* struct stat */
@@ -323,9 +360,10 @@ iof_core_register(struct crt_proto_format *reg,
 }
 
 int
-iof_write_register(crt_rpc_cb_t handlers[])
+iof_write_register(struct crt_proto_format **proto,
+		   crt_rpc_cb_t handlers[])
 {
-	return iof_core_register(&iof_write_registry, NULL, handlers);
+	return iof_core_register(&iof_write_registry, proto, handlers);
 }
 
 int
@@ -1,4 +1,4 @@
-/* Copyright (C) 2017-2018 Intel Corporation
+/* Copyright (C) 2017-2019 Intel Corporation
  * All rights reserved.
  *
  * Redistribution and use in source and binary forms, with or without
@@ -37,6 +37,18 @@
  *
  * This implements a simple, thread-safe, random access vector of fixed size
  * entries.
+ *
+ * The table is two levels: a fixed array of chunk pointers sized for
+ * max_entries and chunks of slots that are allocated and published with a
+ * compare and swap the first time an index in them is set.  Chunks are only
+ * freed by vector_destroy so readers never take a lock; a lookup of an index
+ * that has never been set is a single load.
+ *
+ * Entries are reference counted and slots are updated with an atomic
+ * exchange.  A reader takes its reference inside an epoch critical section
+ * so an entry whose last reference is dropped concurrently is only returned
+ * to the pool once every thread has moved past the epoch in which it was
+ * retired.
  */
 #include <inttypes.h>
 #include <stdbool.h>
@@ -44,6 +56,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <gurt/common.h> /* container_of */
+#include <gurt/list.h>
 #include "iof_atomic.h"
 #include "iof_obj_pool.h"
 #include "iof_vector.h"
@@ -51,48 +64,9 @@
 #define CAS(valuep, old, new) \
 	atomic_compare_exchange(valuep, old, new)
 
-union ptr_lock {
-	void *ptr;
-	ATOMIC uintptr_t value;
-};
-
-/* Acquires a lock on the pointer and returns the pointer. */
-static inline void *acquire_ptr_lock(union ptr_lock *lock)
-{
-	uintptr_t new_value;
-	uintptr_t old_value;
-
-	for (;;) {
-		new_value = lock->value;
-
-		if (new_value & 1) {
-			sched_yield();
-			continue;
-		}
-
-		old_value = new_value;
-		new_value |= 1;
-		if (CAS(&lock->value, old_value, new_value))
-			break;
-	}
-
-	return (void *)old_value;
-}
-
-static inline void release_ptr_lock(union ptr_lock *lock)
-{
-	atomic_store_release(&lock->value, lock->value & ~((uintptr_t)1));
-}
-
-/* Caller must hold lock.  A valid aligned pointer value
- * releases the lock
- */
-static inline void set_ptr_value(union ptr_lock *lock, void *new_value)
-{
-	atomic_store_release(&lock->value, (uintptr_t)new_value);
-}
-
 struct entry {
+	d_list_t retired;          /* Link in vector retire list */
+	uint64_t epoch;            /* Global epoch when retired */
 	ATOMIC int refcount;       /* vector entries that reference data */
 	union {
 		uint64_t align[0]; /* Align to 8 bytes */
@@ -100,76 +74,276 @@ struct entry {
 	};
 };
 
+#define CHUNK_SHIFT 9 /* 512 */
+#define CHUNK_SIZE (1 << CHUNK_SHIFT)
+#define CHUNK_MASK (CHUNK_SIZE - 1)
+
+struct chunk {
+	ATOMIC uintptr_t slots[CHUNK_SIZE]; /* struct entry pointers */
+};
+
 #define MAGIC 0xd3f211dc
 
 struct vector {
-	union ptr_lock *data;        /* entries in vector */
+	ATOMIC uintptr_t *chunks;    /* struct chunk pointers */
 	obj_pool_t pool;             /* Pool of free entries */
-	pthread_rwlock_t lock;       /* reader/writer lock for vector */
+	vector_release_cb release;   /* Called before an entry is freed */
+	pthread_mutex_t lock;        /* Protects retired */
+	d_list_t retired;            /* Entries waiting on readers */
 	int magic;                   /* Magic number for sanity */
 	unsigned int entry_size;     /* Size of entries in vector */
-	unsigned int num_entries;    /* Current number of allocated entries */
 	unsigned int max_entries;    /* limit on size of vector */
+	unsigned int num_chunks;     /* Size of chunks array */
 };
 
 _Static_assert(sizeof(struct vector) <= sizeof(vector_t),
 	       "vector_t must be large enough to contain struct vector");
 
-#define MIN_SIZE 1024
-#define ALLOC_SIZE_SHIFT 9 /* 512 */
-#define ALLOC_SIZE (1 << ALLOC_SIZE_SHIFT)
-#define get_new_size(index) \
-	(((index + ALLOC_SIZE) >> ALLOC_SIZE_SHIFT) << ALLOC_SIZE_SHIFT)
+/* Per thread epoch state.  Records are shared by all vectors and are
+ * never freed; a record is reused by a new thread once its owner exits.
+ */
+struct epoch_rec {
+	d_list_t link;             /* Link in epoch_recs */
+	ATOMIC uint64_t epoch;     /* Epoch observed on entry, 0 if idle */
+	int in_use;                /* Owned by a thread, under epoch_lock */
+};
+
+static ATOMIC uint64_t global_epoch = 1;
+static D_LIST_HEAD(epoch_recs);
+static pthread_mutex_t epoch_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t epoch_once = PTHREAD_ONCE_INIT;
+static pthread_key_t epoch_key;
+static __thread struct epoch_rec *my_rec;
 
-/* Assumes new_index is in bounds of vector but not yet allocated */
-static int expand_vector(struct vector *vector, unsigned int new_index)
+static void epoch_rec_put(void *arg)
 {
-	unsigned int num_entries = get_new_size(new_index);
-	unsigned int new_entries;
-	void *data;
+	struct epoch_rec *rec = arg;
 
-	if (num_entries < MIN_SIZE)
-		num_entries = MIN_SIZE;
+	D_MUTEX_LOCK(&epoch_lock);
+	atomic_store_release(&rec->epoch, 0);
+	rec->in_use = 0;
+	D_MUTEX_UNLOCK(&epoch_lock);
 
-	if (num_entries > vector->max_entries)
-		num_entries = vector->max_entries;
+	my_rec = NULL;
+}
 
-	D_REALLOC(data,
-		  vector->data,
-		  num_entries * sizeof(union ptr_lock));
-	if (!data)
-		return -DER_NOMEM;
-	vector->data = data;
+static void epoch_prefork(void)
+{
+	D_MUTEX_LOCK(&epoch_lock);
+}
 
-	/* Now fill in the data from the old size onward */
-	data = &vector->data[vector->num_entries];
-	new_entries = num_entries - vector->num_entries;
-	memset(data, 0, new_entries * sizeof(union ptr_lock));
-	vector->num_entries = num_entries;
+static void epoch_postfork_parent(void)
+{
+	D_MUTEX_UNLOCK(&epoch_lock);
+}
 
-	return -DER_SUCCESS;
+/* Only the forking thread survives in the child */
+static void epoch_postfork_child(void)
+{
+	struct epoch_rec *rec;
+
+	d_list_for_each_entry(rec, &epoch_recs, link) {
+		if (rec == my_rec)
+			continue;
+		atomic_store_release(&rec->epoch, 0);
+		rec->in_use = 0;
+	}
+
+	D_MUTEX_UNLOCK(&epoch_lock);
+}
+
+static void epoch_init(void)
+{
+	pthread_key_create(&epoch_key, epoch_rec_put);
+	pthread_atfork(epoch_prefork, epoch_postfork_parent,
+		       epoch_postfork_child);
 }
 
-/* Assumes caller holds pthread_rwlock.   Same lock will be held on exit */
-static int expand_if_needed(struct vector *vector, unsigned int index)
+static struct epoch_rec *epoch_rec_get(void)
 {
-	int rc = -DER_SUCCESS;
+	struct epoch_rec *rec;
 
-	if (index >= vector->num_entries) {
-		/* Entry "present" but not allocated. */
-		D_RWLOCK_UNLOCK(&vector->lock);
+	if (my_rec != NULL)
+		return my_rec;
 
-		/* expand the vector */
-		D_RWLOCK_WRLOCK(&vector->lock);
-		if (index >= vector->num_entries)
-			rc = expand_vector(vector, index);
-		D_RWLOCK_UNLOCK(&vector->lock);
+	pthread_once(&epoch_once, epoch_init);
 
-		/* reacquire reader lock and continue */
-		D_RWLOCK_RDLOCK(&vector->lock);
+	D_MUTEX_LOCK(&epoch_lock);
+	d_list_for_each_entry(rec, &epoch_recs, link) {
+		if (!rec->in_use)
+			goto found;
 	}
 
-	return rc;
+	D_ALLOC_PTR(rec);
+	if (rec == NULL) {
+		D_MUTEX_UNLOCK(&epoch_lock);
+		return NULL;
+	}
+	d_list_add(&rec->link, &epoch_recs);
+found:
+	rec->in_use = 1;
+	D_MUTEX_UNLOCK(&epoch_lock);
+
+	pthread_setspecific(epoch_key, rec);
+	my_rec = rec;
+
+	return rec;
+}
+
+static struct epoch_rec *epoch_enter(void)
+{
+	struct epoch_rec *rec = epoch_rec_get();
+
+	if (rec == NULL)
+		return NULL;
+
+	atomic_store_release(&rec->epoch, atomic_load_acquire(&global_epoch));
+	/* The announcement must be visible before any slot is read */
+	atomic_fence();
+
+	return rec;
+}
+
+static void epoch_exit(struct epoch_rec *rec)
+{
+	atomic_store_release(&rec->epoch, 0);
+}
+
+/* Advance the global epoch if no thread is still inside an older one */
+static void epoch_try_advance(void)
+{
+	struct epoch_rec *rec;
+	uint64_t epoch;
+	uint64_t cur;
+
+	D_MUTEX_LOCK(&epoch_lock);
+	epoch = atomic_load_acquire(&global_epoch);
+	d_list_for_each_entry(rec, &epoch_recs, link) {
+		if (!rec->in_use)
+			continue;
+		cur = atomic_load_acquire(&rec->epoch);
+		if (cur != 0 && cur != epoch)
+			goto out;
+	}
+	atomic_store_release(&global_epoch, epoch + 1);
+out:
+	D_MUTEX_UNLOCK(&epoch_lock);
+}
+
+/* Queue an unreferenced entry and free any that no reader can still see.
+ * An entry retired in epoch E may be held by readers that entered in E - 1
+ * or E, so it is safe to free once the global epoch reaches E + 2.
+ */
+static void entry_retire(struct vector *vector, struct entry *entry)
+{
+	struct entry *tmp;
+	uint64_t epoch;
+
+	D_MUTEX_LOCK(&vector->lock);
+	entry->epoch = atomic_load_acquire(&global_epoch);
+	d_list_add_tail(&entry->retired, &vector->retired);
+
+	epoch_try_advance();
+	epoch = atomic_load_acquire(&global_epoch);
+
+	d_list_for_each_entry_safe(entry, tmp, &vector->retired, retired) {
+		if (entry->epoch + 2 > epoch)
+			break;
+		d_list_del(&entry->retired);
+		obj_pool_put(&vector->pool, entry);
+	}
+	D_MUTEX_UNLOCK(&vector->lock);
+}
+
+/* Drop a reference on an entry, releasing it on the last one */
+static void entry_decref(struct vector *vector, struct entry *entry)
+{
+	if (atomic_fetch_sub(&entry->refcount, 1) != 1)
+		return;
+
+	if (vector->release != NULL)
+		vector->release(&entry->data[0]);
+
+	entry_retire(vector, entry);
+}
+
+/* Take a reference on the entry in a slot, if any.  A zero refcount means
+ * the slot was already changed and the entry is being retired, so reload.
+ */
+static int entry_get(ATOMIC uintptr_t *slot, struct entry **entryp)
+{
+	struct epoch_rec *rec;
+	struct entry *entry;
+	int count;
+
+	*entryp = NULL;
+
+	rec = epoch_enter();
+	if (rec == NULL)
+		return -DER_NOMEM;
+
+	for (;;) {
+		entry = (struct entry *)atomic_load_acquire(slot);
+		if (entry == NULL)
+			break;
+		count = atomic_load_acquire(&entry->refcount);
+		if (count == 0)
+			continue;
+		if (CAS(&entry->refcount, count, count + 1)) {
+			*entryp = entry;
+			break;
+		}
+	}
+
+	epoch_exit(rec);
+
+	return *entryp == NULL ? -DER_NONEXIST : -DER_SUCCESS;
+}
+
+/* Find the slot for an index, optionally allocating its chunk.  Returns
+ * NULL if the chunk doesn't exist and create is false or allocation fails.
+ */
+static ATOMIC uintptr_t *get_slot(struct vector *vector, unsigned int index,
+				  bool create)
+{
+	ATOMIC uintptr_t *l1 = &vector->chunks[index >> CHUNK_SHIFT];
+	struct chunk *chunk;
+	struct chunk *new_chunk;
+	uintptr_t old;
+
+	chunk = (struct chunk *)atomic_load_acquire(l1);
+	if (chunk != NULL || !create)
+		goto out;
+
+	D_ALLOC_PTR(new_chunk);
+	if (new_chunk == NULL)
+		return NULL;
+
+	do {
+		old = 0;
+		if (CAS(l1, old, (uintptr_t)new_chunk))
+			return &new_chunk->slots[index & CHUNK_MASK];
+		chunk = (struct chunk *)atomic_load_acquire(l1);
+	} while (chunk == NULL);
+
+	/* Another thread published the chunk first */
+	D_FREE(new_chunk);
+out:
+	if (chunk == NULL)
+		return NULL;
+
+	return &chunk->slots[index & CHUNK_MASK];
+}
+
+/* Install a new value in a slot and drop the reference held by the old */
+static void slot_replace(struct vector *vector, ATOMIC uintptr_t *slot,
+			 struct entry *entry)
+{
+	struct entry *old;
+
+	old = (struct entry *)atomic_exchange(slot, (uintptr_t)entry);
+	if (old != NULL)
+		entry_decref(vector, old);
 }
 
 int vector_init(vector_t *vector, int sizeof_entry, int max_entries)
@@ -186,29 +360,56 @@ int vector_init(vector_t *vector, int sizeof_entry, int max_entries)
 	realv->magic = 0;
 	realv->max_entries = max_entries;
 	realv->entry_size = sizeof_entry;
-	realv->data = NULL;
-	realv->num_entries = 0;
-	/* TODO: Improve cleanup of the error paths in this function */
-	rc = pthread_rwlock_init(&realv->lock, NULL);
+	realv->num_chunks = (max_entries + CHUNK_MASK) >> CHUNK_SHIFT;
+	realv->release = NULL;
+	D_INIT_LIST_HEAD(&realv->retired);
+
+	rc = pthread_mutex_init(&realv->lock, NULL);
 	if (rc != 0)
 		return -DER_INVAL;
+
+	D_ALLOC_ARRAY(realv->chunks, realv->num_chunks);
+	if (realv->chunks == NULL) {
+		pthread_mutex_destroy(&realv->lock);
+		return -DER_NOMEM;
+	}
+
 	rc = obj_pool_initialize(&realv->pool,
 				 sizeof(struct entry) + sizeof_entry);
-	if (rc != -DER_SUCCESS)
+	if (rc != -DER_SUCCESS) {
+		D_FREE(realv->chunks);
+		pthread_mutex_destroy(&realv->lock);
 		return -DER_NOMEM;
-	rc = expand_vector(realv, 0);
-
-	if (rc != -DER_SUCCESS)
-		return rc; /* error logged in expand_vector */
+	}
 
 	realv->magic = MAGIC;
 
 	return -DER_SUCCESS;
 }
 
+int vector_set_release(vector_t *vector, vector_release_cb release)
+{
+	struct vector *realv = (struct vector *)vector;
+
+	if (vector == NULL)
+		return -DER_INVAL;
+
+	if (realv->magic != MAGIC)
+		return -DER_UNINIT;
+
+	realv->release = release;
+
+	return -DER_SUCCESS;
+}
+
+/* Assumes no other thread is still using the vector */
 int vector_destroy(vector_t *vector)
 {
 	struct vector *realv = (struct vector *)vector;
+	struct chunk *chunk;
+	struct entry *entry;
+	unsigned int i;
+	unsigned int j;
 	int rc;
 
 	if (vector == NULL)
@@ -219,9 +420,25 @@ int vector_destroy(vector_t *vector)
 
 	realv->magic = 0;
 
-	rc = pthread_rwlock_destroy(&realv->lock);
+	for (i = 0; i < realv->num_chunks; i++) {
+		chunk = (struct chunk *)realv->chunks[i];
+		if (chunk == NULL)
+			continue;
+		if (realv->release != NULL) {
+			for (j = 0; j < CHUNK_SIZE; j++) {
+				entry = (struct entry *)chunk->slots[j];
+				if (entry != NULL &&
+				    atomic_fetch_sub(&entry->refcount, 1) == 1)
+					realv->release(&entry->data[0]);
+			}
+		}
+		D_FREE(chunk);
+	}
+
+	/* Retired entries are freed along with the pool */
+	rc = pthread_mutex_destroy(&realv->lock);
 	obj_pool_destroy(&realv->pool);
-	D_FREE(realv->data);
+	D_FREE(realv->chunks);
 
 	if (rc == 0)
 		return -DER_SUCCESS;
@@ -232,8 +449,9 @@ int vector_destroy(vector_t *vector)
 int vector_get_(vector_t *vector, unsigned int index, void **ptr)
 {
 	struct vector *realv = (struct vector *)vector;
+	ATOMIC uintptr_t *slot;
 	struct entry *entry;
-	int rc = -DER_SUCCESS;
+	int rc;
 
 	if (ptr == NULL)
 		return -DER_INVAL;
@@ -249,24 +467,14 @@ int vector_get_(vector_t *vector, unsigned int index, void **ptr)
 	if (index >= realv->max_entries)
 		return -DER_INVAL;
 
-	D_RWLOCK_RDLOCK(&realv->lock);
-	if (index >= realv->num_entries) {
-		/* Entry "present" but not allocated. */
-		D_RWLOCK_UNLOCK(&realv->lock);
+	/* Fast path for indices that are not set, no stores or fences */
+	slot = get_slot(realv, index, false);
+	if (slot == NULL || atomic_load_acquire(slot) == 0)
 		return -DER_NONEXIST;
-	}
 
-	entry = (struct entry *)acquire_ptr_lock(&realv->data[index]);
-	if (entry != NULL) {
-		atomic_fetch_add(&entry->refcount, 1);
+	rc = entry_get(slot, &entry);
+	if (rc == -DER_SUCCESS)
 		*ptr = &entry->data[0];
-	} else {
-		rc = -DER_NONEXIST;
-	}
-
-	release_ptr_lock(&realv->data[index]);
-
-	D_RWLOCK_UNLOCK(&realv->lock);
 
 	return rc;
 }
@@ -275,9 +483,10 @@ int vector_dup_(vector_t *vector, unsigned int src_idx, unsigned int dst_idx,
 		void **ptr)
 {
 	struct vector *realv = (struct vector *)vector;
-	struct entry *entry;
-	struct entry *tmp;
-	int rc = -DER_SUCCESS;
+	ATOMIC uintptr_t *src;
+	ATOMIC uintptr_t *dst;
+	struct entry *entry = NULL;
+	int rc = -DER_NONEXIST;
 
 	if (ptr == NULL)
 		return -DER_INVAL;
@@ -293,37 +502,29 @@ int vector_dup_(vector_t *vector, unsigned int src_idx, unsigned int dst_idx,
 	if (src_idx >= realv->max_entries || dst_idx >= realv->max_entries)
 		return -DER_INVAL;
 
-	D_RWLOCK_RDLOCK(&realv->lock);
-	if (src_idx >= realv->num_entries) {
-		/* source entry "present" but not allocated. */
-		D_RWLOCK_UNLOCK(&realv->lock);
-		return -DER_NONEXIST;
+	src = get_slot(realv, src_idx, false);
+	if (src != NULL) {
+		/* Reference for the user */
+		rc = entry_get(src, &entry);
+		if (rc == -DER_NOMEM)
+			return rc;
 	}
-	rc = expand_if_needed(realv, dst_idx);
-	if (rc != -DER_SUCCESS) {
-		D_RWLOCK_UNLOCK(&realv->lock);
-		return rc;
-	}
-
-	entry = (struct entry *)acquire_ptr_lock(&realv->data[src_idx]);
-	if (entry != NULL)
-		atomic_fetch_add(&entry->refcount, 2); /* dst_idx + user */
-	release_ptr_lock(&realv->data[src_idx]);
 
-	tmp = (struct entry *)acquire_ptr_lock(&realv->data[dst_idx]);
-	if (tmp != NULL) {
-		/* We will replace the existing entry */
-		if (atomic_fetch_sub(&tmp->refcount, 1) == 1)
-			obj_pool_put(&realv->pool, tmp);
+	/* An empty source still removes whatever is at dst_idx */
+	dst = get_slot(realv, dst_idx, entry != NULL);
+	if (dst == NULL) {
+		if (entry == NULL)
+			return -DER_NONEXIST;
+		entry_decref(realv, entry);
+		return -DER_NOMEM;
 	}
 
-	if (entry != NULL)
+	if (entry != NULL) {
+		atomic_fetch_add(&entry->refcount, 1); /* dst_idx */
 		*ptr = &entry->data[0];
+	}
 
-	/* Releases the ptr_lock */
-	set_ptr_value(&realv->data[dst_idx], entry);
-
-	D_RWLOCK_UNLOCK(&realv->lock);
+	slot_replace(realv, dst, entry);
 
 	return rc;
 }
@@ -332,7 +533,6 @@ int vector_decref(vector_t *vector, void *ptr)
 {
 	struct vector *realv = (struct vector *)vector;
 	struct entry *entry;
-	int old_value;
 
 	if (vector == NULL || ptr == NULL)
 		return -DER_INVAL;
@@ -342,10 +542,7 @@ int vector_decref(vector_t *vector, void *ptr)
 
 	entry = container_of(ptr, struct entry, data);
 
-	old_value = atomic_fetch_sub(&entry->refcount, 1);
-
-	if (old_value == 1)
-		obj_pool_put(&realv->pool, entry);
+	entry_decref(realv, entry);
 
 	return -DER_SUCCESS;
 }
@@ -353,8 +550,9 @@ int vector_decref(vector_t *vector, void *ptr)
 int vector_set_(vector_t *vector, unsigned int index, void *ptr, size_t size)
 {
 	struct vector *realv = (struct vector *)vector;
+	ATOMIC uintptr_t *slot;
 	struct entry *entry;
-	int rc = -DER_SUCCESS;
+	int rc;
 
 	if (vector == NULL || ptr == NULL)
 		return -DER_INVAL;
@@ -365,47 +563,31 @@ int vector_set_(vector_t *vector, unsigned int index, void *ptr, size_t size)
 	if (size != realv->entry_size || index >= realv->max_entries)
 		return -DER_INVAL;
 
-	D_RWLOCK_RDLOCK(&realv->lock);
-	rc = expand_if_needed(realv, index);
-
-	if (rc != -DER_SUCCESS) {
-		D_RWLOCK_UNLOCK(&realv->lock);
-		return rc;
-	}
-
-	entry = (struct entry *)acquire_ptr_lock(&realv->data[index]);
-	if (entry != NULL) {
-		/* We will replace the existing entry */
-		rc = atomic_fetch_sub(&entry->refcount, 1);
-		if (rc == 1)
-			obj_pool_put(&realv->pool, entry);
-	}
+	slot = get_slot(realv, index, true);
+	if (slot == NULL)
+		return -DER_NOMEM;
 
 	rc = obj_pool_get_(&realv->pool, (void **)&entry,
 			   sizeof(*entry) + realv->entry_size);
 	if (rc != -DER_SUCCESS) {
-		rc = -DER_NOMEM;
-		entry = NULL;
-		goto release;
+		/* The existing entry is removed even on failure */
+		slot_replace(realv, slot, NULL);
+		return -DER_NOMEM;
 	}
 
 	entry->refcount = 1; /* Vector will have a reference */
 	memcpy(&entry->data[0], ptr, size);
-release:
-
-	/* Releases the ptr_lock */
-	set_ptr_value(&realv->data[index], entry);
 
-	D_RWLOCK_UNLOCK(&realv->lock);
+	slot_replace(realv, slot, entry);
 
-	return rc;
+	return -DER_SUCCESS;
 }
 
 int vector_remove_(vector_t *vector, unsigned int index, void **ptr)
 {
 	struct vector *realv = (struct vector *)vector;
+	ATOMIC uintptr_t *slot;
 	struct entry *entry;
-	int rc = -DER_SUCCESS;
 
 	if (ptr != NULL)
 		*ptr = NULL;
@@ -419,29 +601,19 @@ int vector_remove_(vector_t *vector, unsigned int index, void **ptr)
 	if (index >= realv->max_entries)
 		return -DER_INVAL;
 
-	D_RWLOCK_RDLOCK(&realv->lock);
-	if (index >= realv->num_entries) {
-		D_RWLOCK_UNLOCK(&realv->lock);
+	slot = get_slot(realv, index, false);
+	if (slot == NULL)
 		return -DER_NONEXIST;
-	}
 
-	entry = (struct entry *)acquire_ptr_lock(&realv->data[index]);
-	if (entry != NULL) {
-		/* keep the reference if returning the entry */
-		if (ptr == NULL) {
-			if (atomic_fetch_sub(&entry->refcount, 1) == 1)
-				obj_pool_put(&realv->pool, entry);
-		} else {
-			*ptr = &entry->data[0];
-		}
-	} else {
-		rc = -DER_NONEXIST;
-	}
-
-	/* releases ptr lock */
-	set_ptr_value(&realv->data[index], NULL);
+	entry = (struct entry *)atomic_exchange(slot, 0);
+	if (entry == NULL)
+		return -DER_NONEXIST;
 
-	D_RWLOCK_UNLOCK(&realv->lock);
+	/* keep the reference if returning the entry */
+	if (ptr == NULL)
+		entry_decref(realv, entry);
+	else
+		*ptr = &entry->data[0];
 
-	return rc;
+	return -DER_SUCCESS;
 }
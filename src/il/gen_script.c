@@ -103,14 +103,18 @@ int main(int argc, char **argv)
 
 	if (linker_script) {
 		FOREACH_INTERCEPT(LINK_SCRIPT_GEN)
+		FOREACH_OPTIONAL_INTERCEPT(LINK_SCRIPT_GEN)
 		FOREACH_ALIASED_INTERCEPT(LINK_SCRIPT_GEN64)
 	} else {
 		fprintf(fp, "syms=\"");
 		FOREACH_INTERCEPT(SYMBOL_GEN)
+		FOREACH_OPTIONAL_INTERCEPT(SYMBOL_GEN)
 		FOREACH_ALIASED_INTERCEPT(SYMBOL_GEN64)
 		FOREACH_INTERCEPT(SYMBOL_GEN_IOF)
+		FOREACH_OPTIONAL_INTERCEPT(SYMBOL_GEN_IOF)
 		fprintf(fp, "\"\nweak=\"");
 		FOREACH_INTERCEPT(SYMBOL_GEN)
+		FOREACH_OPTIONAL_INTERCEPT(SYMBOL_GEN)
 		FOREACH_ALIASED_INTERCEPT(SYMBOL_GEN64)
 		fprintf(fp, "\"\n");
 	}
@@ -0,0 +1,389 @@
+/* Copyright (C) 2019 Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted for any purpose (including commercial purposes)
+ * provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the
+ *    documentation and/or materials provided with the distribution.
+ *
+ * 3. In addition, redistributions of modified forms of the source or binary
+ *    code must carry prominent notices stating that the original code was
+ *    changed and the date of the change.
+ *
+ *  4. All publications or advertising materials mentioning features or use of
+ *     this software are asked, but not required, to acknowledge that it was
+ *     developed by Intel Corporation and credit the contributors.
+ *
+ * 5. Neither the name of Intel Corporation, nor the name of any Contributor
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/* Asynchronous I/O queues.
+ *
+ * Each request on a bypassed file is sent as a single readx or writex RPC
+ * and the submitting thread returns straight away.  The progress thread
+ * moves requests to the queue's done list as replies arrive and they are
+ * finished, copying immediate data and releasing the RPC, by the thread
+ * that collects them.  Without a progress thread, for example in a forked
+ * child, the thread waiting for requests progresses the RPCs itself.
+ */
+#define D_LOGFAC DD_FAC(il)
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <gurt/list.h>
+#include <iof_aio.h>
+#include "log.h"
+#include "iof_atomic.h"
+#include "iof_common.h"
+#include "intercept.h"
+
+struct iof_aio_queue {
+	pthread_mutex_t		lock;
+	pthread_cond_t		cond;
+	d_list_t		done;		/* Completed, not collected */
+	unsigned int		ndone;		/* Entries in done */
+	unsigned int		depth;		/* Limit on outstanding */
+	unsigned int		outstanding;	/* Submitted, not collected */
+};
+
+/* Time in us to progress inline before checking the queue again */
+#define IOIL_AIO_PROGRESS_TIMEOUT (100 * 1000)
+
+struct aio_op {
+	d_list_t		list;
+	struct iof_aio_queue	*queue;
+	struct iof_aio_req	*req;
+	struct iof_file_common	common;		/* Used by the RPC */
+	void			*io;		/* RPC in flight, if any */
+	ATOMIC int		pending;	/* Submission and reply */
+};
+
+/* Drop one of the two events an op waits for, the submission returning and
+ * the reply arriving, and queue it as done after the second.
+ */
+static void aio_op_put(void *arg)
+{
+	struct aio_op *op = arg;
+	struct iof_aio_queue *queue = op->queue;
+
+	if (atomic_fetch_sub(&op->pending, 1) != 1)
+		return;
+
+	D_MUTEX_LOCK(&queue->lock);
+	d_list_add_tail(&op->list, &queue->done);
+	queue->ndone++;
+	pthread_cond_broadcast(&queue->cond);
+	D_MUTEX_UNLOCK(&queue->lock);
+}
+
+/* Finish a done op, filling in the result of its request */
+static struct iof_aio_req *aio_op_finish(struct aio_op *op)
+{
+	struct iof_aio_req *req = op->req;
+	ssize_t bytes;
+	int err = 0;
+
+	if (op->io != NULL) {
+		if (req->op == IOF_AIO_READ)
+			bytes = ioil_read_finish(op->io, &err);
+		else
+			bytes = ioil_write_finish(op->io, &err);
+		req->result = (bytes < 0) ? -err : bytes;
+	}
+
+	D_FREE(op);
+
+	return req;
+}
+
+/* Start one request.  Anything that can't be sent as an RPC is done or
+ * failed here and its op is queued as done straight away.
+ */
+static void aio_op_start(struct aio_op *op)
+{
+	struct iof_aio_req *req = op->req;
+	bool write = (req->op == IOF_AIO_WRITE);
+	ssize_t bytes;
+	int err;
+
+	op->pending = 2;
+
+	err = ioil_aio_prepare(req->fd, write, req->offset, req->len,
+			       &op->common);
+	if (err == EBADF) {
+		/* Not bypassed, the interception library does it inline */
+		if (write)
+			bytes = pwrite(req->fd, req->buf, req->len,
+				       req->offset);
+		else
+			bytes = pread(req->fd, req->buf, req->len,
+				      req->offset);
+		req->result = (bytes < 0) ? -errno : bytes;
+		goto done;
+	}
+
+	if (err != 0) {
+		req->result = -err;
+		goto done;
+	}
+
+	if (req->len == 0) {
+		req->result = 0;
+		goto done;
+	}
+
+	if (write)
+		op->io = ioil_write_start(req->buf, req->len, req->offset,
+					  &op->common, aio_op_put, op, &err);
+	else
+		op->io = ioil_read_start(req->buf, req->len, req->offset,
+					 &op->common, aio_op_put, op, &err);
+
+	if (op->io == NULL) {
+		req->result = -err;
+		goto done;
+	}
+
+	aio_op_put(op);
+	return;
+
+done:
+	op->pending = 1;
+	aio_op_put(op);
+}
+
+struct aio_wait {
+	struct iof_aio_queue	*queue;
+	unsigned int		nr;
+};
+
+static int aio_wait_check(void *arg)
+{
+	struct aio_wait *wait = arg;
+	int done;
+
+	D_MUTEX_LOCK(&wait->queue->lock);
+	done = (wait->queue->ndone >= wait->nr);
+	D_MUTEX_UNLOCK(&wait->queue->lock);
+
+	return done;
+}
+
+/* Wait until nr ops are done, or until deadline if it is set.  Called with
+ * the queue lock held, which is dropped while progressing RPCs inline.
+ * Returns 0 or ETIMEDOUT.
+ */
+static int aio_wait(struct iof_aio_queue *queue, unsigned int nr,
+		    const struct timespec *deadline)
+{
+	struct aio_wait wait = {.queue = queue, .nr = nr};
+	struct timespec now;
+	int64_t remaining;
+	int64_t timeout;
+	bool progressed;
+	int rc;
+
+	while (queue->ndone < nr) {
+		timeout = IOIL_AIO_PROGRESS_TIMEOUT;
+		if (deadline != NULL) {
+			clock_gettime(CLOCK_REALTIME, &now);
+			remaining = (int64_t)(deadline->tv_sec - now.tv_sec) *
+				    1000000 +
+				    (deadline->tv_nsec - now.tv_nsec) / 1000;
+			if (remaining <= 0)
+				return ETIMEDOUT;
+			if (remaining < timeout)
+				timeout = remaining;
+		}
+
+		D_MUTEX_UNLOCK(&queue->lock);
+		progressed = ioil_progress(timeout, aio_wait_check, &wait);
+		D_MUTEX_LOCK(&queue->lock);
+
+		if (progressed || queue->ndone >= nr)
+			continue;
+
+		if (deadline == NULL) {
+			pthread_cond_wait(&queue->cond, &queue->lock);
+		} else {
+			rc = pthread_cond_timedwait(&queue->cond, &queue->lock,
+						    deadline);
+			if (rc == ETIMEDOUT && queue->ndone < nr)
+				return ETIMEDOUT;
+		}
+	}
+
+	return 0;
+}
+
+IOF_PUBLIC struct iof_aio_queue *iof_aio_queue_create(unsigned int depth)
+{
+	struct iof_aio_queue *queue;
+
+	if (depth == 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	D_ALLOC_PTR(queue);
+	if (queue == NULL) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	if (pthread_mutex_init(&queue->lock, NULL) != 0)
+		goto free_queue;
+
+	if (pthread_cond_init(&queue->cond, NULL) != 0)
+		goto destroy_lock;
+
+	D_INIT_LIST_HEAD(&queue->done);
+	queue->depth = depth;
+
+	return queue;
+
+destroy_lock:
+	pthread_mutex_destroy(&queue->lock);
+free_queue:
+	D_FREE(queue);
+	errno = ENOMEM;
+	return NULL;
+}
+
+IOF_PUBLIC int iof_aio_queue_destroy(struct iof_aio_queue *queue)
+{
+	struct aio_op *op;
+
+	if (queue == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	D_MUTEX_LOCK(&queue->lock);
+	aio_wait(queue, queue->outstanding, NULL);
+	D_MUTEX_UNLOCK(&queue->lock);
+
+	while ((op = d_list_pop_entry(&queue->done, struct aio_op, list)))
+		aio_op_finish(op);
+
+	pthread_cond_destroy(&queue->cond);
+	pthread_mutex_destroy(&queue->lock);
+	D_FREE(queue);
+
+	return 0;
+}
+
+IOF_PUBLIC int iof_aio_submit(struct iof_aio_queue *queue,
+			      struct iof_aio_req **reqs, int nr)
+{
+	struct iof_aio_req *req;
+	struct aio_op *op;
+	int i;
+
+	if (queue == NULL || reqs == NULL || nr < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	for (i = 0; i < nr; i++) {
+		req = reqs[i];
+		if (req == NULL || req->buf == NULL ||
+		    (req->op != IOF_AIO_READ && req->op != IOF_AIO_WRITE)) {
+			if (i > 0)
+				break;
+			errno = EINVAL;
+			return -1;
+		}
+
+		D_ALLOC_PTR(op);
+		if (op == NULL) {
+			if (i > 0)
+				break;
+			errno = ENOMEM;
+			return -1;
+		}
+
+		D_MUTEX_LOCK(&queue->lock);
+		if (queue->outstanding == queue->depth) {
+			D_MUTEX_UNLOCK(&queue->lock);
+			D_FREE(op);
+			if (i > 0)
+				break;
+			errno = EAGAIN;
+			return -1;
+		}
+		queue->outstanding++;
+		D_MUTEX_UNLOCK(&queue->lock);
+
+		op->queue = queue;
+		op->req = req;
+		aio_op_start(op);
+	}
+
+	return i;
+}
+
+IOF_PUBLIC int iof_aio_getevents(struct iof_aio_queue *queue, int min_nr,
+				 int max_nr, struct iof_aio_req **reqs,
+				 const struct timespec *timeout)
+{
+	struct timespec deadline;
+	struct aio_op *op;
+	D_LIST_HEAD(ready);
+	int count = 0;
+
+	if (queue == NULL || reqs == NULL || min_nr < 0 || max_nr < min_nr) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (timeout != NULL) {
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += timeout->tv_sec;
+		deadline.tv_nsec += timeout->tv_nsec;
+		if (deadline.tv_nsec >= 1000000000) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+	}
+
+	D_MUTEX_LOCK(&queue->lock);
+	if ((unsigned int)min_nr > queue->outstanding)
+		min_nr = queue->outstanding;
+
+	aio_wait(queue, min_nr, timeout ? &deadline : NULL);
+
+	while (count < max_nr &&
+	       (op = d_list_pop_entry(&queue->done, struct aio_op, list))) {
+		d_list_add_tail(&op->list, &ready);
+		count++;
+	}
+	queue->ndone -= count;
+	queue->outstanding -= count;
+	D_MUTEX_UNLOCK(&queue->lock);
+
+	count = 0;
+	while ((op = d_list_pop_entry(&ready, struct aio_op, list)))
+		reqs[count++] = aio_op_finish(op);
+
+	return count;
+}
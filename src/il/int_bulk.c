@@ -0,0 +1,340 @@
+/* Copyright (C) 2019 Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted for any purpose (including commercial purposes)
+ * provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the
+ *    documentation and/or materials provided with the distribution.
+ *
+ * 3. In addition, redistributions of modified forms of the source or binary
+ *    code must carry prominent notices stating that the original code was
+ *    changed and the date of the change.
+ *
+ *  4. All publications or advertising materials mentioning features or use of
+ *     this software are asked, but not required, to acknowledge that it was
+ *     developed by Intel Corporation and credit the contributors.
+ *
+ * 5. Neither the name of Intel Corporation, nor the name of any Contributor
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/* Cache of bulk handles over application buffers.
+ *
+ * Creating a bulk handle registers the memory with the network provider,
+ * which on RDMA fabrics can cost more than the transfer itself.  Handles
+ * made for single segment readx and writex RPCs are kept and reused for
+ * later I/O that falls inside the same buffer, with the offset into the
+ * handle sent in the RPC.  Entries are evicted least recently used first
+ * and dropped when the memory under them is unmapped, freed or reallocated.
+ *
+ * Freeing memory comes back through the free() interception, so nothing
+ * that may allocate or free is called with bulk_lock held.
+ */
+#define D_LOGFAC DD_FAC(il)
+#include <pthread.h>
+#include <stdint.h>
+#include <gurt/list.h>
+#include "log.h"
+#include "iof_atomic.h"
+#include "iof_common.h"
+#include "intercept.h"
+
+struct bulk_reg {
+	d_list_t	list;
+	crt_context_t	ctx;
+	char		*addr;
+	size_t		len;
+	crt_bulk_perm_t	perm;
+	crt_bulk_t	bulk;
+	int		users;	/* RPCs in flight using the handle */
+	bool		stale;	/* Memory released, free once idle */
+};
+
+static D_LIST_HEAD(bulk_lru);	/* Most recently used first */
+static pthread_mutex_t bulk_lock = PTHREAD_MUTEX_INITIALIZER;
+static ATOMIC int bulk_count;	/* Entries in bulk_lru */
+static int bulk_max = IOIL_BULK_CACHE_DEFAULT;
+
+/* Lowest and highest address covered by an entry in bulk_lru, so releasing
+ * memory elsewhere doesn't need bulk_lock.  Only written with it held.
+ */
+static ATOMIC uintptr_t bulk_lo = UINTPTR_MAX;
+static ATOMIC uintptr_t bulk_hi;
+
+/* Caller holds bulk_lock.  Recalculate the bounds after entries are removed */
+static void bulk_bounds_locked(void)
+{
+	struct bulk_reg *reg;
+	uintptr_t lo = UINTPTR_MAX;
+	uintptr_t hi = 0;
+
+	d_list_for_each_entry(reg, &bulk_lru, list) {
+		if ((uintptr_t)reg->addr < lo)
+			lo = (uintptr_t)reg->addr;
+		if ((uintptr_t)reg->addr + reg->len > hi)
+			hi = (uintptr_t)reg->addr + reg->len;
+	}
+
+	atomic_store_release(&bulk_lo, lo);
+	atomic_store_release(&bulk_hi, hi);
+}
+
+static void bulk_prefork(void)
+{
+	D_MUTEX_LOCK(&bulk_lock);
+}
+
+static void bulk_postfork_parent(void)
+{
+	D_MUTEX_UNLOCK(&bulk_lock);
+}
+
+/* Handles aren't usable in the child, forget them without freeing */
+static void bulk_postfork_child(void)
+{
+	D_INIT_LIST_HEAD(&bulk_lru);
+	atomic_store_release(&bulk_count, 0);
+	bulk_bounds_locked();
+	D_MUTEX_UNLOCK(&bulk_lock);
+}
+
+void ioil_bulk_init(int max_entries)
+{
+	bulk_max = max_entries;
+
+	pthread_atfork(bulk_prefork, bulk_postfork_parent,
+		       bulk_postfork_child);
+}
+
+/* Thread stacks are unmapped by the C library without calling munmap(), so
+ * buffers on the calling thread's stack are not cached.
+ */
+static __thread char *stack_lo;
+static __thread char *stack_hi;
+
+static bool on_stack(char *addr)
+{
+	pthread_attr_t attr;
+	void *base;
+	size_t size;
+
+	if (stack_hi == NULL) {
+		if (pthread_getattr_np(pthread_self(), &attr) != 0)
+			return true;
+		if (pthread_attr_getstack(&attr, &base, &size) == 0) {
+			stack_lo = base;
+			stack_hi = stack_lo + size;
+		}
+		pthread_attr_destroy(&attr);
+		if (stack_hi == NULL)
+			return true;
+	}
+
+	return addr >= stack_lo && addr < stack_hi;
+}
+
+bool ioil_bulk_empty(void)
+{
+	return atomic_load_acquire(&bulk_count) == 0;
+}
+
+static void bulk_reg_free_list(d_list_t *victims)
+{
+	struct bulk_reg *reg;
+	int rc;
+
+	while ((reg = d_list_pop_entry(victims, struct bulk_reg, list))) {
+		IOF_LOG_DEBUG("Releasing bulk handle for %p-%p", reg->addr,
+			      reg->addr + reg->len - 1);
+		rc = crt_bulk_free(reg->bulk);
+		if (rc != 0)
+			IOF_LOG_WARNING("Failed to free bulk handle, rc = %d",
+					rc);
+		D_FREE(reg);
+	}
+}
+
+/* Caller holds bulk_lock.  Move idle entries from the tail of the list to
+ * victims until the cache is within its limit.
+ */
+static void bulk_evict_locked(d_list_t *victims)
+{
+	struct bulk_reg *reg;
+	d_list_t *pos;
+	d_list_t *prev;
+	bool evicted = false;
+
+	for (pos = bulk_lru.prev; pos != &bulk_lru &&
+	     atomic_load_acquire(&bulk_count) > bulk_max; pos = prev) {
+		prev = pos->prev;
+		reg = d_list_entry(pos, struct bulk_reg, list);
+		if (reg->users != 0)
+			continue;
+		d_list_del(&reg->list);
+		d_list_add(&reg->list, victims);
+		atomic_fetch_sub(&bulk_count, 1);
+		evicted = true;
+	}
+
+	if (evicted)
+		bulk_bounds_locked();
+}
+
+int ioil_bulk_get(crt_context_t ctx, d_sg_list_t *sgl, crt_bulk_perm_t perm,
+		  crt_bulk_t *bulk, uint64_t *offset, void **handle)
+{
+	struct bulk_reg *reg;
+	D_LIST_HEAD(victims);
+	char *addr;
+	size_t len;
+	int rc;
+
+	*offset = 0;
+	*handle = NULL;
+
+	if (sgl->sg_nr != 1 || bulk_max <= 0)
+		return crt_bulk_create(ctx, sgl, perm, bulk);
+
+	addr = sgl->sg_iovs[0].iov_buf;
+	len = sgl->sg_iovs[0].iov_len;
+
+	if (on_stack(addr))
+		return crt_bulk_create(ctx, sgl, perm, bulk);
+
+	D_MUTEX_LOCK(&bulk_lock);
+	d_list_for_each_entry(reg, &bulk_lru, list) {
+		if (reg->ctx != ctx || addr < reg->addr ||
+		    addr + len > reg->addr + reg->len)
+			continue;
+		if (reg->perm != perm && reg->perm != CRT_BULK_RW)
+			continue;
+		reg->users++;
+		d_list_del(&reg->list);
+		d_list_add(&reg->list, &bulk_lru);
+		D_MUTEX_UNLOCK(&bulk_lock);
+
+		*bulk = reg->bulk;
+		*offset = addr - reg->addr;
+		*handle = reg;
+		return -DER_SUCCESS;
+	}
+	D_MUTEX_UNLOCK(&bulk_lock);
+
+	D_ALLOC_PTR(reg);
+	if (reg == NULL)
+		return crt_bulk_create(ctx, sgl, perm, bulk);
+
+	rc = crt_bulk_create(ctx, sgl, perm, &reg->bulk);
+	if (rc != -DER_SUCCESS) {
+		D_FREE(reg);
+		return rc;
+	}
+
+	reg->ctx = ctx;
+	reg->addr = addr;
+	reg->len = len;
+	reg->perm = perm;
+	reg->users = 1;
+
+	D_MUTEX_LOCK(&bulk_lock);
+	d_list_add(&reg->list, &bulk_lru);
+	atomic_fetch_add(&bulk_count, 1);
+	if ((uintptr_t)addr < atomic_load_acquire(&bulk_lo))
+		atomic_store_release(&bulk_lo, (uintptr_t)addr);
+	if ((uintptr_t)addr + len > atomic_load_acquire(&bulk_hi))
+		atomic_store_release(&bulk_hi, (uintptr_t)addr + len);
+	bulk_evict_locked(&victims);
+	D_MUTEX_UNLOCK(&bulk_lock);
+
+	bulk_reg_free_list(&victims);
+
+	*bulk = reg->bulk;
+	*handle = reg;
+
+	return -DER_SUCCESS;
+}
+
+int ioil_bulk_put(void *handle, crt_bulk_t bulk)
+{
+	struct bulk_reg *reg = handle;
+	D_LIST_HEAD(victims);
+
+	if (reg == NULL)
+		return crt_bulk_free(bulk);
+
+	D_MUTEX_LOCK(&bulk_lock);
+	reg->users--;
+	if (reg->users == 0) {
+		if (reg->stale)
+			d_list_add(&reg->list, &victims);
+		else
+			bulk_evict_locked(&victims);
+	}
+	D_MUTEX_UNLOCK(&bulk_lock);
+
+	bulk_reg_free_list(&victims);
+
+	return -DER_SUCCESS;
+}
+
+void ioil_bulk_invalidate(void *addr, size_t len)
+{
+	struct bulk_reg *reg;
+	struct bulk_reg *next;
+	D_LIST_HEAD(victims);
+	char *start = addr;
+	bool removed = false;
+
+	if (len == 0 || (uintptr_t)start >= atomic_load_acquire(&bulk_hi) ||
+	    (uintptr_t)start + len <= atomic_load_acquire(&bulk_lo))
+		return;
+
+	D_MUTEX_LOCK(&bulk_lock);
+	d_list_for_each_entry_safe(reg, next, &bulk_lru, list) {
+		if (start >= reg->addr + reg->len ||
+		    start + len <= reg->addr)
+			continue;
+		d_list_del_init(&reg->list);
+		atomic_fetch_sub(&bulk_count, 1);
+		if (reg->users == 0)
+			d_list_add(&reg->list, &victims);
+		else
+			reg->stale = true;
+		removed = true;
+	}
+	if (removed)
+		bulk_bounds_locked();
+	D_MUTEX_UNLOCK(&bulk_lock);
+
+	bulk_reg_free_list(&victims);
+}
+
+void ioil_bulk_fini(void)
+{
+	D_LIST_HEAD(victims);
+
+	D_MUTEX_LOCK(&bulk_lock);
+	d_list_splice_init(&bulk_lru, &victims);
+	atomic_store_release(&bulk_count, 0);
+	bulk_bounds_locked();
+	D_MUTEX_UNLOCK(&bulk_lock);
+
+	bulk_reg_free_list(&victims);
+}
@@ -0,0 +1,547 @@
+/* Copyright (C) 2019 Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted for any purpose (including commercial purposes)
+ * provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the
+ *    documentation and/or materials provided with the distribution.
+ *
+ * 3. In addition, redistributions of modified forms of the source or binary
+ *    code must carry prominent notices stating that the original code was
+ *    changed and the date of the change.
+ *
+ *  4. All publications or advertising materials mentioning features or use of
+ *     this software are asked, but not required, to acknowledge that it was
+ *     developed by Intel Corporation and credit the contributors.
+ *
+ * 5. Neither the name of Intel Corporation, nor the name of any Contributor
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/* Read-only private mappings of bypassed files.
+ *
+ * The mapping is reserved as anonymous memory and registered with
+ * userfaultfd.  A handler thread resolves missing page faults by reading the
+ * file with readx RPCs and copying the data in with UFFDIO_COPY, reading
+ * ahead in growing chunks while faults arrive in sequence.
+ *
+ * If the file cannot be read the range is mapped from the file through the
+ * kernel instead, which reports errors as SIGBUS.  A forked child does not
+ * inherit the registration, so in the child any pages not yet read are
+ * mapped through the kernel too.  The parent keeps its registration.
+ */
+#define D_LOGFAC DD_FAC(il)
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <gurt/list.h>
+#include "log.h"
+#include "iof_common.h"
+#include "intercept.h"
+
+#ifdef __NR_userfaultfd
+#include <linux/userfaultfd.h>
+
+/* Smallest readahead window, used for the first fault and after a seek */
+#define IOIL_MAP_MIN_WINDOW (64 * 1024)
+
+/* Time in ms to block in poll() before checking for shutdown */
+#define IOIL_MAP_POLL_TIMEOUT 100
+
+/* Number of times a failed read for a fault is retried */
+#define IOIL_MAP_RETRIES 3
+
+struct ioil_map {
+	d_list_t list;
+	struct iof_file_common common;
+	char *addr;
+	size_t len;
+	off_t offset;		/* File offset of addr */
+	int fd;			/* Holds the file open while mapped */
+	int prot;
+	char *next;		/* Where the next sequential fault lands */
+	size_t window;		/* Current readahead size */
+	size_t max_window;
+};
+
+static D_LIST_HEAD(maps);
+static pthread_mutex_t maps_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t uffd_once = PTHREAD_ONCE_INIT;
+static int uffd = -1;
+static size_t page_size;
+static pthread_t fault_tid;
+static struct iof_tracker fault_stop;
+static bool fault_running;
+
+/* Wake any threads waiting for faults in a range */
+static void map_wake(char *addr, size_t len)
+{
+	struct uffdio_range range;
+
+	if (uffd == -1)
+		return;
+
+	range.start = (uintptr_t)addr;
+	range.len = len;
+	ioctl(uffd, UFFDIO_WAKE, &range);
+}
+
+/* Copy len bytes from buf to addr, page by page if part of the range is
+ * already present, and make sure the faulting thread is woken.
+ */
+static void map_copy(char *addr, char *buf, size_t len)
+{
+	struct uffdio_copy copy;
+	size_t done = 0;
+	int rc;
+
+	copy.dst = (uintptr_t)addr;
+	copy.src = (uintptr_t)buf;
+	copy.len = len;
+	copy.mode = 0;
+	copy.copy = 0;
+
+	rc = ioctl(uffd, UFFDIO_COPY, &copy);
+	if (rc == 0)
+		return;
+
+	if (copy.copy > 0)
+		done = copy.copy;
+
+	while (done < len) {
+		copy.dst = (uintptr_t)(addr + done);
+		copy.src = (uintptr_t)(buf + done);
+		copy.len = page_size;
+		copy.mode = 0;
+		copy.copy = 0;
+
+		rc = ioctl(uffd, UFFDIO_COPY, &copy);
+		if (rc != 0 && errno != EEXIST) {
+			IOF_LOG_DEBUG("UFFDIO_COPY at %p failed: errno %d",
+				      addr + done, errno);
+			break;
+		}
+		done += page_size;
+	}
+
+	map_wake(addr, page_size);
+}
+
+/* Replace part of a mapping with a mapping of the file through the kernel,
+ * which then serves faults in the range.  If that fails the range is made
+ * inaccessible, so the application gets a signal rather than wrong data.
+ * Called with maps_lock held.
+ */
+static void map_kernel(struct ioil_map *map, char *addr, size_t len)
+{
+	void *res;
+
+	res = mmap(addr, len, map->prot, MAP_PRIVATE | MAP_FIXED, map->fd,
+		   map->offset + (addr - map->addr));
+	if (res == MAP_FAILED) {
+		IOF_LOG_ERROR("Could not map %p through the kernel, errno %d",
+			      addr, errno);
+		mprotect(addr, len, PROT_NONE);
+	}
+
+	map_wake(addr, len);
+}
+
+static struct ioil_map *map_find(char *addr)
+{
+	struct ioil_map *map;
+
+	d_list_for_each_entry(map, &maps, list) {
+		if (addr >= map->addr && addr < map->addr + map->len)
+			return map;
+	}
+
+	return NULL;
+}
+
+/* Bounce buffer for the fault thread, UFFDIO_COPY needs a page aligned
+ * source.
+ */
+static char *fault_buf;
+static size_t fault_buf_size;
+
+static void handle_fault(char *fault)
+{
+	struct iof_file_common common;
+	struct ioil_map *map;
+	void *buf;
+	char *addr;
+	size_t len = 0;
+	off_t offset = 0;
+	ssize_t bytes_read;
+	int errcode;
+	int retry;
+
+	addr = (char *)((uintptr_t)fault & ~(page_size - 1));
+
+	D_MUTEX_LOCK(&maps_lock);
+	map = map_find(addr);
+	if (map != NULL) {
+		if (addr == map->next) {
+			map->window *= 2;
+			if (map->window > map->max_window)
+				map->window = map->max_window;
+		} else {
+			map->window = IOIL_MAP_MIN_WINDOW;
+		}
+
+		len = map->window;
+		if (len > map->addr + map->len - addr)
+			len = map->addr + map->len - addr;
+
+		map->next = addr + len;
+		offset = map->offset + (addr - map->addr);
+		common = map->common;
+	}
+	D_MUTEX_UNLOCK(&maps_lock);
+
+	if (len == 0) {
+		/* Raced with munmap(), there is nothing left to fill */
+		IOF_LOG_DEBUG("Fault at %p outside any mapping", fault);
+		return;
+	}
+
+	if (len > fault_buf_size) {
+		if (posix_memalign(&buf, page_size, len) != 0) {
+			IOF_LOG_ERROR("Could not allocate %zu bytes", len);
+			goto kernel;
+		}
+		free(fault_buf);
+		fault_buf = buf;
+		fault_buf_size = len;
+	}
+	buf = fault_buf;
+
+	for (retry = 0; retry <= IOIL_MAP_RETRIES; retry++) {
+		bytes_read = ioil_do_pread(buf, len, offset, &common,
+					   &errcode);
+		if (bytes_read >= 0)
+			break;
+		IOF_LOG_WARNING("Read of %zu bytes at %zd for fault at %p "
+				"failed: errno %d", len, offset, fault,
+				errcode);
+	}
+
+	if (bytes_read < 0)
+		goto kernel;
+
+	/* Past the end of the file the mapping reads as zeros */
+	if (bytes_read < len)
+		memset(fault_buf + bytes_read, 0, len - bytes_read);
+
+	map_copy(addr, buf, len);
+	return;
+
+kernel:
+	/* Let the kernel read the file, and report any error */
+	D_MUTEX_LOCK(&maps_lock);
+	map = map_find(addr);
+	if (map != NULL) {
+		if (len > map->addr + map->len - addr)
+			len = map->addr + map->len - addr;
+		map_kernel(map, addr, len);
+	}
+	D_MUTEX_UNLOCK(&maps_lock);
+}
+
+static void *fault_thread(void *arg)
+{
+	struct uffd_msg msg;
+	struct pollfd pfd;
+	ssize_t rc;
+
+	pfd.fd = uffd;
+	pfd.events = POLLIN;
+
+	while (!iof_tracker_test(&fault_stop)) {
+		rc = poll(&pfd, 1, IOIL_MAP_POLL_TIMEOUT);
+		if (rc <= 0)
+			continue;
+
+		rc = read(uffd, &msg, sizeof(msg));
+		if (rc != sizeof(msg))
+			continue;
+
+		if (msg.event != UFFD_EVENT_PAGEFAULT)
+			continue;
+
+		handle_fault((char *)(uintptr_t)msg.arg.pagefault.address);
+	}
+
+	free(fault_buf);
+	fault_buf = NULL;
+	fault_buf_size = 0;
+
+	return NULL;
+}
+
+/* Map the pages of a mapping which have not been read yet through the
+ * kernel.  Called in a forked child, where pages already read have been
+ * copied from the parent as usual and the rest would read as zeros.
+ */
+static void map_unfaulted(struct ioil_map *map)
+{
+	unsigned char *vec;
+	size_t pages = map->len / page_size;
+	size_t start;
+	size_t end;
+
+	D_ALLOC_ARRAY(vec, pages);
+	if (vec == NULL || mincore(map->addr, map->len, vec) != 0) {
+		D_FREE(vec);
+		map_kernel(map, map->addr, map->len);
+		return;
+	}
+
+	for (start = 0; start < pages; start = end) {
+		end = start + 1;
+		if (vec[start] & 1)
+			continue;
+
+		while (end < pages && !(vec[end] & 1))
+			end++;
+
+		map_kernel(map, map->addr + start * page_size,
+			   (end - start) * page_size);
+	}
+
+	D_FREE(vec);
+}
+
+static void map_prefork(void)
+{
+	D_MUTEX_LOCK(&maps_lock);
+}
+
+static void map_postfork_parent(void)
+{
+	D_MUTEX_UNLOCK(&maps_lock);
+}
+
+/* The userfaultfd refers to the parent, so existing and new mappings in
+ * the child go through the kernel.
+ */
+static void map_postfork_child(void)
+{
+	struct ioil_map *map;
+
+	if (uffd != -1)
+		close(uffd);
+	uffd = -1;
+	fault_running = false;
+
+	d_list_for_each_entry(map, &maps, list)
+		map_unfaulted(map);
+
+	D_MUTEX_UNLOCK(&maps_lock);
+}
+
+/* Open the userfaultfd and start the handler thread.  On failure uffd is
+ * left at -1 and mappings fall back to the kernel.
+ */
+static void uffd_init(void)
+{
+	struct uffdio_api api = {.api = UFFD_API};
+	int fd;
+	int rc;
+
+	page_size = sysconf(_SC_PAGESIZE);
+
+	fd = syscall(__NR_userfaultfd, O_CLOEXEC | O_NONBLOCK);
+	if (fd == -1) {
+		IOF_LOG_INFO("userfaultfd not available, errno %d", errno);
+		return;
+	}
+
+	if (ioctl(fd, UFFDIO_API, &api) != 0) {
+		IOF_LOG_INFO("UFFDIO_API failed, errno %d", errno);
+		goto err;
+	}
+
+	uffd = fd;
+	iof_tracker_init(&fault_stop, 1);
+
+	rc = pthread_create(&fault_tid, NULL, fault_thread, NULL);
+	if (rc != 0) {
+		IOF_LOG_ERROR("Could not start fault thread, rc = %d", rc);
+		uffd = -1;
+		goto err;
+	}
+
+	fault_running = true;
+
+	pthread_atfork(map_prefork, map_postfork_parent, map_postfork_child);
+
+	return;
+err:
+	close(fd);
+}
+
+int ioil_map_register(void *addr, size_t len, off_t offset, int fd,
+		      int prot, struct iof_file_common *common)
+{
+	struct uffdio_register reg;
+	struct ioil_map *map;
+
+	pthread_once(&uffd_once, uffd_init);
+	if (uffd == -1)
+		return ENOSYS;
+
+	D_ALLOC_PTR(map);
+	if (map == NULL)
+		return ENOMEM;
+
+	/* Registered ranges must cover whole pages */
+	len = (len + page_size - 1) & ~(page_size - 1);
+
+	map->common = *common;
+	map->addr = addr;
+	map->len = len;
+	map->offset = offset;
+	map->fd = fd;
+	map->prot = prot;
+	map->window = IOIL_MAP_MIN_WINDOW;
+	map->max_window = common->projection->max_read;
+	if (map->max_window < IOIL_MAP_MIN_WINDOW)
+		map->max_window = IOIL_MAP_MIN_WINDOW;
+
+	D_MUTEX_LOCK(&maps_lock);
+	d_list_add(&map->list, &maps);
+	D_MUTEX_UNLOCK(&maps_lock);
+
+	reg.range.start = (uintptr_t)addr;
+	reg.range.len = len;
+	reg.mode = UFFDIO_REGISTER_MODE_MISSING;
+	if (ioctl(uffd, UFFDIO_REGISTER, &reg) != 0 ||
+	    !(reg.ioctls & (1 << _UFFDIO_COPY))) {
+		IOF_LOG_INFO("UFFDIO_REGISTER of %p failed, errno %d", addr,
+			     errno);
+		D_MUTEX_LOCK(&maps_lock);
+		d_list_del(&map->list);
+		D_MUTEX_UNLOCK(&maps_lock);
+		D_FREE(map);
+		return EINVAL;
+	}
+
+	return 0;
+}
+
+int ioil_map_remove(void *addr, size_t len)
+{
+	struct ioil_map *map;
+	struct ioil_map *next;
+	struct ioil_map *tail;
+	char *start = addr;
+	char *end;
+	char *map_end;
+	int fd = -1;
+
+	/* Nothing has been registered */
+	if (page_size == 0)
+		return -1;
+
+	len = (len + page_size - 1) & ~(page_size - 1);
+	end = start + len;
+
+	D_MUTEX_LOCK(&maps_lock);
+	d_list_for_each_entry_safe(map, next, &maps, list) {
+		map_end = map->addr + map->len;
+		if (end <= map->addr || start >= map_end)
+			continue;
+
+		if (start <= map->addr && end >= map_end) {
+			d_list_del(&map->list);
+			fd = map->fd;
+			D_FREE(map);
+			break;
+		}
+
+		if (start > map->addr && end < map_end) {
+			/* A hole in the middle, the part after it gets its
+			 * own copy of the fd.  If that fails the mapping is
+			 * kept whole, which only delays closing the fd.
+			 */
+			D_ALLOC_PTR(tail);
+			if (tail == NULL)
+				continue;
+			*tail = *map;
+			tail->fd = fcntl(map->fd, F_DUPFD_CLOEXEC, 0);
+			if (tail->fd == -1) {
+				D_FREE(tail);
+				continue;
+			}
+			tail->addr = end;
+			tail->len = map_end - end;
+			tail->offset = map->offset + (end - map->addr);
+			tail->next = NULL;
+			d_list_add(&tail->list, &map->list);
+			map->len = start - map->addr;
+		} else if (start <= map->addr) {
+			map->offset += end - map->addr;
+			map->len = map_end - end;
+			map->addr = end;
+		} else {
+			map->len = start - map->addr;
+		}
+	}
+	D_MUTEX_UNLOCK(&maps_lock);
+
+	return fd;
+}
+
+void ioil_map_fini(void)
+{
+	if (!fault_running)
+		return;
+
+	iof_tracker_signal(&fault_stop);
+	pthread_join(fault_tid, NULL);
+	fault_running = false;
+}
+
+#else /* !__NR_userfaultfd */
+
+int ioil_map_register(void *addr, size_t len, off_t offset, int fd,
+		      int prot, struct iof_file_common *common)
+{
+	return ENOSYS;
+}
+
+int ioil_map_remove(void *addr, size_t len)
+{
+	return -1;
+}
+
+void ioil_map_fini(void)
+{
+}
+
+#endif /* __NR_userfaultfd */
@@ -0,0 +1,658 @@
+/* Copyright (C) 2019 Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted for any purpose (including commercial purposes)
+ * provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the
+ *    documentation and/or materials provided with the distribution.
+ *
+ * 3. In addition, redistributions of modified forms of the source or binary
+ *    code must carry prominent notices stating that the original code was
+ *    changed and the date of the change.
+ *
+ *  4. All publications or advertising materials mentioning features or use of
+ *     this software are asked, but not required, to acknowledge that it was
+ *     developed by Intel Corporation and credit the contributors.
+ *
+ * 5. Neither the name of Intel Corporation, nor the name of any Contributor
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/* Opening files with RPCs to the IONSS.
+ *
+ * Opening a file through the kernel costs FUSE lookup and open requests to
+ * the CNSS followed by an ioctl to fetch the GAH before I/O can bypass the
+ * kernel.  Here the path is resolved against the projection mount points
+ * and the file opened with a single open_path RPC relative to the root of
+ * the projection.  The IONSS does not follow symbolic links or open
+ * anything other than regular files, returning ELOOP instead, so those are
+ * left to the kernel.
+ *
+ * Files opened this way are closed on the IONSS once the last fd for them
+ * is closed in the process that opened them.
+ */
+#define D_LOGFAC DD_FAC(il)
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <gurt/list.h>
+#include <cart/api.h>
+#include "log.h"
+#include "iof_common.h"
+#include "iof_ctrl_util.h"
+#include "intercept.h"
+
+#define DIRECT_OP(NAME)						\
+	CRT_PROTO_OPC(md_proto->cpf_base, md_proto->cpf_ver,	\
+		      DEF_RPC_TYPE(NAME))
+
+/* Where a projection is mounted and the GAH of its root */
+struct direct_proj {
+	char			*mount;		/* Canonical path */
+	size_t			mount_len;
+	struct ios_gah		root;
+};
+
+/* A file opened by ioil_direct_open() */
+struct direct_file {
+	d_list_t		list;
+	struct iof_projection	*projection;
+	struct ios_gah		gah;
+	pid_t			owner;
+};
+
+static struct iof_projection *projections;
+static struct direct_proj *dprojs;
+static uint32_t dproj_count;
+static struct crt_proto_format *md_proto;
+static bool direct_enabled;
+
+static D_LIST_HEAD(direct_files);
+static pthread_mutex_t direct_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Close RPCs in flight */
+static struct iof_tracker close_tracker;
+
+static void direct_prefork(void)
+{
+	D_MUTEX_LOCK(&direct_lock);
+}
+
+static void direct_postfork_parent(void)
+{
+	D_MUTEX_UNLOCK(&direct_lock);
+}
+
+/* Files stay open for the parent, forget them without closing */
+static void direct_postfork_child(void)
+{
+	D_INIT_LIST_HEAD(&direct_files);
+	D_MUTEX_UNLOCK(&direct_lock);
+}
+
+/* Read the GAH of a projection root, which is exported as hex */
+static int read_root(uint32_t id, struct ios_gah *gah)
+{
+	unsigned char *bytes = (unsigned char *)gah;
+	char str[sizeof(*gah) * 2 + 2];
+	char tmp[64];
+	size_t i;
+	int rc;
+
+	snprintf(tmp, sizeof(tmp), "iof/projections/%d/root_gah", id);
+	rc = iof_ctrl_read_str(str, sizeof(str), tmp);
+	if (rc != 0)
+		return EIO;
+
+	for (i = 0; i < sizeof(*gah); i++) {
+		if (sscanf(&str[i * 2], "%2hhx", &bytes[i]) != 1)
+			return EIO;
+	}
+
+	return 0;
+}
+
+void ioil_direct_proto(struct crt_proto_format *proto)
+{
+	md_proto = proto;
+}
+
+int ioil_direct_init(struct iof_projection *projs, uint32_t count)
+{
+	char tmp[64];
+	char *buf;
+	uint32_t i;
+	int rc;
+
+	D_ALLOC_ARRAY(dprojs, count);
+	if (dprojs == NULL)
+		return ENOMEM;
+
+	D_ALLOC(buf, IOF_CTRL_MAX_LEN);
+	if (buf == NULL) {
+		D_FREE(dprojs);
+		return ENOMEM;
+	}
+
+	for (i = 0; i < count; i++) {
+		struct direct_proj *dproj = &dprojs[i];
+
+		snprintf(tmp, sizeof(tmp), "iof/projections/%d/mount_point",
+			 i);
+		rc = iof_ctrl_read_str(buf, IOF_CTRL_MAX_LEN, tmp);
+		if (rc != 0) {
+			IOF_LOG_ERROR("Could not read mount_point, rc = %d",
+				      rc);
+			continue;
+		}
+
+		rc = read_root(i, &dproj->root);
+		if (rc != 0) {
+			IOF_LOG_ERROR("Could not read root_gah for %s", buf);
+			continue;
+		}
+
+		/* Paths are compared with the canonical mount point */
+		dproj->mount = realpath(buf, NULL);
+		if (dproj->mount == NULL) {
+			IOF_LOG_ERROR("Could not resolve %s", buf);
+			continue;
+		}
+		dproj->mount_len = strlen(dproj->mount);
+
+		IOF_LOG_INFO("Opening files under %s directly", dproj->mount);
+	}
+
+	D_FREE(buf);
+
+	projections = projs;
+	dproj_count = count;
+
+	pthread_atfork(direct_prefork, direct_postfork_parent,
+		       direct_postfork_child);
+
+	direct_enabled = true;
+
+	return 0;
+}
+
+/* Find the projection a path is on, and the path relative to its mount
+ * point, without the kernel resolving it.  Paths with ".." components or
+ * that name a directory are not handled, as the result could depend on
+ * symbolic links.  buf must hold PATH_MAX bytes.
+ *
+ * Returns the projection id or -1.
+ */
+static int direct_resolve(const char *path, char *buf, const char **rel)
+{
+	struct direct_proj *dproj;
+	const char *p = path;
+	bool dir = true;
+	size_t len = 0;
+	size_t n;
+	uint32_t i;
+
+	if (path[0] == '\0')
+		return -1;
+
+	if (path[0] != '/') {
+		if (getcwd(buf, PATH_MAX) == NULL)
+			return -1;
+		len = strlen(buf);
+		if (len == 1)
+			len = 0;
+	}
+
+	for (;;) {
+		while (*p == '/')
+			p++;
+		if (*p == '\0')
+			break;
+
+		n = strcspn(p, "/");
+		if (n == 2 && p[0] == '.' && p[1] == '.')
+			return -1;
+
+		dir = (n == 1 && p[0] == '.');
+		if (!dir) {
+			if (len + n + 1 >= PATH_MAX)
+				return -1;
+			buf[len++] = '/';
+			memcpy(&buf[len], p, n);
+			len += n;
+		}
+
+		p += n;
+		if (*p == '/')
+			dir = true;
+	}
+	buf[len] = '\0';
+
+	if (dir)
+		return -1;
+
+	for (i = 0; i < dproj_count; i++) {
+		dproj = &dprojs[i];
+		if (dproj->mount == NULL || len <= dproj->mount_len)
+			continue;
+		if (buf[dproj->mount_len] != '/' ||
+		    strncmp(buf, dproj->mount, dproj->mount_len) != 0)
+			continue;
+		*rel = &buf[dproj->mount_len + 1];
+		return i;
+	}
+
+	return -1;
+}
+
+struct direct_cb_r {
+	struct iof_tracker	tracker;
+	crt_rpc_t		*rpc;
+	int			rc;
+};
+
+static void direct_cb(const struct crt_cb_info *cb_info)
+{
+	struct direct_cb_r *reply = cb_info->cci_arg;
+
+	reply->rc = cb_info->cci_rc;
+	if (reply->rc == 0) {
+		crt_req_addref(cb_info->cci_rpc);
+		reply->rpc = cb_info->cci_rpc;
+	}
+
+	iof_tracker_signal(&reply->tracker);
+}
+
+/* Send an RPC and wait for the reply.  On success the RPC is returned in
+ * rpcp for the caller to release with crt_req_decref().
+ *
+ * Returns 0 or an errno.
+ */
+static int direct_rpc(struct iof_projection *projection, crt_rpc_t *rpc,
+		      crt_rpc_t **rpcp)
+{
+	struct direct_cb_r reply = {0};
+	int rc;
+
+	iof_tracker_init(&reply.tracker, 1);
+
+	rc = crt_req_send(rpc, direct_cb, &reply);
+	if (rc) {
+		IOF_LOG_ERROR("Could not send rpc, rc = %d", rc);
+		return EIO;
+	}
+
+	iof_fs_wait(projection, &reply.tracker);
+
+	if (reply.rc) {
+		IOF_LOG_INFO("Bad RPC reply %d", reply.rc);
+		return reply.rc == -DER_TIMEDOUT ? EAGAIN : EIO;
+	}
+
+	*rpcp = reply.rpc;
+
+	return 0;
+}
+
+/* Convert a CaRT error from the IONSS to an errno, ESTALE if the GAH sent
+ * was not recognised.
+ */
+static int direct_err(int err)
+{
+	if (err == -DER_NONEXIST)
+		return ESTALE;
+	if (err == -DER_NOMEM)
+		return ENOMEM;
+	return EIO;
+}
+
+/* Open rel with an open_path RPC relative to the root of the projection,
+ * filling in gah and stat.  Returns 0 or an errno.
+ */
+static int open_path(struct iof_projection *projection,
+		     struct ios_gah *root, const char *rel, int flags,
+		     mode_t mode, struct ios_gah *gah, struct stat *stat)
+{
+	struct iof_open_path_in *in;
+	struct iof_entry_out *out;
+	crt_rpc_t *rpc = NULL;
+	int rc;
+
+	rc = crt_req_create(projection->crt_ctx, &projection->grp->psr_ep,
+			    DIRECT_OP(open_path), &rpc);
+	if (rc || !rpc) {
+		IOF_LOG_ERROR("Could not create request, rc = %d", rc);
+		return EIO;
+	}
+
+	in = crt_req_get(rpc);
+	in->gah = *root;
+	in->path = (d_string_t)rel;
+	in->flags = flags;
+	in->mode = mode;
+
+	rc = direct_rpc(projection, rpc, &rpc);
+	if (rc)
+		return rc;
+
+	out = crt_reply_get(rpc);
+	if (out->err) {
+		IOF_LOG_ERROR("Error from target %d", out->err);
+		rc = direct_err(out->err);
+	} else if (out->rc) {
+		rc = out->rc;
+	} else {
+		*gah = out->gah;
+		*stat = out->stat;
+	}
+
+	crt_req_decref(rpc);
+
+	return rc;
+}
+
+static void close_cb(const struct crt_cb_info *cb_info)
+{
+	iof_tracker_signal(&close_tracker);
+}
+
+/* Close a GAH on the IONSS without waiting for the reply */
+static void close_gah(struct iof_projection *projection, struct ios_gah *gah)
+{
+	struct iof_gah_in *in;
+	crt_rpc_t *rpc = NULL;
+	int rc;
+
+	rc = crt_req_create(projection->crt_ctx, &projection->grp->psr_ep,
+			    DIRECT_OP(close), &rpc);
+	if (rc || !rpc) {
+		IOF_LOG_ERROR("Could not create request, rc = %d", rc);
+		return;
+	}
+
+	in = crt_req_get(rpc);
+	in->gah = *gah;
+
+	atomic_fetch_add(&close_tracker.remaining, 1);
+	rc = crt_req_send(rpc, close_cb, NULL);
+	if (rc) {
+		IOF_LOG_ERROR("Could not send rpc, rc = %d", rc);
+		iof_tracker_signal(&close_tracker);
+	}
+}
+
+int ioil_direct_open(const char *path, int flags, mode_t mode,
+		     struct iof_file_common *common, void **handle)
+{
+	struct iof_projection *projection;
+	struct direct_file *file;
+	struct ios_gah root;
+	struct stat stat;
+	const char *rel;
+	char *buf;
+	int id;
+	int rc;
+
+	if (!direct_enabled)
+		return ENOTSUP;
+
+	D_ALLOC(buf, PATH_MAX);
+	if (buf == NULL)
+		return ENOMEM;
+
+	id = direct_resolve(path, buf, &rel);
+	if (id < 0)
+		D_GOTO(out, rc = ENOTSUP);
+
+	D_ALLOC_PTR(file);
+	if (file == NULL)
+		D_GOTO(out, rc = ENOMEM);
+
+	projection = &projections[id];
+
+	D_MUTEX_LOCK(&direct_lock);
+	root = dprojs[id].root;
+	D_MUTEX_UNLOCK(&direct_lock);
+
+	rc = open_path(projection, &root, rel, flags, mode, &file->gah, &stat);
+	if (rc == ESTALE) {
+		/* The root GAH changes after failover */
+		rc = read_root(id, &root);
+		if (rc == 0) {
+			D_MUTEX_LOCK(&direct_lock);
+			dprojs[id].root = root;
+			D_MUTEX_UNLOCK(&direct_lock);
+			rc = open_path(projection, &root, rel, flags, mode,
+				       &file->gah, &stat);
+		}
+	}
+
+	if (rc == 0 && !S_ISREG(stat.st_mode)) {
+		close_gah(projection, &file->gah);
+		rc = ELOOP;
+	}
+
+	IOF_LOG_INFO("open_path(%s, flags=0%o) = %d " GAH_PRINT_STR, rel,
+		     flags, rc, GAH_PRINT_VAL(file->gah));
+
+	/* Anything left for the kernel to resolve */
+	if (rc == ELOOP || rc == ESTALE || rc == EIO)
+		rc = ENOTSUP;
+
+	if (rc != 0) {
+		D_FREE(file);
+		goto out;
+	}
+
+	file->projection = projection;
+	file->owner = getpid();
+
+	D_MUTEX_LOCK(&direct_lock);
+	d_list_add(&file->list, &direct_files);
+	D_MUTEX_UNLOCK(&direct_lock);
+
+	common->projection = projection;
+	common->gah = file->gah;
+	common->ep = projection->grp->psr_ep;
+	*handle = file;
+
+out:
+	D_FREE(buf);
+	return rc;
+}
+
+void ioil_direct_close(void *handle)
+{
+	struct direct_file *file = handle;
+
+	if (file == NULL)
+		return;
+
+	/* Only the process that opened the file closes it */
+	if (file->owner != getpid()) {
+		D_FREE(file);
+		return;
+	}
+
+	D_MUTEX_LOCK(&direct_lock);
+	d_list_del(&file->list);
+	D_MUTEX_UNLOCK(&direct_lock);
+
+	if (direct_enabled)
+		close_gah(file->projection, &file->gah);
+
+	D_FREE(file);
+}
+
+/* Send an RPC taking a GAH for a file and wait for the reply, returned in
+ * rpcp for the caller to release.  Returns 0 or an errno.
+ */
+static int gah_rpc(struct iof_file_common *common, crt_opcode_t opcode,
+		   crt_rpc_t **rpcp)
+{
+	struct iof_projection *projection = common->projection;
+	struct iof_gah_in *in;
+	crt_rpc_t *rpc = NULL;
+	int rc;
+
+	rc = crt_req_create(projection->crt_ctx, &projection->grp->psr_ep,
+			    opcode, &rpc);
+	if (rc || !rpc) {
+		IOF_LOG_ERROR("Could not create request, rc = %d", rc);
+		return EIO;
+	}
+
+	in = crt_req_get(rpc);
+	in->gah = common->gah;
+
+	return direct_rpc(projection, rpc, rpcp);
+}
+
+int ioil_direct_fsync(struct iof_file_common *common, bool datasync)
+{
+	struct iof_status_out *out;
+	crt_rpc_t *rpc;
+	int rc;
+
+	rc = gah_rpc(common, datasync ? DIRECT_OP(fdatasync) :
+		     DIRECT_OP(fsync), &rpc);
+	if (rc)
+		return rc;
+
+	out = crt_reply_get(rpc);
+	if (out->err)
+		rc = direct_err(out->err);
+	else
+		rc = out->rc;
+
+	crt_req_decref(rpc);
+
+	return rc;
+}
+
+int ioil_direct_getattr(struct iof_file_common *common, struct stat *stat)
+{
+	struct iof_attr_out *out;
+	crt_rpc_t *rpc;
+	int rc;
+
+	rc = gah_rpc(common, DIRECT_OP(getattr), &rpc);
+	if (rc)
+		return rc;
+
+	out = crt_reply_get(rpc);
+	if (out->err)
+		rc = direct_err(out->err);
+	else if (out->rc)
+		rc = out->rc;
+	else
+		*stat = out->stat;
+
+	crt_req_decref(rpc);
+
+	return rc;
+}
+
+int ioil_direct_copy(struct iof_file_common *src, off_t src_off,
+		     struct iof_file_common *dst, off_t dst_off, size_t len,
+		     size_t *copied)
+{
+	struct iof_projection *projection = src->projection;
+	struct iof_copy_out *out;
+	struct iof_copy_in *in;
+	crt_endpoint_t ep;
+	crt_rpc_t *rpc = NULL;
+	int rc;
+
+	*copied = 0;
+
+	if (!md_proto)
+		return EXDEV;
+
+	/* The GAHs for both files are only valid on the rank that opened
+	 * them.
+	 */
+	ep = projection->grp->psr_ep;
+	ep.ep_rank = src->gah.root;
+
+	rc = crt_req_create(projection->crt_ctx, &ep, DIRECT_OP(copy), &rpc);
+	if (rc || !rpc) {
+		IOF_LOG_ERROR("Could not create request, rc = %d", rc);
+		return EIO;
+	}
+
+	in = crt_req_get(rpc);
+	in->gah = src->gah;
+	in->dst_gah = dst->gah;
+	in->src_off = src_off;
+	in->dst_off = dst_off;
+	in->len = len;
+
+	rc = direct_rpc(projection, rpc, &rpc);
+	if (rc)
+		return rc;
+
+	out = crt_reply_get(rpc);
+	if (out->err)
+		rc = direct_err(out->err);
+	else if (out->rc)
+		rc = out->rc;
+	else
+		*copied = out->len;
+
+	crt_req_decref(rpc);
+
+	return rc;
+}
+
+void ioil_direct_fini(void)
+{
+	struct direct_file *file;
+	uint32_t i;
+
+	if (!direct_enabled)
+		return;
+
+	D_MUTEX_LOCK(&direct_lock);
+	d_list_for_each_entry(file, &direct_files, list) {
+		IOF_LOG_INFO("Closing " GAH_PRINT_STR " at exit",
+			     GAH_PRINT_VAL(file->gah));
+		close_gah(file->projection, &file->gah);
+		file->owner = 0;
+	}
+	D_INIT_LIST_HEAD(&direct_files);
+	direct_enabled = false;
+	D_MUTEX_UNLOCK(&direct_lock);
+
+	if (dproj_count > 0)
+		iof_fs_wait(&projections[0], &close_tracker);
+
+	for (i = 0; i < dproj_count; i++)
+		free(dprojs[i].mount);
+	D_FREE(dprojs);
+	dproj_count = 0;
+}
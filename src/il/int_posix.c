@@ -47,9 +47,16 @@
 #include <sys/types.h>
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <dirent.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <string.h>
+#include <malloc.h>
+#include <unistd.h>
+#include <sys/syscall.h>
 #include "log.h"
 #include <gurt/list.h>
 #include <cart/api.h>
@@ -61,6 +68,7 @@
 #include "iof_ctrl_util.h"
 
 FOREACH_INTERCEPT(IOIL_FORWARD_DECL)
+FOREACH_OPTIONAL_INTERCEPT(IOIL_FORWARD_DECL_OPTIONAL)
 
 static bool ioil_initialized;
 static __thread int saved_errno;
@@ -73,6 +81,52 @@ static struct iof_projection *projections;
 static uint32_t projection_count;
 static struct crt_proto_format *iof_proto;
 
+/* Background progress thread for crt_ctx.  Application threads send RPCs and
+ * then wait on their own trackers so many can be in flight at once, rather
+ * than each calling crt_progress() on the shared context in turn.
+ */
+static pthread_t progress_tid;
+static struct iof_tracker progress_stop;
+static bool progress_running;
+
+/* Time in us to block in crt_progress() before checking for shutdown */
+#define IOIL_PROGRESS_TIMEOUT (100 * 1000)
+
+/* Size of the per file descriptor read cache, reads of at least this size
+ * bypass it.  Cached data is not revalidated against writes from other
+ * clients, so it is set by IOIL_READ_CACHE_SIZE, disabled by default.
+ */
+static size_t read_cache_size;
+
+/* Size of the per file descriptor write-behind buffer, capped at the
+ * projection max_write.  Set by IOIL_WRITE_CACHE_SIZE, disabled by default.
+ */
+static size_t write_cache_size;
+
+/* Open files with RPCs to the IONSS rather than through the kernel.  Set
+ * by IOIL_DIRECT_OPEN, disabled by default.
+ */
+static bool direct_open;
+static struct crt_proto_format *md_proto;
+
+/* Return fopen() and fdopen() streams over bypassed fds that do their I/O
+ * through the interception library.  fileno() returns -1 on these streams,
+ * so this is set by IOIL_STREAM_BYPASS, disabled by default.
+ */
+static bool stream_bypass;
+
+/* Flags which direct opens do not handle.  Creates are left to the kernel as
+ * the O_PATH placeholder is opened by a path walk, which could otherwise find
+ * a negative dentry cached from before the file existed.
+ */
+#define IOIL_DIRECT_OPEN_UNSUPPORTED \
+	(O_PATH | O_APPEND | O_DIRECTORY | O_TMPFILE | O_DIRECT | \
+	 O_ASYNC | O_CREAT)
+
+/* All write caches, so buffered data can be flushed at exit */
+static D_LIST_HEAD(write_caches);
+static pthread_mutex_t write_caches_lock = PTHREAD_MUTEX_INITIALIZER;
+
 #define BLOCK_SIZE 1024
 
 #define SAVE_ERRNO(is_error)                 \
@@ -97,23 +151,145 @@ static const char * const bypass_status[] = {
 	"off-rsrc",
 };
 
+/* Client side buffer holding a window of the file, filled by reading ahead
+ * when small reads arrive in sequence.  Shared by all duplicates of a file
+ * descriptor.
+ */
+struct read_cache {
+	pthread_mutex_t lock;
+	char *buf;		/* Allocated on first fill */
+	off_t start;		/* File offset of buf[0] */
+	size_t len;		/* Valid bytes in buf */
+	off_t next;		/* Where a sequential read would start */
+	struct iof_read_cache_stats stats;
+};
+
+/* Write-behind buffer coalescing contiguous writes into a single RPC.  A
+ * failed flush is remembered and reported by the next call that syncs the
+ * buffer, or by close.
+ */
+struct write_cache {
+	d_list_t list;
+	pthread_mutex_t lock;
+	struct iof_file_common common;
+	char *buf;		/* Allocated on first write */
+	size_t size;		/* Capacity of buf */
+	off_t start;		/* File offset of buf[0] */
+	size_t len;		/* Bytes waiting to be written */
+	int error;		/* errno from a failed flush */
+};
+
 struct fd_entry {
 	struct iof_file_common common;
+	struct read_cache *rcache;
+	struct write_cache *wcache;
 	off_t pos;
 	int flags;
 	int status;
+	void *direct;	/* Set if opened by ioil_direct_open() */
 };
 
+static struct read_cache *read_cache_alloc(void)
+{
+	struct read_cache *rc;
+
+	D_ALLOC_PTR(rc);
+	if (rc == NULL)
+		return NULL;
+
+	if (pthread_mutex_init(&rc->lock, NULL) != 0) {
+		D_FREE(rc);
+		return NULL;
+	}
+
+	return rc;
+}
+
+static void read_cache_free(struct read_cache *rc)
+{
+	if (rc == NULL)
+		return;
+
+	IOF_LOG_DEBUG("Read cache %p hits %lu misses %lu fills %lu "
+		      "invalidations %lu", rc, rc->stats.hits,
+		      rc->stats.misses, rc->stats.fills,
+		      rc->stats.invalidations);
+
+	pthread_mutex_destroy(&rc->lock);
+	D_FREE(rc->buf);
+	D_FREE(rc);
+}
+
+static struct write_cache *write_cache_alloc(struct iof_file_common *common)
+{
+	struct write_cache *wc;
+
+	D_ALLOC_PTR(wc);
+	if (wc == NULL)
+		return NULL;
+
+	if (pthread_mutex_init(&wc->lock, NULL) != 0) {
+		D_FREE(wc);
+		return NULL;
+	}
+
+	wc->common = *common;
+	wc->size = write_cache_size;
+	if (wc->size > common->projection->max_write)
+		wc->size = common->projection->max_write;
+
+	D_MUTEX_LOCK(&write_caches_lock);
+	d_list_add(&wc->list, &write_caches);
+	D_MUTEX_UNLOCK(&write_caches_lock);
+
+	return wc;
+}
+
+static void write_cache_free(struct write_cache *wc)
+{
+	if (wc == NULL)
+		return;
+
+	D_MUTEX_LOCK(&write_caches_lock);
+	d_list_del(&wc->list);
+	D_MUTEX_UNLOCK(&write_caches_lock);
+
+	if (wc->len != 0)
+		IOF_LOG_ERROR("Discarding %zu unwritten bytes at offset %zd "
+			      GAH_PRINT_STR, wc->len, wc->start,
+			      GAH_PRINT_VAL(wc->common.gah));
+
+	pthread_mutex_destroy(&wc->lock);
+	D_FREE(wc->buf);
+	D_FREE(wc);
+}
+
+/* Called by the vector when the last reference to an entry is dropped */
+static void fd_entry_release(void *arg)
+{
+	struct fd_entry *entry = arg;
+
+	read_cache_free(entry->rcache);
+	entry->rcache = NULL;
+	write_cache_free(entry->wcache);
+	entry->wcache = NULL;
+	ioil_direct_close(entry->direct);
+	entry->direct = NULL;
+}
+
 int ioil_initialize_fd_table(int max_fds)
 {
 	int rc;
 
 	rc = vector_init(&fd_table, sizeof(struct fd_entry), max_fds);
 
-	if (rc != 0)
+	if (rc != 0) {
 		IOF_LOG_ERROR("Could not allocate file descriptor table"
 			      ", disabling kernel bypass: rc = %d", rc);
-	return rc;
+		return rc;
+	}
+
+	return vector_set_release(&fd_table, fd_entry_release);
 }
 
 #define BUFSIZE 64
@@ -232,6 +408,14 @@ static int find_projections(void)
 			return 1;
 		}
 
+		snprintf(tmp, BUFSIZE, "iof/projections/%d/max_read", i);
+		rc = iof_ctrl_read_uint32(&proj->max_read, tmp);
+		if (rc != 0) {
+			IOF_LOG_ERROR("Could not max_read, rc = %d", rc);
+			D_FREE(buf);
+			return 1;
+		}
+
 		snprintf(tmp, BUFSIZE, "iof/projections/%d/max_write", i);
 		rc = iof_ctrl_read_uint32(&proj->max_write, tmp);
 		if (rc != 0) {
@@ -261,7 +445,6 @@ static ssize_t pread_rpc(struct fd_entry *entry, char *buff, size_t len,
 	return bytes_read;
 }
 
-/* Start simple and just loop */
 static ssize_t preadv_rpc(struct fd_entry *entry, const struct iovec *iov,
 			  int count, off_t offset)
 {
@@ -291,7 +474,6 @@ static ssize_t pwrite_rpc(struct fd_entry *entry, const char *buff, size_t len,
 	return bytes_written;
 }
 
-/* Start simple and just loop */
 static ssize_t pwritev_rpc(struct fd_entry *entry, const struct iovec *iov,
 			   int count, off_t offset)
 {
@@ -307,23 +489,466 @@ static ssize_t pwritev_rpc(struct fd_entry *entry, const struct iovec *iov,
 	return bytes_written;
 }
 
+/* Discard the cached data, called after any write through the file */
+static void read_cache_invalidate(struct fd_entry *entry)
+{
+	struct read_cache *rc = entry->rcache;
+
+	if (rc == NULL)
+		return;
+
+	D_MUTEX_LOCK(&rc->lock);
+	if (rc->len != 0) {
+		rc->len = 0;
+		rc->stats.invalidations++;
+	}
+	D_MUTEX_UNLOCK(&rc->lock);
+}
+
+/* Discard the cached data if the file position moves outside the window */
+static void read_cache_seek(struct fd_entry *entry, off_t offset)
+{
+	struct read_cache *rc = entry->rcache;
+
+	if (rc == NULL)
+		return;
+
+	D_MUTEX_LOCK(&rc->lock);
+	if (rc->len != 0 &&
+	    (offset < rc->start || offset > rc->start + rc->len)) {
+		rc->len = 0;
+		rc->stats.invalidations++;
+	}
+	rc->next = offset;
+	D_MUTEX_UNLOCK(&rc->lock);
+}
+
+/* Read through the per file read cache.  Data in the window is copied out
+ * directly, and a read continuing on from the previous one refills the
+ * window from its offset.  Other reads are sent to the IONSS unchanged,
+ * without holding the cache lock.
+ */
+static ssize_t cached_read(struct fd_entry *entry, char *buff, size_t len,
+			   off_t offset)
+{
+	struct read_cache *rc = entry->rcache;
+	ssize_t bytes_read = 0;
+	ssize_t filled;
+	size_t count;
+	bool uncached = false;
+	bool eof = false;
+	bool miss = false;
+
+	if (rc == NULL || len >= read_cache_size)
+		return pread_rpc(entry, buff, len, offset);
+
+	D_MUTEX_LOCK(&rc->lock);
+
+	while (len > 0) {
+		if (offset >= rc->start && offset < rc->start + rc->len) {
+			count = rc->start + rc->len - offset;
+			if (count > len)
+				count = len;
+			memcpy(buff, rc->buf + (offset - rc->start), count);
+			buff += count;
+			len -= count;
+			offset += count;
+			bytes_read += count;
+			continue;
+		}
+
+		if (eof)
+			break;
+
+		miss = true;
+
+		if (rc->buf == NULL)
+			D_ALLOC(rc->buf, read_cache_size);
+
+		/* Only read ahead for sequential access */
+		if (rc->buf == NULL ||
+		    (offset != rc->next && offset != rc->start + rc->len)) {
+			uncached = true;
+			break;
+		}
+
+		rc->start = offset;
+		rc->len = 0;
+		filled = pread_rpc(entry, rc->buf, read_cache_size, offset);
+		if (filled <= 0) {
+			if (filled < 0 && bytes_read == 0)
+				bytes_read = filled;
+			break;
+		}
+
+		rc->stats.fills++;
+		rc->len = filled;
+		eof = ((size_t)filled < read_cache_size);
+	}
+
+	if (bytes_read >= 0)
+		rc->next = uncached ? offset + len : offset;
+
+	if (miss)
+		rc->stats.misses++;
+	else
+		rc->stats.hits++;
+
+	D_MUTEX_UNLOCK(&rc->lock);
+
+	if (!uncached)
+		return bytes_read;
+
+	filled = pread_rpc(entry, buff, len, offset);
+	if (filled > 0)
+		bytes_read += filled;
+	else if (filled < 0 && bytes_read == 0)
+		bytes_read = filled;
+
+	return bytes_read;
+}
+
+/* Send any buffered data to the IONSS.  Caller holds wc->lock.  Returns
+ * true if anything was written.
+ */
+static bool write_cache_flush_locked(struct write_cache *wc)
+{
+	ssize_t bytes_written;
+	size_t done = 0;
+	int errcode = 0;
+
+	if (wc->len == 0)
+		return false;
+
+	while (done < wc->len) {
+		bytes_written = ioil_do_writex(wc->buf + done, wc->len - done,
+					       wc->start + done, &wc->common,
+					       &errcode);
+		if (bytes_written <= 0) {
+			if (bytes_written == 0)
+				errcode = EIO;
+			IOF_LOG_ERROR("Write-behind of %zu bytes at offset %zd "
+				      "failed: errno %d", wc->len - done,
+				      wc->start + done, errcode);
+			if (wc->error == 0)
+				wc->error = errcode;
+			break;
+		}
+		done += bytes_written;
+	}
+
+	wc->len = 0;
+
+	return true;
+}
+
+/* Flush the write cache.  If report is set any pending error is returned and
+ * cleared, otherwise it is left for a later call.
+ */
+static int write_cache_flush(struct fd_entry *entry, bool report)
+{
+	struct write_cache *wc = entry->wcache;
+	bool flushed;
+	int error = 0;
+
+	if (wc == NULL)
+		return 0;
+
+	D_MUTEX_LOCK(&wc->lock);
+	flushed = write_cache_flush_locked(wc);
+	if (report) {
+		error = wc->error;
+		wc->error = 0;
+	}
+	D_MUTEX_UNLOCK(&wc->lock);
+
+	if (flushed)
+		read_cache_invalidate(entry);
+
+	return error;
+}
+
+static size_t iov_length(const struct iovec *iov, int count)
+{
+	size_t len = 0;
+	int i;
+
+	for (i = 0; i < count; i++)
+		len += iov[i].iov_len;
+
+	return len;
+}
+
+/* Check whether a read of len bytes at offset needs the write cache flushed
+ * first.  With eof set the read came back short, so buffered data anywhere
+ * after it may extend the file.
+ */
+static bool write_cache_overlaps(struct fd_entry *entry, off_t offset,
+				 size_t len, bool eof)
+{
+	struct write_cache *wc = entry->wcache;
+	bool overlap;
+
+	if (wc == NULL)
+		return false;
+
+	D_MUTEX_LOCK(&wc->lock);
+	if (eof)
+		overlap = (wc->len != 0 && wc->start + wc->len > offset);
+	else
+		overlap = (wc->len != 0 && offset + len > wc->start &&
+			   offset < wc->start + wc->len);
+	overlap = overlap || wc->error != 0;
+	D_MUTEX_UNLOCK(&wc->lock);
+
+	return overlap;
+}
+
+/* Write through the write cache.  Data contiguous with the buffer is copied
+ * in and reported as written, anything else flushes the buffer first.
+ * Writes too large for the buffer are sent directly.
+ */
+static ssize_t cached_write(struct fd_entry *entry, const char *buff,
+			    size_t len, off_t offset)
+{
+	struct write_cache *wc = entry->wcache;
+	int error;
+
+	if (wc == NULL)
+		return pwrite_rpc(entry, buff, len, offset);
+
+	D_MUTEX_LOCK(&wc->lock);
+
+	if (wc->len != 0 &&
+	    (offset != wc->start + wc->len || wc->len + len > wc->size))
+		write_cache_flush_locked(wc);
+
+	error = wc->error;
+	wc->error = 0;
+	if (error != 0)
+		goto out;
+
+	if (len >= wc->size) {
+		D_MUTEX_UNLOCK(&wc->lock);
+		return pwrite_rpc(entry, buff, len, offset);
+	}
+
+	if (wc->buf == NULL) {
+		D_ALLOC(wc->buf, wc->size);
+		if (wc->buf == NULL) {
+			D_MUTEX_UNLOCK(&wc->lock);
+			return pwrite_rpc(entry, buff, len, offset);
+		}
+	}
+
+	if (wc->len == 0)
+		wc->start = offset;
+	memcpy(wc->buf + wc->len, buff, len);
+	wc->len += len;
+
+out:
+	D_MUTEX_UNLOCK(&wc->lock);
+
+	if (error != 0) {
+		saved_errno = error;
+		return -1;
+	}
+
+	return len;
+}
+
+/* Flush every write cache, called before the CaRT context goes away */
+static void write_cache_flush_all(void)
+{
+	struct write_cache *wc;
+
+	D_MUTEX_LOCK(&write_caches_lock);
+	d_list_for_each_entry(wc, &write_caches, list) {
+		D_MUTEX_LOCK(&wc->lock);
+		write_cache_flush_locked(wc);
+		D_MUTEX_UNLOCK(&wc->lock);
+	}
+	D_MUTEX_UNLOCK(&write_caches_lock);
+}
+
+/* Read through both caches, flushing buffered writes the read could see */
+static ssize_t ioil_pread(struct fd_entry *entry, char *buff, size_t len,
+			  off_t offset)
+{
+	ssize_t bytes_read;
+	int rc;
+
+	if (write_cache_overlaps(entry, offset, len, false)) {
+		rc = write_cache_flush(entry, true);
+		if (rc != 0)
+			goto err;
+	}
+
+	bytes_read = cached_read(entry, buff, len, offset);
+	if (bytes_read < 0 || bytes_read == len)
+		return bytes_read;
+
+	if (!write_cache_overlaps(entry, offset + bytes_read, 0, true))
+		return bytes_read;
+
+	rc = write_cache_flush(entry, true);
+	if (rc != 0)
+		goto err;
+
+	return cached_read(entry, buff, len, offset);
+err:
+	saved_errno = rc;
+	return -1;
+}
+
+static ssize_t ioil_preadv(struct fd_entry *entry, const struct iovec *iov,
+			   int count, off_t offset)
+{
+	ssize_t bytes_read;
+	size_t len = iov_length(iov, count);
+	int rc;
+
+	if (write_cache_overlaps(entry, offset, len, false)) {
+		rc = write_cache_flush(entry, true);
+		if (rc != 0)
+			goto err;
+	}
+
+	bytes_read = preadv_rpc(entry, iov, count, offset);
+	if (bytes_read < 0 || bytes_read == len)
+		return bytes_read;
+
+	if (!write_cache_overlaps(entry, offset + bytes_read, 0, true))
+		return bytes_read;
+
+	rc = write_cache_flush(entry, true);
+	if (rc != 0)
+		goto err;
+
+	return preadv_rpc(entry, iov, count, offset);
+err:
+	saved_errno = rc;
+	return -1;
+}
+
+static int progress_check_stop(void *arg)
+{
+	return iof_tracker_test(&progress_stop);
+}
+
+static void *progress_thread(void *arg)
+{
+	int rc;
+
+	while (!iof_tracker_test(&progress_stop)) {
+		rc = crt_progress(crt_ctx, IOIL_PROGRESS_TIMEOUT,
+				  progress_check_stop, NULL);
+		if (rc != 0 && rc != -DER_TIMEDOUT)
+			IOF_LOG_ERROR("crt_progress failed rc: %d", rc);
+	}
+
+	return NULL;
+}
+
+/* Only the forking thread exists in the child, so waiters progress the
+ * context inline from iof_fs_wait() rather than waiting on a thread which
+ * is not there.
+ */
+static void progress_postfork_child(void)
+{
+	int i;
+
+	progress_running = false;
+
+	for (i = 0; i < projection_count; i++)
+		projections[i].progress_thread = false;
+}
+
+/* Start the progress thread, on failure the projections are left to make
+ * progress inline from iof_fs_wait().
+ */
+static void start_progress_thread(void)
+{
+	int rc;
+	int i;
+
+	iof_tracker_init(&progress_stop, 1);
+
+	rc = pthread_create(&progress_tid, NULL, progress_thread, NULL);
+	if (rc != 0) {
+		IOF_LOG_ERROR("Could not start progress thread, rc = %d", rc);
+		return;
+	}
+
+	progress_running = true;
+
+	for (i = 0; i < projection_count; i++)
+		projections[i].progress_thread = true;
+
+	pthread_atfork(NULL, NULL, progress_postfork_child);
+}
+
+static void stop_progress_thread(void)
+{
+	if (!progress_running)
+		return;
+
+	iof_tracker_signal(&progress_stop);
+	pthread_join(progress_tid, NULL);
+	progress_running = false;
+}
+
 static pthread_once_t init_links_flag = PTHREAD_ONCE_INIT;
 
 static void init_links(void)
 {
 	FOREACH_INTERCEPT(IOIL_FORWARD_MAP_OR_FAIL);
+	FOREACH_OPTIONAL_INTERCEPT(IOIL_FORWARD_MAP_OPTIONAL);
 }
 
 static __attribute__((constructor)) void ioil_init(void)
 {
 	char *buf;
 	struct rlimit rlimit;
+	int bulk_cache_size;
 	int rc;
 
 	pthread_once(&init_links_flag, init_links);
 
 	iof_log_init();
 
+	buf = getenv("IOIL_READ_CACHE_SIZE");
+	if (buf != NULL) {
+		read_cache_size = strtoul(buf, NULL, 0);
+		IOF_LOG_INFO("Read cache size set to %zu", read_cache_size);
+	}
+
+	buf = getenv("IOIL_WRITE_CACHE_SIZE");
+	if (buf != NULL) {
+		write_cache_size = strtoul(buf, NULL, 0);
+		IOF_LOG_INFO("Write cache size set to %zu", write_cache_size);
+	}
+
+	bulk_cache_size = IOIL_BULK_CACHE_DEFAULT;
+	buf = getenv("IOIL_BULK_CACHE_SIZE");
+	if (buf != NULL) {
+		bulk_cache_size = strtol(buf, NULL, 0);
+		IOF_LOG_INFO("Bulk cache size set to %d", bulk_cache_size);
+	}
+	ioil_bulk_init(bulk_cache_size);
+
+	buf = getenv("IOIL_DIRECT_OPEN");
+	if (buf != NULL) {
+		direct_open = strtol(buf, NULL, 0) != 0;
+		IOF_LOG_INFO("Direct open %s", direct_open ? "on" : "off");
+	}
+
+	buf = getenv("IOIL_STREAM_BYPASS");
+	if (buf != NULL) {
+		stream_bypass = strtol(buf, NULL, 0) != 0;
+		IOF_LOG_INFO("Stream bypass %s", stream_bypass ? "on" : "off");
+	}
+
 	/* Get maximum number of file descriptors */
 	rc = getrlimit(RLIMIT_NOFILE, &rlimit);
 	if (rc != 0) {
@@ -392,6 +1017,32 @@ static __attribute__((constructor)) void ioil_init(void)
 		return;
 	}
 
+	/* Started before direct open is set up so that the child fork handler
+	 * runs first, and the direct fds are reopened with inline progress.
+	 */
+	start_progress_thread();
+
+	/* The metadata RPCs are needed for copy_file_range() even if files
+	 * are opened through the kernel.
+	 */
+	rc = iof_write_register(&md_proto, NULL);
+	if (rc == 0)
+		ioil_direct_proto(md_proto);
+	else
+		IOF_LOG_ERROR("Could not register metadata RPCs, rc = %d", rc);
+
+	if (direct_open) {
+		if (rc == 0)
+			rc = ioil_direct_init(projections, projection_count);
+		if (rc != 0) {
+			IOF_LOG_ERROR("Could not set up direct open, rc = %d",
+				      rc);
+			direct_open = false;
+		} else {
+			pthread_atfork(NULL, NULL, direct_fd_postfork_child);
+		}
+	}
+
 	IOF_LOG_INFO("Using IONSS: cnss_prefix at %s, cnss_id is %d",
 		     cnss_prefix, cnss_id);
 
@@ -403,6 +1054,11 @@ static __attribute__((constructor)) void ioil_init(void)
 static __attribute__((destructor)) void ioil_fini(void)
 {
 	if (ioil_initialized) {
+		ioil_map_fini();
+		write_cache_flush_all();
+		ioil_bulk_fini();
+		ioil_direct_fini();
+		stop_progress_thread();
 		crt_group_detach(ionss_grp.dest_grp);
 		crt_context_destroy(crt_ctx, 0);
 		crt_finalize();
@@ -418,56 +1074,250 @@ static __attribute__((destructor)) void ioil_fini(void)
 	vector_destroy(&fd_table);
 }
 
-static bool check_ioctl_on_open(int fd, struct fd_entry *entry, int flags,
-				int status)
+/* Add an entry for a file in the fd table and enable kernel bypass for it.
+ * Returns 0 on success, otherwise bypass is disabled for the entry.
+ */
+static int track_fd(int fd, struct fd_entry *entry, int flags)
 {
-	struct iof_gah_info gah_info;
 	int rc;
 
-	if (fd == -1)
-		return false;
-
-	rc = ioctl(fd, IOF_IOCTL_GAH, &gah_info);
-	if (rc != 0)
-		return false;
-
-	if (gah_info.version != IOF_IOCTL_VERSION) {
-		IOF_LOG_INFO("IOF ioctl version mismatch (fd=%d): expected %d "
-			     "got %d", fd, IOF_IOCTL_VERSION, gah_info.version);
-		return false;
-	}
-
-	if (gah_info.cnss_id != cnss_id) {
+	entry->pos = 0;
+	entry->flags = flags;
+	entry->status = IOF_IO_BYPASS;
+	entry->rcache = NULL;
+	entry->wcache = NULL;
+	if (read_cache_size != 0 && (flags & O_ACCMODE) != O_WRONLY)
+		entry->rcache = read_cache_alloc();
+	if (write_cache_size != 0 && (flags & O_ACCMODE) != O_RDONLY)
+		entry->wcache = write_cache_alloc(&entry->common);
+	rc = vector_set(&fd_table, fd, entry);
+	if (rc != 0) {
+		IOF_LOG_INFO("Failed to track IOF file fd=%d." GAH_PRINT_STR
+			     ", disabling kernel bypass",
+			     fd, GAH_PRINT_VAL(entry->common.gah));
+		read_cache_free(entry->rcache);
+		entry->rcache = NULL;
+		write_cache_free(entry->wcache);
+		entry->wcache = NULL;
+		/* Disable kernel bypass */
+		entry->status = IOF_IO_DIS_RSRC;
+	}
+	return rc;
+}
+
+/* Read the GAH of an fd opened through the CNSS with an ioctl */
+static bool read_gah_info(int fd, struct iof_gah_info *gah_info)
+{
+	int rc;
+
+	rc = ioctl(fd, IOF_IOCTL_GAH, gah_info);
+	if (rc != 0)
+		return false;
+
+	if (gah_info->version != IOF_IOCTL_VERSION) {
+		IOF_LOG_INFO("IOF ioctl version mismatch (fd=%d): expected %d "
+			     "got %d", fd, IOF_IOCTL_VERSION,
+			     gah_info->version);
+		return false;
+	}
+
+	if (gah_info->cnss_id != cnss_id) {
 		IOF_LOG_INFO("IOF ioctl (fd=%d) received from another CNSS: "
 			     "expected %d got %d", fd, cnss_id,
-			     gah_info.cnss_id);
+			     gah_info->cnss_id);
 		return false;
 	}
 
+	return true;
+}
+
+static bool check_ioctl_on_open(int fd, struct fd_entry *entry, int flags,
+				int status)
+{
+	struct iof_gah_info gah_info;
+
+	if (fd == -1)
+		return false;
+
+	if (!read_gah_info(fd, &gah_info))
+		return false;
+
 	IOF_LOG_INFO("IOF file opened fd=%d." GAH_PRINT_STR ", bypass=%s",
 		     fd, GAH_PRINT_VAL(gah_info.gah), bypass_status[status]);
 	entry->common.gah = gah_info.gah;
 	entry->common.projection = &projections[gah_info.cli_fs_id];
 	entry->common.ep = entry->common.projection->grp->psr_ep;
-	entry->pos = 0;
-	entry->flags = flags;
-	entry->status = IOF_IO_BYPASS;
-	rc = vector_set(&fd_table, fd, entry);
+
+	track_fd(fd, entry, flags);
+
+	return true;
+}
+
+/* Replace the O_PATH placeholder behind a directly opened fd with the file
+ * opened through the kernel, for calls that are passed on to it.
+ */
+static void kernel_fd_upgrade(int fd, struct fd_entry *entry)
+{
+	char path[32];
+	int flags;
+	int newfd;
+
+	if (entry->direct == NULL)
+		return;
+
+	flags = __real_fcntl(fd, F_GETFL, 0);
+	if (flags == -1 || !(flags & O_PATH))
+		return;
+
+	snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+	newfd = __real_open(path, entry->flags &
+			    ~(O_CREAT | O_EXCL | O_TRUNC | O_CLOEXEC));
+	if (newfd == -1) {
+		IOF_LOG_ERROR("Could not reopen fd=%d." GAH_PRINT_STR
+			      ", errno = %d", fd,
+			      GAH_PRINT_VAL(entry->common.gah), errno);
+		return;
+	}
+
+	if (entry->pos != 0)
+		__real_lseek(newfd, entry->pos, SEEK_SET);
+
+	flags = __real_fcntl(fd, F_GETFD, 0);
+	dup3(newfd, fd, (flags != -1 && (flags & FD_CLOEXEC)) ? O_CLOEXEC : 0);
+	__real_close(newfd);
+
+	IOF_LOG_INFO("Reopened fd=%d." GAH_PRINT_STR " through the kernel", fd,
+		     GAH_PRINT_VAL(entry->common.gah));
+}
+
+/* Open a file with an RPC rather than through the kernel.  Returns false if
+ * it should be opened normally, otherwise fdp is set to the new fd or to -1
+ * with errno set.
+ */
+static bool open_direct(const char *pathname, int flags, mode_t mode,
+			int *fdp)
+{
+	struct fd_entry entry = {0};
+	void *handle;
+	int fd;
+	int rc;
+
+	if (!direct_open || (flags & IOIL_DIRECT_OPEN_UNSUPPORTED) != 0)
+		return false;
+
+	rc = ioil_direct_open(pathname, flags & ~O_CLOEXEC, mode,
+			      &entry.common, &handle);
+	if (rc == ENOTSUP)
+		return false;
+
 	if (rc != 0) {
-		IOF_LOG_INFO("Failed to track IOF file fd=%d." GAH_PRINT_STR
-			     ", disabling kernel bypass",
-			     rc, GAH_PRINT_VAL(gah_info.gah));
-		/* Disable kernel bypass */
-		entry->status = IOF_IO_DIS_RSRC;
+		*fdp = -1;
+		errno = rc;
+		return true;
+	}
+
+	/* dup(), fork() and close() work on the placeholder fd returned,
+	 * which the kernel opens without sending an open to the CNSS.
+	 */
+	fd = __real_open(pathname, O_PATH | (flags & O_CLOEXEC));
+	if (fd == -1) {
+		rc = errno;
+		ioil_direct_close(handle);
+		*fdp = -1;
+		errno = rc;
+		return true;
+	}
+
+	entry.direct = handle;
+	rc = track_fd(fd, &entry, flags);
+	if (rc != 0) {
+		kernel_fd_upgrade(fd, &entry);
+		ioil_direct_close(handle);
 	}
+
+	IOF_LOG_INFO("open(pathname=%s, flags=0%o, mode=0%o) = %d."
+		     GAH_PRINT_STR " opened directly, bypass=%s", pathname,
+		     flags, mode, fd, GAH_PRINT_VAL(entry.common.gah),
+		     bypass_status[entry.status]);
+
+	*fdp = fd;
 	return true;
 }
 
-static bool drop_reference_if_disabled(struct fd_entry *entry)
+/* The parent closes the GAH of a directly opened file when it closes its
+ * fd, so a forked child switches each of them to a file opened through the
+ * kernel, with a GAH of its own.
+ */
+static void direct_fd_postfork_child(void)
+{
+	struct iof_gah_info gah_info;
+	struct fd_entry *entry;
+	struct dirent *dirent;
+	DIR *dir;
+	int pass;
+	int fd;
+	int rc;
+
+	dir = opendir("/proc/self/fd");
+	if (dir == NULL) {
+		IOF_LOG_ERROR("Could not list fds after fork, errno = %d",
+			      errno);
+		return;
+	}
+
+	/* Entries are shared by dup()ed fds, so every fd is upgraded before
+	 * any entry forgets its direct handle.
+	 */
+	for (pass = 0; pass < 2; pass++) {
+		rewinddir(dir);
+		while ((dirent = readdir(dir)) != NULL) {
+			if (dirent->d_name[0] == '.')
+				continue;
+			fd = atoi(dirent->d_name);
+			if (fd == dirfd(dir))
+				continue;
+
+			rc = vector_get(&fd_table, fd, &entry);
+			if (rc != 0)
+				continue;
+
+			if (entry->direct == NULL) {
+				vector_decref(&fd_table, entry);
+				continue;
+			}
+
+			if (pass == 0) {
+				kernel_fd_upgrade(fd, entry);
+				vector_decref(&fd_table, entry);
+				continue;
+			}
+
+			/* Frees the handle without closing the GAH */
+			ioil_direct_close(entry->direct);
+			entry->direct = NULL;
+
+			if (read_gah_info(fd, &gah_info)) {
+				entry->common.gah = gah_info.gah;
+			} else {
+				IOF_LOG_INFO("No GAH for fd=%d after fork, "
+					     "disabling kernel bypass", fd);
+				entry->status = IOF_IO_DIS_FLAG;
+			}
+			vector_decref(&fd_table, entry);
+		}
+	}
+
+	closedir(dir);
+}
+
+static bool drop_reference_if_disabled(int fd, struct fd_entry *entry)
 {
 	if (entry->status == IOF_IO_BYPASS)
 		return false;
 
+	/* The call is passed on to the kernel, which needs a real file */
+	kernel_fd_upgrade(fd, entry);
+
 	vector_decref(&fd_table, entry);
 
 	return true;
@@ -488,13 +1338,18 @@ IOF_PUBLIC int iof_open(const char *pathname, int flags, ...)
 		va_start(ap, flags);
 		mode = va_arg(ap, unsigned int);
 		va_end(ap);
-
-		fd = __real_open(pathname, flags, mode);
 	} else {
-		fd =  __real_open(pathname, flags);
 		mode = 0;
 	}
 
+	if (ioil_initialized && open_direct(pathname, flags, mode, &fd))
+		return fd;
+
+	if (flags & O_CREAT)
+		fd = __real_open(pathname, flags, mode);
+	else
+		fd =  __real_open(pathname, flags);
+
 	if (!ioil_initialized || (fd == -1))
 		return fd;
 
@@ -549,6 +1404,7 @@ finish:
 IOF_PUBLIC int iof_close(int fd)
 {
 	struct fd_entry *entry;
+	int error;
 	int rc;
 
 	rc = vector_remove(&fd_table, fd, &entry);
@@ -560,8 +1416,16 @@ IOF_PUBLIC int iof_close(int fd)
 		     fd, GAH_PRINT_VAL(entry->common.gah),
 		     bypass_status[entry->status]);
 
+	error = write_cache_flush(entry, true);
+
 	vector_decref(&fd_table, entry);
 
+	if (error != 0) {
+		__real_close(fd);
+		errno = error;
+		return -1;
+	}
+
 do_real_close:
 	return __real_close(fd);
 }
@@ -583,11 +1447,11 @@ IOF_PUBLIC ssize_t iof_read(int fd, void *buf, size_t len)
 		     buf, len,
 		     bypass_status[entry->status]);
 
-	if (drop_reference_if_disabled(entry))
+	if (drop_reference_if_disabled(fd, entry))
 		goto do_real_read;
 
 	oldpos = entry->pos;
-	bytes_read = pread_rpc(entry, buf, len, oldpos);
+	bytes_read = ioil_pread(entry, buf, len, oldpos);
 	if (bytes_read > 0)
 		entry->pos = oldpos + bytes_read;
 	vector_decref(&fd_table, entry);
@@ -615,10 +1479,10 @@ IOF_PUBLIC ssize_t iof_pread(int fd, void *buf, size_t count, off_t offset)
 		     GAH_PRINT_VAL(entry->common.gah), buf, count, offset,
 		     bypass_status[entry->status]);
 
-	if (drop_reference_if_disabled(entry))
+	if (drop_reference_if_disabled(fd, entry))
 		goto do_real_pread;
 
-	bytes_read = pread_rpc(entry, buf, count, offset);
+	bytes_read = ioil_pread(entry, buf, count, offset);
 
 	vector_decref(&fd_table, entry);
 
@@ -646,13 +1510,14 @@ IOF_PUBLIC ssize_t iof_write(int fd, const void *buf, size_t len)
 		     GAH_PRINT_VAL(entry->common.gah), buf, len,
 		     bypass_status[entry->status]);
 
-	if (drop_reference_if_disabled(entry))
+	if (drop_reference_if_disabled(fd, entry))
 		goto do_real_write;
 
 	oldpos = entry->pos;
-	bytes_written = pwrite_rpc(entry, buf, len, entry->pos);
+	bytes_written = cached_write(entry, buf, len, oldpos);
 	if (bytes_written > 0)
 		entry->pos = oldpos + bytes_written;
+	read_cache_invalidate(entry);
 	vector_decref(&fd_table, entry);
 
 	RESTORE_ERRNO(bytes_written < 0);
@@ -679,10 +1544,11 @@ IOF_PUBLIC ssize_t iof_pwrite(int fd, const void *buf, size_t count,
 		     GAH_PRINT_VAL(entry->common.gah), buf, count, offset,
 		     bypass_status[entry->status]);
 
-	if (drop_reference_if_disabled(entry))
+	if (drop_reference_if_disabled(fd, entry))
 		goto do_real_pwrite;
 
-	bytes_written = pwrite_rpc(entry, buf, count, offset);
+	bytes_written = cached_write(entry, buf, count, offset);
+	read_cache_invalidate(entry);
 
 	vector_decref(&fd_table, entry);
 
@@ -709,20 +1575,38 @@ IOF_PUBLIC off_t iof_lseek(int fd, off_t offset, int whence)
 		     GAH_PRINT_VAL(entry->common.gah), offset, whence,
 		     bypass_status[entry->status]);
 
-	if (drop_reference_if_disabled(entry))
+	if (drop_reference_if_disabled(fd, entry))
 		goto do_real_lseek;
 
+	/* Buffered data may extend the file, and a later write elsewhere
+	 * could not be coalesced with it anyway.
+	 */
+	if (whence != SEEK_CUR || offset != 0)
+		write_cache_flush(entry, false);
+
 	if (whence == SEEK_SET) {
 		new_offset = offset;
 	} else if (whence == SEEK_CUR) {
 		new_offset = entry->pos + offset;
+	} else if (whence == SEEK_END && entry->direct != NULL) {
+		struct stat stat;
+
+		rc = ioil_direct_getattr(&entry->common, &stat);
+		if (rc != 0) {
+			errno = rc;
+			goto cleanup;
+		}
+		new_offset = stat.st_size + offset;
 	} else {
 		/* Let the system handle SEEK_END as well as non-standard
 		 * values such as SEEK_DATA and SEEK_HOLE
 		 */
+		kernel_fd_upgrade(fd, entry);
 		new_offset = __real_lseek(fd, offset, whence);
-		if (new_offset >= 0)
+		if (new_offset >= 0) {
 			entry->pos = new_offset;
+			read_cache_seek(entry, new_offset);
+		}
 		goto cleanup;
 	}
 
@@ -731,6 +1615,7 @@ IOF_PUBLIC off_t iof_lseek(int fd, off_t offset, int whence)
 		errno = EINVAL;
 	} else {
 		entry->pos = new_offset;
+		read_cache_seek(entry, new_offset);
 	}
 
 cleanup:
@@ -763,11 +1648,11 @@ IOF_PUBLIC ssize_t iof_readv(int fd, const struct iovec *vector, int iovcnt)
 		     GAH_PRINT_VAL(entry->common.gah), vector, iovcnt,
 		     bypass_status[entry->status]);
 
-	if (drop_reference_if_disabled(entry))
+	if (drop_reference_if_disabled(fd, entry))
 		goto do_real_readv;
 
 	oldpos = entry->pos;
-	bytes_read = preadv_rpc(entry, vector, iovcnt, entry->pos);
+	bytes_read = ioil_preadv(entry, vector, iovcnt, oldpos);
 	if (bytes_read > 0)
 		entry->pos = oldpos + bytes_read;
 	vector_decref(&fd_table, entry);
@@ -796,10 +1681,10 @@ IOF_PUBLIC ssize_t iof_preadv(int fd, const struct iovec *vector, int iovcnt,
 		     GAH_PRINT_VAL(entry->common.gah), vector, iovcnt, offset,
 		     bypass_status[entry->status]);
 
-	if (drop_reference_if_disabled(entry))
+	if (drop_reference_if_disabled(fd, entry))
 		goto do_real_preadv;
 
-	bytes_read = preadv_rpc(entry, vector, iovcnt, offset);
+	bytes_read = ioil_preadv(entry, vector, iovcnt, offset);
 	vector_decref(&fd_table, entry);
 
 	RESTORE_ERRNO(bytes_read < 0);
@@ -826,13 +1711,20 @@ IOF_PUBLIC ssize_t iof_writev(int fd, const struct iovec *vector, int iovcnt)
 		     GAH_PRINT_VAL(entry->common.gah), vector, iovcnt,
 		     bypass_status[entry->status]);
 
-	if (drop_reference_if_disabled(entry))
+	if (drop_reference_if_disabled(fd, entry))
 		goto do_real_writev;
 
 	oldpos = entry->pos;
-	bytes_written = pwritev_rpc(entry, vector, iovcnt, entry->pos);
+	rc = write_cache_flush(entry, true);
+	if (rc != 0) {
+		saved_errno = rc;
+		bytes_written = -1;
+	} else {
+		bytes_written = pwritev_rpc(entry, vector, iovcnt, oldpos);
+	}
 	if (bytes_written > 0)
 		entry->pos = oldpos + bytes_written;
+	read_cache_invalidate(entry);
 	vector_decref(&fd_table, entry);
 
 	RESTORE_ERRNO(bytes_written < 0);
@@ -859,10 +1751,17 @@ IOF_PUBLIC ssize_t iof_pwritev(int fd, const struct iovec *vector, int iovcnt,
 		     GAH_PRINT_VAL(entry->common.gah), vector, iovcnt, offset,
 		     bypass_status[entry->status]);
 
-	if (drop_reference_if_disabled(entry))
+	if (drop_reference_if_disabled(fd, entry))
 		goto do_real_pwritev;
 
-	bytes_written = pwritev_rpc(entry, vector, iovcnt, offset);
+	rc = write_cache_flush(entry, true);
+	if (rc != 0) {
+		saved_errno = rc;
+		bytes_written = -1;
+	} else {
+		bytes_written = pwritev_rpc(entry, vector, iovcnt, offset);
+	}
+	read_cache_invalidate(entry);
 
 	vector_decref(&fd_table, entry);
 
@@ -874,20 +1773,83 @@ do_real_pwritev:
 	return __real_pwritev(fd, vector, iovcnt, offset);
 }
 
+/* Map a read-only private range as anonymous memory filled on demand over
+ * RPC.  Returns MAP_FAILED if the mapping has to go through the kernel.
+ */
+static void *map_bypass(struct fd_entry *entry, void *address, size_t length,
+			int prot, int flags, int fd, off_t offset)
+{
+	void *addr;
+	int mapfd;
+	int rc;
+
+	if (entry->status != IOF_IO_BYPASS || length == 0 ||
+	    (flags & MAP_TYPE) != MAP_PRIVATE || (prot & PROT_WRITE))
+		return MAP_FAILED;
+
+	/* Holding the placeholder fd would not keep a directly opened file
+	 * open on the IONSS.
+	 */
+	if (entry->direct != NULL)
+		return MAP_FAILED;
+
+	/* Keep the file open for as long as it is mapped */
+	mapfd = __real_fcntl(fd, F_DUPFD_CLOEXEC, 0);
+	if (mapfd == -1)
+		return MAP_FAILED;
+
+	addr = __real_mmap(address, length, prot,
+			   (flags & ~MAP_POPULATE) | MAP_ANONYMOUS, -1, 0);
+	if (addr == MAP_FAILED) {
+		__real_close(mapfd);
+		return MAP_FAILED;
+	}
+
+	write_cache_flush(entry, false);
+
+	rc = ioil_map_register(addr, length, offset, mapfd, prot,
+			       &entry->common);
+	if (rc != 0) {
+		__real_munmap(addr, length);
+		__real_close(mapfd);
+		return MAP_FAILED;
+	}
+
+	return addr;
+}
+
 IOF_PUBLIC void *iof_mmap(void *address, size_t length, int prot, int flags,
 			  int fd, off_t offset)
 {
 	struct fd_entry *entry;
+	void *addr;
 	int rc;
 
 	rc = vector_get(&fd_table, fd, &entry);
 	if (rc == 0) {
+		addr = map_bypass(entry, address, length, prot, flags, fd,
+				  offset);
+		if (addr != MAP_FAILED) {
+			IOF_LOG_INFO("mmap(address=%p, length=%zu, prot=%d, "
+				     "flags=%d, fd=%d." GAH_PRINT_STR
+				     ", offset=%zd) = %p intercepted, "
+				     "bypass=%s", address, length, prot,
+				     flags, fd,
+				     GAH_PRINT_VAL(entry->common.gah),
+				     offset, addr,
+				     bypass_status[entry->status]);
+			vector_decref(&fd_table, entry);
+			return addr;
+		}
+
 		IOF_LOG_INFO("mmap(address=%p, length=%zu, prot=%d, flags=%d,"
 			     " fd=%d." GAH_PRINT_STR ", offset=%zd) "
 			     "intercepted, disabling kernel bypass ", address,
 			     length, prot, flags, fd,
 			     GAH_PRINT_VAL(entry->common.gah), offset);
 
+		write_cache_flush(entry, false);
+		kernel_fd_upgrade(fd, entry);
 		if (entry->pos != 0)
 			__real_lseek(fd, entry->pos, SEEK_SET);
 		/* Disable kernel bypass */
@@ -899,9 +1861,89 @@ IOF_PUBLIC void *iof_mmap(void *address, size_t length, int prot, int flags,
 	return __real_mmap(address, length, prot, flags, fd, offset);
 }
 
+IOF_PUBLIC int iof_munmap(void *address, size_t length)
+{
+	int rc;
+	int fd;
+
+	if (ioil_initialized)
+		ioil_bulk_invalidate(address, length);
+
+	rc = __real_munmap(address, length);
+	if (rc != 0 || !ioil_initialized)
+		return rc;
+
+	while ((fd = ioil_map_remove(address, length)) != -1) {
+		IOF_LOG_INFO("munmap(address=%p, length=%zu) intercepted, "
+			     "closing fd=%d", address, length, fd);
+		__real_close(fd);
+	}
+
+	return rc;
+}
+
+/* The glibc allocator, which serves calls made by dlsym() while the real
+ * free() and realloc() are being looked up.
+ */
+extern void __libc_free(void *ptr);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+#ifdef IOIL_PRELOAD
+/* free() and realloc() are called before ioil_init() and by dlsym() while
+ * the real functions are looked up, so map them on first use.
+ */
+static __thread bool in_alloc_lookup;
+
+static bool map_alloc_funcs(void)
+{
+	if (__real_free != NULL && __real_realloc != NULL)
+		return true;
+
+	if (in_alloc_lookup)
+		return false;
+
+	in_alloc_lookup = true;
+	IOIL_FORWARD_MAP_OR_FAIL(void, free, (void *));
+	IOIL_FORWARD_MAP_OR_FAIL(void *, realloc, (void *, size_t));
+	in_alloc_lookup = false;
+
+	return true;
+}
+#else
+#define map_alloc_funcs() true
+#endif
+
+/* Memory released to the allocator may be unmapped or trimmed from the
+ * heap, so drop any bulk handle registered over it.
+ */
+IOF_PUBLIC void iof_free(void *ptr)
+{
+	if (!map_alloc_funcs()) {
+		__libc_free(ptr);
+		return;
+	}
+
+	if (ptr != NULL && !ioil_bulk_empty())
+		ioil_bulk_invalidate(ptr, malloc_usable_size(ptr));
+
+	__real_free(ptr);
+}
+
+IOF_PUBLIC void *iof_realloc(void *ptr, size_t size)
+{
+	if (!map_alloc_funcs())
+		return __libc_realloc(ptr, size);
+
+	if (ptr != NULL && !ioil_bulk_empty())
+		ioil_bulk_invalidate(ptr, malloc_usable_size(ptr));
+
+	return __real_realloc(ptr, size);
+}
+
 IOF_PUBLIC int iof_fsync(int fd)
 {
 	struct fd_entry *entry;
+	bool direct;
 	int rc;
 
 	rc = vector_get(&fd_table, fd, &entry);
@@ -912,8 +1954,23 @@ IOF_PUBLIC int iof_fsync(int fd)
 		     fd, GAH_PRINT_VAL(entry->common.gah),
 		     bypass_status[entry->status]);
 
+	rc = write_cache_flush(entry, true);
+
+	/* A directly opened file is synced on the IONSS */
+	direct = (entry->direct != NULL);
+	if (rc == 0 && direct)
+		rc = ioil_direct_fsync(&entry->common, false);
+
 	vector_decref(&fd_table, entry);
 
+	if (rc != 0) {
+		errno = rc;
+		return -1;
+	}
+
+	if (direct)
+		return 0;
+
 do_real_fsync:
 	return __real_fsync(fd);
 }
@@ -921,6 +1978,7 @@ do_real_fsync:
 IOF_PUBLIC int iof_fdatasync(int fd)
 {
 	struct fd_entry *entry;
+	bool direct;
 	int rc;
 
 	rc = vector_get(&fd_table, fd, &entry);
@@ -931,12 +1989,243 @@ IOF_PUBLIC int iof_fdatasync(int fd)
 		     "bypass=%s", fd, GAH_PRINT_VAL(entry->common.gah),
 		     bypass_status[entry->status]);
 
+	rc = write_cache_flush(entry, true);
+
+	/* A directly opened file is synced on the IONSS */
+	direct = (entry->direct != NULL);
+	if (rc == 0 && direct)
+		rc = ioil_direct_fsync(&entry->common, true);
+
 	vector_decref(&fd_table, entry);
 
+	if (rc != 0) {
+		errno = rc;
+		return -1;
+	}
+
+	if (direct)
+		return 0;
+
 do_real_fdatasync:
 	return __real_fdatasync(fd);
 }
 
+/* Send buffered writes for an fd before a call which the kernel handles on
+ * its own.  If the call changes the file, cached data is discarded and a
+ * directly opened fd is replaced with a real file for the kernel to use.
+ */
+static void kernel_fd_sync(int fd, bool modify)
+{
+	struct fd_entry *entry;
+	int rc;
+
+	rc = vector_get(&fd_table, fd, &entry);
+	if (rc != 0)
+		return;
+
+	write_cache_flush(entry, false);
+	if (modify) {
+		read_cache_invalidate(entry);
+		kernel_fd_upgrade(fd, entry);
+	}
+
+	vector_decref(&fd_table, entry);
+}
+
+IOF_PUBLIC int iof_ftruncate(int fd, off_t length)
+{
+	kernel_fd_sync(fd, true);
+
+	return __real_ftruncate(fd, length);
+}
+
+IOF_PUBLIC int iof_fallocate(int fd, int mode, off_t offset, off_t len)
+{
+	kernel_fd_sync(fd, true);
+
+	return __real_fallocate(fd, mode, offset, len);
+}
+
+IOF_PUBLIC int iof_posix_fallocate(int fd, off_t offset, off_t len)
+{
+	kernel_fd_sync(fd, true);
+
+	return __real_posix_fallocate(fd, offset, len);
+}
+
+IOF_PUBLIC int iof_fstat(int fd, struct stat *buf)
+{
+	kernel_fd_sync(fd, false);
+
+	if (__real_fstat != NULL)
+		return __real_fstat(fd, buf);
+
+	return syscall(SYS_fstat, fd, buf);
+}
+
+IOF_PUBLIC int iof_fstat64(int fd, struct stat64 *buf)
+{
+	kernel_fd_sync(fd, false);
+
+	if (__real_fstat64 != NULL)
+		return __real_fstat64(fd, buf);
+
+	return syscall(SYS_fstat, fd, buf);
+}
+
+IOF_PUBLIC int iof___fxstat(int ver, int fd, struct stat *buf)
+{
+	kernel_fd_sync(fd, false);
+
+	if (__real___fxstat != NULL)
+		return __real___fxstat(ver, fd, buf);
+
+	return syscall(SYS_fstat, fd, buf);
+}
+
+IOF_PUBLIC int iof___fxstat64(int ver, int fd, struct stat64 *buf)
+{
+	kernel_fd_sync(fd, false);
+
+	if (__real___fxstat64 != NULL)
+		return __real___fxstat64(ver, fd, buf);
+
+	return syscall(SYS_fstat, fd, buf);
+}
+
+static ssize_t real_copy_file_range(int fd_in, loff_t *off_in, int fd_out,
+				    loff_t *off_out, size_t len,
+				    unsigned int flags)
+{
+	if (__real_copy_file_range != NULL)
+		return __real_copy_file_range(fd_in, off_in, fd_out, off_out,
+					      len, flags);
+
+#ifdef SYS_copy_file_range
+	return syscall(SYS_copy_file_range, fd_in, off_in, fd_out, off_out,
+		       len, flags);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+/* Check if a copy between two intercepted files can be done on the IONSS.
+ * Anything the kernel would reject is left for it to report.
+ */
+static bool copy_on_ionss(struct fd_entry *src, struct fd_entry *dst,
+			  unsigned int flags)
+{
+	if (src == NULL || dst == NULL || flags != 0)
+		return false;
+
+	if (src->status != IOF_IO_BYPASS || dst->status != IOF_IO_BYPASS)
+		return false;
+
+	if ((src->flags & O_ACCMODE) == O_WRONLY ||
+	    (dst->flags & O_ACCMODE) == O_RDONLY ||
+	    (dst->flags & O_APPEND))
+		return false;
+
+	/* Both GAHs have to be open on the same rank */
+	return src->common.projection == dst->common.projection &&
+	       src->common.gah.root == dst->common.gah.root;
+}
+
+IOF_PUBLIC ssize_t iof_copy_file_range(int fd_in, loff_t *off_in, int fd_out,
+				       loff_t *off_out, size_t len,
+				       unsigned int flags)
+{
+	struct fd_entry *src = NULL;
+	struct fd_entry *dst = NULL;
+	loff_t *src_off = off_in;
+	loff_t *dst_off = off_out;
+	loff_t src_pos = 0;
+	loff_t dst_pos = 0;
+	size_t copied;
+	ssize_t bytes = -1;
+	int rc;
+
+	if (vector_get(&fd_table, fd_in, &src) != 0)
+		src = NULL;
+	if (vector_get(&fd_table, fd_out, &dst) != 0)
+		dst = NULL;
+
+	if (src == NULL && dst == NULL)
+		return real_copy_file_range(fd_in, off_in, fd_out, off_out,
+					    len, flags);
+
+	IOF_LOG_INFO("copy_file_range(fd_in=%d, fd_out=%d, len=%zu, "
+		     "flags=%#x) intercepted, bypass=%s/%s", fd_in, fd_out,
+		     len, flags,
+		     src ? bypass_status[src->status] : "none",
+		     dst ? bypass_status[dst->status] : "none");
+
+	/* The positions of intercepted files are kept here rather than in
+	 * the kernel.
+	 */
+	if (src != NULL && off_in == NULL) {
+		src_pos = src->pos;
+		src_off = &src_pos;
+	}
+	if (dst != NULL && off_out == NULL) {
+		dst_pos = dst->pos;
+		dst_off = &dst_pos;
+	}
+
+	/* Cached writes must reach the IONSS before the copy, any error is
+	 * left to be reported by a later call.
+	 */
+	if (src != NULL)
+		write_cache_flush(src, false);
+	if (dst != NULL)
+		write_cache_flush(dst, false);
+
+	rc = EXDEV;
+	if (copy_on_ionss(src, dst, flags)) {
+		rc = ioil_direct_copy(&src->common, *src_off, &dst->common,
+				      *dst_off, len, &copied);
+		if (rc == 0) {
+			*src_off += copied;
+			*dst_off += copied;
+			bytes = copied;
+		} else {
+			saved_errno = rc;
+			bytes = -1;
+		}
+	}
+
+	/* Otherwise let the kernel copy the data, or report why it can't */
+	if (rc == EXDEV) {
+		if (src != NULL)
+			kernel_fd_upgrade(fd_in, src);
+		if (dst != NULL)
+			kernel_fd_upgrade(fd_out, dst);
+		bytes = real_copy_file_range(fd_in, src_off, fd_out, dst_off,
+					     len, flags);
+		if (bytes < 0)
+			saved_errno = errno;
+	}
+
+	if (bytes > 0 && dst != NULL)
+		read_cache_invalidate(dst);
+
+	if (src != NULL) {
+		if (off_in == NULL)
+			src->pos = src_pos;
+		vector_decref(&fd_table, src);
+	}
+	if (dst != NULL) {
+		if (off_out == NULL)
+			dst->pos = dst_pos;
+		vector_decref(&fd_table, dst);
+	}
+
+	RESTORE_ERRNO(bytes < 0);
+
+	return bytes;
+}
+
 IOF_PUBLIC int iof_dup(int oldfd)
 {
 	struct fd_entry *entry = NULL;
@@ -952,6 +2241,7 @@ IOF_PUBLIC int iof_dup(int oldfd)
 			     " intercepted, bypass=%s", oldfd, newfd,
 			     GAH_PRINT_VAL(entry->common.gah),
 			     bypass_status[entry->status]);
+		write_cache_flush(entry, false);
 		vector_decref(&fd_table, entry);
 	}
 
@@ -973,23 +2263,200 @@ IOF_PUBLIC int iof_dup2(int oldfd, int newfd)
 			     " intercepted, bypass=%s", oldfd, newfd,
 			     realfd, GAH_PRINT_VAL(entry->common.gah),
 			     bypass_status[entry->status]);
+		write_cache_flush(entry, false);
 		vector_decref(&fd_table, entry);
 	}
 
 	return realfd;
 }
 
+/* State behind a FILE created with fopencookie() over a bypassed fd */
+struct ioil_stream {
+	int fd;
+	char *buf;	/* stdio buffer, sized to the projection */
+};
+
+static ssize_t stream_read(void *cookie, char *buf, size_t size)
+{
+	struct ioil_stream *stream = cookie;
+
+	return iof_read(stream->fd, buf, size);
+}
+
+static ssize_t stream_write(void *cookie, const char *buf, size_t size)
+{
+	struct ioil_stream *stream = cookie;
+	ssize_t bytes_written;
+
+	bytes_written = iof_write(stream->fd, buf, size);
+
+	/* stdio expects 0, not -1, on error */
+	if (bytes_written < 0)
+		return 0;
+
+	return bytes_written;
+}
+
+static int stream_seek(void *cookie, off64_t *offset, int whence)
+{
+	struct ioil_stream *stream = cookie;
+	off_t new_offset;
+
+	new_offset = iof_lseek(stream->fd, *offset, whence);
+	if (new_offset < 0)
+		return -1;
+
+	*offset = new_offset;
+
+	return 0;
+}
+
+static int stream_close(void *cookie)
+{
+	struct ioil_stream *stream = cookie;
+	int rc;
+
+	rc = iof_close(stream->fd);
+
+	SAVE_ERRNO(rc != 0);
+
+	D_FREE(stream->buf);
+	D_FREE(stream);
+
+	RESTORE_ERRNO(rc != 0);
+
+	return rc;
+}
+
+static const cookie_io_functions_t stream_funcs = {
+	.read = stream_read,
+	.write = stream_write,
+	.seek = stream_seek,
+	.close = stream_close,
+};
+
+/* Translate an fopen() mode string to open() flags.  Returns -1 for modes
+ * that stdio should handle itself.
+ */
+static int stream_flags(const char *mode)
+{
+	int flags;
+
+	switch (*mode++) {
+	case 'r':
+		flags = O_RDONLY;
+		break;
+	case 'w':
+		flags = O_WRONLY | O_CREAT | O_TRUNC;
+		break;
+	default:
+		/* Append mode disables bypass anyway */
+		return -1;
+	}
+
+	for (; *mode != '\0'; mode++) {
+		switch (*mode) {
+		case '+':
+			flags = (flags & ~O_ACCMODE) | O_RDWR;
+			break;
+		case 'e':
+			flags |= O_CLOEXEC;
+			break;
+		case 'x':
+			flags |= O_EXCL;
+			break;
+		case 'b':
+		case 'm':
+		case 'c':
+			break;
+		default:
+			return -1;
+		}
+	}
+
+	return flags;
+}
+
+/* Wrap a bypassed fd in a FILE whose I/O goes through the interception
+ * library, with a buffer large enough for a full sized RPC.  Returns NULL
+ * if stream bypass is off, fd is not bypassed or the stream could not be
+ * created, leaving the caller to use the kernel.
+ */
+static FILE *stream_open(int fd, const char *mode)
+{
+	struct ioil_stream *stream;
+	struct fd_entry *entry;
+	size_t size;
+	FILE *fp;
+	int rc;
+
+	if (!stream_bypass)
+		return NULL;
+
+	rc = vector_get(&fd_table, fd, &entry);
+	if (rc != 0)
+		return NULL;
+
+	if (entry->status != IOF_IO_BYPASS) {
+		vector_decref(&fd_table, entry);
+		return NULL;
+	}
+
+	size = entry->common.projection->max_read;
+	if (size < entry->common.projection->max_write)
+		size = entry->common.projection->max_write;
+
+	vector_decref(&fd_table, entry);
+
+	D_ALLOC_PTR(stream);
+	if (stream == NULL)
+		return NULL;
+
+	stream->fd = fd;
+	if (size != 0) {
+		D_ALLOC(stream->buf, size);
+		if (stream->buf == NULL)
+			goto err;
+	}
+
+	fp = fopencookie(stream, mode, stream_funcs);
+	if (fp == NULL)
+		goto err;
+
+	if (stream->buf != NULL)
+		setvbuf(fp, stream->buf, _IOFBF, size);
+
+	return fp;
+err:
+	D_FREE(stream->buf);
+	D_FREE(stream);
+	return NULL;
+}
+
 IOF_PUBLIC FILE * iof_fdopen(int fd, const char *mode)
 {
 	struct fd_entry *entry;
+	FILE *fp;
 	int rc;
 
+	if (stream_flags(mode) != -1) {
+		fp = stream_open(fd, mode);
+		if (fp != NULL) {
+			IOF_LOG_INFO("fdopen(fd=%d, mode=%s) = %p intercepted, "
+				     "bypass=%s", fd, mode, fp,
+				     bypass_status[IOF_IO_BYPASS]);
+			return fp;
+		}
+	}
+
 	rc = vector_get(&fd_table, fd, &entry);
 	if (rc == 0) {
 		IOF_LOG_INFO("fdopen(fd=%d." GAH_PRINT_STR ", mode=%s) "
 			     "intercepted, disabling kernel bypass", fd,
 			     GAH_PRINT_VAL(entry->common.gah), mode);
 
+		write_cache_flush(entry, false);
+		kernel_fd_upgrade(fd, entry);
 		if (entry->pos != 0)
 			__real_lseek(fd, entry->pos, SEEK_SET);
 
@@ -1023,7 +2490,9 @@ IOF_PUBLIC int iof_fcntl(int fd, int cmd, ...)
 		IOF_LOG_INFO("Removed IOF entry for fd=%d." GAH_PRINT_STR ": "
 			     "F_SETFL not supported for kernel bypass", fd,
 			     GAH_PRINT_VAL(entry->common.gah));
-		if (!drop_reference_if_disabled(entry)) {
+		if (!drop_reference_if_disabled(fd, entry)) {
+			write_cache_flush(entry, false);
+			kernel_fd_upgrade(fd, entry);
 			/* Disable kernel bypass */
 			entry->status = IOF_IO_DIS_FCNTL;
 			vector_decref(&fd_table, entry);
@@ -1051,6 +2520,7 @@ IOF_PUBLIC int iof_fcntl(int fd, int cmd, ...)
 			     "/* F_DUPFD* */, arg=%d) intercepted, bypass=%s",
 			     fd, GAH_PRINT_VAL(entry->common.gah), cmd, fdarg,
 			     bypass_status[entry->status]);
+		write_cache_flush(entry, false);
 		vector_decref(&fd_table, entry);
 	}
 
@@ -1061,10 +2531,40 @@ IOF_PUBLIC FILE * iof_fopen(const char *path, const char *mode)
 {
 	FILE *fp;
 	struct fd_entry entry = {0};
+	int flags;
 	int fd;
 
 	pthread_once(&init_links_flag, init_links);
 
+	if (!ioil_initialized)
+		return __real_fopen(path, mode);
+
+	/* Open the file directly so that a stream over a bypassed fd can be
+	 * returned, otherwise hand the fd to stdio.
+	 */
+	flags = stream_bypass ? stream_flags(mode) : -1;
+	if (flags != -1) {
+		fd = iof_open(path, flags, 0666);
+		if (fd == -1)
+			return NULL;
+
+		fp = stream_open(fd, mode);
+		if (fp != NULL) {
+			IOF_LOG_INFO("fopen(path=%s, mode=%s) = %p(fd=%d) "
+				     "intercepted, bypass=%s", path, mode, fp,
+				     fd, bypass_status[IOF_IO_BYPASS]);
+			return fp;
+		}
+
+		fp = iof_fdopen(fd, mode);
+		if (fp == NULL) {
+			SAVE_ERRNO(true);
+			iof_close(fd);
+			RESTORE_ERRNO(true);
+		}
+		return fp;
+	}
+
 	fp = __real_fopen(path, mode);
 
 	if (!ioil_initialized || fp == NULL)
@@ -1104,6 +2604,12 @@ IOF_PUBLIC FILE * iof_freopen(const char *path, const char *mode, FILE *stream)
 	if (oldfd == -1)
 		return __real_freopen(path, mode, stream);
 
+	rc = vector_get(&fd_table, oldfd, &old_entry);
+	if (rc == 0) {
+		write_cache_flush(old_entry, false);
+		vector_decref(&fd_table, old_entry);
+	}
+
 	newstream = __real_freopen(path, mode, stream);
 	if (newstream == NULL)
 		return NULL;
@@ -1150,6 +2656,7 @@ IOF_PUBLIC FILE * iof_freopen(const char *path, const char *mode, FILE *stream)
 IOF_PUBLIC int iof_fclose(FILE *stream)
 {
 	struct fd_entry *entry = NULL;
+	int error;
 	int fd;
 	int rc;
 
@@ -1170,8 +2677,15 @@ IOF_PUBLIC int iof_fclose(FILE *stream)
 		     "bypass=%s", stream, fd, GAH_PRINT_VAL(entry->common.gah),
 		     bypass_status[entry->status]);
 
+	error = write_cache_flush(entry, true);
 	vector_decref(&fd_table, entry);
 
+	if (error != 0) {
+		__real_fclose(stream);
+		errno = error;
+		return EOF;
+	}
+
 do_real_fclose:
 	return __real_fclose(stream);
 }
@@ -1193,5 +2707,80 @@ IOF_PUBLIC int iof_get_bypass_status(int fd)
 	return rc;
 }
 
+IOF_PUBLIC int iof_get_read_cache_stats(int fd,
+					struct iof_read_cache_stats *stats)
+{
+	struct fd_entry *entry;
+	int rc;
+
+	rc = vector_get(&fd_table, fd, &entry);
+	if (rc != 0) {
+		errno = EBADF;
+		return -1;
+	}
+
+	if (entry->rcache == NULL) {
+		vector_decref(&fd_table, entry);
+		errno = ENOTSUP;
+		return -1;
+	}
+
+	D_MUTEX_LOCK(&entry->rcache->lock);
+	*stats = entry->rcache->stats;
+	D_MUTEX_UNLOCK(&entry->rcache->lock);
+
+	vector_decref(&fd_table, entry);
+
+	return 0;
+}
+
+int ioil_aio_prepare(int fd, bool write, off_t offset, size_t len,
+		     struct iof_file_common *common)
+{
+	struct fd_entry *entry;
+	int error = 0;
+	int rc;
+
+	rc = vector_get(&fd_table, fd, &entry);
+	if (rc != 0)
+		return EBADF;
+
+	if (drop_reference_if_disabled(fd, entry))
+		return EBADF;
+
+	IOF_LOG_INFO("aio %s(fd=%d." GAH_PRINT_STR ", len=%zu, offset=%zd)",
+		     write ? "write" : "read", fd,
+		     GAH_PRINT_VAL(entry->common.gah), len, offset);
+
+	/* Buffered writes go first, so the RPC sees or replaces them */
+	if (write) {
+		error = write_cache_flush(entry, true);
+		read_cache_invalidate(entry);
+	} else if (write_cache_overlaps(entry, offset, len, true)) {
+		error = write_cache_flush(entry, true);
+	}
+
+	*common = entry->common;
+
+	vector_decref(&fd_table, entry);
+
+	return error;
+}
+
+bool ioil_progress(int64_t timeout, crt_progress_cond_cb_t cond, void *arg)
+{
+	int rc;
+
+	if (progress_running)
+		return false;
+
+	rc = crt_progress(crt_ctx, timeout, cond, arg);
+	if (rc != 0 && rc != -DER_TIMEDOUT)
+		IOF_LOG_ERROR("crt_progress failed rc: %d", rc);
+
+	return true;
+}
+
 FOREACH_INTERCEPT(IOIL_DECLARE_ALIAS)
+FOREACH_OPTIONAL_INTERCEPT(IOIL_DECLARE_ALIAS)
 FOREACH_ALIASED_INTERCEPT(IOIL_DECLARE_ALIAS64)
@@ -46,6 +46,8 @@ struct read_bulk_cb_r {
 	struct iof_file_common *f_info;
 	crt_rpc_t *rpc;
 	struct iof_tracker tracker;
+	ioil_io_cb cb;		/* Optional completion callback */
+	void *cb_arg;
 	int err;
 	int rc;
 };
@@ -55,6 +57,8 @@ read_bulk_cb(const struct crt_cb_info *cb_info)
 {
 	struct read_bulk_cb_r *reply = cb_info->cci_arg;
 	struct iof_readx_out *out = crt_reply_get(cb_info->cci_rpc);
+	ioil_io_cb cb = reply->cb;
+	void *cb_arg = reply->cb_arg;
 
 	if (cb_info->cci_rc != 0) {
 		/*
@@ -68,8 +72,7 @@ read_bulk_cb(const struct crt_cb_info *cb_info)
 			reply->err = EAGAIN;
 		else
 			reply->err = EIO;
-		iof_tracker_signal(&reply->tracker);
-		return;
+		goto out;
 	}
 
 	if (out->err) {
@@ -79,14 +82,12 @@ read_bulk_cb(const struct crt_cb_info *cb_info)
 			reply->err = ENOMEM;
 		else
 			reply->err = EIO;
-		iof_tracker_signal(&reply->tracker);
-		return;
+		goto out;
 	}
 
 	if (out->rc) {
 		reply->rc = out->rc;
-		iof_tracker_signal(&reply->tracker);
-		return;
+		goto out;
 	}
 
 	crt_req_addref(cb_info->cci_rpc);
@@ -94,26 +95,82 @@ read_bulk_cb(const struct crt_cb_info *cb_info)
 	reply->out = out;
 	reply->rpc = cb_info->cci_rpc;
 
+out:
+	/* A synchronous waiter may free reply once the tracker is signaled */
 	iof_tracker_signal(&reply->tracker);
+	if (cb != NULL)
+		cb(cb_arg);
 }
 
-static ssize_t read_bulk(char *buff, size_t len, off_t position,
-			 struct iof_file_common *f_info, int *errcode)
+/* A readx RPC in flight, covering a contiguous file range read into one or
+ * more iovec entries.
+ */
+struct read_req {
+	struct read_bulk_cb_r	reply;
+	const struct iovec	*iov;
+	int			count;
+	size_t			len;
+	crt_bulk_t		bulk;
+	void			*reg;	/* Cached bulk handle, if any */
+};
+
+/* Copy len bytes of src into an iovec, starting offset bytes in */
+static void
+iov_copy_in(const struct iovec *iov, int count, size_t offset,
+	    const char *src, size_t len)
+{
+	size_t seg;
+	int i;
+
+	for (i = 0; i < count && len > 0; i++) {
+		if (offset >= iov[i].iov_len) {
+			offset -= iov[i].iov_len;
+			continue;
+		}
+		seg = iov[i].iov_len - offset;
+		if (seg > len)
+			seg = len;
+		memcpy((char *)iov[i].iov_base + offset, src, seg);
+		src += seg;
+		len -= seg;
+		offset = 0;
+	}
+}
+
+/* Create a bulk handle over the iovec and send a readx RPC for it.  If every
+ * entry is zero-length then no RPC is sent and req->len is 0.
+ *
+ * Returns 0 on success or an errno, in which case nothing is in flight.
+ */
+static int
+read_send(struct read_req *req, const struct iovec *iov, int count,
+	  off_t position, struct iof_file_common *f_info)
 {
-	struct iof_projection *fs_handle;
-	struct iof_service_group *grp;
+	struct iof_projection *fs_handle = f_info->projection;
+	struct iof_service_group *grp = fs_handle->grp;
 	struct iof_readx_in *in;
-	struct iof_readx_out *out;
-	struct read_bulk_cb_r reply = {0};
 	crt_rpc_t *rpc = NULL;
-	crt_bulk_t bulk;
-	ssize_t read_len = 0;
 	d_sg_list_t sgl = {0};
-	d_iov_t iov = {0};
+	d_iov_t diov[IOIL_MAX_BULK_IOV];
 	int rc;
+	int i;
+
+	req->iov = iov;
+	req->count = count;
+	req->len = 0;
+
+	for (i = 0; i < count; i++) {
+		if (iov[i].iov_len == 0)
+			continue;
+		d_iov_set(&diov[sgl.sg_nr], iov[i].iov_base, iov[i].iov_len);
+		sgl.sg_nr++;
+		req->len += iov[i].iov_len;
+	}
+	sgl.sg_iovs = diov;
 
-	fs_handle = f_info->projection;
-	grp = fs_handle->grp;
+	/* Nothing to read, so no RPC is needed */
+	if (req->len == 0)
+		return 0;
 
 	rc = crt_req_create(fs_handle->crt_ctx, &grp->psr_ep,
 			    CRT_PROTO_OPC(fs_handle->io_proto->cpf_base,
@@ -123,72 +180,86 @@ static ssize_t read_bulk(char *buff, size_t len, off_t position,
 	if (rc || !rpc) {
 		IOF_LOG_ERROR("Could not create request, rc = %d",
 			      rc);
-		*errcode = EIO;
-		return -1;
+		return EIO;
 	}
 
 	in = crt_req_get(rpc);
 	in->gah = f_info->gah;
 	in->xtvec.xt_off = position;
-	in->xtvec.xt_len = len;
-
-	iov.iov_len = len;
-	iov.iov_buf_len = len;
-	iov.iov_buf = (void *)buff;
-	sgl.sg_iovs = &iov;
-	sgl.sg_nr = 1;
+	in->xtvec.xt_len = req->len;
 
-	rc = crt_bulk_create(fs_handle->crt_ctx, &sgl, CRT_BULK_RW,
-			     &in->data_bulk);
+	rc = ioil_bulk_get(fs_handle->crt_ctx, &sgl, CRT_BULK_RW,
+			   &in->data_bulk, &in->bulk_off, &req->reg);
 	if (rc) {
 		IOF_LOG_ERROR("Failed to make local bulk handle %d", rc);
-		*errcode = EIO;
-		return -1;
+		crt_req_decref(rpc);
+		return EIO;
 	}
 
-	iof_tracker_init(&reply.tracker, 1);
-	bulk = in->data_bulk;
+	iof_tracker_init(&req->reply.tracker, 1);
+	req->bulk = in->data_bulk;
 
-	reply.f_info = f_info;
+	req->reply.f_info = f_info;
 
-	rc = crt_req_send(rpc, read_bulk_cb, &reply);
+	rc = crt_req_send(rpc, read_bulk_cb, &req->reply);
 	if (rc) {
 		IOF_LOG_ERROR("Could not send rpc, rc = %d", rc);
-		*errcode = EIO;
-		return -1;
+		ioil_bulk_put(req->reg, req->bulk);
+		return EIO;
 	}
-	iof_fs_wait(fs_handle, &reply.tracker);
 
-	if (reply.err) {
-		*errcode = reply.err;
+	return 0;
+}
+
+/* Wait for a readx RPC to complete and release its resources.
+ *
+ * Returns the number of bytes read, or -1 with errcode set.
+ */
+static ssize_t
+read_complete(struct read_req *req, int *errcode)
+{
+	struct iof_projection *fs_handle = req->reply.f_info->projection;
+	struct iof_readx_out *out;
+	ssize_t read_len = 0;
+	int rc;
+
+	if (req->len == 0)
+		return 0;
+
+	iof_fs_wait(fs_handle, &req->reply.tracker);
+
+	rc = ioil_bulk_put(req->reg, req->bulk);
+
+	if (req->reply.err) {
+		*errcode = req->reply.err;
 		return -1;
 	}
 
-	if (reply.rc != 0) {
-		*errcode = reply.rc;
+	if (req->reply.rc != 0) {
+		*errcode = req->reply.rc;
 		return -1;
 	}
 
-	out = reply.out;
+	out = req->reply.out;
 	if (out->iov_len > 0) {
 		if (out->data.iov_len != out->iov_len) {
-			/* TODO: This is a resource leak */
 			IOF_LOG_ERROR("Missing IOV %d", out->iov_len);
+			crt_req_decref(req->reply.rpc);
 			*errcode = EIO;
 			return -1;
 		}
 		read_len = out->data.iov_len;
 		IOF_LOG_INFO("Received %#zx via immediate", read_len);
-		memcpy(buff + out->bulk_len, out->data.iov_buf, read_len);
+		iov_copy_in(req->iov, req->count, out->bulk_len,
+			    out->data.iov_buf, read_len);
 	}
 	if (out->bulk_len > 0) {
 		IOF_LOG_INFO("Received %#zx via bulk", out->bulk_len);
 		read_len += out->bulk_len;
 	}
 
-	crt_req_decref(reply.rpc);
+	crt_req_decref(req->reply.rpc);
 
-	rc = crt_bulk_free(bulk);
 	if (rc) {
 		*errcode = EIO;
 		return -1;
@@ -202,34 +273,134 @@ static ssize_t read_bulk(char *buff, size_t len, off_t position,
 ssize_t ioil_do_pread(char *buff, size_t len, off_t position,
 		      struct iof_file_common *f_info, int *errcode)
 {
+	struct read_req req = {0};
+	struct iovec iov = {.iov_base = buff, .iov_len = len};
+	int rc;
+
 	IOF_LOG_INFO("%#zx-%#zx " GAH_PRINT_STR, position, position + len - 1,
 		     GAH_PRINT_VAL(f_info->gah));
 
-	return read_bulk(buff, len, position, f_info, errcode);
+	rc = read_send(&req, &iov, 1, position, f_info);
+	if (rc) {
+		*errcode = rc;
+		return -1;
+	}
+
+	return read_complete(&req, errcode);
+}
+
+/* A read started by ioil_read_start(), owning the iovec read_req points to */
+struct read_async {
+	struct read_req		req;
+	struct iovec		iov;
+};
+
+void *ioil_read_start(char *buff, size_t len, off_t position,
+		      struct iof_file_common *f_info, ioil_io_cb cb, void *arg,
+		      int *errcode)
+{
+	struct read_async *ra;
+	int rc;
+
+	IOF_LOG_INFO("%#zx-%#zx " GAH_PRINT_STR " async", position,
+		     position + len - 1, GAH_PRINT_VAL(f_info->gah));
+
+	D_ALLOC_PTR(ra);
+	if (ra == NULL) {
+		*errcode = ENOMEM;
+		return NULL;
+	}
+
+	ra->iov.iov_base = buff;
+	ra->iov.iov_len = len;
+	ra->req.reply.cb = cb;
+	ra->req.reply.cb_arg = arg;
+
+	rc = read_send(&ra->req, &ra->iov, 1, position, f_info);
+	if (rc) {
+		D_FREE(ra);
+		*errcode = rc;
+		return NULL;
+	}
+
+	return ra;
+}
+
+ssize_t ioil_read_finish(void *handle, int *errcode)
+{
+	struct read_async *ra = handle;
+	ssize_t bytes_read;
+
+	bytes_read = read_complete(&ra->req, errcode);
+	D_FREE(ra);
+
+	return bytes_read;
 }
 
-/* TODO: This could be optimized to send multiple RPCs at once rather than
- * sending them serially.   Get it working first.
+/* Read into an iovec with one RPC per IOIL_MAX_BULK_IOV entries, all of
+ * which are in flight at once.  The result is the number of bytes read up to
+ * the first short read or error.
  */
 ssize_t ioil_do_preadv(const struct iovec *iov, int count, off_t position,
 		       struct iof_file_common *f_info, int *errcode)
 {
+	struct read_req *reqs;
 	ssize_t bytes_read;
 	ssize_t total_read = 0;
+	bool done = false;
+	int err = 0;
+	int nreq;
+	int sent;
+	int n;
+	int rc;
 	int i;
 
-	for (i = 0; i < count; i++) {
-		bytes_read = read_bulk(iov[i].iov_base, iov[i].iov_len,
-				       position, f_info, errcode);
+	if (count <= 0)
+		return 0;
+
+	nreq = (count + IOIL_MAX_BULK_IOV - 1) / IOIL_MAX_BULK_IOV;
+
+	D_ALLOC_ARRAY(reqs, nreq);
+	if (!reqs) {
+		*errcode = ENOMEM;
+		return -1;
+	}
+
+	for (sent = 0; sent < nreq; sent++) {
+		n = count - sent * IOIL_MAX_BULK_IOV;
+		if (n > IOIL_MAX_BULK_IOV)
+			n = IOIL_MAX_BULK_IOV;
+
+		rc = read_send(&reqs[sent], &iov[sent * IOIL_MAX_BULK_IOV], n,
+			       position, f_info);
+		if (rc) {
+			err = rc;
+			break;
+		}
+		position += reqs[sent].len;
+	}
 
-		if (bytes_read == -1)
-			return (ssize_t)-1;
+	for (i = 0; i < sent; i++) {
+		bytes_read = read_complete(&reqs[i], &rc);
+		if (done)
+			continue;
 
-		if (bytes_read == 0)
-			return total_read;
+		if (bytes_read == -1) {
+			err = rc;
+			done = true;
+			continue;
+		}
 
-		position += bytes_read;
 		total_read += bytes_read;
+		if (bytes_read < reqs[i].len)
+			done = true;
+	}
+
+	D_FREE(reqs);
+
+	if (total_read == 0 && err) {
+		*errcode = err;
+		return -1;
 	}
 
 	return total_read;
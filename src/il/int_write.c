@@ -45,6 +45,8 @@ struct write_cb_r {
 	struct iof_file_common *f_info;
 	ssize_t len;
 	struct iof_tracker tracker;
+	ioil_io_cb cb;		/* Optional completion callback */
+	void *cb_arg;
 	int err;
 	int rc;
 };
@@ -54,6 +56,8 @@ write_cb(const struct crt_cb_info *cb_info)
 {
 	struct write_cb_r *reply = cb_info->cci_arg;
 	struct iof_writex_out *out = crt_reply_get(cb_info->cci_rpc);
+	ioil_io_cb cb = reply->cb;
+	void *cb_arg = reply->cb_arg;
 
 	if (cb_info->cci_rc != 0) {
 		/*
@@ -67,8 +71,7 @@ write_cb(const struct crt_cb_info *cb_info)
 			reply->err = EAGAIN;
 		else
 			reply->err = EIO;
-		iof_tracker_signal(&reply->tracker);
-		return;
+		goto out;
 	}
 
 	if (out->err) {
@@ -79,35 +82,64 @@ write_cb(const struct crt_cb_info *cb_info)
 		if (out->err == -DER_NOMEM)
 			reply->err = ENOMEM;
 
-		iof_tracker_signal(&reply->tracker);
-		return;
+		goto out;
 	}
 
 	reply->len = out->len;
 	reply->rc = out->rc;
+out:
+	/* A synchronous waiter may free reply once the tracker is signaled */
 	iof_tracker_signal(&reply->tracker);
+	if (cb != NULL)
+		cb(cb_arg);
 }
 
-ssize_t ioil_do_writex(const char *buff, size_t len, off_t position,
-		       struct iof_file_common *f_info, int *errcode)
+/* A writex RPC in flight, covering a contiguous file range written from
+ * bulk data in an iovec followed by an optional immediate tail.
+ */
+struct write_req {
+	struct write_cb_r	reply;
+	size_t			len;
+	crt_bulk_t		bulk;
+	void			*reg;	/* Cached bulk handle, if any */
+};
+
+/* Send a writex RPC for the bulk iovec followed by imm_len bytes of
+ * immediate data.  If there is no data at all then no RPC is sent and
+ * req->len is 0.
+ *
+ * Returns 0 on success or an errno, in which case nothing is in flight.
+ */
+static int
+write_send(struct write_req *req, const struct iovec *iov, int count,
+	   const char *imm, size_t imm_len, off_t position,
+	   struct iof_file_common *f_info)
 {
-	struct iof_projection *fs_handle;
-	struct iof_service_group *grp;
+	struct iof_projection *fs_handle = f_info->projection;
+	struct iof_service_group *grp = fs_handle->grp;
 	struct iof_writex_in *in;
-	struct write_cb_r reply = {0};
 	crt_rpc_t *rpc = NULL;
-	crt_bulk_t bulk;
 	d_sg_list_t sgl = {0};
-	d_iov_t iov = {0};
-	uint64_t imm_len;
-	uint64_t imm_offset = 0;
+	d_iov_t diov[IOIL_MAX_BULK_IOV];
+	size_t bulk_len = 0;
 	int rc;
+	int i;
 
-	IOF_LOG_INFO("%#zx-%#zx " GAH_PRINT_STR, position,
-		     position + len - 1, GAH_PRINT_VAL(f_info->gah));
+	for (i = 0; i < count; i++) {
+		if (iov[i].iov_len == 0)
+			continue;
+		d_iov_set(&diov[sgl.sg_nr], iov[i].iov_base, iov[i].iov_len);
+		sgl.sg_nr++;
+		bulk_len += iov[i].iov_len;
+	}
+	sgl.sg_iovs = diov;
 
-	fs_handle = f_info->projection;
-	grp = fs_handle->grp;
+	req->len = bulk_len + imm_len;
+	req->bulk = NULL;
+
+	/* Nothing to write, so no RPC is needed */
+	if (req->len == 0)
+		return 0;
 
 	rc = crt_req_create(fs_handle->crt_ctx, &grp->psr_ep,
 			    CRT_PROTO_OPC(fs_handle->io_proto->cpf_base,
@@ -117,98 +149,264 @@ ssize_t ioil_do_writex(const char *buff, size_t len, off_t position,
 	if (rc || !rpc) {
 		IOF_LOG_ERROR("Could not create request, rc = %d",
 			      rc);
-		*errcode = EIO;
-		return -1;
+		return EIO;
 	}
 
 	in = crt_req_get(rpc);
 	in->gah = f_info->gah;
+	in->xtvec.xt_off = position;
+	in->xtvec.xt_len = req->len;
 
-	in->xtvec.xt_len = len;
-	imm_len = len % fs_handle->max_write;
-	if (imm_len <= fs_handle->max_iov_write) {
-		imm_offset = len - imm_len;
-		d_iov_set(&in->data, (void *)buff + imm_offset, imm_len);
-	} else {
-		imm_len = 0;
-		imm_offset = in->xtvec.xt_len;
-	}
-
-	if (imm_offset != 0) {
-		in->bulk_len = iov.iov_len = imm_offset;
-		iov.iov_buf_len = imm_offset;
-		iov.iov_buf = (void *)buff;
-		sgl.sg_iovs = &iov;
-		sgl.sg_nr = 1;
-
-		rc = crt_bulk_create(fs_handle->crt_ctx, &sgl, CRT_BULK_RO,
-				     &in->data_bulk);
+	if (imm_len)
+		d_iov_set(&in->data, (void *)imm, imm_len);
+
+	if (bulk_len != 0) {
+		in->bulk_len = bulk_len;
+
+		rc = ioil_bulk_get(fs_handle->crt_ctx, &sgl, CRT_BULK_RO,
+				   &in->data_bulk, &in->bulk_off, &req->reg);
 		if (rc) {
 			IOF_LOG_ERROR("Failed to make local bulk handle %d",
 				      rc);
-			*errcode = EIO;
-			return -1;
+			crt_req_decref(rpc);
+			return EIO;
 		}
 	}
 
-	iof_tracker_init(&reply.tracker, 1);
-	in->xtvec.xt_off = position;
+	iof_tracker_init(&req->reply.tracker, 1);
 
-	bulk = in->data_bulk;
+	req->bulk = in->data_bulk;
 
-	reply.f_info = f_info;
+	req->reply.f_info = f_info;
 
-	rc = crt_req_send(rpc, write_cb, &reply);
+	rc = crt_req_send(rpc, write_cb, &req->reply);
 	if (rc) {
 		IOF_LOG_ERROR("Could not send rpc, rc = %d", rc);
-		*errcode = EIO;
-		return -1;
+		if (req->bulk)
+			ioil_bulk_put(req->reg, req->bulk);
+		return EIO;
 	}
-	iof_fs_wait(fs_handle, &reply.tracker);
 
-	if (bulk) {
-		rc = crt_bulk_free(bulk);
+	return 0;
+}
+
+/* Wait for a writex RPC to complete and release its resources.
+ *
+ * Returns the number of bytes written, or -1 with errcode set.
+ */
+static ssize_t
+write_complete(struct write_req *req, int *errcode)
+{
+	struct iof_projection *fs_handle = req->reply.f_info->projection;
+	int rc;
+
+	if (req->len == 0)
+		return 0;
+
+	iof_fs_wait(fs_handle, &req->reply.tracker);
+
+	if (req->bulk) {
+		rc = ioil_bulk_put(req->reg, req->bulk);
 		if (rc) {
 			*errcode = EIO;
 			return -1;
 		}
 	}
 
-	if (reply.err) {
-		*errcode = reply.err;
+	if (req->reply.err) {
+		*errcode = req->reply.err;
 		return -1;
 	}
 
-	if (reply.rc != 0) {
-		*errcode = reply.rc;
+	if (req->reply.rc != 0) {
+		*errcode = req->reply.rc;
+		return -1;
+	}
+
+	return req->reply.len;
+}
+
+/* Return how much of a len byte write is sent by bulk, the remainder is
+ * small enough to go as immediate data.
+ */
+static uint64_t
+write_imm_offset(struct iof_projection *fs_handle, size_t len)
+{
+	uint64_t imm_len;
+
+	imm_len = len % fs_handle->max_write;
+	if (imm_len <= fs_handle->max_iov_write)
+		return len - imm_len;
+
+	return len;
+}
+
+ssize_t ioil_do_writex(const char *buff, size_t len, off_t position,
+		       struct iof_file_common *f_info, int *errcode)
+{
+	struct write_req req = {0};
+	struct iovec iov = {0};
+	uint64_t imm_offset;
+	int rc;
+
+	IOF_LOG_INFO("%#zx-%#zx " GAH_PRINT_STR, position,
+		     position + len - 1, GAH_PRINT_VAL(f_info->gah));
+
+	imm_offset = write_imm_offset(f_info->projection, len);
+
+	iov.iov_base = (void *)buff;
+	iov.iov_len = imm_offset;
+
+	rc = write_send(&req, &iov, 1, buff + imm_offset, len - imm_offset,
+			position, f_info);
+	if (rc) {
+		*errcode = rc;
 		return -1;
 	}
 
-	return reply.len;
+	return write_complete(&req, errcode);
+}
+
+void *ioil_write_start(const char *buff, size_t len, off_t position,
+		       struct iof_file_common *f_info, ioil_io_cb cb,
+		       void *arg, int *errcode)
+{
+	struct write_req *req;
+	struct iovec iov = {0};
+	uint64_t imm_offset;
+	int rc;
+
+	IOF_LOG_INFO("%#zx-%#zx " GAH_PRINT_STR " async", position,
+		     position + len - 1, GAH_PRINT_VAL(f_info->gah));
+
+	D_ALLOC_PTR(req);
+	if (req == NULL) {
+		*errcode = ENOMEM;
+		return NULL;
+	}
+
+	imm_offset = write_imm_offset(f_info->projection, len);
+
+	iov.iov_base = (void *)buff;
+	iov.iov_len = imm_offset;
+	req->reply.cb = cb;
+	req->reply.cb_arg = arg;
+
+	rc = write_send(req, &iov, 1, buff + imm_offset, len - imm_offset,
+			position, f_info);
+	if (rc) {
+		D_FREE(req);
+		*errcode = rc;
+		return NULL;
+	}
+
+	return req;
+}
+
+ssize_t ioil_write_finish(void *handle, int *errcode)
+{
+	struct write_req *req = handle;
+	ssize_t bytes_written;
+
+	bytes_written = write_complete(req, errcode);
+	D_FREE(req);
+
+	return bytes_written;
 }
 
-/* TODO: This could be optimized to send multiple RPCs at once rather than
- * sending them serially.   Get it working first.
+/* Write from an iovec with one RPC per IOIL_MAX_BULK_IOV entries, all of
+ * which are in flight at once.  Vectors small enough to be sent as
+ * immediate data are gathered and sent with ioil_do_writex() instead.
+ * The result is the number of bytes written up to the first short write or
+ * error.
  */
 ssize_t ioil_do_pwritev(const struct iovec *iov, int count, off_t position,
 			struct iof_file_common *f_info, int *errcode)
 {
+	struct iof_projection *fs_handle = f_info->projection;
+	struct write_req *reqs;
 	ssize_t bytes_written;
 	ssize_t total_write = 0;
+	size_t len = 0;
+	bool done = false;
+	int err = 0;
+	int nreq;
+	int sent;
+	int n;
+	int rc;
 	int i;
 
-	for (i = 0; i < count; i++) {
-		bytes_written = ioil_do_writex(iov[i].iov_base, iov[i].iov_len,
-					       position, f_info, errcode);
+	if (count <= 0)
+		return 0;
+
+	for (i = 0; i < count; i++)
+		len += iov[i].iov_len;
 
-		if (bytes_written == -1)
-			return (ssize_t)-1;
+	if (len == 0)
+		return 0;
 
-		if (bytes_written == 0)
-			return total_write;
+	if (len <= fs_handle->max_iov_write) {
+		char *buff;
+		size_t off = 0;
+
+		D_ALLOC(buff, len);
+		if (!buff) {
+			*errcode = ENOMEM;
+			return -1;
+		}
+		for (i = 0; i < count; i++) {
+			memcpy(buff + off, iov[i].iov_base, iov[i].iov_len);
+			off += iov[i].iov_len;
+		}
+		bytes_written = ioil_do_writex(buff, len, position, f_info,
+					       errcode);
+		D_FREE(buff);
+		return bytes_written;
+	}
+
+	nreq = (count + IOIL_MAX_BULK_IOV - 1) / IOIL_MAX_BULK_IOV;
+
+	D_ALLOC_ARRAY(reqs, nreq);
+	if (!reqs) {
+		*errcode = ENOMEM;
+		return -1;
+	}
+
+	for (sent = 0; sent < nreq; sent++) {
+		n = count - sent * IOIL_MAX_BULK_IOV;
+		if (n > IOIL_MAX_BULK_IOV)
+			n = IOIL_MAX_BULK_IOV;
+
+		rc = write_send(&reqs[sent], &iov[sent * IOIL_MAX_BULK_IOV], n,
+				NULL, 0, position, f_info);
+		if (rc) {
+			err = rc;
+			break;
+		}
+		position += reqs[sent].len;
+	}
+
+	for (i = 0; i < sent; i++) {
+		bytes_written = write_complete(&reqs[i], &rc);
+		if (done)
+			continue;
+
+		if (bytes_written == -1) {
+			err = rc;
+			done = true;
+			continue;
+		}
 
-		position += bytes_written;
 		total_write += bytes_written;
+		if (bytes_written < reqs[i].len)
+			done = true;
+	}
+
+	D_FREE(reqs);
+
+	if (total_write == 0 && err) {
+		*errcode = err;
+		return -1;
 	}
 
 	return total_write;
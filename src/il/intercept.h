@@ -40,6 +40,7 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <sys/uio.h>
+#include <sys/stat.h>
 #include "log.h"
 #include "ios_gah.h"
 #include "iof_fs.h"
@@ -52,7 +53,6 @@
  * fileno
  * fileno_unlocked
  * sync
- * munmap
  * msync
  * mremap
  * select
@@ -68,7 +68,10 @@
 	ACTION(off_t,   lseek,     (int, off_t, int))                         \
 	ACTION(ssize_t, preadv,    (int, const struct iovec *, int, off_t))   \
 	ACTION(ssize_t, pwritev,   (int, const struct iovec *, int, off_t))   \
-	ACTION(void *,  mmap,      (void *, size_t, int, int, int, off_t))
+	ACTION(void *,  mmap,      (void *, size_t, int, int, int, off_t))    \
+	ACTION(int,     ftruncate, (int, off_t))                              \
+	ACTION(int,     fallocate, (int, int, off_t, off_t))                  \
+	ACTION(int,     posix_fallocate, (int, off_t, off_t))
 
 #define FOREACH_SINGLE_INTERCEPT(ACTION)                                      \
 	ACTION(int,     fclose,    (FILE *))                                  \
@@ -82,18 +85,36 @@
 	ACTION(int,     dup,       (int))                                     \
 	ACTION(int,     dup2,      (int, int))                                \
 	ACTION(int,     fcntl,     (int fd, int cmd, ...))                    \
+	ACTION(int,     munmap,    (void *, size_t))                          \
+	ACTION(void,    free,      (void *))                                  \
+	ACTION(void *,  realloc,   (void *, size_t))                          \
 	ACTION(FILE *,  fdopen,    (int, const char *))
 
 #define FOREACH_INTERCEPT(ACTION)            \
 	FOREACH_SINGLE_INTERCEPT(ACTION)     \
 	FOREACH_ALIASED_INTERCEPT(ACTION)
 
+/* Functions which older C libraries do not provide.  If the real function
+ * cannot be found the intercept makes the system call itself.  Before glibc
+ * 2.33 fstat() was an inline wrapper around __fxstat(), which later versions
+ * no longer export.
+ */
+#define FOREACH_OPTIONAL_INTERCEPT(ACTION)                                    \
+	ACTION(ssize_t, copy_file_range, (int, loff_t *, int, loff_t *,       \
+					  size_t, unsigned int))              \
+	ACTION(int,     fstat,      (int, struct stat *))                     \
+	ACTION(int,     fstat64,    (int, struct stat64 *))                   \
+	ACTION(int,     __fxstat,   (int, int, struct stat *))                \
+	ACTION(int,     __fxstat64, (int, int, struct stat64 *))
+
 #ifdef IOIL_PRELOAD
 #include <dlfcn.h>
 
 #define IOIL_FORWARD_DECL(type, name, params)  \
 	static type(*__real_##name) params;
 
+#define IOIL_FORWARD_DECL_OPTIONAL IOIL_FORWARD_DECL
+
 #define IOIL_DECL(name) name
 
 #define IOIL_DECLARE_ALIAS(type, name, params) \
@@ -116,14 +137,27 @@
 		}                                                           \
 	} while (0);
 
+#define IOIL_FORWARD_MAP_OPTIONAL(type, name, params)                       \
+	do {                                                                \
+		if (__real_##name != NULL)                                  \
+			break;                                              \
+		__real_##name = (__typeof__(__real_##name))dlsym(RTLD_NEXT, \
+								 #name);    \
+	} while (0);
+
 #else /* !IOIL_PRELOAD */
 #define IOIL_FORWARD_DECL(type, name, params)  \
 	extern type __real_##name params;
 
+#define IOIL_FORWARD_DECL_OPTIONAL(type, name, params)  \
+	extern type __real_##name params __attribute__((weak));
+
 #define IOIL_DECL(name) __wrap_##name
 
 #define IOIL_FORWARD_MAP_OR_FAIL(type, name, params) (void)0;
 
+#define IOIL_FORWARD_MAP_OPTIONAL(type, name, params) (void)0;
+
 #define IOIL_DECLARE_ALIAS(type, name, params) \
 	IOF_PUBLIC type __wrap_##name params \
 		__attribute__((weak, alias("iof_" #name)));
@@ -134,6 +168,12 @@
 
 #endif /* IOIL_PRELOAD */
 
+/* Maximum number of iovec entries to register in a single bulk handle.
+ * Longer vectors are split over several RPCs, which are all sent before
+ * waiting for any of them to complete.
+ */
+#define IOIL_MAX_BULK_IOV 64
+
 ssize_t ioil_do_pread(char *buff, size_t len, off_t position,
 		      struct iof_file_common *f_info, int *errcode);
 ssize_t ioil_do_preadv(const struct iovec *iov, int count, off_t position,
@@ -143,4 +183,116 @@ ssize_t ioil_do_writex(const char *buff, size_t len, off_t position,
 ssize_t ioil_do_pwritev(const struct iovec *iov, int count, off_t position,
 			struct iof_file_common *f_info, int *errcode);
 
+/* Called from the thread progressing the context when an asynchronous RPC
+ * has completed
+ */
+typedef void (*ioil_io_cb)(void *arg);
+
+/* Send a readx or writex RPC without waiting for it.  cb is called once the
+ * reply arrives, after which the matching finish function returns the
+ * result and releases the handle.  Returns NULL with errcode set if nothing
+ * was sent, in which case cb is never called.
+ */
+void *ioil_read_start(char *buff, size_t len, off_t position,
+		      struct iof_file_common *f_info, ioil_io_cb cb, void *arg,
+		      int *errcode);
+ssize_t ioil_read_finish(void *handle, int *errcode);
+void *ioil_write_start(const char *buff, size_t len, off_t position,
+		       struct iof_file_common *f_info, ioil_io_cb cb,
+		       void *arg, int *errcode);
+ssize_t ioil_write_finish(void *handle, int *errcode);
+
+/* Get the file behind a bypassed fd for direct asynchronous I/O of len
+ * bytes at offset, flushing or discarding cached data that would otherwise
+ * be inconsistent with it.  Returns 0 or an errno, EBADF if fd isn't
+ * bypassed.
+ */
+int ioil_aio_prepare(int fd, bool write, off_t offset, size_t len,
+		     struct iof_file_common *common);
+
+/* Progress the context from the calling thread for up to timeout us, or
+ * until cond returns non-zero, if there is no progress thread.  Returns
+ * false if there is a progress thread, in which case nothing was done.
+ */
+bool ioil_progress(int64_t timeout, crt_progress_cond_cb_t cond, void *arg);
+
+/* Set the protocol used for metadata RPCs sent without the kernel */
+void ioil_direct_proto(struct crt_proto_format *proto);
+
+/* Set up opening files with RPCs rather than through the kernel.  Returns 0
+ * or an errno.
+ */
+int ioil_direct_init(struct iof_projection *projs, uint32_t count);
+
+/* Open the file at path with an RPC to the IONSS, filling in common and a
+ * handle to close it with.  Returns 0, an errno from the open, or ENOTSUP
+ * if the path should be opened through the kernel instead.
+ */
+int ioil_direct_open(const char *path, int flags, mode_t mode,
+		     struct iof_file_common *common, void **handle);
+
+/* Close a file opened by ioil_direct_open(), NULL is ignored */
+void ioil_direct_close(void *handle);
+
+/* fsync() or fdatasync() and fstat() on a directly opened file */
+int ioil_direct_fsync(struct iof_file_common *common, bool datasync);
+int ioil_direct_getattr(struct iof_file_common *common, struct stat *stat);
+
+/* Copy len bytes from the file described by src at src_off to the file
+ * described by dst at dst_off with a copy RPC, so the data stays on the
+ * IONSS.  Sets copied, which may be short.  Returns 0 or an errno, EXDEV if
+ * the IONSS cannot copy between the files.
+ */
+int ioil_direct_copy(struct iof_file_common *src, off_t src_off,
+		     struct iof_file_common *dst, off_t dst_off, size_t len,
+		     size_t *copied);
+
+/* Close any files still open and wait for the RPCs to complete */
+void ioil_direct_fini(void);
+
+/* Serve page faults in the anonymous range at addr from the file described
+ * by common, starting at offset.  fd is held until the range is removed, and
+ * is mapped with prot in place of the range if the file cannot be read.
+ * Returns 0 on success or an errno if userfaultfd can not be used.
+ */
+int ioil_map_register(void *addr, size_t len, off_t offset, int fd,
+		      int prot, struct iof_file_common *common);
+
+/* Forget the parts of mappings inside an unmapped range.  Returns the fd of
+ * one mapping which is now wholly unmapped, for the caller to close, or -1
+ * if there is none.  Call until it returns -1.
+ */
+int ioil_map_remove(void *addr, size_t len);
+
+/* Stop the fault handler thread */
+void ioil_map_fini(void);
+
+/* Default number of bulk handles over application buffers kept for reuse */
+#define IOIL_BULK_CACHE_DEFAULT 32
+
+/* Set the number of cached bulk handles, 0 to disable caching */
+void ioil_bulk_init(int max_entries);
+
+/* Get a bulk handle covering sgl, reusing a cached one if it covers the
+ * buffer.  offset is set to where the buffer starts within the handle and
+ * handle to the cache entry, or NULL if the bulk handle isn't cached.
+ * Returns a CaRT error code.
+ */
+int ioil_bulk_get(crt_context_t ctx, d_sg_list_t *sgl, crt_bulk_perm_t perm,
+		  crt_bulk_t *bulk, uint64_t *offset, void **handle);
+
+/* Release a bulk handle returned by ioil_bulk_get() */
+int ioil_bulk_put(void *handle, crt_bulk_t bulk);
+
+/* Drop cached bulk handles overlapping memory that is being released.  Only
+ * takes a lock if the memory is within the range of cached handles.
+ */
+void ioil_bulk_invalidate(void *addr, size_t len);
+
+/* Returns true if no bulk handles are cached, without taking a lock */
+bool ioil_bulk_empty(void);
+
+/* Free all cached bulk handles */
+void ioil_bulk_fini(void);
+
 #endif /* __INTERCEPT_H__ */
@@ -0,0 +1,110 @@
+/* Copyright (C) 2019 Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted for any purpose (including commercial purposes)
+ * provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the
+ *    documentation and/or materials provided with the distribution.
+ *
+ * 3. In addition, redistributions of modified forms of the source or binary
+ *    code must carry prominent notices stating that the original code was
+ *    changed and the date of the change.
+ *
+ *  4. All publications or advertising materials mentioning features or use of
+ *     this software are asked, but not required, to acknowledge that it was
+ *     developed by Intel Corporation and credit the contributors.
+ *
+ * 5. Neither the name of Intel Corporation, nor the name of any Contributor
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __IOF_AIO_H__
+#define __IOF_AIO_H__
+
+#include <sys/types.h>
+#include <time.h>
+#include <iof_defines.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/** Asynchronous I/O for files forwarded by IOF.
+ *
+ *  Requests are submitted to a queue, in batches if desired, and each is
+ *  sent as its own RPC so many can be in flight from a single thread.
+ *  Completed requests are collected with iof_aio_getevents().  Requests on
+ *  descriptors that are not forwarded by IOF are performed synchronously
+ *  during submission and complete immediately.
+ */
+
+enum iof_aio_op {
+	IOF_AIO_READ = 0,	/** pread() into buf */
+	IOF_AIO_WRITE,		/** pwrite() from buf */
+};
+
+/** An I/O request.  Owned by the caller, which must not modify or free it,
+ *  or its buffer, until it has been returned by iof_aio_getevents().
+ */
+struct iof_aio_req {
+	int		fd;		/** File descriptor */
+	int		op;		/** One of enum iof_aio_op */
+	void		*buf;		/** Data buffer */
+	size_t		len;		/** Bytes to transfer */
+	off_t		offset;		/** File offset */
+	void		*user_data;	/** Not used by IOF */
+	ssize_t		result;		/** On completion, bytes transferred
+					 *  or a negative errno
+					 */
+};
+
+struct iof_aio_queue;
+
+/** Create a queue allowing up to \p depth requests to be submitted and not
+ *  yet collected.  Returns NULL with errno set on failure.
+ */
+IOF_PUBLIC struct iof_aio_queue *iof_aio_queue_create(unsigned int depth);
+
+/** Wait for all requests in \p queue to complete, discarding their results,
+ *  and free it.  Returns 0 on success or -1 with errno set.
+ */
+IOF_PUBLIC int iof_aio_queue_destroy(struct iof_aio_queue *queue);
+
+/** Submit \p nr requests from \p reqs.  Returns the number submitted,
+ *  which is less than \p nr if the queue filled up, or -1 with errno set to
+ *  EAGAIN if none could be.  Invalid requests fail with EINVAL.
+ */
+IOF_PUBLIC int iof_aio_submit(struct iof_aio_queue *queue,
+			      struct iof_aio_req **reqs, int nr);
+
+/** Collect between \p min_nr and \p max_nr completed requests into
+ *  \p reqs, waiting up to \p timeout for at least \p min_nr, or forever if
+ *  \p timeout is NULL.  \p min_nr is limited to the number of requests
+ *  outstanding.  Returns the number collected or -1 with errno set.
+ */
+IOF_PUBLIC int iof_aio_getevents(struct iof_aio_queue *queue, int min_nr,
+				 int max_nr, struct iof_aio_req **reqs,
+				 const struct timespec *timeout);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* __IOF_AIO_H__ */
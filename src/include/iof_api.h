@@ -39,6 +39,7 @@
 #define __IOF_API_H__
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <iof_defines.h>
 
 #if defined(__cplusplus)
@@ -68,4 +69,19 @@ enum iof_bypass_status {
  */
 IOF_PUBLIC int iof_get_bypass_status(int fd);
 
+/** Counters for the per file descriptor read cache */
+struct iof_read_cache_stats {
+	uint64_t hits;		/** Reads served without an RPC */
+	uint64_t misses;	/** Reads that needed at least one RPC */
+	uint64_t fills;		/** Readahead RPCs to fill the cache */
+	uint64_t invalidations;	/** Times cached data was discarded */
+};
+
+/** Copy the read cache counters for \p fd into \p stats.  Returns 0 on
+ *  success or -1 with errno set to EBADF if the file is not forwarded by
+ *  IOF, or to ENOTSUP if it has no read cache.
+ */
+IOF_PUBLIC int iof_get_read_cache_stats(int fd,
+					struct iof_read_cache_stats *stats);
+
 #endif /* __IOF_IO_H__ */
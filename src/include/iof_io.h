@@ -57,6 +57,9 @@ IOF_PUBLIC off_t iof_lseek(int, off_t, int);
 IOF_PUBLIC ssize_t iof_preadv(int, const struct iovec *, int, off_t);
 IOF_PUBLIC ssize_t iof_pwritev(int, const struct iovec *, int, off_t);
 IOF_PUBLIC void *iof_mmap(void *, size_t, int, int, int, off_t);
+IOF_PUBLIC int iof_munmap(void *, size_t);
+IOF_PUBLIC void iof_free(void *);
+IOF_PUBLIC void *iof_realloc(void *, size_t);
 IOF_PUBLIC int iof_close(int);
 IOF_PUBLIC ssize_t iof_read(int, void *, size_t);
 IOF_PUBLIC ssize_t iof_write(int, const void *, size_t);
@@ -41,5 +41,6 @@
 #define IOF_DECLARE_WEAK
 #include <iof_api.h>
 #include <iof_io.h>
+#include <iof_aio.h>
 
 #endif /* __IOF_PRELOAD_H__ */
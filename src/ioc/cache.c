@@ -0,0 +1,918 @@
+/* Copyright (C) 2019 Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted for any purpose (including commercial purposes)
+ * provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the
+ *    documentation and/or materials provided with the distribution.
+ *
+ * 3. In addition, redistributions of modified forms of the source or binary
+ *    code must carry prominent notices stating that the original code was
+ *    changed and the date of the change.
+ *
+ *  4. All publications or advertising materials mentioning features or use of
+ *     this software are asked, but not required, to acknowledge that it was
+ *     developed by Intel Corporation and credit the contributors.
+ *
+ * 5. Neither the name of Intel Corporation, nor the name of any Contributor
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Local data cache for DataWarp cache mode projections.
+ *
+ * Data read from files opened read-only is written in the background to a
+ * file per inode in a local directory, normally on node-local flash, and
+ * later reads which are entirely covered by cached blocks are answered from
+ * there without an RPC.  Each open checks the size and modification time of
+ * the file on the IONSS against those the data was cached with, and discards
+ * the data if either has changed, which gives the same close-to-open
+ * consistency as the kernel page cache.  Local writes and truncates also
+ * discard any cached data for the file.
+ *
+ * The cache is bounded in size with the least recently used files which are
+ * not open evicted first.  On shutdown the map of cached blocks for each file
+ * is saved next to the data, so the cache can be used by the next CNSS on the
+ * same node, for example by a later step of the same job.
+ */
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "iof_common.h"
+#include "ioc.h"
+#include "log.h"
+
+#define CACHE_MAP_MAGIC 0x10fcace1
+
+struct ioc_cache_entry {
+	d_list_t	ce_link;
+	d_list_t	ce_lru;
+	fuse_ino_t	ce_ino;
+	/** Data file, only open while the entry is referenced */
+	int		ce_fd;
+	int		ce_ref;
+	/** Incremented whenever the cached data is discarded */
+	uint64_t	ce_gen;
+	/** Set once the file has been checked against the IONSS */
+	bool		ce_valid;
+	/** Size and modification time of the file the data was read from */
+	off_t		ce_size;
+	struct timespec	ce_mtime;
+	/** Bitmap of the blocks held */
+	uint8_t		*ce_map;
+	uint64_t	ce_blocks;
+	uint64_t	ce_used;
+};
+
+/* Header of the block map saved for each file on shutdown */
+struct cache_map_hdr {
+	uint32_t	magic;
+	uint32_t	block;
+	uint64_t	size;
+	int64_t		mtime_sec;
+	int64_t		mtime_nsec;
+	uint64_t	blocks;
+};
+
+/* Data read from the IONSS, waiting to be written to the cache */
+struct cache_fill {
+	d_list_t		cf_link;
+	struct ioc_cache_entry	*cf_ce;
+	uint64_t		cf_gen;
+	off_t			cf_off;
+	size_t			cf_len;
+	char			cf_data[];
+};
+
+/* A check of a file against the IONSS, sent on open */
+struct cache_check {
+	struct ioc_cache	*cc;
+	struct ioc_cache_entry	*ce;
+	uint64_t		gen;
+};
+
+static uint64_t
+cache_nblocks(off_t size)
+{
+	return (size + IOC_CACHE_BLOCK - 1) / IOC_CACHE_BLOCK;
+}
+
+static bool
+cache_has_block(struct ioc_cache_entry *ce, uint64_t blk)
+{
+	return ce->ce_map[blk / 8] & (1 << (blk % 8));
+}
+
+/* Bytes of data in a block, only the last block of a file may be short */
+static size_t
+cache_block_len(struct ioc_cache_entry *ce, uint64_t blk)
+{
+	off_t start = blk * IOC_CACHE_BLOCK;
+
+	if (start + IOC_CACHE_BLOCK > ce->ce_size)
+		return ce->ce_size - start;
+	return IOC_CACHE_BLOCK;
+}
+
+static void
+cache_path(struct ioc_cache *cc, fuse_ino_t ino, const char *suffix,
+	   char *path, size_t len)
+{
+	snprintf(path, len, "%s/%lu%s", cc->cc_dir, ino, suffix);
+}
+
+static d_list_t *
+cache_bucket(struct ioc_cache *cc, fuse_ino_t ino)
+{
+	return &cc->cc_buckets[ino & (IOC_CACHE_BUCKETS - 1)];
+}
+
+/* Find an entry, should be called with cc_lock held */
+static struct ioc_cache_entry *
+cache_find(struct ioc_cache *cc, fuse_ino_t ino)
+{
+	struct ioc_cache_entry *ce;
+
+	d_list_for_each_entry(ce, cache_bucket(cc, ino), ce_link) {
+		if (ce->ce_ino == ino)
+			return ce;
+	}
+	return NULL;
+}
+
+static void
+cache_add(struct ioc_cache *cc, struct ioc_cache_entry *ce)
+{
+	d_list_add(&ce->ce_link, cache_bucket(cc, ce->ce_ino));
+	d_list_add_tail(&ce->ce_lru, &cc->cc_lru);
+	cc->cc_count++;
+	cc->cc_used += ce->ce_used;
+}
+
+/* Unlink and free an unreferenced entry along with its data, should be called
+ * with cc_lock held.
+ */
+static void
+cache_del(struct ioc_cache *cc, struct ioc_cache_entry *ce)
+{
+	char path[PATH_MAX];
+
+	d_list_del(&ce->ce_link);
+	d_list_del(&ce->ce_lru);
+	cc->cc_count--;
+	cc->cc_used -= ce->ce_used;
+
+	cache_path(cc, ce->ce_ino, "", path, sizeof(path));
+	unlink(path);
+
+	D_FREE(ce->ce_map);
+	D_FREE(ce);
+}
+
+/* Evict unreferenced entries, oldest first, until there is room for another
+ * len bytes and count entries.  Should be called with cc_lock held.
+ */
+static bool
+cache_evict(struct ioc_cache *cc, uint64_t len, uint32_t count)
+{
+	struct ioc_cache_entry *ce, *next;
+
+	d_list_for_each_entry_safe(ce, next, &cc->cc_lru, ce_lru) {
+		if (cc->cc_used + len <= cc->cc_capacity &&
+		    cc->cc_count + count <= IOC_CACHE_MAX)
+			return true;
+		if (ce->ce_ref != 0)
+			continue;
+		cache_del(cc, ce);
+		atomic_inc(&cc->cc_evictions);
+	}
+
+	return cc->cc_used + len <= cc->cc_capacity &&
+		cc->cc_count + count <= IOC_CACHE_MAX;
+}
+
+/* Discard the data held for an entry and set the attributes of the file that
+ * any new data will be read from.  Should be called with cc_lock held.
+ */
+static bool
+cache_reset(struct ioc_cache *cc, struct ioc_cache_entry *ce, off_t size,
+	    const struct timespec *mtime)
+{
+	char path[PATH_MAX];
+	int rc;
+
+	ce->ce_gen++;
+	cc->cc_used -= ce->ce_used;
+	ce->ce_used = 0;
+	ce->ce_size = size;
+	ce->ce_mtime = *mtime;
+
+	if (ce->ce_fd != -1) {
+		rc = ftruncate(ce->ce_fd, 0);
+	} else {
+		cache_path(cc, ce->ce_ino, "", path, sizeof(path));
+		rc = truncate(path, 0);
+		if (rc != 0 && errno == ENOENT)
+			rc = 0;
+	}
+	if (rc != 0)
+		IOF_LOG_WARNING("Could not truncate cache file for %lu %d:%s",
+				ce->ce_ino, errno, strerror(errno));
+
+	D_FREE(ce->ce_map);
+	ce->ce_blocks = cache_nblocks(size);
+	D_ALLOC(ce->ce_map, ce->ce_blocks / 8 + 1);
+
+	return rc == 0 && ce->ce_map;
+}
+
+/* Take a reference on an entry, opening the data file if this is the first.
+ * Should be called with cc_lock held.
+ */
+static int
+cache_get(struct ioc_cache *cc, struct ioc_cache_entry *ce)
+{
+	char path[PATH_MAX];
+
+	if (ce->ce_ref == 0) {
+		cache_path(cc, ce->ce_ino, "", path, sizeof(path));
+		ce->ce_fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+		if (ce->ce_fd == -1)
+			return errno;
+	}
+	ce->ce_ref++;
+	return 0;
+}
+
+/* Drop a reference on an entry, should be called with cc_lock held */
+static void
+cache_put(struct ioc_cache *cc, struct ioc_cache_entry *ce)
+{
+	if (--ce->ce_ref == 0) {
+		close(ce->ce_fd);
+		ce->ce_fd = -1;
+	}
+}
+
+/* Write read data to the cache files, marking the blocks present once it is
+ * written.  Data is only used if the entry has not been reset since it was
+ * read, and space is reserved before writing so the cache never holds more
+ * than its capacity.
+ */
+static void *
+cache_fill_thread(void *arg)
+{
+	struct ioc_cache *cc = arg;
+	struct ioc_cache_entry *ce;
+	struct cache_fill *cf;
+	ssize_t written;
+	uint64_t blk;
+	bool room;
+
+	D_MUTEX_LOCK(&cc->cc_lock);
+	for (;;) {
+		cf = d_list_pop_entry(&cc->cc_fill_list, struct cache_fill,
+				      cf_link);
+		if (!cf) {
+			if (cc->cc_stop)
+				break;
+			pthread_cond_wait(&cc->cc_fill_cond, &cc->cc_lock);
+			continue;
+		}
+		ce = cf->cf_ce;
+
+		room = cf->cf_gen == ce->ce_gen &&
+			cache_evict(cc, cf->cf_len, 0);
+		if (room)
+			cc->cc_used += cf->cf_len;
+		D_MUTEX_UNLOCK(&cc->cc_lock);
+
+		written = -1;
+		if (room) {
+			written = pwrite(ce->ce_fd, cf->cf_data, cf->cf_len,
+					 cf->cf_off);
+			if (written != cf->cf_len)
+				IOF_LOG_WARNING("Could not write cache file for %lu %d:%s",
+						ce->ce_ino, errno,
+						strerror(errno));
+		}
+
+		D_MUTEX_LOCK(&cc->cc_lock);
+		if (room)
+			cc->cc_used -= cf->cf_len;
+		if (written == cf->cf_len && cf->cf_gen == ce->ce_gen) {
+			for (blk = cf->cf_off / IOC_CACHE_BLOCK;
+			     blk < cache_nblocks(cf->cf_off + cf->cf_len);
+			     blk++) {
+				if (cache_has_block(ce, blk))
+					continue;
+				ce->ce_map[blk / 8] |= 1 << (blk % 8);
+				ce->ce_used += cache_block_len(ce, blk);
+				cc->cc_used += cache_block_len(ce, blk);
+				atomic_inc(&cc->cc_fills);
+			}
+		}
+		cc->cc_fill_bytes -= cf->cf_len;
+		cache_put(cc, ce);
+		D_FREE(cf);
+	}
+	D_MUTEX_UNLOCK(&cc->cc_lock);
+
+	return NULL;
+}
+
+/* Load the block maps saved by a previous CNSS.  Maps are removed once
+ * loaded, so if this CNSS does not shut down cleanly the data is not reused,
+ * and data files without a map are removed as their contents are unknown.
+ */
+static void
+cache_load(struct ioc_cache *cc)
+{
+	struct ioc_cache_entry *ce;
+	struct cache_map_hdr hdr;
+	struct dirent *de;
+	struct stat st;
+	char path[PATH_MAX];
+	fuse_ino_t ino;
+	uint64_t blk;
+	off_t end;
+	size_t len;
+	char *tail;
+	DIR *dir;
+	int fd;
+
+	dir = opendir(cc->cc_dir);
+	if (!dir)
+		return;
+
+	while ((de = readdir(dir))) {
+		ino = strtoul(de->d_name, &tail, 10);
+		if (tail == de->d_name || strcmp(tail, ".map") != 0)
+			continue;
+
+		cache_path(cc, ino, ".map", path, sizeof(path));
+		fd = open(path, O_RDONLY | O_CLOEXEC);
+		unlink(path);
+		if (fd == -1)
+			continue;
+
+		ce = NULL;
+		if (read(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+		    hdr.magic != CACHE_MAP_MAGIC ||
+		    hdr.block != IOC_CACHE_BLOCK ||
+		    hdr.blocks != cache_nblocks(hdr.size) ||
+		    cache_find(cc, ino) || cc->cc_count >= IOC_CACHE_MAX)
+			D_GOTO(next, 0);
+
+		D_ALLOC_PTR(ce);
+		if (!ce)
+			D_GOTO(next, 0);
+
+		len = hdr.blocks / 8 + 1;
+		D_ALLOC(ce->ce_map, len);
+		if (!ce->ce_map || read(fd, ce->ce_map, len) != len)
+			D_GOTO(next, 0);
+
+		ce->ce_ino = ino;
+		ce->ce_fd = -1;
+		ce->ce_size = hdr.size;
+		ce->ce_mtime.tv_sec = hdr.mtime_sec;
+		ce->ce_mtime.tv_nsec = hdr.mtime_nsec;
+		ce->ce_blocks = hdr.blocks;
+
+		end = 0;
+		for (blk = 0; blk < ce->ce_blocks; blk++) {
+			if (!cache_has_block(ce, blk))
+				continue;
+			ce->ce_used += cache_block_len(ce, blk);
+			end = blk * IOC_CACHE_BLOCK + cache_block_len(ce, blk);
+		}
+
+		/* Check the data file holds every block in the map */
+		cache_path(cc, ino, "", path, sizeof(path));
+		if (ce->ce_used == 0 || stat(path, &st) != 0 ||
+		    st.st_size < end)
+			D_GOTO(next, 0);
+
+		cache_add(cc, ce);
+		ce = NULL;
+next:
+		if (ce) {
+			D_FREE(ce->ce_map);
+			D_FREE(ce);
+		}
+		close(fd);
+	}
+
+	rewinddir(dir);
+	while ((de = readdir(dir))) {
+		ino = strtoul(de->d_name, &tail, 10);
+		if (tail == de->d_name || *tail != '\0' || cache_find(cc, ino))
+			continue;
+		cache_path(cc, ino, "", path, sizeof(path));
+		unlink(path);
+	}
+	closedir(dir);
+
+	cache_evict(cc, 0, 0);
+
+	IOF_LOG_INFO("Loaded %u files, %lu bytes from cache '%s'",
+		     cc->cc_count, cc->cc_used, cc->cc_dir);
+}
+
+/* Save the block map of an entry for the next CNSS, making sure the data it
+ * describes is on disk first.
+ */
+static void
+cache_save(struct ioc_cache *cc, struct ioc_cache_entry *ce)
+{
+	struct cache_map_hdr hdr = {0};
+	char path[PATH_MAX];
+	size_t len = ce->ce_blocks / 8 + 1;
+	int fd;
+	int rc;
+
+	cache_path(cc, ce->ce_ino, "", path, sizeof(path));
+	if (ce->ce_used == 0) {
+		unlink(path);
+		return;
+	}
+
+	fd = open(path, O_RDWR | O_CLOEXEC);
+	if (fd == -1)
+		return;
+	rc = fdatasync(fd);
+	close(fd);
+	if (rc != 0)
+		return;
+
+	hdr.magic = CACHE_MAP_MAGIC;
+	hdr.block = IOC_CACHE_BLOCK;
+	hdr.size = ce->ce_size;
+	hdr.mtime_sec = ce->ce_mtime.tv_sec;
+	hdr.mtime_nsec = ce->ce_mtime.tv_nsec;
+	hdr.blocks = ce->ce_blocks;
+
+	cache_path(cc, ce->ce_ino, ".map", path, sizeof(path));
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (fd == -1)
+		return;
+	if (write(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+	    write(fd, ce->ce_map, len) != len)
+		unlink(path);
+	close(fd);
+}
+
+int
+ioc_cache_init(struct iof_projection_info *fs_handle, const char *root,
+	       uint64_t capacity)
+{
+	struct ioc_cache *cc;
+	int rc;
+	int i;
+
+	D_ALLOC_PTR(cc);
+	if (!cc)
+		return -DER_NOMEM;
+
+	D_ASPRINTF(cc->cc_dir, "%s/%s", root, fs_handle->mnt_dir.name);
+	if (!cc->cc_dir)
+		D_GOTO(free_cc, rc = -DER_NOMEM);
+
+	if ((mkdir(root, 0700) != 0 && errno != EEXIST) ||
+	    (mkdir(cc->cc_dir, 0700) != 0 && errno != EEXIST)) {
+		IOF_TRACE_WARNING(fs_handle,
+				  "Could not create cache dir '%s' %d:%s",
+				  cc->cc_dir, errno, strerror(errno));
+		D_GOTO(free_dir, rc = -DER_MISC);
+	}
+
+	D_ALLOC_ARRAY(cc->cc_buckets, IOC_CACHE_BUCKETS);
+	if (!cc->cc_buckets)
+		D_GOTO(free_dir, rc = -DER_NOMEM);
+
+	for (i = 0; i < IOC_CACHE_BUCKETS; i++)
+		D_INIT_LIST_HEAD(&cc->cc_buckets[i]);
+	D_INIT_LIST_HEAD(&cc->cc_lru);
+	D_INIT_LIST_HEAD(&cc->cc_fill_list);
+	cc->cc_capacity = capacity;
+
+	rc = D_MUTEX_INIT(&cc->cc_lock, NULL);
+	if (rc != -DER_SUCCESS)
+		D_GOTO(free_buckets, 0);
+
+	rc = pthread_cond_init(&cc->cc_fill_cond, NULL);
+	if (rc != 0)
+		D_GOTO(free_lock, rc = -DER_MISC);
+
+	cache_load(cc);
+
+	rc = pthread_create(&cc->cc_fill_thread, NULL, cache_fill_thread, cc);
+	if (rc != 0)
+		D_GOTO(free_cond, rc = -DER_MISC);
+
+	IOF_TRACE_INFO(fs_handle, "Caching data in '%s', capacity %lu",
+		       cc->cc_dir, cc->cc_capacity);
+
+	fs_handle->cache = cc;
+	return -DER_SUCCESS;
+
+free_cond:
+	pthread_cond_destroy(&cc->cc_fill_cond);
+	/* Keep any data loaded for the next attempt */
+	while (!d_list_empty(&cc->cc_lru)) {
+		struct ioc_cache_entry *ce;
+
+		ce = d_list_entry(cc->cc_lru.next, struct ioc_cache_entry,
+				  ce_lru);
+		d_list_del(&ce->ce_lru);
+		cache_save(cc, ce);
+		D_FREE(ce->ce_map);
+		D_FREE(ce);
+	}
+free_lock:
+	D_MUTEX_DESTROY(&cc->cc_lock);
+free_buckets:
+	D_FREE(cc->cc_buckets);
+free_dir:
+	D_FREE(cc->cc_dir);
+free_cc:
+	D_FREE(cc);
+	return rc;
+}
+
+void
+ioc_cache_fini(struct iof_projection_info *fs_handle)
+{
+	struct ioc_cache *cc = fs_handle->cache;
+	struct ioc_cache_entry *ce;
+
+	if (!cc)
+		return;
+
+	/* The fill thread writes any remaining data before exiting */
+	D_MUTEX_LOCK(&cc->cc_lock);
+	cc->cc_stop = true;
+	pthread_cond_signal(&cc->cc_fill_cond);
+	D_MUTEX_UNLOCK(&cc->cc_lock);
+	pthread_join(cc->cc_fill_thread, NULL);
+
+	IOF_TRACE_INFO(fs_handle, "Saving %u files, %lu bytes in cache",
+		       cc->cc_count, cc->cc_used);
+
+	while ((ce = d_list_pop_entry(&cc->cc_lru, struct ioc_cache_entry,
+				      ce_lru))) {
+		if (ce->ce_ref != 0)
+			close(ce->ce_fd);
+		cache_save(cc, ce);
+		D_FREE(ce->ce_map);
+		D_FREE(ce);
+	}
+
+	pthread_cond_destroy(&cc->cc_fill_cond);
+	D_MUTEX_DESTROY(&cc->cc_lock);
+	D_FREE(cc->cc_buckets);
+	D_FREE(cc->cc_dir);
+	D_FREE(cc);
+	fs_handle->cache = NULL;
+}
+
+static void
+cache_check_cb(const struct crt_cb_info *cb_info)
+{
+	struct cache_check *check = cb_info->cci_arg;
+	struct ioc_cache *cc = check->cc;
+	struct ioc_cache_entry *ce = check->ce;
+	struct iof_attr_out *out = crt_reply_get(cb_info->cci_rpc);
+	struct stat *st = &out->stat;
+
+	D_MUTEX_LOCK(&cc->cc_lock);
+
+	if (cb_info->cci_rc != 0 || out->rc != 0 || out->err != 0) {
+		IOF_LOG_WARNING("Could not check %lu, rc = %d", ce->ce_ino,
+				cb_info->cci_rc);
+		D_GOTO(done, 0);
+	}
+
+	/* Ignore the reply if the data was discarded since the check was sent,
+	 * as it may have been for a local write which is not reflected here.
+	 */
+	if (check->gen != ce->ce_gen)
+		D_GOTO(done, 0);
+
+	if (!ce->ce_map || ce->ce_size != st->st_size ||
+	    ce->ce_mtime.tv_sec != st->st_mtim.tv_sec ||
+	    ce->ce_mtime.tv_nsec != st->st_mtim.tv_nsec) {
+		if (ce->ce_used != 0)
+			atomic_inc(&cc->cc_invalidations);
+		if (!cache_reset(cc, ce, st->st_size, &st->st_mtim))
+			D_GOTO(done, 0);
+	}
+	ce->ce_valid = true;
+
+done:
+	cache_put(cc, ce);
+	D_MUTEX_UNLOCK(&cc->cc_lock);
+	D_FREE(check);
+}
+
+/* Called once a file is open.  Writeable opens discard any cached data,
+ * read-only opens take a reference on the entry for the file and check it
+ * against the IONSS, with reads sent to the IONSS until the check completes.
+ */
+void
+ioc_cache_open(struct iof_file_handle *handle)
+{
+	struct iof_projection_info *fs_handle = handle->open_req.fsh;
+	struct ioc_cache *cc = fs_handle->cache;
+	struct ioc_cache_entry *ce = NULL;
+	struct cache_check *check;
+	struct iof_gah_in *in;
+	crt_rpc_t *rpc = NULL;
+	int rc;
+
+	if (!cc)
+		return;
+
+	if ((handle->flags & O_ACCMODE) != O_RDONLY) {
+		ioc_cache_invalidate(fs_handle, handle->inode_num);
+		return;
+	}
+
+	D_ALLOC_PTR(check);
+	if (!check)
+		return;
+
+	rc = crt_req_create(fs_handle->proj.crt_ctx, &handle->common.ep,
+			    FS_TO_OP(fs_handle, getattr), &rpc);
+	if (rc || !rpc) {
+		IOF_TRACE_WARNING(handle, "Could not create request, rc = %d",
+				  rc);
+		D_FREE(check);
+		return;
+	}
+
+	in = crt_req_get(rpc);
+	in->gah = handle->common.gah;
+
+	D_MUTEX_LOCK(&cc->cc_lock);
+
+	ce = cache_find(cc, handle->inode_num);
+	if (ce) {
+		d_list_del(&ce->ce_lru);
+		d_list_add_tail(&ce->ce_lru, &cc->cc_lru);
+	} else {
+		if (!cache_evict(cc, 0, 1))
+			D_GOTO(err, 0);
+		D_ALLOC_PTR(ce);
+		if (!ce)
+			D_GOTO(err, 0);
+		ce->ce_ino = handle->inode_num;
+		ce->ce_fd = -1;
+		cache_add(cc, ce);
+	}
+
+	/* One reference for the handle, and one for the check */
+	rc = cache_get(cc, ce);
+	if (rc != 0) {
+		IOF_TRACE_WARNING(handle, "Could not open cache file %d:%s",
+				  rc, strerror(rc));
+		D_GOTO(err, 0);
+	}
+	ce->ce_ref++;
+	ce->ce_valid = false;
+
+	check->cc = cc;
+	check->ce = ce;
+	check->gen = ce->ce_gen;
+	handle->cache_entry = ce;
+
+	D_MUTEX_UNLOCK(&cc->cc_lock);
+
+	rc = crt_req_send(rpc, cache_check_cb, check);
+	if (rc) {
+		IOF_TRACE_WARNING(handle, "Could not send rpc, rc = %d", rc);
+		D_MUTEX_LOCK(&cc->cc_lock);
+		cache_put(cc, ce);
+		D_MUTEX_UNLOCK(&cc->cc_lock);
+		D_FREE(check);
+	}
+	return;
+
+err:
+	D_MUTEX_UNLOCK(&cc->cc_lock);
+	crt_req_decref(rpc);
+	D_FREE(check);
+}
+
+void
+ioc_cache_release(struct iof_file_handle *handle)
+{
+	struct ioc_cache *cc = handle->open_req.fsh->cache;
+
+	if (!handle->cache_entry)
+		return;
+
+	D_MUTEX_LOCK(&cc->cc_lock);
+	cache_put(cc, handle->cache_entry);
+	D_MUTEX_UNLOCK(&cc->cc_lock);
+	handle->cache_entry = NULL;
+}
+
+/* Answer a read from the cache if every block it covers is present.
+ *
+ * Returns true if the read has been replied to.
+ */
+bool
+ioc_cache_read(struct iof_file_handle *handle, fuse_req_t req, off_t position,
+	       size_t len)
+{
+	struct ioc_cache_entry *ce = handle->cache_entry;
+	struct fuse_bufvec bufv = FUSE_BUFVEC_INIT(0);
+	struct ioc_cache *cc;
+	off_t end = position + len;
+	bool hit = false;
+	uint64_t blk;
+	int rc;
+
+	if (!ce)
+		return false;
+
+	cc = handle->open_req.fsh->cache;
+
+	D_MUTEX_LOCK(&cc->cc_lock);
+	if (!ce->ce_valid)
+		D_GOTO(out, 0);
+
+	if (end > ce->ce_size)
+		end = ce->ce_size;
+
+	hit = true;
+	for (blk = position / IOC_CACHE_BLOCK;
+	     position < end && blk <= (end - 1) / IOC_CACHE_BLOCK; blk++) {
+		if (!cache_has_block(ce, blk)) {
+			hit = false;
+			break;
+		}
+	}
+
+	if (hit) {
+		d_list_del(&ce->ce_lru);
+		d_list_add_tail(&ce->ce_lru, &cc->cc_lru);
+	}
+out:
+	D_MUTEX_UNLOCK(&cc->cc_lock);
+
+	if (!hit) {
+		atomic_inc(&cc->cc_misses);
+		return false;
+	}
+
+	/* The handle holds a reference so the file stays open */
+	if (position < end)
+		bufv.buf[0].size = end - position;
+	bufv.buf[0].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+	bufv.buf[0].fd = ce->ce_fd;
+	bufv.buf[0].pos = position;
+
+	IOF_TRACE_DEBUG(handle, "%#zx-%#zx from cache", position,
+			position + bufv.buf[0].size - 1);
+
+	rc = fuse_reply_data(req, &bufv, FUSE_BUF_SPLICE_MOVE);
+	if (rc != 0)
+		IOF_TRACE_ERROR(handle, "fuse_reply_data returned %d:%s",
+				rc, strerror(-rc));
+
+	atomic_inc(&cc->cc_hits);
+	atomic_add(&cc->cc_hit_bytes, bufv.buf[0].size);
+	return true;
+}
+
+/* Queue data read from the IONSS to be written to the cache.  Only whole
+ * blocks are cached, plus the partial block at the end of the file, and data
+ * is dropped rather than queued if the fill thread is too far behind.
+ */
+void
+ioc_cache_fill(struct iof_file_handle *handle, off_t position,
+	       const void *buff, size_t len)
+{
+	struct ioc_cache_entry *ce = handle->cache_entry;
+	struct cache_fill *cf;
+	struct ioc_cache *cc;
+	off_t end = position + len;
+	uint64_t first;
+	uint64_t last;
+	uint64_t gen;
+	off_t off;
+	size_t flen;
+
+	if (!ce || len == 0)
+		return;
+
+	cc = handle->open_req.fsh->cache;
+
+	D_MUTEX_LOCK(&cc->cc_lock);
+	if (!ce->ce_valid)
+		D_GOTO(out, 0);
+
+	first = (position + IOC_CACHE_BLOCK - 1) / IOC_CACHE_BLOCK;
+	if (end >= ce->ce_size)
+		last = ce->ce_blocks;
+	else
+		last = end / IOC_CACHE_BLOCK;
+
+	while (first < last && cache_has_block(ce, first))
+		first++;
+	while (last > first && cache_has_block(ce, last - 1))
+		last--;
+	if (first >= last)
+		D_GOTO(out, 0);
+
+	off = first * IOC_CACHE_BLOCK;
+	if (last * IOC_CACHE_BLOCK > ce->ce_size)
+		flen = ce->ce_size - off;
+	else
+		flen = last * IOC_CACHE_BLOCK - off;
+
+	if (cc->cc_fill_bytes + flen > IOC_CACHE_FILL_MAX)
+		D_GOTO(out, 0);
+
+	cc->cc_fill_bytes += flen;
+	ce->ce_ref++;
+	gen = ce->ce_gen;
+	D_MUTEX_UNLOCK(&cc->cc_lock);
+
+	D_ALLOC(cf, sizeof(*cf) + flen);
+	if (cf) {
+		cf->cf_ce = ce;
+		cf->cf_gen = gen;
+		cf->cf_off = off;
+		cf->cf_len = flen;
+		memcpy(cf->cf_data, (const char *)buff + (off - position),
+		       flen);
+	}
+
+	D_MUTEX_LOCK(&cc->cc_lock);
+	if (cf) {
+		d_list_add_tail(&cf->cf_link, &cc->cc_fill_list);
+		pthread_cond_signal(&cc->cc_fill_cond);
+	} else {
+		cc->cc_fill_bytes -= flen;
+		cache_put(cc, ce);
+	}
+out:
+	D_MUTEX_UNLOCK(&cc->cc_lock);
+}
+
+/* Discard any data cached for an inode, called before it is modified
+ * locally.  Reads through open handles go to the IONSS until the file is
+ * next opened and checked.
+ */
+void
+ioc_cache_invalidate(struct iof_projection_info *fs_handle, fuse_ino_t ino)
+{
+	struct ioc_cache *cc = fs_handle->cache;
+	struct ioc_cache_entry *ce;
+
+	if (!cc)
+		return;
+
+	D_MUTEX_LOCK(&cc->cc_lock);
+	ce = cache_find(cc, ino);
+	if (ce) {
+		if (ce->ce_used != 0)
+			atomic_inc(&cc->cc_invalidations);
+
+		/* Changing the generation also stops any check or fill which
+		 * is in progress from using data read before the write.
+		 */
+		if (ce->ce_ref == 0) {
+			cache_del(cc, ce);
+		} else if (ce->ce_used != 0) {
+			ce->ce_valid = false;
+			cache_reset(cc, ce, ce->ce_size, &ce->ce_mtime);
+		} else {
+			ce->ce_valid = false;
+			ce->ce_gen++;
+		}
+	}
+	D_MUTEX_UNLOCK(&cc->cc_lock);
+}
@@ -185,13 +185,21 @@ void ie_close(struct iof_projection_info *fs_handle, struct ioc_inode_entry *ie)
 
 	drop_ino_ref(fs_handle, ie->parent);
 
+	ioc_md_close(fs_handle, ie);
+
 	if (FS_IS_OFFLINE(fs_handle))
 		D_GOTO(err, rc = fs_handle->offline_reason);
 
 	if (!H_GAH_IS_VALID(ie))
 		D_GOTO(out, 0);
 
-	if (ie->gah.root != atomic_load_consume(&fs_handle->proj.grp->pri_srv_rank)) {
+	/* With striped metadata or load balancing inodes are opened on
+	 * every rank
+	 */
+	if (!(fs_handle->flags &
+	      (IOF_STRIPED_METADATA | IOF_LOAD_BALANCE)) &&
+	    ie->gah.root !=
+	    atomic_load_consume(&fs_handle->proj.grp->pri_srv_rank)) {
 		IOF_TRACE_WARNING(ie,
 				  "Gah with old root %lu " GAH_PRINT_STR,
 				  ie->stat.st_ino, GAH_PRINT_VAL(ie->gah));
@@ -82,6 +82,224 @@ struct iof_stats {
 	ATOMIC unsigned int lookup;
 	ATOMIC unsigned int forget;
 	ATOMIC unsigned int setattr;
+	ATOMIC unsigned int copy;
+	ATOMIC unsigned int fallocate;
+	ATOMIC unsigned int flush;
+};
+
+/**
+ * Methods of replying to the kernel with read data.
+ *
+ * BUF uses fuse_reply_buf() which is a writev() of the bulk buffer, DATA
+ * uses fuse_reply_data() over the same memory, and SPLICE vmsplices the
+ * bulk buffer into a pipe which is then spliced into the fuse device.
+ * AUTO times all three per size class and uses the fastest.
+ */
+enum ioc_read_reply {
+	IOC_READ_REPLY_BUF,
+	IOC_READ_REPLY_DATA,
+	IOC_READ_REPLY_SPLICE,
+	IOC_READ_REPLY_AUTO,
+};
+
+/** Number of timed reply methods, AUTO is a selector only */
+#define IOC_READ_REPLY_METHODS IOC_READ_REPLY_AUTO
+
+/** Number of power-of-two size classes, from 4KiB to 1MiB and above */
+#define IOC_READ_REPLY_CLASSES 9
+
+/** Number of samples of each method taken per size class in AUTO mode */
+#define IOC_READ_REPLY_SAMPLES 32
+
+/** In AUTO mode every method is re-sampled once in this many calls */
+#define IOC_READ_REPLY_RESAMPLE 4096
+
+struct ioc_read_reply_stat {
+	ATOMIC uint64_t count;
+	ATOMIC uint64_t nsec;
+};
+
+/** Per size class timing of reply methods */
+struct ioc_read_reply_bench {
+	struct ioc_read_reply_stat
+		stat[IOC_READ_REPLY_CLASSES][IOC_READ_REPLY_METHODS];
+	/** Number of replies made in each size class */
+	ATOMIC uint64_t calls[IOC_READ_REPLY_CLASSES];
+	/** Fastest method seen so far for each size class */
+	ATOMIC int best[IOC_READ_REPLY_CLASSES];
+};
+
+extern const char * const ioc_read_reply_names[];
+
+/** Smallest I/O buffer size class, 4KiB */
+#define IOC_BUF_CLASS_SHIFT 12
+
+/** Maximum number of power-of-two I/O buffer size classes, from 4KiB to
+ * 8MiB.  The largest class in use is sized to max_read or max_write.
+ */
+#define IOC_BUF_CLASSES 12
+
+/** Number of hash buckets in the negative dentry cache */
+#define IOC_NEG_BUCKETS 1024
+
+/** Default maximum number of negative dentry cache entries */
+#define IOC_NEG_MAX 8192
+
+/** Default lifetime of a negative dentry in seconds, both in the client
+ * cache and as the entry timeout reported to the kernel.
+ */
+#define IOC_NEG_TIMEOUT 1
+
+/** Negative dentry cache, see neg_cache.c */
+struct ioc_neg_cache {
+	pthread_mutex_t			nc_lock;
+	d_list_t			*nc_buckets;
+	/** Entries in the order they were last added, oldest first */
+	d_list_t			nc_lru;
+	uint32_t			nc_count;
+	uint32_t			nc_max;
+	/** Incremented on every local create, see ioc_neg_insert() */
+	uint64_t			nc_gen;
+	/** Entry lifetime in seconds, 0 disables the cache */
+	ATOMIC uint32_t			nc_timeout;
+	ATOMIC uint64_t			nc_hits;
+	ATOMIC uint64_t			nc_misses;
+	ATOMIC uint64_t			nc_evictions;
+	ATOMIC uint64_t			nc_invalidations;
+};
+
+/** Size of a block in the local data cache.  Data is only cached from reads
+ * which cover whole blocks, apart from the last block of a file, so this
+ * should be no larger than the reads the kernel sends.
+ */
+#define IOC_CACHE_BLOCK (64 * 1024)
+
+/** Default capacity of the local data cache in bytes */
+#define IOC_CACHE_SIZE (1024ULL * 1024 * 1024)
+
+/** Number of hash buckets in the local data cache */
+#define IOC_CACHE_BUCKETS 1024
+
+/** Maximum number of files in the local data cache */
+#define IOC_CACHE_MAX 16384
+
+/** Maximum bytes of read data waiting to be written to the local cache */
+#define IOC_CACHE_FILL_MAX (64 * 1024 * 1024)
+
+struct ioc_cache_entry;
+
+/** Local data cache for DataWarp cache mode projections, see cache.c */
+struct ioc_cache {
+	pthread_mutex_t			cc_lock;
+	/** Directory holding the cached data for this projection */
+	char				*cc_dir;
+	d_list_t			*cc_buckets;
+	/** Entries in the order they were last used, oldest first */
+	d_list_t			cc_lru;
+	uint32_t			cc_count;
+	/** Bytes of data held, and the maximum allowed */
+	uint64_t			cc_used;
+	uint64_t			cc_capacity;
+	/** Blocks waiting to be written by the fill thread */
+	d_list_t			cc_fill_list;
+	uint64_t			cc_fill_bytes;
+	pthread_cond_t			cc_fill_cond;
+	pthread_t			cc_fill_thread;
+	bool				cc_stop;
+	ATOMIC uint64_t			cc_hits;
+	ATOMIC uint64_t			cc_hit_bytes;
+	ATOMIC uint64_t			cc_misses;
+	ATOMIC uint64_t			cc_fills;
+	ATOMIC uint64_t			cc_evictions;
+	ATOMIC uint64_t			cc_invalidations;
+};
+
+/** Default maximum bytes of absorbed writes held in scratch mode */
+#define IOC_SCRATCH_SIZE (4ULL * 1024 * 1024 * 1024)
+
+/** When absorbed writes must have reached the IONSS, see scratch.c */
+enum ioc_scratch_drain {
+	/** fsync() and close() wait for the data to be drained */
+	IOC_SCRATCH_DRAIN_CLOSE,
+	/** Neither waits, fsync() only syncs the local copy */
+	IOC_SCRATCH_DRAIN_ASYNC,
+};
+
+struct ioc_scratch_log;
+struct scratch_extent;
+
+/** Number of drain threads for each projection, and so the number of
+ * extents which can be sent to the IONSS at once
+ */
+#define IOC_SCRATCH_DRAINERS 4
+
+/** A drain thread, see scratch.c */
+struct ioc_scratch_drainer {
+	struct iof_projection_info	*sd_fs_handle;
+	pthread_t			sd_thread;
+	/** Buffer the thread sends data from */
+	struct iof_local_bulk		sd_lb;
+	/** Extent being sent, NULL when idle */
+	struct scratch_extent		*sd_se;
+};
+
+/** Local write absorption for DataWarp scratch mode projections, see
+ * scratch.c
+ */
+struct ioc_scratch {
+	pthread_mutex_t			sc_lock;
+	/** Signalled when there is data to drain */
+	pthread_cond_t			sc_cond;
+	/** Signalled whenever data has been drained */
+	pthread_cond_t			sc_drained_cond;
+	/** Directory holding the logs for this projection */
+	char				*sc_dir;
+	/** Logs of open handles, and of closed handles still draining */
+	d_list_t			sc_logs;
+	/** Extents waiting to be drained, oldest first */
+	d_list_t			sc_extents;
+	/** Bytes absorbed but not yet drained, and the maximum allowed */
+	uint64_t			sc_backlog;
+	uint64_t			sc_capacity;
+	/** Number of closed handles waiting for their log to drain */
+	uint32_t			sc_releasing;
+	bool				sc_stop;
+	struct ioc_scratch_drainer	sc_drainers[IOC_SCRATCH_DRAINERS];
+	/** Number of drain threads which were started */
+	int				sc_threads;
+	/** An ioc_scratch_drain */
+	ATOMIC int			sc_drain;
+	ATOMIC uint64_t			sc_absorbed;
+	ATOMIC uint64_t			sc_drained;
+	ATOMIC uint64_t			sc_rpcs;
+	ATOMIC uint64_t			sc_errors;
+	ATOMIC uint64_t			sc_waits;
+};
+
+struct iof_ctx;
+
+/** A size class of I/O buffers on a context.
+ *
+ * Each class has its own pool, with the class as the pool argument, so that
+ * descriptors can be initialised with the buffer size of the class.
+ */
+struct ioc_buf_class {
+	struct iof_pool			pool;
+	struct iof_ctx			*ctx;
+	/** Bulk buffer size of read descriptors, 0 if not used */
+	size_t				rb_size;
+	/** Bulk buffer size of write descriptors, 0 if not used */
+	size_t				wb_size;
+	struct iof_pool_type		*rb_pool;
+	struct iof_pool_type		*wb_pool;
+};
+
+/** Per size class usage counters, shared by all contexts */
+struct ioc_buf_class_stats {
+	ATOMIC uint64_t			reads;
+	ATOMIC uint64_t			read_bytes;
+	ATOMIC uint64_t			writes;
+	ATOMIC uint64_t			write_bytes;
 };
 
 /**
@@ -103,6 +321,15 @@ struct iof_ctx {
 	uint32_t			poll_interval;
 	/** Callback function to pass to crt_progress() */
 	crt_progress_cond_cb_t		callback_fn;
+	/** Projection using this context, NULL for the global context */
+	struct iof_projection_info	*fs_handle;
+	/** Pools of I/O descriptors with RPCs created on this context,
+	 * one per buffer size class.
+	 */
+	struct ioc_buf_class		buf_class[IOC_BUF_CLASSES];
+	int				buf_classes;
+	/** Number of RPCs currently in flight on this context */
+	ATOMIC uint64_t			queue_depth;
 };
 
 /**
@@ -164,8 +391,15 @@ enum iof_failover_state {
 
 struct iof_projection_info {
 	struct iof_projection		proj;
+	/** Array of contexts, each with a progress thread.
+	 *
+	 * The first entry uses proj.crt_ctx and is used for all metadata
+	 * requests, every entry has its own pool of I/O descriptors.
+	 */
 	struct iof_ctx			*ctx_array;
 	int ctx_num;
+	/** Counter used to distribute reads across contexts */
+	ATOMIC unsigned int		ctx_next;
 	struct iof_state		*iof_state;
 	struct ios_gah			gah;
 	d_list_t			link;
@@ -185,6 +419,20 @@ struct iof_projection_info {
 	/** Feature Flags */
 	uint64_t			flags;
 	int				fs_id;
+	/** Size of each stripe in bytes, zero if data is not striped */
+	uint32_t			stripe_size;
+	/** Number of ranks file data or metadata is striped over */
+	uint32_t			stripe_count;
+	/** Root GAH of the projection on each rank, indexed by rank */
+	struct ios_gah			*stripe_root;
+	/** Load of each rank, for projections with IOF_LOAD_BALANCE */
+	struct ioc_rank_load		*rank_load;
+	/** Time of the last load refresh, in milliseconds */
+	ATOMIC uint64_t			load_time;
+	/** Number of load RPCs in flight */
+	ATOMIC int			load_pending;
+	/** Counter used to spread requests over server contexts */
+	ATOMIC uint32_t			next_tag;
 	struct iof_pool			pool;
 	struct iof_pool_type		*dh_pool;
 	struct iof_pool_type		*fgh_pool;
@@ -194,16 +442,25 @@ struct iof_projection_info {
 	struct iof_pool_type		*mkdir_pool;
 	struct iof_pool_type		*symlink_pool;
 	struct iof_pool_type		*fh_pool;
-	struct iof_pool_type		*rb_pool_page;
-	struct iof_pool_type		*rb_pool_large;
-	struct iof_pool_type		*write_pool;
 	uint32_t			max_read;
 	uint32_t			max_iov_read;
 	uint32_t			readdir_size;
+	/** Method used to reply to read requests, an ioc_read_reply */
+	ATOMIC int			read_reply;
+	/** Timings of the read reply methods */
+	struct ioc_read_reply_bench	read_bench;
+	/** Usage of each I/O buffer size class */
+	struct ioc_buf_class_stats	buf_stats[IOC_BUF_CLASSES];
 	/** set to error code if projection is off-line */
 	int				offline_reason;
 	/** Hash table of open inodes */
 	struct d_hash_table		inode_ht;
+	/** Names known not to exist */
+	struct ioc_neg_cache		neg_cache;
+	/** Local data cache, NULL unless enabled */
+	struct ioc_cache		*cache;
+	/** Local write absorption, NULL unless enabled */
+	struct ioc_scratch		*scratch;
 
 	pthread_mutex_t			od_lock;
 	/** List of directory handles owned by FUSE */
@@ -523,6 +780,8 @@ struct ioc_request {
 	fuse_req_t			req;
 	/** Callbacks to use for this request */
 	const struct ioc_request_api	*ir_api;
+	/** Context the RPC is sent on, NULL for the first context */
+	struct iof_ctx			*ir_ctx;
 	/** Error status of this request.
 	 *
 	 * This is a libc error number and is set before a call to
@@ -554,6 +813,18 @@ struct ioc_request {
 	 * actioned once failover is complete.
 	 */
 	d_list_t			ir_list;
+	/** Name used to pick a rank when metadata is striped, NULL for
+	 * requests which are sent to the rank of the GAH.
+	 */
+	const char			*ir_md_name;
+	/** Set if ir_md_gah should be sent rather than the handle GAH */
+	bool				ir_md;
+	/** GAH of the parent on the rank chosen from ir_md_name */
+	struct ios_gah			ir_md_gah;
+	/** Set if a request on the projection root may be sent to the
+	 * least loaded rank, for requests which return a new handle.
+	 */
+	bool				ir_balance;
 };
 
 /** Initialise a request.  To be called once per request */
@@ -561,6 +832,7 @@ struct ioc_request {
 	do {						\
 		(REQUEST)->fsh = FSH;			\
 		(REQUEST)->rpc = NULL;			\
+		(REQUEST)->ir_ctx = NULL;		\
 		(REQUEST)->ir_rs = RS_INIT;		\
 		D_INIT_LIST_HEAD(&(REQUEST)->ir_list);	\
 	} while (0)
@@ -574,6 +846,9 @@ struct ioc_request {
 		(REQUEST)->ir_rs = RS_RESET;				\
 		(REQUEST)->ir_ht = RHS_NONE;				\
 		(REQUEST)->ir_inode = NULL;				\
+		(REQUEST)->ir_md_name = NULL;				\
+		(REQUEST)->ir_md = false;				\
+		(REQUEST)->ir_balance = false;				\
 		(REQUEST)->rc = 0;					\
 	} while (0)
 
@@ -674,6 +949,12 @@ struct ioc_inode_entry {
 	 * Set to true during failover if this inode should be migrated
 	 */
 	bool		failover;
+
+	/** GAH of this directory on each rank, indexed by rank.
+	 * Allocated when metadata is striped and a request for an entry in
+	 * this directory is first sent to a rank other than gah.root.
+	 */
+	struct ioc_md_gah *ie_md_gah;
 };
 
 /**
@@ -743,6 +1024,34 @@ struct iof_file_handle {
 	 * the file handle is in use then this field will be NULL.
 	 */
 	struct ioc_inode_entry		*ie;
+	/** The flags the file was opened with */
+	int				flags;
+	/** Striping state, an ioc_stripe_state */
+	ATOMIC int			stripe_state;
+	/** GAH of the file on each rank, indexed by rank.  Only valid once
+	 * stripe_state is IOC_STRIPE_ON.
+	 */
+	struct ios_gah			*stripe_gah;
+	/** Entry in the local data cache, set for files opened read-only
+	 * when the cache is enabled.
+	 */
+	struct ioc_cache_entry		*cache_entry;
+	/** Log of absorbed writes, set for files opened for writing when
+	 * write absorption is enabled.
+	 */
+	struct ioc_scratch_log		*scratch_log;
+};
+
+/** Striping state of an open file */
+enum ioc_stripe_state {
+	/** Stripe handles have not been opened yet */
+	IOC_STRIPE_NONE,
+	/** Stripe handles are being opened */
+	IOC_STRIPE_BUSY,
+	/** Stripe handles are open, data I/O is spread across ranks */
+	IOC_STRIPE_ON,
+	/** Striping failed, all I/O goes to the rank which opened the file */
+	IOC_STRIPE_OFF,
 };
 
 /* GAH ok manipulation macros. gah_ok is defined as a int but we're
@@ -794,6 +1103,8 @@ struct iof_rb {
 struct iof_wb {
 	struct ioc_request		wb_req;
 	struct iof_local_bulk		lb;
+	struct iof_pool_type		*pt;
+	size_t				buf_size;
 	bool				failure;
 };
 
@@ -828,8 +1139,105 @@ struct entry_req {
 	crt_opcode_t			opcode;
 	struct iof_pool_type		*pool;
 	char				*dest;
+	/** Negative cache generation at the start of a lookup */
+	uint64_t			neg_gen;
+};
+
+/* neg_cache.c */
+
+int ioc_neg_init(struct ioc_neg_cache *, uint32_t, uint32_t);
+
+void ioc_neg_fini(struct ioc_neg_cache *);
+
+bool ioc_neg_lookup(struct ioc_neg_cache *, fuse_ino_t, const char *,
+		    uint64_t *);
+
+void ioc_neg_insert(struct ioc_neg_cache *, fuse_ino_t, const char *,
+		    uint64_t);
+
+void ioc_neg_remove(struct ioc_neg_cache *, fuse_ino_t, const char *);
+
+/* cache.c */
+
+int ioc_cache_init(struct iof_projection_info *, const char *, uint64_t);
+
+void ioc_cache_fini(struct iof_projection_info *);
+
+void ioc_cache_open(struct iof_file_handle *);
+
+void ioc_cache_release(struct iof_file_handle *);
+
+bool ioc_cache_read(struct iof_file_handle *, fuse_req_t, off_t, size_t);
+
+void ioc_cache_fill(struct iof_file_handle *, off_t, const void *, size_t);
+
+void ioc_cache_invalidate(struct iof_projection_info *, fuse_ino_t);
+
+/* scratch.c */
+
+int ioc_scratch_init(struct iof_projection_info *, const char *, uint64_t,
+		     int);
+
+void ioc_scratch_flush(struct iof_projection_info *);
+
+void ioc_scratch_fini(struct iof_projection_info *);
+
+void ioc_scratch_open(struct iof_file_handle *);
+
+int ioc_scratch_close(struct iof_file_handle *);
+
+bool ioc_scratch_release(struct iof_file_handle *);
+
+bool ioc_scratch_write(struct iof_file_handle *, fuse_req_t,
+		       struct fuse_bufvec *, off_t);
+
+bool ioc_scratch_fsync(struct iof_file_handle *, fuse_req_t);
+
+void ioc_scratch_sync(struct iof_projection_info *, fuse_ino_t);
+
+void ioc_scratch_attr(struct iof_projection_info *, struct stat *);
+
+/* stripe.c */
+
+/** GAH of a directory on a specific rank, see ioc_md_find_gah() */
+struct ioc_md_gah {
+	struct ios_gah	gah;
+	bool		valid;
+};
+
+/** Load of a rank as last reported, plus the number of requests sent to it
+ * since, used to balance lookups in the projection root.
+ */
+struct ioc_rank_load {
+	ATOMIC uint32_t	load;
+	ATOMIC uint32_t	assigned;
 };
 
+int ioc_stripe_init(struct iof_projection_info *, struct iof_fs_info *,
+		    struct iof_query_out **, uint32_t);
+
+bool ioc_stripe_active(struct iof_file_handle *, off_t, size_t);
+
+size_t ioc_stripe_map(struct iof_file_handle *, off_t, size_t,
+		      crt_endpoint_t *, struct ios_gah *);
+
+int ioc_stripe_count(struct iof_file_handle *, off_t, size_t);
+
+void ioc_stripe_fail(struct iof_file_handle *);
+
+int ioc_stripe_fsync(struct iof_file_handle *, bool);
+
+void ioc_stripe_release(struct iof_file_handle *);
+
+d_rank_t ioc_md_rank(struct iof_projection_info *, fuse_ino_t, const char *);
+
+int ioc_md_find_gah(struct iof_projection_info *, fuse_ino_t, d_rank_t,
+		    struct ios_gah *);
+
+int ioc_md_route(struct ioc_request *);
+
+void ioc_md_close(struct iof_projection_info *, struct ioc_inode_entry *);
+
 /* inode.c */
 
 /* Convert from a inode to a GAH using the hash table */
@@ -842,6 +1250,19 @@ void ie_close(struct iof_projection_info *, struct ioc_inode_entry *);
 
 int iof_fs_send(struct ioc_request *request);
 
+uint32_t ioc_gah_tag(struct iof_projection_info *, struct ios_gah *);
+
+uint32_t ioc_next_tag(struct iof_projection_info *);
+
+struct iof_ctx *ioc_ctx_for_read(struct iof_projection_info *);
+
+struct iof_ctx *ioc_ctx_for_write(struct iof_projection_info *,
+				  struct iof_file_handle *);
+
+struct ioc_buf_class *ioc_buf_class_for_read(struct iof_ctx *, size_t);
+
+struct ioc_buf_class *ioc_buf_class_for_write(struct iof_ctx *, size_t);
+
 int ioc_simple_resend(struct ioc_request *request);
 
 bool ioc_gen_cb(struct ioc_request *);
@@ -905,6 +1326,15 @@ void ioc_ll_symlink(fuse_req_t, const char *, fuse_ino_t, const char *);
 
 void ioc_ll_fsync(fuse_req_t, fuse_ino_t, int, struct fuse_file_info *);
 
+void ioc_ll_flush(fuse_req_t, fuse_ino_t, struct fuse_file_info *);
+
+void ioc_ll_copy_file_range(fuse_req_t, fuse_ino_t, off_t,
+			    struct fuse_file_info *, fuse_ino_t, off_t,
+			    struct fuse_file_info *, size_t, int);
+
+void ioc_ll_fallocate(fuse_req_t, fuse_ino_t, int, off_t, off_t,
+		      struct fuse_file_info *);
+
 bool iof_entry_cb(struct ioc_request *);
 
 #endif
@@ -113,6 +113,15 @@ ioc_fuse_init(void *arg, struct fuse_conn_info *conn)
 	conn->want |= FUSE_CAP_BIG_WRITES;
 #endif
 
+	/* Allow read replies to be spliced into the fuse device, this is
+	 * used by the splice read reply method, and by fuse_reply_data()
+	 * for larger replies.
+	 */
+	if (conn->capable & FUSE_CAP_SPLICE_WRITE)
+		conn->want |= FUSE_CAP_SPLICE_WRITE;
+	if (conn->capable & FUSE_CAP_SPLICE_MOVE)
+		conn->want |= FUSE_CAP_SPLICE_MOVE;
+
 	/* This does not work as ioctl.c assumes fi->fh is a file handle */
 	conn->want &= ~FUSE_CAP_IOCTL_DIR;
 
@@ -188,8 +197,12 @@ ioc_fuse_init(void *arg, struct fuse_conn_info *conn)
 /* Ignore the first two bits (writeable and failover) */
 #define FLAGS_TO_MODE_INDEX(X) (((X) & 0x3F) >> 2)
 
-/* Only supporting default (Private mode) at the moment */
-static uint8_t supported_impl[] = { 0x0 };
+/* Supporting default (Private mode), striped metadata and striped data,
+ * either directly or with a DataWarp scratch or cache on the client.
+ */
+static uint8_t supported_impl[] = { 0x0, 0x1, 0x2, 0x3,
+				    0x8, 0x9, 0xA, 0xB,
+				    0xC, 0xD, 0xE, 0xF };
 
 int iof_is_mode_supported(uint8_t flags)
 {
@@ -247,9 +260,17 @@ struct fuse_lowlevel_ops *iof_get_fuse_ops(uint64_t flags)
 	fuse_ops->rename = ioc_ll_rename;
 	fuse_ops->fsync = ioc_ll_fsync;
 	fuse_ops->write = ioc_ll_write;
+	fuse_ops->fallocate = ioc_ll_fallocate;
+#if FUSE_VERSION >= FUSE_MAKE_VERSION(3, 4)
+	fuse_ops->copy_file_range = ioc_ll_copy_file_range;
+#endif
 
 	if (flags & IOF_FUSE_WRITE_BUF)
 		fuse_ops->write_buf = ioc_ll_write_buf;
 
+	/* Only scratch mode has anything to report on close() */
+	if (IOF_FS_TYPE(flags) == IOF_DW_SCRATCH)
+		fuse_ops->flush = ioc_ll_flush;
+
 	return fuse_ops;
 }
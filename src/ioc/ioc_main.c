@@ -783,6 +783,8 @@ static void generic_cb(const struct crt_cb_info *cb_info)
 	D_ASSERT(request->ir_rs == RS_RESET);
 	request->ir_rs = RS_LIVE;
 
+	atomic_dec_release(&request->ir_ctx->queue_depth);
+
 	/* No Error */
 	if (cb_info->cci_rc == -DER_SUCCESS) {
 		IOF_TRACE_DEBUG(request,
@@ -859,6 +861,13 @@ iof_fs_send(struct ioc_request *request)
 			request->ir_ht = RHS_INODE;
 		}
 	}
+
+	if (request->ir_md_name) {
+		rc = ioc_md_route(request);
+		if (rc != 0)
+			D_GOTO(err, 0);
+	}
+
 	rc = iof_fs_resend(request);
 	if (rc) {
 		D_GOTO(err, 0);
@@ -910,10 +919,16 @@ iof_fs_resend(struct ioc_request *request)
 		}
 
 		D_MUTEX_UNLOCK(&request->fsh->gah_lock);
+
+		/* Striped metadata requests use the GAH of the parent on the
+		 * rank chosen by ioc_md_route().
+		 */
+		if (request->ir_md)
+			*gah = request->ir_md_gah;
+
 		IOF_TRACE_DEBUG(request, GAH_PRINT_STR, GAH_PRINT_VAL(*gah));
 	}
 
-	ep.ep_tag = 0;
 	ep.ep_grp = fs_handle->proj.grp->dest_grp;
 
 	/* Pick an appropriate rank, for most cases this is the root of the GAH
@@ -946,6 +961,18 @@ iof_fs_resend(struct ioc_request *request)
 		ep.ep_rank = fs_handle->gah.root;
 	}
 
+	if (request->ir_md)
+		ep.ep_rank = request->ir_md_gah.root;
+
+	/* Requests on an open file all go to the same server context so they
+	 * are processed in order, anything else is spread round robin.
+	 */
+	if (request->ir_ht == RHS_FILE)
+		ep.ep_tag = ioc_gah_tag(fs_handle,
+					&request->ir_file->common.gah);
+	else
+		ep.ep_tag = ioc_next_tag(fs_handle);
+
 	/* Defer clean up until the output is copied. */
 	rc = crt_req_set_endpoint(request->rpc, &ep);
 	if (rc) {
@@ -954,9 +981,18 @@ iof_fs_resend(struct ioc_request *request)
 	IOF_TRACE_INFO(request, "Sending RPC to rank %d",
 		       request->rpc->cr_ep.ep_rank);
 
+	/* Requests not allocated from a per-context pool have their RPC
+	 * created on the first context.
+	 */
+	if (!request->ir_ctx)
+		request->ir_ctx = &fs_handle->ctx_array[0];
+
+	atomic_inc(&request->ir_ctx->queue_depth);
+
 	crt_req_addref(request->rpc);
 	rc = crt_req_send(request->rpc, generic_cb, request);
 	if (rc) {
+		atomic_dec_release(&request->ir_ctx->queue_depth);
 		D_GOTO(err, ret = EIO);
 	}
 	return 0;
@@ -966,6 +1002,130 @@ err:
 	return ret;
 }
 
+/* Select the server context for requests on an open handle.
+ *
+ * The tag is fixed for the lifetime of the handle so every request for it
+ * is handled by the same context on the server, in the order sent.
+ */
+uint32_t
+ioc_gah_tag(struct iof_projection_info *fs_handle, struct ios_gah *gah)
+{
+	uint32_t count = fs_handle->proj.grp->ctx_count;
+
+	if (count < 2)
+		return 0;
+
+	return gah->fid % count;
+}
+
+/* Select the server context for a request which does not depend on any
+ * other, distributing them round robin.
+ */
+uint32_t
+ioc_next_tag(struct iof_projection_info *fs_handle)
+{
+	uint32_t count = fs_handle->proj.grp->ctx_count;
+
+	if (count < 2)
+		return 0;
+
+	return atomic_fetch_add(&fs_handle->next_tag, 1) % count;
+}
+
+/* Select the context to use for a read.
+ *
+ * Reads are independent of each other so are distributed round robin
+ * across all contexts.
+ */
+struct iof_ctx *
+ioc_ctx_for_read(struct iof_projection_info *fs_handle)
+{
+	unsigned int idx;
+
+	idx = atomic_fetch_add(&fs_handle->ctx_next, 1);
+
+	return &fs_handle->ctx_array[idx % fs_handle->ctx_num];
+}
+
+/* Select the context to use for a write.
+ *
+ * Writes are hashed on the inode so that writes to the same file are
+ * always sent, and completed, in order on one context.
+ */
+struct iof_ctx *
+ioc_ctx_for_write(struct iof_projection_info *fs_handle,
+		  struct iof_file_handle *handle)
+{
+	return &fs_handle->ctx_array[handle->inode_num % fs_handle->ctx_num];
+}
+
+/* Return the number of buffer size classes needed for buffers of up to
+ * max_size bytes.
+ */
+static int
+buf_class_count(size_t max_size)
+{
+	int count = 1;
+
+	while (count < IOC_BUF_CLASSES &&
+	       ((size_t)1 << (IOC_BUF_CLASS_SHIFT + count - 1)) < max_size)
+		count++;
+	return count;
+}
+
+/* Return the buffer size of a class, the largest class in use is sized to
+ * hold max_size bytes.
+ */
+static size_t
+buf_class_size(int idx, int count, size_t max_size)
+{
+	if (idx == count - 1)
+		return max_size;
+	return (size_t)1 << (IOC_BUF_CLASS_SHIFT + idx);
+}
+
+/* Return the index of the smallest class of at least len bytes */
+static int
+buf_class_index(size_t len, int count)
+{
+	int idx = 0;
+
+	while (idx < count - 1 &&
+	       ((size_t)1 << (IOC_BUF_CLASS_SHIFT + idx)) < len)
+		idx++;
+	return idx;
+}
+
+/* Select the buffer size class to use for a read of len bytes */
+struct ioc_buf_class *
+ioc_buf_class_for_read(struct iof_ctx *iof_ctx, size_t len)
+{
+	struct iof_projection_info *fs_handle = iof_ctx->fs_handle;
+	int idx;
+
+	idx = buf_class_index(len, buf_class_count(fs_handle->max_read));
+
+	atomic_inc(&fs_handle->buf_stats[idx].reads);
+	atomic_add(&fs_handle->buf_stats[idx].read_bytes, len);
+
+	return &iof_ctx->buf_class[idx];
+}
+
+/* Select the buffer size class to use for a write of len bytes */
+struct ioc_buf_class *
+ioc_buf_class_for_write(struct iof_ctx *iof_ctx, size_t len)
+{
+	struct iof_projection_info *fs_handle = iof_ctx->fs_handle;
+	int idx;
+
+	idx = buf_class_index(len, buf_class_count(fs_handle->proj.max_write));
+
+	atomic_inc(&fs_handle->buf_stats[idx].writes);
+	atomic_add(&fs_handle->buf_stats[idx].write_bytes, len);
+
+	return &iof_ctx->buf_class[idx];
+}
+
 static void
 query_cb(const struct crt_cb_info *cb_info)
 {
@@ -976,12 +1136,13 @@ query_cb(const struct crt_cb_info *cb_info)
 }
 
 /*
- * Send RPC to PSR to get information about projected filesystems
+ * Send RPC to an IONSS rank, normally the PSR, to get information about
+ * projected filesystems
  *
  * Returns CaRT error code.
  */
 static int
-get_info(struct iof_state *iof_state, struct iof_group_info *group,
+get_info(struct iof_state *iof_state, crt_endpoint_t *ep,
 	 crt_rpc_t **query_rpc)
 {
 	struct query_cb_r reply = {0};
@@ -991,7 +1152,7 @@ get_info(struct iof_state *iof_state, struct iof_group_info *group,
 	*query_rpc = NULL;
 
 	iof_tracker_init(&reply.tracker, 1);
-	rc = crt_req_create(iof_state->iof_ctx.crt_ctx, &group->grp.psr_ep,
+	rc = crt_req_create(iof_state->iof_ctx.crt_ctx, ep,
 			CRT_PROTO_OPC(iof_state->handshake_proto->cpf_base,
 				iof_state->handshake_proto->cpf_ver,
 				0),
@@ -1298,6 +1459,12 @@ fh_reset(void *arg)
 	/* Used by creat but not open */
 	fh->common.ep = fh->open_req.fsh->proj.grp->psr_ep;
 
+	fh->flags = 0;
+	D_FREE(fh->stripe_gah);
+	atomic_store_release(&fh->stripe_state, IOC_STRIPE_NONE);
+	fh->cache_entry = NULL;
+	fh->scratch_log = NULL;
+
 	if (!fh->ie) {
 		D_ALLOC_PTR(fh->ie);
 		if (!fh->ie)
@@ -1348,6 +1515,7 @@ fh_release(void *arg)
 	crt_req_decref(fh->release_req.rpc);
 	crt_req_decref(fh->release_req.rpc);
 	D_FREE(fh->ie);
+	D_FREE(fh->stripe_gah);
 }
 
 #define COMMON_INIT(type)						\
@@ -1466,27 +1634,20 @@ entry_release(void *arg)
 }
 
 static void
-rb_page_init(void *arg, void *handle)
+rb_init(void *arg, void *handle)
 {
 	struct iof_rb *rb = arg;
+	struct ioc_buf_class *bc = handle;
 
-	IOC_REQUEST_INIT(&rb->rb_req, handle);
-	rb->buf_size = 4096;
+	IOC_REQUEST_INIT(&rb->rb_req, bc->ctx->fs_handle);
+	rb->rb_req.ir_ctx = bc->ctx;
+	rb->buf_size = bc->rb_size;
 	rb->fbuf.count = 1;
 	rb->fbuf.buf[0].fd = -1;
 	rb->failure = false;
 	rb->lb.buf = NULL;
 }
 
-static void
-rb_large_init(void *arg, void *handle)
-{
-	struct iof_rb *rb = arg;
-
-	rb_page_init(arg, handle);
-	rb->buf_size = rb->rb_req.fsh->max_read;
-}
-
 static bool
 rb_reset(void *arg)
 {
@@ -1504,13 +1665,13 @@ rb_reset(void *arg)
 	}
 
 	if (!rb->lb.buf) {
-		IOF_BULK_ALLOC(rb->rb_req.fsh->proj.crt_ctx, rb, lb,
+		IOF_BULK_ALLOC(rb->rb_req.ir_ctx->crt_ctx, rb, lb,
 			       rb->buf_size, false);
 		if (!rb->lb.buf)
 			return false;
 	}
 
-	rc = crt_req_create(rb->rb_req.fsh->proj.crt_ctx, NULL,
+	rc = crt_req_create(rb->rb_req.ir_ctx->crt_ctx, NULL,
 			    FS_TO_IOOP(rb->rb_req.fsh, 0), &rb->rb_req.rpc);
 	if (rc || !rb->rb_req.rpc) {
 		IOF_TRACE_ERROR(rb, "Could not create request, rc = %d", rc);
@@ -1537,8 +1698,11 @@ static void
 wb_init(void *arg, void *handle)
 {
 	struct iof_wb *wb = arg;
+	struct ioc_buf_class *bc = handle;
 
-	IOC_REQUEST_INIT(&wb->wb_req, handle);
+	IOC_REQUEST_INIT(&wb->wb_req, bc->ctx->fs_handle);
+	wb->wb_req.ir_ctx = bc->ctx;
+	wb->buf_size = bc->wb_size;
 	wb->failure = false;
 	wb->lb.buf = NULL;
 }
@@ -1560,13 +1724,13 @@ wb_reset(void *arg)
 	}
 
 	if (!wb->lb.buf) {
-		IOF_BULK_ALLOC(wb->wb_req.fsh->proj.crt_ctx, wb, lb,
-			       wb->wb_req.fsh->proj.max_write, true);
+		IOF_BULK_ALLOC(wb->wb_req.ir_ctx->crt_ctx, wb, lb,
+			       wb->buf_size, true);
 		if (!wb->lb.buf)
 			return false;
 	}
 
-	rc = crt_req_create(wb->wb_req.fsh->proj.crt_ctx, NULL,
+	rc = crt_req_create(wb->wb_req.ir_ctx->crt_ctx, NULL,
 			    FS_TO_IOOP(wb->wb_req.fsh, 1), &wb->wb_req.rpc);
 	if (rc || !wb->wb_req.rpc) {
 		IOF_TRACE_ERROR(wb, "Could not create request, rc = %d", rc);
@@ -1589,6 +1753,31 @@ wb_release(void *arg)
 	IOF_BULK_FREE(wb, lb);
 }
 
+/* Reclaim the I/O descriptors of every size class on a context
+ *
+ * Returns true if there are any descriptors in use.
+ */
+static bool
+ioc_ctx_pool_reclaim(struct iof_ctx *iof_ctx)
+{
+	bool active = false;
+	int i;
+
+	for (i = 0; i < iof_ctx->buf_classes; i++)
+		if (iof_pool_reclaim(&iof_ctx->buf_class[i].pool))
+			active = true;
+	return active;
+}
+
+static void
+ioc_ctx_pool_destroy(struct iof_ctx *iof_ctx)
+{
+	int i;
+
+	for (i = 0; i < iof_ctx->buf_classes; i++)
+		iof_pool_destroy(&iof_ctx->buf_class[i].pool);
+}
+
 static int
 iof_check_complete(void *arg)
 {
@@ -1808,6 +1997,29 @@ static int failover_state_cb(char *buf, size_t buflen, void *arg)
 	return CNSS_SUCCESS;
 }
 
+/* Report the GAH of the projection root as hex, for the interception
+ * library to open files relative to.
+ */
+static int root_gah_cb(char *buf, size_t buflen, void *arg)
+{
+	struct iof_projection_info *fs_handle = arg;
+	struct ios_gah gah = fs_handle->gah;
+	unsigned char *bytes = (unsigned char *)&gah;
+	size_t i;
+
+	for (i = 0; i < sizeof(gah) && (i + 1) * 2 < buflen; i++)
+		snprintf(&buf[i * 2], 3, "%02x", bytes[i]);
+
+	return CNSS_SUCCESS;
+}
+
+static uint64_t queue_depth_read_cb(void *arg)
+{
+	struct iof_ctx *iof_ctx = arg;
+
+	return atomic_load_consume(&iof_ctx->queue_depth);
+}
+
 static uint64_t online_read_cb(void *arg)
 {
 	struct iof_projection_info *fs_handle = arg;
@@ -1830,6 +2042,332 @@ static int online_write_cb(uint64_t value, void *arg)
 	return CNSS_SUCCESS;
 }
 
+const char * const ioc_read_reply_names[] = {
+	[IOC_READ_REPLY_BUF]	= "buf",
+	[IOC_READ_REPLY_DATA]	= "data",
+	[IOC_READ_REPLY_SPLICE]	= "splice",
+	[IOC_READ_REPLY_AUTO]	= "auto",
+};
+
+static int read_reply_read_cb(char *buf, size_t buflen, void *arg)
+{
+	struct iof_projection_info *fs_handle = arg;
+	int mode = atomic_load_consume(&fs_handle->read_reply);
+
+	strncpy(buf, ioc_read_reply_names[mode], buflen);
+	return CNSS_SUCCESS;
+}
+
+static int read_reply_write_cb(const char *value, void *arg)
+{
+	struct iof_projection_info *fs_handle = arg;
+	size_t len;
+	int i;
+
+	len = strcspn(value, "\n");
+
+	for (i = 0; i <= IOC_READ_REPLY_AUTO; i++) {
+		if (strlen(ioc_read_reply_names[i]) == len &&
+		    strncmp(value, ioc_read_reply_names[i], len) == 0) {
+			IOF_TRACE_INFO(fs_handle, "Setting read reply to %s",
+				       ioc_read_reply_names[i]);
+			atomic_store_release(&fs_handle->read_reply, i);
+			return CNSS_SUCCESS;
+		}
+	}
+
+	return EINVAL;
+}
+
+/* Report the timings of each read reply method, one line per size class
+ * showing the number of replies and average time per reply in ns.
+ */
+static int read_reply_stats_cb(char *buf, size_t buflen, void *arg)
+{
+	struct iof_projection_info *fs_handle = arg;
+	struct ioc_read_reply_bench *bench = &fs_handle->read_bench;
+	uint64_t count;
+	uint64_t nsec;
+	size_t off = 0;
+	int class;
+	int i;
+
+	buf[0] = '\0';
+	for (class = 0; class < IOC_READ_REPLY_CLASSES; class++) {
+		if (off < buflen)
+			off += snprintf(buf + off, buflen - off, "%dk:",
+					4 << class);
+		for (i = 0; i < IOC_READ_REPLY_METHODS; i++) {
+			count = atomic_load_consume(&bench->stat[class][i].count);
+			nsec = atomic_load_consume(&bench->stat[class][i].nsec);
+			if (off < buflen)
+				off += snprintf(buf + off, buflen - off,
+						" %s=%lu/%lu",
+						ioc_read_reply_names[i], count,
+						count ? nsec / count : 0);
+		}
+		if (off < buflen)
+			off += snprintf(buf + off, buflen - off, " best=%s\n",
+					ioc_read_reply_names[
+					atomic_load_consume(&bench->best[class])]);
+	}
+	return CNSS_SUCCESS;
+}
+
+static uint64_t neg_timeout_read_cb(void *arg)
+{
+	struct iof_projection_info *fs_handle = arg;
+
+	return atomic_load_consume(&fs_handle->neg_cache.nc_timeout);
+}
+
+static int neg_timeout_write_cb(uint64_t value, void *arg)
+{
+	struct iof_projection_info *fs_handle = arg;
+
+	if (value > UINT32_MAX)
+		return EINVAL;
+
+	IOF_TRACE_INFO(fs_handle, "Setting negative entry timeout to %lu",
+		       value);
+	atomic_store_release(&fs_handle->neg_cache.nc_timeout, value);
+	return CNSS_SUCCESS;
+}
+
+static int neg_cache_stats_cb(char *buf, size_t buflen, void *arg)
+{
+	struct iof_projection_info *fs_handle = arg;
+	struct ioc_neg_cache *nc = &fs_handle->neg_cache;
+
+	snprintf(buf, buflen,
+		 "entries=%u hits=%lu misses=%lu evictions=%lu "
+		 "invalidations=%lu\n",
+		 nc->nc_count,
+		 atomic_load_consume(&nc->nc_hits),
+		 atomic_load_consume(&nc->nc_misses),
+		 atomic_load_consume(&nc->nc_evictions),
+		 atomic_load_consume(&nc->nc_invalidations));
+	return CNSS_SUCCESS;
+}
+
+static int cache_stats_cb(char *buf, size_t buflen, void *arg)
+{
+	struct iof_projection_info *fs_handle = arg;
+	struct ioc_cache *cc = fs_handle->cache;
+
+	D_MUTEX_LOCK(&cc->cc_lock);
+	snprintf(buf, buflen,
+		 "files=%u used=%lu pending=%lu hits=%lu hit_bytes=%lu "
+		 "misses=%lu fills=%lu evictions=%lu invalidations=%lu\n",
+		 cc->cc_count, cc->cc_used, cc->cc_fill_bytes,
+		 atomic_load_consume(&cc->cc_hits),
+		 atomic_load_consume(&cc->cc_hit_bytes),
+		 atomic_load_consume(&cc->cc_misses),
+		 atomic_load_consume(&cc->cc_fills),
+		 atomic_load_consume(&cc->cc_evictions),
+		 atomic_load_consume(&cc->cc_invalidations));
+	D_MUTEX_UNLOCK(&cc->cc_lock);
+	return CNSS_SUCCESS;
+}
+
+/* Enable the local data cache for a DataWarp cache mode projection.  The
+ * cache is kept in a directory given by CNSS_CACHE_DIR, which should be on
+ * local storage, and is limited to CNSS_CACHE_SIZE bytes which may use a
+ * K, M or G suffix.
+ */
+static void
+cache_setup(struct iof_projection_info *fs_handle, struct cnss_plugin_cb *cb)
+{
+	const char *dir = cb->get_config_option("CNSS_CACHE_DIR");
+	const char *size = cb->get_config_option("CNSS_CACHE_SIZE");
+	uint64_t capacity = IOC_CACHE_SIZE;
+	char *end;
+	int rc;
+
+	if (!dir) {
+		IOF_TRACE_INFO(fs_handle, "CNSS_CACHE_DIR not set, no cache");
+		return;
+	}
+
+	if (size) {
+		capacity = strtoull(size, &end, 10);
+		if (*end == 'k' || *end == 'K')
+			capacity <<= 10;
+		else if (*end == 'm' || *end == 'M')
+			capacity <<= 20;
+		else if (*end == 'g' || *end == 'G')
+			capacity <<= 30;
+	}
+
+	rc = ioc_cache_init(fs_handle, dir, capacity);
+	if (rc != -DER_SUCCESS) {
+		IOF_TRACE_WARNING(fs_handle, "Could not enable cache, rc = %d",
+				  rc);
+		return;
+	}
+
+	cb->register_ctrl_constant(fs_handle->fs_dir, "cache_dir",
+				   fs_handle->cache->cc_dir);
+	cb->register_ctrl_constant_uint64(fs_handle->fs_dir, "cache_size",
+					  capacity);
+}
+
+static const char * const scratch_drain_names[] = {
+	[IOC_SCRATCH_DRAIN_CLOSE]	= "close",
+	[IOC_SCRATCH_DRAIN_ASYNC]	= "async",
+};
+
+static int scratch_drain_read_cb(char *buf, size_t buflen, void *arg)
+{
+	struct iof_projection_info *fs_handle = arg;
+	struct ioc_scratch *sc = fs_handle->scratch;
+
+	if (!sc)
+		return ENODEV;
+
+	strncpy(buf, scratch_drain_names[atomic_load_consume(&sc->sc_drain)],
+		buflen);
+	return CNSS_SUCCESS;
+}
+
+static int scratch_drain_write_cb(const char *value, void *arg)
+{
+	struct iof_projection_info *fs_handle = arg;
+	struct ioc_scratch *sc = fs_handle->scratch;
+	size_t len;
+	int i;
+
+	if (!sc)
+		return ENODEV;
+
+	len = strcspn(value, "\n");
+
+	for (i = 0; i <= IOC_SCRATCH_DRAIN_ASYNC; i++) {
+		if (strlen(scratch_drain_names[i]) == len &&
+		    strncmp(value, scratch_drain_names[i], len) == 0) {
+			IOF_TRACE_INFO(fs_handle, "Setting scratch drain to %s",
+				       scratch_drain_names[i]);
+			atomic_store_release(&sc->sc_drain, i);
+			return CNSS_SUCCESS;
+		}
+	}
+
+	return EINVAL;
+}
+
+static int scratch_stats_cb(char *buf, size_t buflen, void *arg)
+{
+	struct iof_projection_info *fs_handle = arg;
+	struct ioc_scratch *sc = fs_handle->scratch;
+
+	if (!sc)
+		return ENODEV;
+
+	D_MUTEX_LOCK(&sc->sc_lock);
+	snprintf(buf, buflen,
+		 "backlog=%lu releasing=%u absorbed=%lu drained=%lu rpcs=%lu "
+		 "errors=%lu waits=%lu\n",
+		 sc->sc_backlog, sc->sc_releasing,
+		 atomic_load_consume(&sc->sc_absorbed),
+		 atomic_load_consume(&sc->sc_drained),
+		 atomic_load_consume(&sc->sc_rpcs),
+		 atomic_load_consume(&sc->sc_errors),
+		 atomic_load_consume(&sc->sc_waits));
+	D_MUTEX_UNLOCK(&sc->sc_lock);
+	return CNSS_SUCCESS;
+}
+
+/* Enable write absorption for a DataWarp scratch mode projection.  Writes are
+ * logged in a directory given by CNSS_SCRATCH_DIR, which should be on local
+ * storage, until drained to the IONSS.  CNSS_SCRATCH_SIZE limits how much
+ * data may be waiting to drain and may use a K, M or G suffix, and
+ * CNSS_SCRATCH_DRAIN selects whether close() waits for the drain ("close",
+ * the default) or not ("async").
+ *
+ * The drain thread sends RPCs on the projection context, so this is called
+ * once the progress threads are running.
+ */
+static void
+scratch_setup(struct iof_projection_info *fs_handle, struct cnss_plugin_cb *cb)
+{
+	const char *dir = cb->get_config_option("CNSS_SCRATCH_DIR");
+	const char *size = cb->get_config_option("CNSS_SCRATCH_SIZE");
+	const char *drain = cb->get_config_option("CNSS_SCRATCH_DRAIN");
+	uint64_t capacity = IOC_SCRATCH_SIZE;
+	int mode = IOC_SCRATCH_DRAIN_CLOSE;
+	char *end;
+	int rc;
+
+	if (!dir) {
+		IOF_TRACE_INFO(fs_handle,
+			       "CNSS_SCRATCH_DIR not set, writing through");
+		return;
+	}
+
+	if (size) {
+		capacity = strtoull(size, &end, 10);
+		if (*end == 'k' || *end == 'K')
+			capacity <<= 10;
+		else if (*end == 'm' || *end == 'M')
+			capacity <<= 20;
+		else if (*end == 'g' || *end == 'G')
+			capacity <<= 30;
+	}
+
+	if (drain && strcmp(drain, scratch_drain_names[
+				    IOC_SCRATCH_DRAIN_ASYNC]) == 0)
+		mode = IOC_SCRATCH_DRAIN_ASYNC;
+
+	rc = ioc_scratch_init(fs_handle, dir, capacity, mode);
+	if (rc != -DER_SUCCESS) {
+		IOF_TRACE_WARNING(fs_handle,
+				  "Could not enable scratch, rc = %d", rc);
+		return;
+	}
+
+	cb->register_ctrl_constant(fs_handle->fs_dir, "scratch_dir",
+				   fs_handle->scratch->sc_dir);
+	cb->register_ctrl_constant_uint64(fs_handle->fs_dir, "scratch_size",
+					  capacity);
+	cb->register_ctrl_variable(fs_handle->fs_dir, "scratch_drain",
+				   scratch_drain_read_cb,
+				   scratch_drain_write_cb, NULL, fs_handle);
+	cb->register_ctrl_variable(fs_handle->stats_dir, "scratch",
+				   scratch_stats_cb, NULL, NULL, fs_handle);
+}
+
+/* Report the usage of each I/O buffer size class, one line per class
+ * showing the number of reads and writes and the bytes they requested.
+ */
+static int buf_class_stats_cb(char *buf, size_t buflen, void *arg)
+{
+	struct iof_projection_info *fs_handle = arg;
+	struct iof_ctx *iof_ctx = &fs_handle->ctx_array[0];
+	struct ioc_buf_class_stats *stats;
+	uint64_t reads, read_bytes, writes, write_bytes;
+	size_t off = 0;
+	size_t size;
+	int i;
+
+	buf[0] = '\0';
+	for (i = 0; i < iof_ctx->buf_classes; i++) {
+		stats = &fs_handle->buf_stats[i];
+		size = iof_ctx->buf_class[i].rb_size;
+		if (iof_ctx->buf_class[i].wb_size > size)
+			size = iof_ctx->buf_class[i].wb_size;
+		reads = atomic_load_consume(&stats->reads);
+		read_bytes = atomic_load_consume(&stats->read_bytes);
+		writes = atomic_load_consume(&stats->writes);
+		write_bytes = atomic_load_consume(&stats->write_bytes);
+		if (off < buflen)
+			off += snprintf(buf + off, buflen - off,
+					"%zuk: reads=%lu/%lu writes=%lu/%lu\n",
+					size / 1024, reads, read_bytes,
+					writes, write_bytes);
+	}
+	return CNSS_SUCCESS;
+}
+
 #define REGISTER_STAT(_STAT) cb->register_ctrl_variable(	\
 		fs_handle->stats_dir,				\
 		#_STAT,						\
@@ -1848,6 +2386,8 @@ initialize_projection(struct iof_state *iof_state,
 		      struct iof_group_info *group,
 		      struct iof_fs_info *fs_info,
 		      struct iof_query_out *query,
+		      struct iof_query_out **rank_info,
+		      uint32_t ranks,
 		      int id)
 {
 	struct iof_projection_info	*fs_handle;
@@ -1856,6 +2396,12 @@ initialize_projection(struct iof_state *iof_state,
 	bool				writeable = false;
 	int				ret;
 	struct fuse_lowlevel_ops	*fuse_ops = NULL;
+	struct ctrl_dir			*ctx_dir;
+	const char			*mode;
+	size_t				max_read;
+	size_t				max_write;
+	int				rb_classes;
+	int				wb_classes;
 	int i;
 
 	struct iof_pool_reg pt = {.init = dh_init,
@@ -1876,15 +2422,10 @@ initialize_projection(struct iof_state *iof_state,
 				       .release = entry_release,
 				       POOL_TYPE_INIT(entry_req, list)};
 
-	struct iof_pool_reg rb_page = {.init = rb_page_init,
-				       .reset = rb_reset,
-				       .release = rb_release,
-				       POOL_TYPE_INIT(iof_rb, rb_req.ir_list)};
-
-	struct iof_pool_reg rb_large = {.init = rb_large_init,
-					.reset = rb_reset,
-					.release = rb_release,
-					POOL_TYPE_INIT(iof_rb, rb_req.ir_list)};
+	struct iof_pool_reg rb = {.init = rb_init,
+				  .reset = rb_reset,
+				  .release = rb_release,
+				  POOL_TYPE_INIT(iof_rb, rb_req.ir_list)};
 
 	struct iof_pool_reg wb = {.init = wb_init,
 				  .reset = wb_reset,
@@ -1933,6 +2474,12 @@ initialize_projection(struct iof_state *iof_state,
 
 	fs_handle->iof_state = iof_state;
 	fs_handle->flags = fs_info->flags;
+	if (fs_handle->flags & IOF_FUSE_READ_BUF)
+		fs_handle->read_reply = IOC_READ_REPLY_BUF;
+	else
+		fs_handle->read_reply = IOC_READ_REPLY_DATA;
+	for (i = 0; i < IOC_READ_REPLY_CLASSES; i++)
+		fs_handle->read_bench.best[i] = fs_handle->read_reply;
 	fs_handle->proj.io_proto = iof_state->io_proto;
 	fs_handle->failover_state = iof_failover_running;
 	IOF_TRACE_INFO(fs_handle, "Filesystem mode: Private; "
@@ -1942,11 +2489,11 @@ initialize_projection(struct iof_state *iof_state,
 			fs_handle->flags & IOF_FAILOVER
 					 ? "Enabled" : "Disabled");
 	IOF_TRACE_INFO(fs_handle, "FUSE: %sthreaded | API => "
-			"Write: ioc_ll_write%s, Read: fuse_reply_%s",
+			"Write: ioc_ll_write%s, Read: %s",
 			fs_handle->flags & IOF_CNSS_MT
 					 ? "Multi-" : "Single ",
 			fs_handle->flags & IOF_FUSE_WRITE_BUF ? "_buf" : "",
-			fs_handle->flags & IOF_FUSE_READ_BUF ? "buf" : "data");
+			ioc_read_reply_names[fs_handle->read_reply]);
 
 	IOF_TRACE_INFO(fs_handle, "%d cart threads",
 		       fs_handle->ctx_num);
@@ -1959,6 +2506,11 @@ initialize_projection(struct iof_state *iof_state,
 	if (ret != 0)
 		D_GOTO(err, 0);
 
+	ret = ioc_neg_init(&fs_handle->neg_cache, IOC_NEG_MAX,
+			   IOC_NEG_TIMEOUT);
+	if (ret != -DER_SUCCESS)
+		D_GOTO(err, 0);
+
 	/* Keep a list of open file and directory handles
 	 *
 	 * Handles are added to these lists as the open call succeeds,
@@ -1994,11 +2546,19 @@ initialize_projection(struct iof_state *iof_state,
 
 	fs_handle->max_read = fs_info->max_read;
 	fs_handle->max_iov_read = fs_info->max_iov_read;
+	fs_handle->proj.max_read = fs_info->max_read;
 	fs_handle->proj.max_write = fs_info->max_write;
 	fs_handle->proj.max_iov_write = fs_info->max_iov_write;
 	fs_handle->readdir_size = fs_info->readdir_size;
 	fs_handle->gah = fs_info->gah;
 
+	if (fs_info->flags & (IOF_STRIPED_DATA | IOF_STRIPED_METADATA |
+			      IOF_LOAD_BALANCE)) {
+		ret = ioc_stripe_init(fs_handle, fs_info, rank_info, ranks);
+		if (ret != -DER_SUCCESS)
+			D_GOTO(err, 0);
+	}
+
 	strncpy(fs_handle->mnt_dir.name, fs_info->dir_name.name, NAME_MAX);
 
 	IOF_TRACE_DEBUG(fs_handle,
@@ -2038,8 +2598,32 @@ initialize_projection(struct iof_state *iof_state,
 				   "mount_point",
 				   fs_handle->mount_point);
 
-	cb->register_ctrl_constant(fs_handle->fs_dir, "mode",
-				   "private");
+	if ((fs_handle->flags & IOF_STRIPED_DATA) &&
+	    (fs_handle->flags & IOF_STRIPED_METADATA))
+		mode = "striped";
+	else if (fs_handle->flags & IOF_STRIPED_DATA)
+		mode = "striped_data";
+	else if (fs_handle->flags & IOF_STRIPED_METADATA)
+		mode = "striped_metadata";
+	else
+		mode = "private";
+
+	cb->register_ctrl_constant(fs_handle->fs_dir, "mode", mode);
+
+	cb->register_ctrl_constant(fs_handle->fs_dir, "load_balance",
+				   fs_handle->flags & IOF_LOAD_BALANCE ?
+				   "enabled" : "disabled");
+
+	if (IOF_FS_TYPE(fs_handle->flags) == IOF_DW_CACHE)
+		cache_setup(fs_handle, cb);
+
+	cb->register_ctrl_constant_uint64(fs_handle->fs_dir,
+					  "stripe_size",
+					  fs_handle->stripe_size);
+
+	cb->register_ctrl_constant_uint64(fs_handle->fs_dir,
+					  "stripe_count",
+					  fs_handle->stripe_count);
 
 	cb->register_ctrl_constant_uint64(fs_handle->fs_dir,
 					  "fs_id",
@@ -2073,9 +2657,40 @@ initialize_projection(struct iof_state *iof_state,
 	cb->register_ctrl_variable(fs_handle->fs_dir, "failover_state",
 				   failover_state_cb, NULL, NULL, fs_handle);
 
+	cb->register_ctrl_variable(fs_handle->fs_dir, "root_gah",
+				   root_gah_cb, NULL, NULL, fs_handle);
+
+	cb->register_ctrl_variable(fs_handle->fs_dir, "read_reply",
+				   read_reply_read_cb, read_reply_write_cb,
+				   NULL, fs_handle);
+
+	cb->register_ctrl_uint64_variable(fs_handle->fs_dir, "neg_timeout",
+					  neg_timeout_read_cb,
+					  neg_timeout_write_cb,
+					  fs_handle);
+
+	cb->register_ctrl_constant_uint64(fs_handle->fs_dir, "neg_max",
+					  IOC_NEG_MAX);
+
 	cb->create_ctrl_subdir(fs_handle->fs_dir, "stats",
 			       &fs_handle->stats_dir);
 
+	cb->register_ctrl_constant_uint64(fs_handle->fs_dir, "ctx_count",
+					  fs_handle->ctx_num);
+
+	cb->create_ctrl_subdir(fs_handle->fs_dir, "ctx", &ctx_dir);
+
+	for (i = 0; i < fs_handle->ctx_num; i++) {
+		struct ctrl_dir *dir;
+		char name[16];
+
+		snprintf(name, sizeof(name), "%d", i);
+		cb->create_ctrl_subdir(ctx_dir, name, &dir);
+		cb->register_ctrl_uint64_variable(dir, "queue_depth",
+						  queue_depth_read_cb, NULL,
+						  &fs_handle->ctx_array[i]);
+	}
+
 	REGISTER_STAT(opendir);
 	REGISTER_STAT(readdir);
 	REGISTER_STAT(closedir);
@@ -2090,6 +2705,16 @@ initialize_projection(struct iof_state *iof_state,
 	REGISTER_STAT(lookup);
 	REGISTER_STAT(forget);
 	REGISTER_STAT64(read_bytes);
+	cb->register_ctrl_variable(fs_handle->stats_dir, "read_reply",
+				   read_reply_stats_cb, NULL, NULL, fs_handle);
+	cb->register_ctrl_variable(fs_handle->stats_dir, "buf_classes",
+				   buf_class_stats_cb, NULL, NULL, fs_handle);
+	cb->register_ctrl_variable(fs_handle->stats_dir, "neg_cache",
+				   neg_cache_stats_cb, NULL, NULL, fs_handle);
+	if (fs_handle->cache)
+		cb->register_ctrl_variable(fs_handle->stats_dir, "cache",
+					   cache_stats_cb, NULL, NULL,
+					   fs_handle);
 
 	if (writeable) {
 		REGISTER_STAT(create);
@@ -2100,6 +2725,9 @@ initialize_projection(struct iof_state *iof_state,
 		REGISTER_STAT(write);
 		REGISTER_STAT(fsync);
 		REGISTER_STAT(setattr);
+		REGISTER_STAT(copy);
+		REGISTER_STAT(fallocate);
+		REGISTER_STAT(flush);
 		REGISTER_STAT64(write_bytes);
 	}
 
@@ -2123,10 +2751,34 @@ initialize_projection(struct iof_state *iof_state,
 		D_GOTO(err, 0);
 	}
 
+	/* The first context is the projection context, every other thread
+	 * gets a context of its own so that RPCs and completions are not
+	 * serialised through a single context.
+	 */
 	for (i = 0; i < fs_handle->ctx_num; i++) {
-		fs_handle->ctx_array[i].crt_ctx       = fs_handle->proj.crt_ctx;
-		fs_handle->ctx_array[i].poll_interval = iof_state->iof_ctx.poll_interval;
-		fs_handle->ctx_array[i].callback_fn   = iof_state->iof_ctx.callback_fn;
+		struct iof_ctx *iof_ctx = &fs_handle->ctx_array[i];
+
+		if (i == 0) {
+			iof_ctx->crt_ctx = fs_handle->proj.crt_ctx;
+		} else {
+			ret = crt_context_create(&iof_ctx->crt_ctx);
+			if (ret) {
+				IOF_TRACE_ERROR(iof_ctx,
+						"Could not create context");
+				D_GOTO(err, 0);
+			}
+
+			ret = crt_context_set_timeout(iof_ctx->crt_ctx,
+						      fs_info->timeout);
+			if (ret != -DER_SUCCESS) {
+				IOF_TRACE_ERROR(iof_ctx,
+						"Context timeout not set");
+				D_GOTO(err, 0);
+			}
+		}
+		iof_ctx->fs_handle     = fs_handle;
+		iof_ctx->poll_interval = iof_state->iof_ctx.poll_interval;
+		iof_ctx->callback_fn   = iof_state->iof_ctx.callback_fn;
 
 		/* TODO: Much better error checking is required here, not least
 		 * terminating the thread if there are any failures in the rest
@@ -2138,6 +2790,9 @@ initialize_projection(struct iof_state *iof_state,
 		}
 	}
 
+	if (IOF_FS_TYPE(fs_handle->flags) == IOF_DW_SCRATCH)
+		scratch_setup(fs_handle, cb);
+
 	args.argc = 4;
 	if (!writeable)
 		args.argc++;
@@ -2216,17 +2871,49 @@ initialize_projection(struct iof_state *iof_state,
 	if (!fs_handle->fh_pool)
 		D_GOTO(err, 0);
 
-	fs_handle->rb_pool_page = iof_pool_register(&fs_handle->pool, &rb_page);
-	if (!fs_handle->rb_pool_page)
-		D_GOTO(err, 0);
+	/* Register the I/O descriptor types once per context, so that the
+	 * RPCs and bulk handles are created on the context they are sent on,
+	 * and once per size class so that small requests do not pin
+	 * max_read or max_write sized buffers.
+	 */
+	max_read = fs_handle->max_read;
+	max_write = fs_handle->proj.max_write;
+	rb_classes = buf_class_count(max_read);
+	wb_classes = buf_class_count(max_write);
 
-	fs_handle->rb_pool_large = iof_pool_register(&fs_handle->pool, &rb_large);
-	if (!fs_handle->rb_pool_large)
-		D_GOTO(err, 0);
+	for (i = 0; i < fs_handle->ctx_num; i++) {
+		struct iof_ctx *iof_ctx = &fs_handle->ctx_array[i];
+		int j;
 
-	fs_handle->write_pool = iof_pool_register(&fs_handle->pool, &wb);
-	if (!fs_handle->write_pool)
-		D_GOTO(err, 0);
+		iof_ctx->buf_classes = rb_classes > wb_classes ?
+			rb_classes : wb_classes;
+
+		for (j = 0; j < iof_ctx->buf_classes; j++) {
+			struct ioc_buf_class *bc = &iof_ctx->buf_class[j];
+
+			bc->ctx = iof_ctx;
+
+			ret = iof_pool_init(&bc->pool, bc);
+			if (ret != -DER_SUCCESS)
+				D_GOTO(err, 0);
+
+			if (j < rb_classes) {
+				bc->rb_size = buf_class_size(j, rb_classes,
+							     max_read);
+				bc->rb_pool = iof_pool_register(&bc->pool, &rb);
+				if (!bc->rb_pool)
+					D_GOTO(err, 0);
+			}
+
+			if (j < wb_classes) {
+				bc->wb_size = buf_class_size(j, wb_classes,
+							     max_write);
+				bc->wb_pool = iof_pool_register(&bc->pool, &wb);
+				if (!bc->wb_pool)
+					D_GOTO(err, 0);
+			}
+		}
+	}
 
 	if (!cb->register_fuse_fs(cb->handle,
 				  NULL,
@@ -2249,8 +2936,15 @@ initialize_projection(struct iof_state *iof_state,
 
 	return true;
 err:
+	ioc_scratch_fini(fs_handle);
+	for (i = 0; i < fs_handle->ctx_num; i++)
+		ioc_ctx_pool_destroy(&fs_handle->ctx_array[i]);
 	iof_pool_destroy(&fs_handle->pool);
+	ioc_neg_fini(&fs_handle->neg_cache);
+	ioc_cache_fini(fs_handle);
 	D_FREE(fuse_ops);
+	D_FREE(fs_handle->stripe_root);
+	D_FREE(fs_handle->rank_load);
 	D_FREE(fs_handle);
 	return false;
 }
@@ -2261,7 +2955,14 @@ query_projections(struct iof_state *iof_state,
 		  int *total, int *active)
 {
 	crt_rpc_t *query_rpc = NULL;
+	crt_rpc_t **rank_rpc = NULL;
+	struct iof_query_out **rank_info = NULL;
 	struct iof_query_out *query;
+	struct iof_fs_info *fs_info;
+	crt_endpoint_t ep;
+	uint32_t ranks = 0;
+	uint32_t r;
+	bool ok = true;
 	int rc;
 	int i;
 
@@ -2275,7 +2976,7 @@ query_projections(struct iof_state *iof_state,
 	 * server side-state or RPCs created at this point.
 	 */
 	do {
-		rc = get_info(iof_state, group, &query_rpc);
+		rc = get_info(iof_state, &group->grp.psr_ep, &query_rpc);
 
 		if (rc == -DER_OOG || rc == -DER_EVICTED) {
 			d_rank_list_t *psr_list = NULL;
@@ -2310,6 +3011,9 @@ query_projections(struct iof_state *iof_state,
 
 	query = crt_reply_get(query_rpc);
 
+	group->grp.ctx_count = query->ctx_count;
+	IOF_TRACE_INFO(iof_state, "Server contexts: %u", query->ctx_count);
+
 	iof_state->iof_ctx.poll_interval = query->poll_interval;
 	iof_state->iof_ctx.callback_fn = query->progress_callback ?
 					 iof_check_complete : NULL;
@@ -2321,24 +3025,73 @@ query_projections(struct iof_state *iof_state,
 	IOF_TRACE_DEBUG(iof_state, "Number of filesystems projected by %s: %ld",
 			group->grp_name, query->info.ca_count);
 
+	/* Striped and load balanced projections need the root GAH on every
+	 * rank, so query the other ranks as well.  Any rank which does not
+	 * reply is left NULL and striping is disabled for projections which
+	 * need it.
+	 */
+	for (i = 0; i < query->info.ca_count; i++) {
+		fs_info = &query->info.ca_arrays[i];
+		if ((fs_info->flags & (IOF_STRIPED_DATA |
+				       IOF_STRIPED_METADATA |
+				       IOF_LOAD_BALANCE)) &&
+		    fs_info->stripe_count > ranks)
+			ranks = fs_info->stripe_count;
+	}
+
+	if (ranks > 0) {
+		D_ALLOC_ARRAY(rank_rpc, ranks);
+		D_ALLOC_ARRAY(rank_info, ranks);
+		if (!rank_rpc || !rank_info)
+			ranks = 0;
+	}
+
+	for (r = 0; r < ranks; r++) {
+		if (r == group->grp.psr_ep.ep_rank) {
+			rank_info[r] = query;
+			continue;
+		}
+
+		ep = group->grp.psr_ep;
+		ep.ep_rank = r;
+		rc = get_info(iof_state, &ep, &rank_rpc[r]);
+		if (rc != -DER_SUCCESS) {
+			IOF_TRACE_WARNING(iof_state,
+					  "Could not query rank %u: %d",
+					  r, rc);
+			continue;
+		}
+
+		rank_info[r] = crt_reply_get(rank_rpc[r]);
+	}
+
 	for (i = 0; i < query->info.ca_count; i++) {
 
 		if (!initialize_projection(iof_state, group,
 					   &query->info.ca_arrays[i], query,
+					   rank_info, ranks,
 					   (*total)++)) {
 			IOF_TRACE_ERROR(iof_state,
 					"Could not initialize projection '%s' from %s",
 					query->info.ca_arrays[i].dir_name.name,
 					group->grp_name);
-			return false;
+			ok = false;
+			break;
 		}
 
 		(*active)++;
 	}
 
+	for (r = 0; r < ranks; r++) {
+		if (rank_rpc[r])
+			crt_req_decref(rank_rpc[r]);
+	}
+	D_FREE(rank_rpc);
+	D_FREE(rank_info);
+
 	crt_req_decref(query_rpc);
 
-	return true;
+	return ok;
 }
 
 static int iof_post_start(void *arg)
@@ -2458,6 +3211,11 @@ static int iof_deregister_fuse(void *arg)
 	int rcp = 0;
 	int i;
 
+	/* Absorbed writes have to reach the IONSS before the handles they
+	 * were written through are closed.
+	 */
+	ioc_scratch_flush(fs_handle);
+
 	IOF_TRACE_INFO(fs_handle, "Draining inode table");
 	do {
 		struct ioc_inode_entry *ie;
@@ -2496,6 +3254,8 @@ static int iof_deregister_fuse(void *arg)
 		rcp = EINVAL;
 	}
 
+	ioc_neg_fini(&fs_handle->neg_cache);
+
 	/* This code does not need to hold the locks as the fuse progression
 	 * thread is no longer running so no more calls to open()/opendir()
 	 * or close()/releasedir() can race with this code.
@@ -2519,6 +3279,8 @@ static int iof_deregister_fuse(void *arg)
 	}
 	IOF_TRACE_INFO(fs_handle, "Closed %d file handles", handles);
 
+	ioc_scratch_fini(fs_handle);
+
 	/* Stop the progress thread for this projection and delete the context
 	 */
 
@@ -2529,40 +3291,59 @@ static int iof_deregister_fuse(void *arg)
 					"thread[%d] stop returned %d", i, rc);
 	}
 
-	do {
-		/* If this context has a pool associated with it then reap
-		 * any descriptors with it so there are no pending RPCs when
-		 * we call context_destroy.
-		 */
-		bool active;
+	/* Destroy the contexts in reverse order, so the projection context
+	 * which is shared by the metadata pool is done last.
+	 */
+	for (i = fs_handle->ctx_num - 1; i >= 0; i--) {
+		struct iof_ctx *iof_ctx = &fs_handle->ctx_array[i];
 
 		do {
-			rc = iof_progress_drain(&fs_handle->ctx_array[0]);
+			/* If this context has a pool associated with it then
+			 * reap any descriptors with it so there are no pending
+			 * RPCs when we call context_destroy.
+			 */
+			bool active;
 
-			active = iof_pool_reclaim(&fs_handle->pool);
+			do {
+				rc = iof_progress_drain(iof_ctx);
 
-			if (!active)
-				break;
+				active = ioc_ctx_pool_reclaim(iof_ctx);
 
-			IOF_TRACE_INFO(fs_handle,
-					  "Active descriptors, waiting for one second");
+				if (i == 0 &&
+				    iof_pool_reclaim(&fs_handle->pool))
+					active = true;
 
-		} while (active && rc == -DER_SUCCESS);
+				if (!active)
+					break;
 
-		rc = crt_context_destroy(fs_handle->proj.crt_ctx, false);
-		if (rc == -DER_BUSY)
-			IOF_TRACE_INFO(fs_handle, "RPCs in flight, waiting");
-		else if (rc != DER_SUCCESS)
-			IOF_TRACE_ERROR(fs_handle,
-					"Could not destroy context %d",
-					rc);
-	} while (rc == -DER_BUSY);
+				IOF_TRACE_INFO(iof_ctx,
+					       "Active descriptors, waiting for one second");
 
-	if (rc != -DER_SUCCESS)
-		IOF_TRACE_ERROR(fs_handle, "Count not destroy context");
+			} while (active && rc == -DER_SUCCESS);
+
+			rc = crt_context_destroy(iof_ctx->crt_ctx, false);
+			if (rc == -DER_BUSY)
+				IOF_TRACE_INFO(iof_ctx,
+					       "RPCs in flight, waiting");
+			else if (rc != DER_SUCCESS)
+				IOF_TRACE_ERROR(iof_ctx,
+						"Could not destroy context %d",
+						rc);
+		} while (rc == -DER_BUSY);
+
+		if (rc != -DER_SUCCESS)
+			IOF_TRACE_ERROR(iof_ctx, "Count not destroy context");
+
+		ioc_ctx_pool_destroy(iof_ctx);
+	}
 
 	iof_pool_destroy(&fs_handle->pool);
 
+	/* All handles have been released and every RPC has completed, so
+	 * nothing else holds a reference on the cache.
+	 */
+	ioc_cache_fini(fs_handle);
+
 	rc = pthread_mutex_destroy(&fs_handle->od_lock);
 	if (rc != 0) {
 		IOF_TRACE_ERROR(fs_handle,
@@ -2605,6 +3386,9 @@ static int iof_deregister_fuse(void *arg)
 	D_FREE(fs_handle->mount_point);
 
 	D_FREE(fs_handle->stats);
+
+	D_FREE(fs_handle->stripe_root);
+	D_FREE(fs_handle->rank_load);
 	return rcp;
 }
 
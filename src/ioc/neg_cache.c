@@ -0,0 +1,262 @@
+/* Copyright (C) 2019 Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted for any purpose (including commercial purposes)
+ * provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the
+ *    documentation and/or materials provided with the distribution.
+ *
+ * 3. In addition, redistributions of modified forms of the source or binary
+ *    code must carry prominent notices stating that the original code was
+ *    changed and the date of the change.
+ *
+ *  4. All publications or advertising materials mentioning features or use of
+ *     this software are asked, but not required, to acknowledge that it was
+ *     developed by Intel Corporation and credit the contributors.
+ *
+ * 5. Neither the name of Intel Corporation, nor the name of any Contributor
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Negative dentry cache.
+ *
+ * Records (parent, name) pairs that the IONSS has reported as not existing
+ * so that repeated failing lookups, such as search path probing, can be
+ * answered without an RPC.  Entries expire after a timeout, the cache is
+ * bounded in size with the oldest entries evicted first, and entries are
+ * removed when a name is created locally in the parent.
+ */
+
+#include <time.h>
+
+#include "iof_common.h"
+#include "ioc.h"
+#include "log.h"
+
+struct ioc_neg_entry {
+	d_list_t	ne_link;
+	d_list_t	ne_lru;
+	fuse_ino_t	ne_parent;
+	uint64_t	ne_expire;
+	char		ne_name[NAME_MAX + 1];
+};
+
+static uint64_t
+neg_now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* FNV-1a over the parent inode and name */
+static d_list_t *
+neg_bucket(struct ioc_neg_cache *nc, fuse_ino_t parent, const char *name)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	int i;
+
+	for (i = 0; i < (int)sizeof(parent); i++) {
+		hash ^= (parent >> (i * 8)) & 0xff;
+		hash *= 0x100000001b3ULL;
+	}
+	for (; *name; name++) {
+		hash ^= (unsigned char)*name;
+		hash *= 0x100000001b3ULL;
+	}
+
+	return &nc->nc_buckets[hash & (IOC_NEG_BUCKETS - 1)];
+}
+
+/* Find an entry, should be called with nc_lock held */
+static struct ioc_neg_entry *
+neg_find(struct ioc_neg_cache *nc, fuse_ino_t parent, const char *name)
+{
+	struct ioc_neg_entry *ne;
+
+	d_list_for_each_entry(ne, neg_bucket(nc, parent, name), ne_link) {
+		if (ne->ne_parent == parent &&
+		    strncmp(ne->ne_name, name, NAME_MAX) == 0)
+			return ne;
+	}
+	return NULL;
+}
+
+/* Unlink and free an entry, should be called with nc_lock held */
+static void
+neg_del(struct ioc_neg_cache *nc, struct ioc_neg_entry *ne)
+{
+	d_list_del(&ne->ne_link);
+	d_list_del(&ne->ne_lru);
+	nc->nc_count--;
+	D_FREE(ne);
+}
+
+int
+ioc_neg_init(struct ioc_neg_cache *nc, uint32_t max, uint32_t timeout)
+{
+	int rc;
+	int i;
+
+	rc = D_MUTEX_INIT(&nc->nc_lock, NULL);
+	if (rc != -DER_SUCCESS)
+		return rc;
+
+	D_ALLOC_ARRAY(nc->nc_buckets, IOC_NEG_BUCKETS);
+	if (!nc->nc_buckets) {
+		D_MUTEX_DESTROY(&nc->nc_lock);
+		return -DER_NOMEM;
+	}
+
+	for (i = 0; i < IOC_NEG_BUCKETS; i++)
+		D_INIT_LIST_HEAD(&nc->nc_buckets[i]);
+	D_INIT_LIST_HEAD(&nc->nc_lru);
+
+	nc->nc_count = 0;
+	nc->nc_max = max ? max : 1;
+	nc->nc_gen = 0;
+	atomic_store_release(&nc->nc_timeout, timeout);
+
+	return -DER_SUCCESS;
+}
+
+void
+ioc_neg_fini(struct ioc_neg_cache *nc)
+{
+	struct ioc_neg_entry *ne;
+
+	if (!nc->nc_buckets)
+		return;
+
+	while ((ne = d_list_pop_entry(&nc->nc_lru, struct ioc_neg_entry,
+				      ne_lru))) {
+		d_list_del(&ne->ne_link);
+		D_FREE(ne);
+	}
+
+	D_FREE(nc->nc_buckets);
+	D_MUTEX_DESTROY(&nc->nc_lock);
+}
+
+/* Check for a cached negative entry
+ *
+ * Returns true if (parent, name) is known not to exist.  On a miss the current
+ * generation is returned in gen, to be passed to ioc_neg_insert() once the
+ * lookup completes.
+ */
+bool
+ioc_neg_lookup(struct ioc_neg_cache *nc, fuse_ino_t parent, const char *name,
+	       uint64_t *gen)
+{
+	struct ioc_neg_entry *ne;
+	bool found = false;
+
+	if (atomic_load_consume(&nc->nc_timeout) == 0) {
+		*gen = 0;
+		return false;
+	}
+
+	D_MUTEX_LOCK(&nc->nc_lock);
+	*gen = nc->nc_gen;
+	ne = neg_find(nc, parent, name);
+	if (ne) {
+		if (ne->ne_expire > neg_now_ms())
+			found = true;
+		else
+			neg_del(nc, ne);
+	}
+	D_MUTEX_UNLOCK(&nc->nc_lock);
+
+	if (found)
+		atomic_inc(&nc->nc_hits);
+	else
+		atomic_inc(&nc->nc_misses);
+
+	return found;
+}
+
+/* Record that (parent, name) does not exist
+ *
+ * The entry is only added if nothing has been created since the lookup was
+ * started, as given by gen, otherwise a stale entry could hide a new file.
+ */
+void
+ioc_neg_insert(struct ioc_neg_cache *nc, fuse_ino_t parent, const char *name,
+	       uint64_t gen)
+{
+	struct ioc_neg_entry *ne;
+	uint32_t timeout = atomic_load_consume(&nc->nc_timeout);
+
+	if (timeout == 0)
+		return;
+
+	D_MUTEX_LOCK(&nc->nc_lock);
+
+	if (gen != nc->nc_gen)
+		D_GOTO(out, 0);
+
+	ne = neg_find(nc, parent, name);
+	if (ne) {
+		d_list_del(&ne->ne_lru);
+	} else {
+		if (nc->nc_count >= nc->nc_max) {
+			ne = d_list_entry(nc->nc_lru.next,
+					  struct ioc_neg_entry, ne_lru);
+			d_list_del(&ne->ne_link);
+			d_list_del(&ne->ne_lru);
+			nc->nc_count--;
+			atomic_inc(&nc->nc_evictions);
+		} else {
+			D_ALLOC_PTR(ne);
+			if (!ne)
+				D_GOTO(out, 0);
+		}
+		ne->ne_parent = parent;
+		strncpy(ne->ne_name, name, NAME_MAX);
+		ne->ne_name[NAME_MAX] = '\0';
+		d_list_add(&ne->ne_link, neg_bucket(nc, parent, name));
+		nc->nc_count++;
+	}
+
+	ne->ne_expire = neg_now_ms() + timeout * 1000;
+	d_list_add_tail(&ne->ne_lru, &nc->nc_lru);
+
+out:
+	D_MUTEX_UNLOCK(&nc->nc_lock);
+}
+
+/* Remove any entry for (parent, name), called before a name is created
+ * locally.
+ */
+void
+ioc_neg_remove(struct ioc_neg_cache *nc, fuse_ino_t parent, const char *name)
+{
+	struct ioc_neg_entry *ne;
+
+	D_MUTEX_LOCK(&nc->nc_lock);
+	nc->nc_gen++;
+	ne = neg_find(nc, parent, name);
+	if (ne) {
+		neg_del(nc, ne);
+		atomic_inc(&nc->nc_invalidations);
+	}
+	D_MUTEX_UNLOCK(&nc->nc_lock);
+}
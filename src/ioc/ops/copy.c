@@ -0,0 +1,163 @@
+/* Copyright (C) 2019 Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted for any purpose (including commercial purposes)
+ * provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the
+ *    documentation and/or materials provided with the distribution.
+ *
+ * 3. In addition, redistributions of modified forms of the source or binary
+ *    code must carry prominent notices stating that the original code was
+ *    changed and the date of the change.
+ *
+ *  4. All publications or advertising materials mentioning features or use of
+ *     this software are asked, but not required, to acknowledge that it was
+ *     developed by Intel Corporation and credit the contributors.
+ *
+ * 5. Neither the name of Intel Corporation, nor the name of any Contributor
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "iof_common.h"
+#include "ioc.h"
+#include "log.h"
+
+static bool
+ioc_copy_cb(struct ioc_request *request)
+{
+	struct iof_copy_out *out = crt_reply_get(request->rpc);
+
+	IOC_REQUEST_RESOLVE(request, out);
+	if (request->rc) {
+		IOC_REPLY_ERR(request, request->rc);
+		D_GOTO(out, 0);
+	}
+
+	IOC_REPLY_WRITE(request, request->req, out->len);
+	IOF_TRACE_DOWN(request);
+
+out:
+	/* Clean up the two refs this code holds on the rpc */
+	crt_req_decref(request->rpc);
+	crt_req_decref(request->rpc);
+
+	D_FREE(request);
+	return false;
+}
+
+static const struct ioc_request_api api = {
+	.on_result	= ioc_copy_cb,
+	.have_gah	= true,
+	.gah_offset	= offsetof(struct iof_copy_in, gah),
+};
+
+/* Copy a range between two files with an RPC to the IONSS, so the data does
+ * not pass through the client.  Both files have to be open on the same rank,
+ * otherwise EXDEV is returned and the kernel copies the data itself.
+ */
+void
+ioc_ll_copy_file_range(fuse_req_t req, fuse_ino_t ino_in, off_t off_in,
+		       struct fuse_file_info *fi_in, fuse_ino_t ino_out,
+		       off_t off_out, struct fuse_file_info *fi_out,
+		       size_t len, int flags)
+{
+	struct iof_file_handle		*src = (struct iof_file_handle *)fi_in->fh;
+	struct iof_file_handle		*dst = (struct iof_file_handle *)fi_out->fh;
+	struct iof_projection_info	*fs_handle = src->open_req.fsh;
+	struct ioc_request		*request;
+	struct iof_copy_in		*in;
+	int rc;
+	int ret;
+
+	STAT_ADD(fs_handle->stats, copy);
+
+	IOF_TRACE_INFO(src, "%#zx-%#zx to %lu at %#zx", off_in,
+		       off_in + len - 1, ino_out, off_out);
+
+	if (flags != 0)
+		D_GOTO(out_no_request, ret = EINVAL);
+
+	if (!IOF_IS_WRITEABLE(fs_handle->flags))
+		D_GOTO(out_no_request, ret = EROFS);
+
+	/* Striped data may be spread over several ranks */
+	if (fs_handle->flags & IOF_STRIPED_DATA)
+		D_GOTO(out_no_request, ret = EXDEV);
+
+	D_MUTEX_LOCK(&fs_handle->gah_lock);
+	rc = (src->common.gah.root != dst->common.gah.root);
+	D_MUTEX_UNLOCK(&fs_handle->gah_lock);
+	if (rc)
+		D_GOTO(out_no_request, ret = EXDEV);
+
+	/* Absorbed writes to either file have to reach the IONSS first */
+	ioc_scratch_sync(fs_handle, ino_in);
+	ioc_scratch_sync(fs_handle, ino_out);
+	ioc_cache_invalidate(fs_handle, ino_out);
+
+	D_ALLOC_PTR(request);
+	if (!request)
+		D_GOTO(out_no_request, ret = ENOMEM);
+
+	IOC_REQUEST_INIT(request, fs_handle);
+	IOC_REQUEST_RESET(request);
+
+	IOF_TRACE_UP(request, src, "copy");
+
+	request->req = req;
+	request->ir_api = &api;
+	request->ir_ht = RHS_FILE;
+	request->ir_file = src;
+
+	rc = crt_req_create(fs_handle->proj.crt_ctx, NULL,
+			    FS_TO_OP(fs_handle, copy), &request->rpc);
+	if (rc || !request->rpc) {
+		IOF_TRACE_ERROR(request, "Could not create request, rc = %d",
+				rc);
+		D_GOTO(out_err, ret = EIO);
+	}
+	crt_req_addref(request->rpc);
+
+	in = crt_req_get(request->rpc);
+	D_MUTEX_LOCK(&fs_handle->gah_lock);
+	in->dst_gah = dst->common.gah;
+	D_MUTEX_UNLOCK(&fs_handle->gah_lock);
+	in->src_off = off_in;
+	in->dst_off = off_out;
+	in->len = len;
+
+	rc = iof_fs_send(request);
+	if (rc != 0)
+		D_GOTO(out_decref, ret = EIO);
+
+	return;
+
+out_no_request:
+	IOC_REPLY_ERR_RAW(fs_handle, req, ret);
+	return;
+
+out_decref:
+	crt_req_decref(request->rpc);
+
+out_err:
+	IOC_REPLY_ERR(request, ret);
+	D_FREE(request);
+}
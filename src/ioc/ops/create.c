@@ -73,6 +73,7 @@ ioc_create_ll_cb(struct ioc_request *request)
 	H_GAH_SET_VALID(handle);
 	handle->inode_num = entry.ino;
 	handle->common.ep = request->rpc->cr_ep;
+	handle->common.ep.ep_tag = ioc_gah_tag(fs_handle, &out->gah);
 
 	D_MUTEX_LOCK(&fs_handle->of_lock);
 	d_list_add_tail(&handle->fh_of_list, &fs_handle->openfile_list);
@@ -121,6 +122,8 @@ ioc_create_ll_cb(struct ioc_request *request)
 		ie_close(fs_handle, handle->ie);
 	}
 
+	ioc_scratch_open(handle);
+
 	IOC_REPLY_CREATE(request, entry, fi);
 	return keep_ref;
 
@@ -197,8 +200,11 @@ void ioc_ll_create(fuse_req_t req, fuse_ino_t parent, const char *name,
 	handle->creat_req.ir_inode_num = parent;
 
 	strncpy(in->common.name.name, name, NAME_MAX);
+	handle->creat_req.ir_md_name = in->common.name.name;
+	handle->creat_req.ir_balance = true;
 	in->mode = mode;
 	in->flags = fi->flags;
+	handle->flags = fi->flags;
 
 	strncpy(handle->ie->name, name, NAME_MAX);
 	handle->ie->parent = parent;
@@ -206,6 +212,8 @@ void ioc_ll_create(fuse_req_t req, fuse_ino_t parent, const char *name,
 	LOG_FLAGS(handle, fi->flags);
 	LOG_MODES(handle, mode);
 
+	ioc_neg_remove(&fs_handle->neg_cache, parent, name);
+
 	rc = iof_fs_send(&handle->creat_req);
 	if (rc) {
 		D_GOTO(out_err, rc = EIO);
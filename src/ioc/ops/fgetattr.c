@@ -54,10 +54,12 @@ ioc_getattr_result_fn(struct ioc_request *request)
 
 	IOC_REQUEST_RESOLVE(request, out);
 
-	if (request->rc == 0)
+	if (request->rc == 0) {
+		ioc_scratch_attr(request->fsh, &out->stat);
 		IOC_REPLY_ATTR(request, &out->stat);
-	else
+	} else {
 		IOC_REPLY_ERR(request, request->rc);
+	}
 
 	iof_pool_release(request->fsh->POOL_NAME, CONTAINER(request));
 	return false;
@@ -64,6 +64,14 @@ ioc_ll_fsync(fuse_req_t req, fuse_ino_t ino, int datasync,
 
 	IOF_TRACE_INFO(handle);
 
+	if (ioc_scratch_fsync(handle, req))
+		return;
+
+	/* Every rank holding part of a striped file has to sync it */
+	ret = ioc_stripe_fsync(handle, datasync);
+	if (ret)
+		D_GOTO(out_no_request, 0);
+
 	D_ALLOC_PTR(request);
 	if (!request) {
 		D_GOTO(out_no_request, ret = ENOMEM);
@@ -98,6 +98,14 @@ void ioc_ll_ioctl(fuse_req_t req, fuse_ino_t ino, unsigned int cmd, void *arg,
 		D_GOTO(out_err, ret = ENOTSUP);
 	}
 
+	/* Writes to files with a scratch log have to go through FUSE, so do
+	 * not let the interception library bypass it.
+	 */
+	if (handle->scratch_log) {
+		IOF_TRACE_INFO(handle, "Not exporting GAH of scratch file");
+		D_GOTO(out_err, ret = ENOTSUP);
+	}
+
 	handle_gah_ioctl(cmd, handle, &gah_info);
 
 	IOC_REPLY_IOCTL(handle, req, gah_info);
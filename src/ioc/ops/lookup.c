@@ -97,10 +97,26 @@ iof_entry_cb(struct ioc_request *request)
 		ie_close(fs_handle, desc->ie);
 	}
 
+	ioc_scratch_attr(fs_handle, &entry.attr);
+
 	IOC_REPLY_ENTRY(request, entry);
 	iof_pool_release(desc->pool, desc);
 	return keep_ref;
 out:
+	/* Remember failed lookups, and let the kernel cache them as a
+	 * negative entry for the same time.
+	 */
+	if (request->rc == ENOENT && desc->pool == fs_handle->lookup_pool) {
+		ioc_neg_insert(&fs_handle->neg_cache, desc->ie->parent,
+			       desc->ie->name, desc->neg_gen);
+		entry.entry_timeout =
+			atomic_load_consume(&fs_handle->neg_cache.nc_timeout);
+		if (entry.entry_timeout > 0) {
+			IOC_REPLY_ENTRY(request, entry);
+			iof_pool_release(desc->pool, desc);
+			return false;
+		}
+	}
 	IOC_REPLY_ERR(request, request->rc);
 	iof_pool_release(desc->pool, desc);
 	return false;
@@ -120,9 +136,26 @@ ioc_ll_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
 	struct iof_projection_info	*fs_handle = fuse_req_userdata(req);
 	struct TYPE_NAME		*desc = NULL;
 	struct iof_gah_string_in	*in;
+	uint64_t			neg_gen;
 	int rc;
 
 	IOF_TRACE_INFO(fs_handle, "Parent:%lu '%s'", parent, name);
+
+	if (ioc_neg_lookup(&fs_handle->neg_cache, parent, name, &neg_gen)) {
+		struct fuse_entry_param entry = {0};
+
+		STAT_ADD(fs_handle->stats, lookup);
+		IOF_TRACE_DEBUG(fs_handle, "Negative cache hit");
+		entry.entry_timeout =
+			atomic_load_consume(&fs_handle->neg_cache.nc_timeout);
+		rc = fuse_reply_entry(req, &entry);
+		if (rc != 0)
+			IOF_TRACE_ERROR(fs_handle,
+					"fuse_reply_entry returned %d:%s",
+					rc, strerror(-rc));
+		return;
+	}
+
 	IOC_REQ_INIT_REQ(desc, fs_handle, api, req, rc);
 	if (rc)
 		D_GOTO(err, rc);
@@ -133,9 +166,12 @@ ioc_ll_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
 
 	in = crt_req_get(desc->request.rpc);
 	strncpy(in->name.name, name, NAME_MAX);
+	desc->request.ir_md_name = in->name.name;
+	desc->request.ir_balance = true;
 	strncpy(desc->ie->name, name, NAME_MAX);
 	desc->ie->parent = parent;
 	desc->pool = fs_handle->lookup_pool;
+	desc->neg_gen = neg_gen;
 
 	rc = iof_fs_send(&desc->request);
 	if (rc != 0)
@@ -74,6 +74,9 @@ ioc_ll_mkdir(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode)
 	in->mode = mode;
 
 	desc->request.ir_inode_num = parent;
+	desc->request.ir_md_name = in->common.name.name;
+
+	ioc_neg_remove(&fs_handle->neg_cache, parent, name);
 
 	rc = iof_fs_send(&desc->request);
 	if (rc != 0)
@@ -63,11 +63,15 @@ ioc_open_ll_cb(struct ioc_request *request)
 	fi.fh = (uint64_t)handle;
 	handle->common.gah = out->gah;
 	handle->common.ep = request->rpc->cr_ep;
+	handle->common.ep.ep_tag = ioc_gah_tag(request->fsh, &out->gah);
 	H_GAH_SET_VALID(handle);
 	D_MUTEX_LOCK(&request->fsh->of_lock);
 	d_list_add_tail(&handle->fh_of_list, &request->fsh->openfile_list);
 	D_MUTEX_UNLOCK(&request->fsh->of_lock);
 
+	ioc_cache_open(handle);
+	ioc_scratch_open(handle);
+
 	IOC_REPLY_OPEN(&handle->open_req, fi);
 
 	return false;
@@ -119,6 +123,10 @@ void ioc_ll_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
 		}
 	}
 
+	/* Absorbed writes have to reach the IONSS before it truncates */
+	if (fi->flags & O_TRUNC)
+		ioc_scratch_sync(fs_handle, ino);
+
 	handle = iof_pool_acquire(fs_handle->fh_pool);
 	if (!handle) {
 		D_GOTO(out_err, rc = ENOMEM);
@@ -137,6 +145,7 @@ void ioc_ll_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
 	handle->open_req.ir_inode_num = ino;
 
 	in->flags = fi->flags;
+	handle->flags = fi->flags;
 	IOF_TRACE_INFO(handle, "flags 0%o", fi->flags);
 
 	LOG_FLAGS(handle, fi->flags);
@@ -36,17 +36,316 @@
  * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+
 #include "iof_common.h"
 #include "ioc.h"
 #include "log.h"
 #include "ios_gah.h"
 
+/* Pipe used for splicing read data into the fuse device.
+ *
+ * Replies are sent from the CaRT progress threads, so each thread creates
+ * its own pipe on first use, sized to the largest reply it has sent, and
+ * closes it on thread exit.
+ */
+struct read_pipe {
+	int	fd[2];
+	size_t	size;
+};
+
+static pthread_key_t read_pipe_key;
+static pthread_once_t read_pipe_once = PTHREAD_ONCE_INIT;
+static int read_pipe_key_rc;
+
+/* Largest pipe which can be used, replies which need more than this are not
+ * spliced.  Starts at /proc/sys/fs/pipe-max-size and is lowered if a resize
+ * is refused, so that reads of that size do not try again.
+ */
+static ATOMIC size_t read_pipe_max = SIZE_MAX;
+
+static void
+read_pipe_destroy(void *arg)
+{
+	struct read_pipe *rp = arg;
+
+	close(rp->fd[0]);
+	close(rp->fd[1]);
+	D_FREE(rp);
+}
+
+static void
+read_pipe_key_init(void)
+{
+	FILE *fp;
+	unsigned long max;
+
+	read_pipe_key_rc = pthread_key_create(&read_pipe_key,
+					      read_pipe_destroy);
+
+	fp = fopen("/proc/sys/fs/pipe-max-size", "r");
+	if (!fp)
+		return;
+
+	if (fscanf(fp, "%lu", &max) == 1)
+		atomic_store_release(&read_pipe_max, max);
+
+	fclose(fp);
+}
+
+/* Drop the pipe for this thread, used if the pipe may contain stale data */
+static void
+read_pipe_reset(struct read_pipe *rp)
+{
+	pthread_setspecific(read_pipe_key, NULL);
+	read_pipe_destroy(rp);
+}
+
+static struct read_pipe *
+read_pipe_get(struct iof_rb *rb, size_t len)
+{
+	struct read_pipe *rp;
+	size_t max;
+	int rc;
+
+	pthread_once(&read_pipe_once, read_pipe_key_init);
+	if (read_pipe_key_rc != 0)
+		return NULL;
+
+	/* Allow an extra page as data which is not page aligned will
+	 * use one more pipe buffer than its length suggests.
+	 */
+	len += sysconf(_SC_PAGESIZE);
+	max = atomic_load_acquire(&read_pipe_max);
+	if (len > max)
+		return NULL;
+
+	rp = pthread_getspecific(read_pipe_key);
+	if (!rp) {
+		D_ALLOC_PTR(rp);
+		if (!rp)
+			return NULL;
+
+		rc = pipe2(rp->fd, O_CLOEXEC);
+		if (rc != 0) {
+			IOF_TRACE_WARNING(rb, "Could not create pipe %d:%s",
+					  errno, strerror(errno));
+			D_FREE(rp);
+			return NULL;
+		}
+
+		rc = pthread_setspecific(read_pipe_key, rp);
+		if (rc != 0) {
+			read_pipe_destroy(rp);
+			return NULL;
+		}
+	}
+
+	if (rp->size < len) {
+		rc = fcntl(rp->fd[0], F_SETPIPE_SZ, len);
+		if (rc < 0 && errno == EPERM) {
+			/* Only warn for the thread which lowers the limit */
+			if (atomic_compare_exchange(&read_pipe_max, max,
+						    len - 1))
+				IOF_TRACE_WARNING(rb, "Could not resize pipe to"
+						  " %zu, not splicing reads"
+						  " of this size", len);
+			return NULL;
+		}
+		if (rc < 0) {
+			IOF_TRACE_WARNING(rb, "Could not resize pipe %d:%s",
+					  errno, strerror(errno));
+			return NULL;
+		}
+		rp->size = rc;
+	}
+
+	return rp;
+}
+
+/* Reply to a read by splicing the data rather than copying it.
+ *
+ * The buffer is vmspliced into a pipe and passed to libfuse as a file
+ * descriptor, which then splices it into the fuse device.  The pages are
+ * not gifted, as bulk buffers are re-used by the pool, so this is safe as
+ * long as the data has been consumed by the time fuse_reply_data()
+ * returns, which it has.
+ *
+ * Returns -EAGAIN if the reply could not be attempted, in which case the
+ * caller should fall back to one of the other methods.
+ */
+static int
+read_reply_splice(struct iof_rb *rb, void *buff, size_t len)
+{
+	struct fuse_bufvec bufv = FUSE_BUFVEC_INIT(len);
+	struct iovec iov = {.iov_base = buff, .iov_len = len};
+	struct read_pipe *rp;
+	ssize_t bytes;
+	int pending;
+	int rc;
+
+	rp = read_pipe_get(rb, len);
+	if (!rp)
+		return -EAGAIN;
+
+	while (iov.iov_len > 0) {
+		bytes = vmsplice(rp->fd[1], &iov, 1, SPLICE_F_NONBLOCK);
+		if (bytes <= 0) {
+			IOF_TRACE_WARNING(rb, "vmsplice returned %zi %d:%s",
+					  bytes, errno, strerror(errno));
+			read_pipe_reset(rp);
+			return -EAGAIN;
+		}
+		iov.iov_base = (char *)iov.iov_base + bytes;
+		iov.iov_len -= bytes;
+	}
+
+	bufv.buf[0].flags = FUSE_BUF_IS_FD;
+	bufv.buf[0].fd = rp->fd[0];
+
+	rc = fuse_reply_data(rb->rb_req.req, &bufv, FUSE_BUF_SPLICE_MOVE);
+
+	/* If the reply failed part way through then the pipe may still
+	 * contain data, so drop it rather than send it with the next reply.
+	 */
+	if (ioctl(rp->fd[0], FIONREAD, &pending) != 0 || pending != 0)
+		read_pipe_reset(rp);
+
+	return rc;
+}
+
+static uint64_t
+read_reply_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Size class of a reply, 0 is anything below 8KiB and each class after that
+ * is twice the size of the previous one.
+ */
+static int
+read_reply_class(size_t len)
+{
+	int class = 0;
+
+	len >>= 12;
+	while (len > 1 && class < IOC_READ_REPLY_CLASSES - 1) {
+		len >>= 1;
+		class++;
+	}
+	return class;
+}
+
+/* Pick the method to use for a reply.  In AUTO mode the first replies in
+ * each size class cycle through all methods, after which the fastest is
+ * used with periodic re-sampling so the choice follows changes in load.
+ */
+static int
+read_reply_select(struct iof_projection_info *fs_handle, int class)
+{
+	struct ioc_read_reply_bench *bench = &fs_handle->read_bench;
+	uint64_t calls;
+	int mode;
+
+	mode = atomic_load_consume(&fs_handle->read_reply);
+	if (mode != IOC_READ_REPLY_AUTO)
+		return mode;
+
+	calls = atomic_fetch_add(&bench->calls[class], 1);
+	if (calls < IOC_READ_REPLY_SAMPLES * IOC_READ_REPLY_METHODS ||
+	    (calls % IOC_READ_REPLY_RESAMPLE) < IOC_READ_REPLY_METHODS)
+		return calls % IOC_READ_REPLY_METHODS;
+
+	return atomic_load_consume(&bench->best[class]);
+}
+
+static void
+read_reply_record(struct iof_projection_info *fs_handle, int class,
+		  int method, uint64_t nsec)
+{
+	struct ioc_read_reply_bench *bench = &fs_handle->read_bench;
+	uint64_t best_avg = UINT64_MAX;
+	uint64_t count;
+	uint64_t avg;
+	int best = method;
+	int i;
+
+	atomic_inc(&bench->stat[class][method].count);
+	atomic_add(&bench->stat[class][method].nsec, nsec);
+
+	for (i = 0; i < IOC_READ_REPLY_METHODS; i++) {
+		count = atomic_load_consume(&bench->stat[class][i].count);
+		if (count == 0)
+			continue;
+		avg = atomic_load_consume(&bench->stat[class][i].nsec) / count;
+		if (avg < best_avg) {
+			best_avg = avg;
+			best = i;
+		}
+	}
+	atomic_store_release(&bench->best[class], best);
+}
+
+static void
+read_reply(struct iof_rb *rb, void *buff, size_t len)
+{
+	struct iof_projection_info *fs_handle = rb->rb_req.fsh;
+	uint64_t start;
+	int method;
+	int class;
+	int rc;
+
+	class = read_reply_class(len);
+	method = read_reply_select(fs_handle, class);
+
+	start = read_reply_now();
+
+	if (method == IOC_READ_REPLY_SPLICE) {
+		rc = read_reply_splice(rb, buff, len);
+		if (rc == 0)
+			goto done;
+		if (rc != -EAGAIN) {
+			IOF_TRACE_ERROR(rb, "splice reply returned %d:%s",
+					rc, strerror(-rc));
+			goto done;
+		}
+		method = IOC_READ_REPLY_DATA;
+	}
+
+	if (method == IOC_READ_REPLY_BUF) {
+		rc = fuse_reply_buf(rb->rb_req.req, buff, len);
+		if (rc != 0)
+			IOF_TRACE_ERROR(rb, "fuse_reply_buf returned %d:%s",
+					rc, strerror(-rc));
+	} else {
+		rb->fbuf.buf[0].size = len;
+		rb->fbuf.buf[0].mem = buff;
+		rc = fuse_reply_data(rb->rb_req.req, &rb->fbuf, 0);
+		if (rc != 0)
+			IOF_TRACE_ERROR(rb, "fuse_reply_data returned %d:%s",
+					rc, strerror(-rc));
+	}
+
+done:
+	if (rc == 0)
+		read_reply_record(fs_handle, class, method,
+				  read_reply_now() - start);
+}
+
 static bool
 read_bulk_cb(struct ioc_request *request)
 {
 	struct iof_rb *rb = container_of(request, struct iof_rb, rb_req);
+	struct iof_readx_in *in = crt_req_get(request->rpc);
 	struct iof_readx_out *out = crt_reply_get(request->rpc);
-	int rc = 0;
 	size_t bytes_read = 0;
 	void *buff = NULL;
 
@@ -78,35 +377,190 @@ out:
 	} else {
 		STAT_ADD_COUNT(request->fsh->stats, read_bytes, bytes_read);
 
-		/* It's not clear without benchmarking which approach is better
-		 * here, fuse_reply_buf() is a small wrapper around writev()
-		 * which is a much shorter code-path however fuse_reply_data()
-		 * attempts to use splice which may well be faster.
-		 *
-		 * For now it's easy to pick between them, and both of them are
-		 * passing valgrind tests.
-		 */
-		if (request->fsh->flags & IOF_FUSE_READ_BUF) {
-			rc = fuse_reply_buf(request->req, buff, bytes_read);
-			if (rc != 0)
-				IOF_TRACE_ERROR(rb,
-						"fuse_reply_buf returned %d:%s",
-						rc, strerror(-rc));
-
-		} else {
-			rb->fbuf.buf[0].size = bytes_read;
-			rb->fbuf.buf[0].mem = buff;
-			rc = fuse_reply_data(request->req, &rb->fbuf, 0);
-			if (rc != 0)
-				IOF_TRACE_ERROR(rb,
-						"fuse_reply_data returned %d:%s",
-						rc, strerror(-rc));
-		}
+		/* Before replying, as the handle may be released after */
+		ioc_cache_fill(request->ir_file, in->xtvec.xt_off, buff,
+			       bytes_read);
+
+		read_reply(rb, buff, bytes_read);
 	}
 	iof_pool_release(rb->pt, rb);
 	return false;
 }
 
+/* A read which spans stripes, split into one RPC per stripe with the data
+ * for each placed at its offset in the read buffer.
+ */
+struct read_stripe_seg {
+	struct read_stripe	*rs;
+	size_t			off;
+	size_t			len;
+	size_t			done;
+	int			rc;
+};
+
+struct read_stripe {
+	struct iof_rb		*rb;
+	ATOMIC int		pending;
+	int			count;
+	struct read_stripe_seg	seg[];
+};
+
+/* Reply with the data up to the first short or failed segment */
+static void
+read_stripe_done(struct read_stripe *rs)
+{
+	struct iof_rb *rb = rs->rb;
+	struct iof_readx_in *in = crt_req_get(rb->rb_req.rpc);
+	size_t bytes = 0;
+	int rc = 0;
+	int i;
+
+	for (i = 0; i < rs->count; i++) {
+		if (rs->seg[i].rc) {
+			rc = rs->seg[i].rc;
+			break;
+		}
+		bytes += rs->seg[i].done;
+		if (rs->seg[i].done < rs->seg[i].len)
+			break;
+	}
+
+	if (bytes == 0 && rc) {
+		IOC_REPLY_ERR(&rb->rb_req, rc);
+	} else {
+		STAT_ADD_COUNT(rb->rb_req.fsh->stats, read_bytes, bytes);
+
+		ioc_cache_fill(rb->rb_req.ir_file, in->xtvec.xt_off,
+			       rb->lb.buf, bytes);
+
+		read_reply(rb, rb->lb.buf, bytes);
+	}
+	iof_pool_release(rb->pt, rb);
+	D_FREE(rs);
+}
+
+static void
+read_stripe_put(struct read_stripe *rs)
+{
+	if (atomic_fetch_sub(&rs->pending, 1) == 1)
+		read_stripe_done(rs);
+}
+
+static void
+read_stripe_cb(const struct crt_cb_info *cb_info)
+{
+	struct read_stripe_seg *seg = cb_info->cci_arg;
+	struct iof_rb *rb = seg->rs->rb;
+	struct iof_readx_out *out = crt_reply_get(cb_info->cci_rpc);
+
+	atomic_dec_release(&rb->rb_req.ir_ctx->queue_depth);
+
+	if (cb_info->cci_rc) {
+		IOF_TRACE_INFO(rb, "Bad RPC reply %d", cb_info->cci_rc);
+		ioc_stripe_fail(rb->rb_req.ir_file);
+		D_GOTO(out, seg->rc = EIO);
+	}
+
+	if (out->err) {
+		IOF_TRACE_ERROR(rb, "Error from target %d", out->err);
+		rb->failure = true;
+		ioc_stripe_fail(rb->rb_req.ir_file);
+		D_GOTO(out, seg->rc = EIO);
+	}
+
+	if (out->rc)
+		D_GOTO(out, seg->rc = out->rc);
+
+	/* Any data which did not fit in the bulk transfers follows it */
+	seg->done = out->bulk_len;
+	if (out->iov_len > 0) {
+		if (out->data.iov_len != out->iov_len ||
+		    seg->done + out->iov_len > seg->len)
+			D_GOTO(out, seg->rc = EIO);
+		memcpy((char *)rb->lb.buf + seg->off + seg->done,
+		       out->data.iov_buf, out->iov_len);
+		seg->done += out->iov_len;
+	}
+
+out:
+	read_stripe_put(seg->rs);
+}
+
+/* Send a striped read.  Returns an errno if nothing was sent, in which case
+ * the caller still owns rb.
+ */
+static int
+read_stripe(struct iof_rb *rb, off_t position, size_t len)
+{
+	struct iof_file_handle *handle = rb->rb_req.ir_file;
+	struct iof_projection_info *fs_handle = rb->rb_req.fsh;
+	struct read_stripe_seg *seg;
+	struct iof_readx_in *in;
+	struct read_stripe *rs;
+	struct ios_gah gah;
+	crt_endpoint_t ep;
+	crt_rpc_t *rpc;
+	size_t off = 0;
+	int count;
+	int rc;
+	int i;
+
+	count = ioc_stripe_count(handle, position, len);
+
+	D_ALLOC(rs, sizeof(*rs) + count * sizeof(rs->seg[0]));
+	if (!rs)
+		return ENOMEM;
+
+	rs->rb = rb;
+	rs->count = count;
+
+	/* Hold an extra reference until every segment has been sent */
+	atomic_store_release(&rs->pending, count + 1);
+
+	for (i = 0; i < count; i++) {
+		seg = &rs->seg[i];
+		seg->rs = rs;
+		seg->off = off;
+		seg->len = ioc_stripe_map(handle, position + off, len - off,
+					  &ep, &gah);
+		off += seg->len;
+
+		rpc = NULL;
+		rc = crt_req_create(rb->rb_req.ir_ctx->crt_ctx, &ep,
+				    FS_TO_IOOP(fs_handle, 0), &rpc);
+		if (rc || !rpc) {
+			IOF_TRACE_ERROR(rb, "Could not create request, rc = %d",
+					rc);
+			seg->rc = ENOMEM;
+			read_stripe_put(rs);
+			continue;
+		}
+
+		in = crt_req_get(rpc);
+		in->gah = gah;
+		in->xtvec.xt_off = position + seg->off;
+		in->xtvec.xt_len = seg->len;
+		in->data_bulk = rb->lb.handle;
+		in->bulk_off = seg->off;
+
+		IOF_TRACE_DEBUG(rb, "%#zx-%#zx on rank %d",
+				position + seg->off,
+				position + seg->off + seg->len - 1, ep.ep_rank);
+
+		atomic_inc(&rb->rb_req.ir_ctx->queue_depth);
+		rc = crt_req_send(rpc, read_stripe_cb, seg);
+		if (rc) {
+			IOF_TRACE_ERROR(rb, "Could not send rpc, rc = %d", rc);
+			atomic_dec_release(&rb->rb_req.ir_ctx->queue_depth);
+			seg->rc = EIO;
+			read_stripe_put(rs);
+		}
+	}
+
+	read_stripe_put(rs);
+	return 0;
+}
+
 static const struct ioc_request_api api = {
 	.on_result	= read_bulk_cb,
 	.gah_offset	= offsetof(struct iof_readx_in, gah),
@@ -119,6 +573,7 @@ void ioc_ll_read(fuse_req_t req, fuse_ino_t ino, size_t len,
 	struct iof_file_handle *handle = (void *)fi->fh;
 	struct iof_projection_info *fs_handle = handle->open_req.fsh;
 	struct iof_readx_in *in;
+	struct iof_ctx *iof_ctx;
 	struct iof_pool_type *pt;
 	struct iof_rb *rb = NULL;
 	int rc;
@@ -128,10 +583,14 @@ void ioc_ll_read(fuse_req_t req, fuse_ino_t ino, size_t len,
 	IOF_TRACE_INFO(handle, "%#zx-%#zx " GAH_PRINT_STR, position,
 		       position + len - 1, GAH_PRINT_VAL(handle->common.gah));
 
-	if (len <= 4096)
-		pt = fs_handle->rb_pool_page;
-	else
-		pt = fs_handle->rb_pool_large;
+	ioc_scratch_sync(fs_handle, handle->inode_num);
+
+	if (ioc_cache_read(handle, req, position, len))
+		return;
+
+	iof_ctx = ioc_ctx_for_read(fs_handle);
+
+	pt = ioc_buf_class_for_read(iof_ctx, len)->rb_pool;
 
 	rb = iof_pool_acquire(pt);
 	if (!rb)
@@ -151,6 +610,14 @@ void ioc_ll_read(fuse_req_t req, fuse_ino_t ino, size_t len,
 	in->data_bulk = rb->lb.handle;
 	IOF_TRACE_LINK(rb->rb_req.rpc, rb, "read_bulk_rpc");
 
+	if (ioc_stripe_active(handle, position, len)) {
+		rc = read_stripe(rb, position, len);
+		if (rc == 0) {
+			iof_pool_restock(pt);
+			return;
+		}
+	}
+
 	rc = iof_fs_send(&rb->rb_req);
 	if (rc != 0) {
 		IOC_REPLY_ERR(&rb->rb_req, rc);
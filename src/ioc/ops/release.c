@@ -76,6 +76,9 @@ ioc_release_priv(struct iof_file_handle *handle)
 	d_list_del(&handle->fh_ino_list);
 	D_MUTEX_UNLOCK(&fs_handle->of_lock);
 
+	ioc_stripe_release(handle);
+	ioc_cache_release(handle);
+
 	IOF_TRACE_UP(&handle->release_req, handle, "release_req");
 
 	IOF_TRACE_INFO(&handle->release_req,
@@ -104,11 +107,14 @@ void ioc_ll_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
 	struct iof_file_handle *handle = (struct iof_file_handle *)fi->fh;
 
 	handle->release_req.req = req;
+	if (ioc_scratch_release(handle))
+		return;
 	ioc_release_priv(handle);
 }
 
 void ioc_int_release(struct iof_file_handle *handle)
 {
-
+	if (ioc_scratch_release(handle))
+		return;
 	ioc_release_priv(handle);
 }
@@ -116,11 +116,22 @@ ioc_ll_rename(fuse_req_t req, fuse_ino_t parent, const char *name,
 
 	request->ir_inode_num = parent;
 	request->ir_ht = RHS_INODE_NUM;
-
-	rc = find_gah(fs_handle, newparent, &in->new_gah);
+	request->ir_md_name = in->old_name.name;
+
+	/* With striped metadata both parents are needed on the rank the
+	 * request is sent to, which is chosen from the old name.
+	 */
+	if (fs_handle->flags & IOF_STRIPED_METADATA)
+		rc = ioc_md_find_gah(fs_handle, newparent,
+				     ioc_md_rank(fs_handle, parent, name),
+				     &in->new_gah);
+	else
+		rc = find_gah(fs_handle, newparent, &in->new_gah);
 	if (rc != 0)
 		D_GOTO(out_decref, ret = rc);
 
+	ioc_neg_remove(&fs_handle->neg_cache, newparent, newname);
+
 	crt_req_addref(request->rpc);
 
 	rc = iof_fs_send(request);
@@ -84,6 +84,12 @@ ioc_ll_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr, int to_set,
 
 	IOF_TRACE_INFO(fs_handle, "inode %lu handle %p", ino, handle);
 
+	/* Absorbed writes would otherwise land after the new attributes */
+	ioc_scratch_sync(fs_handle, ino);
+
+	if (to_set & FUSE_SET_ATTR_SIZE)
+		ioc_cache_invalidate(fs_handle, ino);
+
 	IOC_REQ_INIT_REQ(desc, fs_handle, setattr_api, req, rc);
 	if (rc)
 		D_GOTO(err, rc);
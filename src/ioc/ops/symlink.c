@@ -80,6 +80,9 @@ ioc_ll_symlink(fuse_req_t req, const char *link, fuse_ino_t parent,
 	desc->ie->parent = parent;
 
 	desc->request.ir_inode_num = parent;
+	desc->request.ir_md_name = in->common.name.name;
+
+	ioc_neg_remove(&fs_handle->neg_cache, parent, name);
 
 	rc = iof_fs_send(&desc->request);
 	if (rc != 0)
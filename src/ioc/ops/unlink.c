@@ -86,6 +86,7 @@ ioc_ll_remove(fuse_req_t req, fuse_ino_t parent, const char *name, bool dir)
 
 	in = crt_req_get(request->rpc);
 	strncpy(in->name.name, name, NAME_MAX);
+	request->ir_md_name = in->name.name;
 	if (dir)
 		in->flags = 1;
 
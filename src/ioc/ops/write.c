@@ -70,14 +70,14 @@ write_cb(struct ioc_request *request)
 
 	STAT_ADD_COUNT(request->fsh->stats, write_bytes, out->len);
 
-	iof_pool_release(request->fsh->write_pool, wb);
+	iof_pool_release(wb->pt, wb);
 
 	return false;
 
 err:
 	IOC_REPLY_ERR(request, request->rc);
 
-	iof_pool_release(request->fsh->write_pool, wb);
+	iof_pool_release(wb->pt, wb);
 	return false;
 }
 
@@ -87,6 +87,175 @@ static const struct ioc_request_api api = {
 	.have_gah = true,
 };
 
+/* A write which spans stripes, split into one RPC per stripe */
+struct write_stripe_seg {
+	struct write_stripe	*ws;
+	size_t			off;
+	size_t			len;
+	size_t			done;
+	int			rc;
+};
+
+struct write_stripe {
+	struct iof_wb		*wb;
+	ATOMIC int		pending;
+	int			count;
+	struct write_stripe_seg	seg[];
+};
+
+/* Reply with the number of bytes written up to the first short or failed
+ * segment.
+ */
+static void
+write_stripe_done(struct write_stripe *ws)
+{
+	struct iof_wb *wb = ws->wb;
+	size_t bytes = 0;
+	int rc = 0;
+	int i;
+
+	for (i = 0; i < ws->count; i++) {
+		if (ws->seg[i].rc) {
+			rc = ws->seg[i].rc;
+			break;
+		}
+		bytes += ws->seg[i].done;
+		if (ws->seg[i].done < ws->seg[i].len)
+			break;
+	}
+
+	if (bytes == 0 && rc) {
+		IOC_REPLY_ERR(&wb->wb_req, rc);
+	} else {
+		IOC_REPLY_WRITE(wb, wb->wb_req.req, bytes);
+
+		STAT_ADD_COUNT(wb->wb_req.fsh->stats, write_bytes, bytes);
+	}
+	iof_pool_release(wb->pt, wb);
+	D_FREE(ws);
+}
+
+static void
+write_stripe_put(struct write_stripe *ws)
+{
+	if (atomic_fetch_sub(&ws->pending, 1) == 1)
+		write_stripe_done(ws);
+}
+
+static void
+write_stripe_cb(const struct crt_cb_info *cb_info)
+{
+	struct write_stripe_seg *seg = cb_info->cci_arg;
+	struct iof_wb *wb = seg->ws->wb;
+	struct iof_writex_out *out = crt_reply_get(cb_info->cci_rpc);
+	struct iof_writex_in *in = crt_req_get(cb_info->cci_rpc);
+
+	atomic_dec_release(&wb->wb_req.ir_ctx->queue_depth);
+
+	if (cb_info->cci_rc) {
+		IOF_TRACE_INFO(wb, "Bad RPC reply %d", cb_info->cci_rc);
+		ioc_stripe_fail(wb->wb_req.ir_file);
+		D_GOTO(out, seg->rc = EIO);
+	}
+
+	if (out->err) {
+		IOF_TRACE_ERROR(wb, "Error from target %d", out->err);
+		if (in->data_bulk)
+			wb->failure = true;
+		ioc_stripe_fail(wb->wb_req.ir_file);
+		D_GOTO(out, seg->rc = EIO);
+	}
+
+	if (out->rc)
+		D_GOTO(out, seg->rc = out->rc);
+
+	seg->done = out->len;
+
+out:
+	write_stripe_put(seg->ws);
+}
+
+/* Send a striped write.  Returns an errno if nothing was sent, in which
+ * case the caller still owns wb.
+ */
+static int
+write_stripe(size_t len, off_t position, struct iof_wb *wb)
+{
+	struct iof_file_handle *handle = wb->wb_req.ir_file;
+	struct iof_projection_info *fs_handle = wb->wb_req.fsh;
+	struct write_stripe_seg *seg;
+	struct iof_writex_in *in;
+	struct write_stripe *ws;
+	struct ios_gah gah;
+	crt_endpoint_t ep;
+	crt_rpc_t *rpc;
+	size_t off = 0;
+	int count;
+	int rc;
+	int i;
+
+	count = ioc_stripe_count(handle, position, len);
+
+	D_ALLOC(ws, sizeof(*ws) + count * sizeof(ws->seg[0]));
+	if (!ws)
+		return ENOMEM;
+
+	ws->wb = wb;
+	ws->count = count;
+
+	/* Hold an extra reference until every segment has been sent */
+	atomic_store_release(&ws->pending, count + 1);
+
+	for (i = 0; i < count; i++) {
+		seg = &ws->seg[i];
+		seg->ws = ws;
+		seg->off = off;
+		seg->len = ioc_stripe_map(handle, position + off, len - off,
+					  &ep, &gah);
+		off += seg->len;
+
+		rpc = NULL;
+		rc = crt_req_create(wb->wb_req.ir_ctx->crt_ctx, &ep,
+				    FS_TO_IOOP(fs_handle, 1), &rpc);
+		if (rc || !rpc) {
+			IOF_TRACE_ERROR(wb, "Could not create request, rc = %d",
+					rc);
+			seg->rc = ENOMEM;
+			write_stripe_put(ws);
+			continue;
+		}
+
+		in = crt_req_get(rpc);
+		in->gah = gah;
+		in->xtvec.xt_off = position + seg->off;
+		in->xtvec.xt_len = seg->len;
+		if (seg->len <= fs_handle->proj.max_iov_write) {
+			d_iov_set(&in->data, (char *)wb->lb.buf + seg->off,
+				  seg->len);
+		} else {
+			in->bulk_len = seg->len;
+			in->bulk_off = seg->off;
+			in->data_bulk = wb->lb.handle;
+		}
+
+		IOF_TRACE_DEBUG(wb, "%#zx-%#zx on rank %d",
+				position + seg->off,
+				position + seg->off + seg->len - 1, ep.ep_rank);
+
+		atomic_inc(&wb->wb_req.ir_ctx->queue_depth);
+		rc = crt_req_send(rpc, write_stripe_cb, seg);
+		if (rc) {
+			IOF_TRACE_ERROR(wb, "Could not send rpc, rc = %d", rc);
+			atomic_dec_release(&wb->wb_req.ir_ctx->queue_depth);
+			seg->rc = EIO;
+			write_stripe_put(ws);
+		}
+	}
+
+	write_stripe_put(ws);
+	return 0;
+}
+
 static void
 ioc_writex(size_t len, off_t position, struct iof_wb *wb)
 {
@@ -95,6 +264,10 @@ ioc_writex(size_t len, off_t position, struct iof_wb *wb)
 
 	IOF_TRACE_LINK(wb->wb_req.rpc, wb, "writex_rpc");
 
+	if (ioc_stripe_active(wb->wb_req.ir_file, position, len) &&
+	    write_stripe(len, position, wb) == 0)
+		return;
+
 	in->xtvec.xt_len = len;
 	if (len <= wb->wb_req.fsh->proj.max_iov_write) {
 		d_iov_set(&in->data, wb->lb.buf, len);
@@ -115,21 +288,35 @@ ioc_writex(size_t len, off_t position, struct iof_wb *wb)
 
 err:
 	IOC_REPLY_ERR_RAW(wb, wb->wb_req.req, rc);
-	iof_pool_release(wb->wb_req.fsh->write_pool, wb);
+	iof_pool_release(wb->pt, wb);
 }
 
 void ioc_ll_write(fuse_req_t req, fuse_ino_t ino, const char *buff, size_t len,
 		  off_t position, struct fuse_file_info *fi)
 {
 	struct iof_file_handle *handle = (struct iof_file_handle *)fi->fh;
+	struct iof_ctx *iof_ctx;
+	struct iof_pool_type *pt;
 	struct iof_wb *wb = NULL;
+	struct fuse_bufvec bufv = FUSE_BUFVEC_INIT(len);
 	int rc;
 
 	STAT_ADD(handle->open_req.fsh->stats, write);
 
-	wb = iof_pool_acquire(handle->open_req.fsh->write_pool);
+	ioc_cache_invalidate(handle->open_req.fsh, handle->inode_num);
+
+	bufv.buf[0].mem = (void *)buff;
+	if (ioc_scratch_write(handle, req, &bufv, position))
+		return;
+
+	iof_ctx = ioc_ctx_for_write(handle->open_req.fsh, handle);
+
+	pt = ioc_buf_class_for_write(iof_ctx, len)->wb_pool;
+
+	wb = iof_pool_acquire(pt);
 	if (!wb)
 		D_GOTO(err, rc = ENOMEM);
+	wb->pt = pt;
 
 	IOF_TRACE_UP(wb, handle, "writebuf");
 
@@ -158,6 +345,8 @@ void ioc_ll_write_buf(fuse_req_t req, fuse_ino_t ino, struct fuse_bufvec *bufv,
 		      off_t position, struct fuse_file_info *fi)
 {
 	struct iof_file_handle *handle = (struct iof_file_handle *)fi->fh;
+	struct iof_ctx *iof_ctx;
+	struct iof_pool_type *pt;
 	struct iof_wb *wb = NULL;
 	size_t len = bufv->buf[0].size;
 	struct fuse_bufvec dst = { .count = 1 };
@@ -165,6 +354,8 @@ void ioc_ll_write_buf(fuse_req_t req, fuse_ino_t ino, struct fuse_bufvec *bufv,
 
 	STAT_ADD(handle->open_req.fsh->stats, write);
 
+	ioc_cache_invalidate(handle->open_req.fsh, handle->inode_num);
+
 	/* Check for buffer count being 1.  According to the documentation this
 	 * will always be the case, and if it isn't then our code will be using
 	 * the wrong value for len
@@ -172,12 +363,20 @@ void ioc_ll_write_buf(fuse_req_t req, fuse_ino_t ino, struct fuse_bufvec *bufv,
 	if (bufv->count != 1)
 		D_GOTO(err, rc = EIO);
 
+	if (ioc_scratch_write(handle, req, bufv, position))
+		return;
+
 	IOF_TRACE_INFO(handle, "Count %zi [0].flags %#x",
 		       bufv->count, bufv->buf[0].flags);
 
-	wb = iof_pool_acquire(handle->open_req.fsh->write_pool);
+	iof_ctx = ioc_ctx_for_write(handle->open_req.fsh, handle);
+
+	pt = ioc_buf_class_for_write(iof_ctx, len)->wb_pool;
+
+	wb = iof_pool_acquire(pt);
 	if (!wb)
 		D_GOTO(err, rc = ENOMEM);
+	wb->pt = pt;
 	IOF_TRACE_UP(wb, handle, "writebuf");
 
 	IOF_TRACE_INFO(wb, "%#zx-%#zx " GAH_PRINT_STR, position,
@@ -198,5 +397,5 @@ void ioc_ll_write_buf(fuse_req_t req, fuse_ino_t ino, struct fuse_bufvec *bufv,
 err:
 	IOC_REPLY_ERR_RAW(handle, req, rc);
 	if (wb)
-		iof_pool_release(handle->open_req.fsh->write_pool, wb);
+		iof_pool_release(wb->pt, wb);
 }
@@ -0,0 +1,780 @@
+/* Copyright (C) 2019 Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted for any purpose (including commercial purposes)
+ * provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the
+ *    documentation and/or materials provided with the distribution.
+ *
+ * 3. In addition, redistributions of modified forms of the source or binary
+ *    code must carry prominent notices stating that the original code was
+ *    changed and the date of the change.
+ *
+ *  4. All publications or advertising materials mentioning features or use of
+ *     this software are asked, but not required, to acknowledge that it was
+ *     developed by Intel Corporation and credit the contributors.
+ *
+ * 5. Neither the name of Intel Corporation, nor the name of any Contributor
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Local write absorption for DataWarp scratch mode projections.
+ *
+ * Writes to files open for writing are appended to a log for the handle in a
+ * local directory, normally on node-local flash, and acknowledged as soon as
+ * they are stored.  Drain threads send logged data to the IONSS in the order
+ * it was written, merging consecutive writes into RPCs of up to max_write
+ * bytes.  Logs are unlinked as they are created and are not kept across
+ * restarts, so absorbed data is lost if the node fails before it is drained.
+ *
+ * Each drain thread sends one extent at a time, so a burst of writes is
+ * streamed with IOC_SCRATCH_DRAINERS RPCs in flight.  An extent is only
+ * started once no overlapping extent of the same inode is in flight, so
+ * overlapping writes still reach the IONSS in the order they were made.
+ *
+ * In "close" drain mode, the default, fsync() and close() wait for all data
+ * written through the handle to be drained, and report any error from doing
+ * so.  close() waits in the flush callback, as the kernel does not wait for
+ * the release that follows.  In "async" mode fsync() only syncs the log,
+ * close() returns straight away, and the handle is kept open on the IONSS
+ * until its log has drained.
+ *
+ * Reads, setattr and opens with O_TRUNC wait for data absorbed for the inode
+ * to be drained first, and file sizes reported to the kernel include
+ * data which has yet to be drained.
+ */
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "iof_common.h"
+#include "ioc.h"
+#include "log.h"
+
+struct ioc_scratch_log {
+	d_list_t		sl_link;
+	struct iof_file_handle	*sl_handle;
+	fuse_ino_t		sl_ino;
+	int			sl_fd;
+	/** Offset in the log file of the next write */
+	off_t			sl_tail;
+	/** Bytes absorbed but not yet drained */
+	uint64_t		sl_backlog;
+	/** End of the furthest write not yet drained */
+	off_t			sl_size;
+	/** First error from draining, reported by fsync() and close() */
+	int			sl_err;
+	/** The handle has been closed, release it once drained */
+	bool			sl_released;
+};
+
+/* A range of the file stored contiguously in a log */
+struct scratch_extent {
+	d_list_t		se_link;
+	struct ioc_scratch_log	*se_log;
+	off_t			se_off;
+	off_t			se_log_off;
+	size_t			se_len;
+};
+
+struct scratch_cb_r {
+	struct iof_tracker	tracker;
+	crt_rpc_t		*rpc;
+	int			rc;
+};
+
+static void
+scratch_cb(const struct crt_cb_info *cb_info)
+{
+	struct scratch_cb_r *reply = cb_info->cci_arg;
+
+	reply->rc = cb_info->cci_rc;
+	if (reply->rc == 0) {
+		crt_req_addref(cb_info->cci_rpc);
+		reply->rpc = cb_info->cci_rpc;
+	}
+
+	iof_tracker_signal(&reply->tracker);
+}
+
+/* Write len bytes from buf_off in a drain buffer to the file at off, and
+ * wait for the reply.  Returns an errno, with the number of bytes written in
+ * written.
+ */
+static int
+scratch_writex(struct iof_projection_info *fs_handle,
+	       struct iof_file_handle *handle, struct iof_local_bulk *lb,
+	       off_t off, size_t buf_off, size_t len, size_t *written)
+{
+	struct ioc_scratch *sc = fs_handle->scratch;
+	struct scratch_cb_r reply = {0};
+	struct iof_writex_out *out;
+	struct iof_writex_in *in;
+	struct ios_gah gah;
+	crt_endpoint_t ep;
+	crt_rpc_t *rpc = NULL;
+	int rc;
+
+	if (ioc_stripe_active(handle, off, len)) {
+		len = ioc_stripe_map(handle, off, len, &ep, &gah);
+	} else {
+		D_MUTEX_LOCK(&fs_handle->gah_lock);
+		ep = handle->common.ep;
+		gah = handle->common.gah;
+		D_MUTEX_UNLOCK(&fs_handle->gah_lock);
+	}
+
+	rc = crt_req_create(fs_handle->proj.crt_ctx, &ep,
+			    FS_TO_IOOP(fs_handle, 1), &rpc);
+	if (rc || !rpc) {
+		IOF_TRACE_ERROR(handle, "Could not create request, rc = %d",
+				rc);
+		return ENOMEM;
+	}
+
+	in = crt_req_get(rpc);
+	in->gah = gah;
+	in->xtvec.xt_off = off;
+	in->xtvec.xt_len = len;
+	if (len <= fs_handle->proj.max_iov_write) {
+		d_iov_set(&in->data, (char *)lb->buf + buf_off, len);
+	} else {
+		in->bulk_len = len;
+		in->bulk_off = buf_off;
+		in->data_bulk = lb->handle;
+	}
+
+	IOF_TRACE_DEBUG(handle, "Draining %#zx-%#zx to rank %d", off,
+			off + len - 1, ep.ep_rank);
+
+	iof_tracker_init(&reply.tracker, 1);
+	rc = crt_req_send(rpc, scratch_cb, &reply);
+	if (rc) {
+		IOF_TRACE_ERROR(handle, "Could not send rpc, rc = %d", rc);
+		return EIO;
+	}
+	iof_fs_wait(&fs_handle->proj, &reply.tracker);
+
+	if (reply.rc) {
+		IOF_TRACE_WARNING(handle, "Bad RPC reply %d", reply.rc);
+		return EIO;
+	}
+
+	out = crt_reply_get(reply.rpc);
+	if (out->err) {
+		IOF_TRACE_ERROR(handle, "Error from target %d", out->err);
+		if (out->err == -DER_NONEXIST)
+			H_GAH_SET_INVALID(handle);
+		rc = EIO;
+	} else {
+		rc = out->rc;
+		*written = out->len;
+	}
+	crt_req_decref(reply.rpc);
+
+	atomic_inc(&sc->sc_rpcs);
+	return rc;
+}
+
+/* Send an extent to the IONSS, a drain buffer at a time */
+static int
+scratch_drain(struct ioc_scratch_drainer *sd, struct scratch_extent *se)
+{
+	struct iof_local_bulk *lb = &sd->sd_lb;
+	struct iof_file_handle *handle = se->se_log->sl_handle;
+	size_t done = 0;
+	size_t written;
+	size_t len;
+	size_t off;
+	ssize_t bytes;
+	int rc;
+
+	while (done < se->se_len) {
+		len = se->se_len - done;
+		if (len > lb->len)
+			len = lb->len;
+
+		bytes = pread(se->se_log->sl_fd, lb->buf, len,
+			      se->se_log_off + done);
+		if (bytes != (ssize_t)len) {
+			IOF_TRACE_ERROR(handle, "Could not read log %d:%s",
+					errno, strerror(errno));
+			return EIO;
+		}
+
+		for (off = 0; off < len; off += written) {
+			written = 0;
+			rc = scratch_writex(sd->sd_fs_handle, handle, lb,
+					    se->se_off + done + off, off,
+					    len - off, &written);
+			if (rc)
+				return rc;
+			if (written == 0)
+				return EIO;
+		}
+		done += len;
+	}
+
+	return 0;
+}
+
+static void
+scratch_close(struct ioc_scratch_log *log)
+{
+	if (log->sl_err)
+		IOF_TRACE_WARNING(log->sl_handle,
+				  "Data lost draining log %d:%s",
+				  log->sl_err, strerror(log->sl_err));
+	log->sl_handle->scratch_log = NULL;
+	close(log->sl_fd);
+	D_FREE(log);
+}
+
+/* Check if an extent overlaps one of the same inode which is being sent.
+ * Called with sc_lock held.
+ */
+static bool
+scratch_in_flight(struct ioc_scratch *sc, struct scratch_extent *se)
+{
+	struct scratch_extent *other;
+	int i;
+
+	for (i = 0; i < sc->sc_threads; i++) {
+		other = sc->sc_drainers[i].sd_se;
+		if (other && other->se_log->sl_ino == se->se_log->sl_ino &&
+		    other->se_off < se->se_off + (off_t)se->se_len &&
+		    se->se_off < other->se_off + (off_t)other->se_len)
+			return true;
+	}
+
+	return false;
+}
+
+/* Drain extents in the order they were written.  The oldest extent waits for
+ * any overlapping extent in flight to complete, and extents behind it wait
+ * with it.
+ */
+static void *
+scratch_drain_thread(void *arg)
+{
+	struct ioc_scratch_drainer *sd = arg;
+	struct iof_projection_info *fs_handle = sd->sd_fs_handle;
+	struct ioc_scratch *sc = fs_handle->scratch;
+	struct iof_file_handle *handle;
+	struct ioc_scratch_log *log;
+	struct scratch_extent *se;
+	int rc;
+
+	D_MUTEX_LOCK(&sc->sc_lock);
+	for (;;) {
+		se = NULL;
+		if (!d_list_empty(&sc->sc_extents))
+			se = d_list_entry(sc->sc_extents.next,
+					  struct scratch_extent, se_link);
+		if (!se || scratch_in_flight(sc, se)) {
+			if (!se && sc->sc_stop)
+				break;
+			pthread_cond_wait(&sc->sc_cond, &sc->sc_lock);
+			continue;
+		}
+		d_list_del(&se->se_link);
+		sd->sd_se = se;
+		log = se->se_log;
+		D_MUTEX_UNLOCK(&sc->sc_lock);
+
+		rc = scratch_drain(sd, se);
+		if (rc == 0)
+			STAT_ADD_COUNT(fs_handle->stats, write_bytes,
+				       se->se_len);
+
+		D_MUTEX_LOCK(&sc->sc_lock);
+		sd->sd_se = NULL;
+		if (rc) {
+			if (!log->sl_err)
+				log->sl_err = rc;
+			atomic_inc(&sc->sc_errors);
+		} else {
+			atomic_add(&sc->sc_drained, se->se_len);
+		}
+		log->sl_backlog -= se->se_len;
+		sc->sc_backlog -= se->se_len;
+		D_FREE(se);
+
+		if (log->sl_backlog == 0) {
+			log->sl_size = 0;
+			if (log->sl_released) {
+				handle = log->sl_handle;
+				d_list_del(&log->sl_link);
+				D_MUTEX_UNLOCK(&sc->sc_lock);
+
+				scratch_close(log);
+				ioc_int_release(handle);
+
+				D_MUTEX_LOCK(&sc->sc_lock);
+				sc->sc_releasing--;
+			}
+		}
+		pthread_cond_broadcast(&sc->sc_drained_cond);
+
+		/* Another thread may be waiting for this extent to finish */
+		if (!d_list_empty(&sc->sc_extents))
+			pthread_cond_broadcast(&sc->sc_cond);
+	}
+	D_MUTEX_UNLOCK(&sc->sc_lock);
+
+	return NULL;
+}
+
+int
+ioc_scratch_init(struct iof_projection_info *fs_handle, const char *root,
+		 uint64_t capacity, int drain)
+{
+	struct ioc_scratch_drainer *sd;
+	struct ioc_scratch *sc;
+	int rc;
+	int i;
+
+	D_ALLOC_PTR(sc);
+	if (!sc)
+		return -DER_NOMEM;
+
+	D_ASPRINTF(sc->sc_dir, "%s/%s", root, fs_handle->mnt_dir.name);
+	if (!sc->sc_dir)
+		D_GOTO(free_sc, rc = -DER_NOMEM);
+
+	if ((mkdir(root, 0700) != 0 && errno != EEXIST) ||
+	    (mkdir(sc->sc_dir, 0700) != 0 && errno != EEXIST)) {
+		IOF_TRACE_WARNING(fs_handle,
+				  "Could not create scratch dir '%s' %d:%s",
+				  sc->sc_dir, errno, strerror(errno));
+		D_GOTO(free_dir, rc = -DER_MISC);
+	}
+
+	D_INIT_LIST_HEAD(&sc->sc_logs);
+	D_INIT_LIST_HEAD(&sc->sc_extents);
+	sc->sc_capacity = capacity;
+	atomic_store_release(&sc->sc_drain, drain);
+
+	for (i = 0; i < IOC_SCRATCH_DRAINERS; i++) {
+		sd = &sc->sc_drainers[i];
+		sd->sd_fs_handle = fs_handle;
+		if (!IOF_BULK_ALLOC(fs_handle->proj.crt_ctx, sd, sd_lb,
+				    fs_handle->proj.max_write, true))
+			D_GOTO(free_bulk, rc = -DER_NOMEM);
+	}
+
+	rc = D_MUTEX_INIT(&sc->sc_lock, NULL);
+	if (rc != -DER_SUCCESS)
+		D_GOTO(free_bulk, 0);
+
+	rc = pthread_cond_init(&sc->sc_cond, NULL);
+	if (rc != 0)
+		D_GOTO(free_lock, rc = -DER_MISC);
+
+	rc = pthread_cond_init(&sc->sc_drained_cond, NULL);
+	if (rc != 0)
+		D_GOTO(free_cond, rc = -DER_MISC);
+
+	fs_handle->scratch = sc;
+
+	/* Carry on with fewer threads if some could not be started */
+	for (i = 0; i < IOC_SCRATCH_DRAINERS; i++) {
+		rc = pthread_create(&sc->sc_drainers[i].sd_thread, NULL,
+				    scratch_drain_thread, &sc->sc_drainers[i]);
+		if (rc != 0)
+			break;
+		sc->sc_threads++;
+	}
+
+	if (sc->sc_threads == 0) {
+		fs_handle->scratch = NULL;
+		D_GOTO(free_drained, rc = -DER_MISC);
+	}
+
+	IOF_TRACE_INFO(fs_handle, "Absorbing writes in '%s', capacity %lu, "
+		       "%d drain threads", sc->sc_dir, sc->sc_capacity,
+		       sc->sc_threads);
+
+	return -DER_SUCCESS;
+
+free_drained:
+	pthread_cond_destroy(&sc->sc_drained_cond);
+free_cond:
+	pthread_cond_destroy(&sc->sc_cond);
+free_lock:
+	D_MUTEX_DESTROY(&sc->sc_lock);
+free_bulk:
+	for (i = 0; i < IOC_SCRATCH_DRAINERS; i++) {
+		if (sc->sc_drainers[i].sd_lb.buf)
+			IOF_BULK_FREE(&sc->sc_drainers[i], sd_lb);
+	}
+free_dir:
+	D_FREE(sc->sc_dir);
+free_sc:
+	D_FREE(sc);
+	return rc;
+}
+
+/* Wait for all absorbed data to be drained, and the handles which were
+ * closed while draining to be released.  Called before the projection is
+ * shut down, when no more writes can arrive.
+ */
+void
+ioc_scratch_flush(struct iof_projection_info *fs_handle)
+{
+	struct ioc_scratch *sc = fs_handle->scratch;
+
+	if (!sc)
+		return;
+
+	D_MUTEX_LOCK(&sc->sc_lock);
+	if (sc->sc_backlog != 0)
+		IOF_TRACE_INFO(fs_handle, "Draining %lu bytes", sc->sc_backlog);
+	while (sc->sc_backlog != 0 || sc->sc_releasing != 0)
+		pthread_cond_wait(&sc->sc_drained_cond, &sc->sc_lock);
+	D_MUTEX_UNLOCK(&sc->sc_lock);
+}
+
+void
+ioc_scratch_fini(struct iof_projection_info *fs_handle)
+{
+	struct ioc_scratch *sc = fs_handle->scratch;
+	struct ioc_scratch_log *log;
+	int i;
+
+	if (!sc)
+		return;
+
+	D_MUTEX_LOCK(&sc->sc_lock);
+	sc->sc_stop = true;
+	pthread_cond_broadcast(&sc->sc_cond);
+	D_MUTEX_UNLOCK(&sc->sc_lock);
+	for (i = 0; i < sc->sc_threads; i++)
+		pthread_join(sc->sc_drainers[i].sd_thread, NULL);
+
+	while ((log = d_list_pop_entry(&sc->sc_logs, struct ioc_scratch_log,
+				       sl_link)))
+		scratch_close(log);
+
+	pthread_cond_destroy(&sc->sc_drained_cond);
+	pthread_cond_destroy(&sc->sc_cond);
+	D_MUTEX_DESTROY(&sc->sc_lock);
+	for (i = 0; i < IOC_SCRATCH_DRAINERS; i++)
+		IOF_BULK_FREE(&sc->sc_drainers[i], sd_lb);
+	D_FREE(sc->sc_dir);
+	D_FREE(sc);
+	fs_handle->scratch = NULL;
+}
+
+/* Create a log for a file which has been opened for writing */
+void
+ioc_scratch_open(struct iof_file_handle *handle)
+{
+	struct iof_projection_info *fs_handle = handle->open_req.fsh;
+	struct ioc_scratch *sc = fs_handle->scratch;
+	struct ioc_scratch_log *log;
+	char path[PATH_MAX];
+
+	if (!sc || (handle->flags & O_ACCMODE) == O_RDONLY)
+		return;
+
+	D_ALLOC_PTR(log);
+	if (!log)
+		return;
+
+	snprintf(path, sizeof(path), "%s/%lu.XXXXXX", sc->sc_dir,
+		 handle->inode_num);
+	log->sl_fd = mkostemp(path, O_CLOEXEC);
+	if (log->sl_fd == -1) {
+		IOF_TRACE_WARNING(handle, "Could not create log %d:%s",
+				  errno, strerror(errno));
+		D_FREE(log);
+		return;
+	}
+	unlink(path);
+
+	log->sl_handle = handle;
+	log->sl_ino = handle->inode_num;
+
+	D_MUTEX_LOCK(&sc->sc_lock);
+	d_list_add_tail(&log->sl_link, &sc->sc_logs);
+	D_MUTEX_UNLOCK(&sc->sc_lock);
+
+	handle->scratch_log = log;
+}
+
+/* Called when a file descriptor for a handle is closed.  In close mode this
+ * waits for the log to drain and returns any error from doing so.
+ */
+int
+ioc_scratch_close(struct iof_file_handle *handle)
+{
+	struct ioc_scratch_log *log = handle->scratch_log;
+	struct ioc_scratch *sc;
+	int rc = 0;
+
+	if (!log)
+		return 0;
+
+	sc = handle->open_req.fsh->scratch;
+
+	D_MUTEX_LOCK(&sc->sc_lock);
+	if (atomic_load_consume(&sc->sc_drain) == IOC_SCRATCH_DRAIN_CLOSE) {
+		while (log->sl_backlog != 0)
+			pthread_cond_wait(&sc->sc_drained_cond, &sc->sc_lock);
+		rc = log->sl_err;
+	}
+	D_MUTEX_UNLOCK(&sc->sc_lock);
+
+	return rc;
+}
+
+/* Called when a handle is released.  Returns true if the release of the
+ * handle has been deferred until its log is drained, in which case the
+ * release has already been acknowledged.
+ */
+bool
+ioc_scratch_release(struct iof_file_handle *handle)
+{
+	struct ioc_scratch_log *log = handle->scratch_log;
+	struct ioc_scratch *sc;
+
+	if (!log)
+		return false;
+
+	sc = handle->open_req.fsh->scratch;
+
+	D_MUTEX_LOCK(&sc->sc_lock);
+	if (log->sl_backlog == 0) {
+		d_list_del(&log->sl_link);
+		D_MUTEX_UNLOCK(&sc->sc_lock);
+		scratch_close(log);
+		return false;
+	}
+
+	/* Reply before handing the handle to the drain thread, which may
+	 * release it as soon as the lock is dropped.
+	 */
+	if (handle->release_req.req) {
+		IOF_FUSE_REPLY_ZERO(handle->release_req.req);
+		handle->release_req.req = NULL;
+	}
+	log->sl_released = true;
+	sc->sc_releasing++;
+	D_MUTEX_UNLOCK(&sc->sc_lock);
+
+	IOF_TRACE_INFO(handle, "Deferring release until drained");
+	return true;
+}
+
+/* Absorb a write into the log of the handle.  Returns false if the handle
+ * does not have a log, otherwise the request has been replied to.
+ */
+bool
+ioc_scratch_write(struct iof_file_handle *handle, fuse_req_t req,
+		  struct fuse_bufvec *bufv, off_t position)
+{
+	struct ioc_scratch_log *log = handle->scratch_log;
+	struct fuse_bufvec dst = FUSE_BUFVEC_INIT(0);
+	struct scratch_extent *last;
+	struct scratch_extent *se;
+	struct ioc_scratch *sc;
+	size_t len = fuse_buf_size(bufv);
+	ssize_t bytes;
+	off_t log_off;
+	int rc;
+
+	if (!log)
+		return false;
+
+	sc = handle->open_req.fsh->scratch;
+
+	D_ALLOC_PTR(se);
+	if (!se)
+		D_GOTO(err, rc = ENOMEM);
+
+	D_MUTEX_LOCK(&sc->sc_lock);
+
+	/* Wait for space, unless nothing is waiting to be drained so that a
+	 * write larger than the capacity can still complete.
+	 */
+	while (sc->sc_backlog != 0 &&
+	       sc->sc_backlog + len > sc->sc_capacity) {
+		atomic_inc(&sc->sc_waits);
+		pthread_cond_wait(&sc->sc_drained_cond, &sc->sc_lock);
+	}
+
+	rc = log->sl_err;
+	if (rc) {
+		D_MUTEX_UNLOCK(&sc->sc_lock);
+		D_FREE(se);
+		D_GOTO(err, 0);
+	}
+
+	log_off = log->sl_tail;
+	log->sl_tail += len;
+	log->sl_backlog += len;
+	sc->sc_backlog += len;
+	D_MUTEX_UNLOCK(&sc->sc_lock);
+
+	dst.buf[0].size = len;
+	dst.buf[0].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+	dst.buf[0].fd = log->sl_fd;
+	dst.buf[0].pos = log_off;
+
+	bytes = fuse_buf_copy(&dst, bufv, 0);
+
+	D_MUTEX_LOCK(&sc->sc_lock);
+	if (bytes != (ssize_t)len) {
+		log->sl_backlog -= len;
+		sc->sc_backlog -= len;
+		pthread_cond_broadcast(&sc->sc_drained_cond);
+		D_MUTEX_UNLOCK(&sc->sc_lock);
+		D_FREE(se);
+		IOF_TRACE_ERROR(handle, "Could not write log, rc = %zi",
+				bytes);
+		D_GOTO(err, rc = EIO);
+	}
+
+	if (position + len > log->sl_size)
+		log->sl_size = position + len;
+
+	/* Merge with the previous write if it follows on in both the file and
+	 * the log, and has not been picked up by the drain thread yet.
+	 */
+	last = NULL;
+	if (!d_list_empty(&sc->sc_extents))
+		last = d_list_entry(sc->sc_extents.prev, struct scratch_extent,
+				    se_link);
+	if (last && last->se_log == log &&
+	    last->se_off + last->se_len == position &&
+	    last->se_log_off + last->se_len == log_off &&
+	    last->se_len + len <= handle->open_req.fsh->proj.max_write) {
+		last->se_len += len;
+		D_FREE(se);
+	} else {
+		se->se_log = log;
+		se->se_off = position;
+		se->se_log_off = log_off;
+		se->se_len = len;
+		d_list_add_tail(&se->se_link, &sc->sc_extents);
+		pthread_cond_signal(&sc->sc_cond);
+	}
+	D_MUTEX_UNLOCK(&sc->sc_lock);
+
+	atomic_add(&sc->sc_absorbed, len);
+
+	IOF_TRACE_DEBUG(handle, "Absorbed %#zx-%#zx", position,
+			position + len - 1);
+
+	IOC_REPLY_WRITE(handle, req, len);
+	return true;
+
+err:
+	IOC_REPLY_ERR_RAW(handle, req, rc);
+	return true;
+}
+
+/* Handle fsync() for a handle with a log.  In close mode this waits for the
+ * log to drain and returns false so the caller then syncs the file on the
+ * IONSS, otherwise the request is replied to once the log is synced locally.
+ */
+bool
+ioc_scratch_fsync(struct iof_file_handle *handle, fuse_req_t req)
+{
+	struct ioc_scratch_log *log = handle->scratch_log;
+	struct ioc_scratch *sc;
+	int rc;
+
+	if (!log)
+		return false;
+
+	sc = handle->open_req.fsh->scratch;
+
+	D_MUTEX_LOCK(&sc->sc_lock);
+	if (atomic_load_consume(&sc->sc_drain) == IOC_SCRATCH_DRAIN_CLOSE) {
+		while (log->sl_backlog != 0)
+			pthread_cond_wait(&sc->sc_drained_cond, &sc->sc_lock);
+		rc = log->sl_err;
+		D_MUTEX_UNLOCK(&sc->sc_lock);
+		if (rc == 0)
+			return false;
+	} else {
+		rc = log->sl_err;
+		D_MUTEX_UNLOCK(&sc->sc_lock);
+		if (rc == 0 && fdatasync(log->sl_fd) != 0)
+			rc = errno;
+	}
+
+	if (rc)
+		IOC_REPLY_ERR_RAW(handle, req, rc);
+	else
+		IOF_FUSE_REPLY_ZERO(req);
+	return true;
+}
+
+/* Wait for any data absorbed for an inode to be drained */
+void
+ioc_scratch_sync(struct iof_projection_info *fs_handle, fuse_ino_t ino)
+{
+	struct ioc_scratch *sc = fs_handle->scratch;
+	struct ioc_scratch_log *log;
+	bool pending;
+
+	if (!sc)
+		return;
+
+	D_MUTEX_LOCK(&sc->sc_lock);
+	for (;;) {
+		pending = false;
+		d_list_for_each_entry(log, &sc->sc_logs, sl_link) {
+			if (log->sl_ino == ino && log->sl_backlog != 0) {
+				pending = true;
+				break;
+			}
+		}
+		if (!pending)
+			break;
+		atomic_inc(&sc->sc_waits);
+		pthread_cond_wait(&sc->sc_drained_cond, &sc->sc_lock);
+	}
+	D_MUTEX_UNLOCK(&sc->sc_lock);
+}
+
+/* Include data which has yet to be drained in the size of a file, called
+ * before attributes are returned to the kernel.
+ */
+void
+ioc_scratch_attr(struct iof_projection_info *fs_handle, struct stat *stat)
+{
+	struct ioc_scratch *sc = fs_handle->scratch;
+	struct ioc_scratch_log *log;
+
+	if (!sc)
+		return;
+
+	D_MUTEX_LOCK(&sc->sc_lock);
+	d_list_for_each_entry(log, &sc->sc_logs, sl_link) {
+		if (log->sl_ino == stat->st_ino && log->sl_backlog != 0 &&
+		    log->sl_size > stat->st_size)
+			stat->st_size = log->sl_size;
+	}
+	D_MUTEX_UNLOCK(&sc->sc_lock);
+}
@@ -0,0 +1,948 @@
+/* Copyright (C) 2019 Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted for any purpose (including commercial purposes)
+ * provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the
+ *    documentation and/or materials provided with the distribution.
+ *
+ * 3. In addition, redistributions of modified forms of the source or binary
+ *    code must carry prominent notices stating that the original code was
+ *    changed and the date of the change.
+ *
+ *  4. All publications or advertising materials mentioning features or use of
+ *     this software are asked, but not required, to acknowledge that it was
+ *     developed by Intel Corporation and credit the contributors.
+ *
+ * 5. Neither the name of Intel Corporation, nor the name of any Contributor
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Data and metadata striping.
+ *
+ * Projections exported with striped_data have file data divided into fixed
+ * size stripes placed round robin over the IONSS ranks, starting with the
+ * rank which opened the file.  Every rank exports the same shared
+ * filesystem so a file opened on one rank is opened on the others by
+ * fetching its path from the first rank with a getpath RPC and sending
+ * open_path RPCs relative to the projection root on each other rank.
+ *
+ * Stripe handles are opened lazily, on the first I/O which extends beyond
+ * the first stripe, so small files are only ever opened on one rank.  If
+ * anything goes wrong striping is turned off for the file and all I/O is
+ * sent to the rank which opened it, which is always correct as every rank
+ * sees the same data.
+ *
+ * Projections exported with striped_metadata have requests for a directory
+ * entry sent to a rank chosen by hashing the parent inode and name, so
+ * creates in a single directory are spread over all ranks.  The rank
+ * returns its own handle for the entry, so later requests for the entry
+ * go to the same rank.  The parent is opened on the chosen rank the same
+ * way as for data, and the handle is kept until the parent is closed.
+ *
+ * Projections exported with load_balance have lookups and creates in the
+ * projection root sent to the least loaded rank, so the resulting handle
+ * and everything below it is served by that rank.  The load of each rank
+ * is fetched with a load RPC at most once every LOAD_REFRESH_MS, without
+ * waiting for the reply, and requests sent to a rank since are counted
+ * against it so bursts of lookups are spread evenly.
+ */
+
+#include <fcntl.h>
+#include <time.h>
+
+#include "iof_common.h"
+#include "ioc.h"
+#include "log.h"
+#include "ios_gah.h"
+
+/* Minimum time between fetching the load of each rank */
+#define LOAD_REFRESH_MS 500
+
+/* Weight of an active or queued I/O request relative to an open handle */
+#define LOAD_IO_WEIGHT 8
+
+struct stripe_cb_r {
+	struct iof_tracker	*tracker;
+	crt_rpc_t		*rpc;
+	int			rc;
+};
+
+static void
+stripe_cb(const struct crt_cb_info *cb_info)
+{
+	struct stripe_cb_r *reply = cb_info->cci_arg;
+
+	reply->rc = cb_info->cci_rc;
+	if (reply->rc == 0) {
+		crt_req_addref(cb_info->cci_rpc);
+		reply->rpc = cb_info->cci_rpc;
+	}
+
+	iof_tracker_signal(reply->tracker);
+}
+
+/* Create an RPC to a specific rank */
+static int
+stripe_create(struct iof_projection_info *fs_handle, d_rank_t rank,
+	      crt_opcode_t opc, crt_rpc_t **rpc)
+{
+	crt_endpoint_t ep = fs_handle->proj.grp->psr_ep;
+	int rc;
+
+	ep.ep_rank = rank;
+
+	rc = crt_req_create(fs_handle->proj.crt_ctx, &ep, opc, rpc);
+	if (rc || !*rpc) {
+		IOF_TRACE_ERROR(fs_handle, "Could not create request, rc = %d",
+				rc);
+		return rc ? rc : -DER_NOMEM;
+	}
+
+	return -DER_SUCCESS;
+}
+
+/* Send an RPC, signalling tracker on completion.  On success the RPC is
+ * saved in reply for the caller to release with crt_req_decref().
+ */
+static void
+stripe_send(crt_rpc_t *rpc, struct iof_tracker *tracker,
+	    struct stripe_cb_r *reply)
+{
+	int rc;
+
+	reply->tracker = tracker;
+
+	rc = crt_req_send(rpc, stripe_cb, reply);
+	if (rc) {
+		IOF_TRACE_ERROR(rpc, "Could not send rpc, rc = %d", rc);
+		reply->rc = rc;
+		iof_tracker_signal(tracker);
+	}
+}
+
+/* Close a GAH on a rank without waiting for the reply */
+static void
+stripe_close(struct iof_projection_info *fs_handle, struct ios_gah *gah)
+{
+	struct iof_gah_in *in;
+	crt_rpc_t *rpc = NULL;
+	int rc;
+
+	rc = stripe_create(fs_handle, gah->root, FS_TO_OP(fs_handle, close),
+			   &rpc);
+	if (rc)
+		return;
+
+	in = crt_req_get(rpc);
+	in->gah = *gah;
+
+	rc = crt_req_send(rpc, NULL, NULL);
+	if (rc)
+		IOF_TRACE_ERROR(fs_handle, "Could not send rpc, rc = %d", rc);
+}
+
+/* Fetch the path of a GAH, relative to the projection root, from the rank
+ * which opened it.  On success the RPC holding the path is returned in rpcp
+ * for the caller to release with crt_req_decref().
+ */
+static int
+stripe_getpath(struct iof_projection_info *fs_handle, struct ios_gah *gah,
+	       crt_rpc_t **rpcp)
+{
+	struct stripe_cb_r reply = {0};
+	struct iof_tracker tracker;
+	struct iof_gah_in *in;
+	struct iof_string_out *out;
+	crt_rpc_t *rpc = NULL;
+	int rc;
+
+	rc = stripe_create(fs_handle, gah->root, FS_TO_OP(fs_handle, getpath),
+			   &rpc);
+	if (rc)
+		return rc;
+
+	in = crt_req_get(rpc);
+	in->gah = *gah;
+
+	iof_tracker_init(&tracker, 1);
+	stripe_send(rpc, &tracker, &reply);
+	iof_fs_wait(&fs_handle->proj, &tracker);
+
+	if (reply.rc)
+		return reply.rc;
+
+	out = crt_reply_get(reply.rpc);
+	if (out->err || out->rc || !out->path) {
+		IOF_TRACE_INFO(fs_handle, "getpath failed, rc = %d err = %d",
+			       out->rc, out->err);
+		rc = out->err ? out->err : -DER_NONEXIST;
+		crt_req_decref(reply.rpc);
+		return rc;
+	}
+
+	*rpcp = reply.rpc;
+	return -DER_SUCCESS;
+}
+
+/* Open the file on every rank it is striped over, filling in stripe_gah.
+ *
+ * The stat returned by each rank is checked against the inode the file was
+ * opened as, so a rename racing with this cannot open a different file.
+ */
+static int
+stripe_open(struct iof_file_handle *handle)
+{
+	struct iof_projection_info *fs_handle = handle->open_req.fsh;
+	struct iof_open_path_in *in;
+	struct iof_string_out *path;
+	struct iof_entry_out *out;
+	struct stripe_cb_r *reply = NULL;
+	struct ios_gah *gah = NULL;
+	struct iof_tracker tracker;
+	crt_rpc_t *path_rpc = NULL;
+	crt_rpc_t *rpc;
+	d_rank_t root = handle->common.gah.root;
+	uint32_t count = fs_handle->stripe_count;
+	uint32_t r;
+	int ret = -DER_SUCCESS;
+	int rc;
+
+	if (root >= count)
+		return -DER_INVAL;
+
+	rc = stripe_getpath(fs_handle, &handle->common.gah, &path_rpc);
+	if (rc)
+		return rc;
+
+	path = crt_reply_get(path_rpc);
+
+	IOF_TRACE_DEBUG(handle, "Opening '%s' on %u ranks", path->path, count);
+
+	D_ALLOC_ARRAY(reply, count);
+	D_ALLOC_ARRAY(gah, count);
+	if (!reply || !gah)
+		D_GOTO(out, ret = -DER_NOMEM);
+
+	/* Send all the opens before waiting for any of them */
+	iof_tracker_init(&tracker, count - 1);
+	for (r = 0; r < count; r++) {
+		if (r == root)
+			continue;
+
+		rpc = NULL;
+		rc = stripe_create(fs_handle, r, FS_TO_OP(fs_handle, open_path),
+				   &rpc);
+		if (rc) {
+			reply[r].rc = rc;
+			iof_tracker_signal(&tracker);
+			continue;
+		}
+
+		in = crt_req_get(rpc);
+		in->gah = fs_handle->stripe_root[r];
+		in->path = path->path;
+		in->flags = handle->flags & ~(O_CREAT | O_EXCL | O_TRUNC);
+		in->mode = 0;
+
+		stripe_send(rpc, &tracker, &reply[r]);
+	}
+
+	iof_fs_wait(&fs_handle->proj, &tracker);
+
+	gah[root] = handle->common.gah;
+	for (r = 0; r < count; r++) {
+		if (r == root)
+			continue;
+
+		if (reply[r].rc) {
+			IOF_TRACE_INFO(handle, "Rank %u failed, rc = %d",
+				       r, reply[r].rc);
+			ret = reply[r].rc;
+			continue;
+		}
+
+		out = crt_reply_get(reply[r].rpc);
+		if (out->err || out->rc) {
+			IOF_TRACE_INFO(handle,
+				       "Rank %u failed, rc = %d err = %d",
+				       r, out->rc, out->err);
+			ret = out->err ? out->err : -DER_NONEXIST;
+			continue;
+		}
+
+		gah[r] = out->gah;
+
+		if (out->stat.st_ino != handle->inode_num ||
+		    !S_ISREG(out->stat.st_mode)) {
+			IOF_TRACE_WARNING(handle,
+					  "Rank %u opened a different file",
+					  r);
+			ret = -DER_MISMATCH;
+		}
+	}
+
+	/* Close anything which was opened if any rank failed */
+	for (r = 0; r < count; r++) {
+		if (!reply[r].rpc)
+			continue;
+
+		out = crt_reply_get(reply[r].rpc);
+		if (ret && out->err == 0 && out->rc == 0)
+			stripe_close(fs_handle, &gah[r]);
+
+		crt_req_decref(reply[r].rpc);
+	}
+
+	if (ret == -DER_SUCCESS) {
+		handle->stripe_gah = gah;
+		gah = NULL;
+	}
+
+out:
+	crt_req_decref(path_rpc);
+	D_FREE(reply);
+	D_FREE(gah);
+	return ret;
+}
+
+/* Set up striping for a projection, from the query replies of every rank.
+ *
+ * If any rank cannot take part then striping is disabled by clearing the
+ * flags.  Returns a CaRT error code.
+ */
+int
+ioc_stripe_init(struct iof_projection_info *fs_handle,
+		struct iof_fs_info *fs_info,
+		struct iof_query_out **rank_info, uint32_t ranks)
+{
+	uint64_t mask = IOF_STRIPED_DATA | IOF_STRIPED_METADATA |
+		IOF_LOAD_BALANCE;
+	struct iof_fs_info *info;
+	uint32_t r;
+	int i;
+
+	if (fs_info->stripe_size == 0)
+		fs_handle->flags &= ~IOF_STRIPED_DATA;
+
+	/* Lookups are already spread by name with striped metadata */
+	if (fs_handle->flags & IOF_STRIPED_METADATA)
+		fs_handle->flags &= ~IOF_LOAD_BALANCE;
+
+	if (!(fs_handle->flags & mask))
+		return -DER_SUCCESS;
+
+	if (fs_info->stripe_count < 2 || fs_info->stripe_count > ranks)
+		D_GOTO(disable, 0);
+
+	D_ALLOC_ARRAY(fs_handle->stripe_root, fs_info->stripe_count);
+	if (!fs_handle->stripe_root)
+		return -DER_NOMEM;
+
+	/* Find the root GAH of this projection on every rank */
+	for (r = 0; r < fs_info->stripe_count; r++) {
+		info = NULL;
+		for (i = 0; rank_info[r] && i < rank_info[r]->info.ca_count;
+		     i++) {
+			if (rank_info[r]->info.ca_arrays[i].id == fs_info->id) {
+				info = &rank_info[r]->info.ca_arrays[i];
+				break;
+			}
+		}
+
+		if (!info || (info->flags & mask) != (fs_info->flags & mask) ||
+		    info->gah.root != r) {
+			IOF_TRACE_WARNING(fs_handle,
+					  "Rank %u cannot stripe projection %d",
+					  r, fs_info->id);
+			D_GOTO(disable, 0);
+		}
+
+		fs_handle->stripe_root[r] = info->gah;
+	}
+
+	if (fs_handle->flags & IOF_LOAD_BALANCE) {
+		D_ALLOC_ARRAY(fs_handle->rank_load, fs_info->stripe_count);
+		if (!fs_handle->rank_load) {
+			D_FREE(fs_handle->stripe_root);
+			return -DER_NOMEM;
+		}
+	}
+
+	fs_handle->stripe_count = fs_info->stripe_count;
+	if (fs_handle->flags & IOF_STRIPED_DATA) {
+		fs_handle->stripe_size = fs_info->stripe_size;
+		IOF_TRACE_INFO(fs_handle,
+			       "Striping data over %u ranks, %u bytes",
+			       fs_handle->stripe_count, fs_handle->stripe_size);
+	}
+	if (fs_handle->flags & IOF_STRIPED_METADATA)
+		IOF_TRACE_INFO(fs_handle, "Striping metadata over %u ranks",
+			       fs_handle->stripe_count);
+	if (fs_handle->flags & IOF_LOAD_BALANCE)
+		IOF_TRACE_INFO(fs_handle, "Balancing lookups over %u ranks",
+			       fs_handle->stripe_count);
+
+	return -DER_SUCCESS;
+
+disable:
+	IOF_TRACE_WARNING(fs_handle,
+			  "Unable to stripe over %u ranks, disabled",
+			  fs_info->stripe_count);
+	D_FREE(fs_handle->stripe_root);
+	fs_handle->flags &= ~mask;
+	return -DER_SUCCESS;
+}
+
+/* Check if an I/O should be striped, opening the stripe handles the first
+ * time an I/O extends beyond the first stripe.
+ *
+ * Returns false if the I/O should be sent to the rank which opened the
+ * file.
+ */
+bool
+ioc_stripe_active(struct iof_file_handle *handle, off_t position, size_t len)
+{
+	struct iof_projection_info *fs_handle = handle->open_req.fsh;
+	int expected;
+	int state;
+	int rc;
+
+	/* Appends are written at the end of file as seen by the rank, so
+	 * cannot be split.
+	 */
+	if (!(fs_handle->flags & IOF_STRIPED_DATA) ||
+	    (handle->flags & O_APPEND))
+		return false;
+
+	state = atomic_load_acquire(&handle->stripe_state);
+	if (state == IOC_STRIPE_ON)
+		return true;
+	if (state != IOC_STRIPE_NONE)
+		return false;
+
+	if (position + len <= fs_handle->stripe_size)
+		return false;
+
+	if (!atomic_load_consume(&handle->gah_ok))
+		return false;
+
+	/* Only one thread opens the stripe handles, anything else arriving
+	 * in the meantime is sent to the rank which opened the file.
+	 */
+	expected = IOC_STRIPE_NONE;
+	if (!atomic_compare_exchange(&handle->stripe_state, expected,
+				     IOC_STRIPE_BUSY))
+		return false;
+
+	rc = stripe_open(handle);
+	if (rc) {
+		IOF_TRACE_INFO(handle, "Not striping, rc = %d", rc);
+		atomic_store_release(&handle->stripe_state, IOC_STRIPE_OFF);
+		return false;
+	}
+
+	atomic_store_release(&handle->stripe_state, IOC_STRIPE_ON);
+	return true;
+}
+
+/* Map the start of an I/O to the rank holding it, returning the number of
+ * bytes which are in the same stripe.
+ */
+size_t
+ioc_stripe_map(struct iof_file_handle *handle, off_t position, size_t len,
+	       crt_endpoint_t *ep, struct ios_gah *gah)
+{
+	struct iof_projection_info *fs_handle = handle->open_req.fsh;
+	uint64_t stripe = position / fs_handle->stripe_size;
+	size_t left;
+	d_rank_t rank;
+
+	left = fs_handle->stripe_size - position % fs_handle->stripe_size;
+	rank = (handle->common.gah.root + stripe) % fs_handle->stripe_count;
+
+	*ep = fs_handle->proj.grp->psr_ep;
+	ep->ep_rank = rank;
+	*gah = handle->stripe_gah[rank];
+	ep->ep_tag = ioc_gah_tag(fs_handle, gah);
+
+	return len < left ? len : left;
+}
+
+/* Number of stripes an I/O touches */
+int
+ioc_stripe_count(struct iof_file_handle *handle, off_t position, size_t len)
+{
+	struct iof_projection_info *fs_handle = handle->open_req.fsh;
+
+	if (len == 0)
+		return 1;
+
+	return (position + len - 1) / fs_handle->stripe_size -
+		position / fs_handle->stripe_size + 1;
+}
+
+/* Stop striping after an error, the stripe handles are kept until release
+ * as I/O may still be in flight on them.
+ */
+void
+ioc_stripe_fail(struct iof_file_handle *handle)
+{
+	IOF_TRACE_WARNING(handle, "Striping disabled");
+	atomic_store_release(&handle->stripe_state, IOC_STRIPE_OFF);
+}
+
+/* Sync the stripe handles on all ranks except the one which opened the
+ * file, which the caller syncs itself.  Handles are synced even after
+ * striping has failed as data may already have been written through them.
+ * Returns 0 or the errno from the first rank to fail.
+ */
+int
+ioc_stripe_fsync(struct iof_file_handle *handle, bool datasync)
+{
+	struct iof_projection_info *fs_handle = handle->open_req.fsh;
+	struct iof_status_out *out;
+	struct stripe_cb_r *reply;
+	struct iof_tracker tracker;
+	struct iof_gah_in *in;
+	crt_opcode_t opc;
+	crt_rpc_t *rpc;
+	d_rank_t root = handle->common.gah.root;
+	uint32_t count = fs_handle->stripe_count;
+	uint32_t r;
+	int state;
+	int ret = 0;
+	int rc;
+
+	state = atomic_load_acquire(&handle->stripe_state);
+	if ((state != IOC_STRIPE_ON && state != IOC_STRIPE_OFF) ||
+	    !handle->stripe_gah)
+		return 0;
+
+	D_ALLOC_ARRAY(reply, count);
+	if (!reply)
+		return ENOMEM;
+
+	if (datasync)
+		opc = FS_TO_OP(fs_handle, fdatasync);
+	else
+		opc = FS_TO_OP(fs_handle, fsync);
+
+	iof_tracker_init(&tracker, count - 1);
+	for (r = 0; r < count; r++) {
+		if (r == root)
+			continue;
+
+		rpc = NULL;
+		rc = stripe_create(fs_handle, r, opc, &rpc);
+		if (rc) {
+			reply[r].rc = rc;
+			iof_tracker_signal(&tracker);
+			continue;
+		}
+
+		in = crt_req_get(rpc);
+		in->gah = handle->stripe_gah[r];
+
+		stripe_send(rpc, &tracker, &reply[r]);
+	}
+
+	iof_fs_wait(&fs_handle->proj, &tracker);
+
+	for (r = 0; r < count; r++) {
+		if (r == root)
+			continue;
+
+		if (reply[r].rc) {
+			IOF_TRACE_WARNING(handle,
+					  "Rank %u fsync failed, rc = %d",
+					  r, reply[r].rc);
+			if (!ret)
+				ret = EIO;
+			continue;
+		}
+
+		out = crt_reply_get(reply[r].rpc);
+		if (out->err || out->rc) {
+			IOF_TRACE_WARNING(handle,
+					  "Rank %u fsync failed, rc = %d "
+					  "err = %d", r, out->rc, out->err);
+			if (!ret)
+				ret = out->err ? EIO : out->rc;
+		}
+		crt_req_decref(reply[r].rpc);
+	}
+
+	D_FREE(reply);
+	return ret;
+}
+
+/* Close the stripe handles on all ranks except the one which opened the
+ * file, which is closed by the release itself.
+ */
+void
+ioc_stripe_release(struct iof_file_handle *handle)
+{
+	struct iof_projection_info *fs_handle = handle->open_req.fsh;
+	uint32_t r;
+
+	if (handle->stripe_gah) {
+		for (r = 0; r < fs_handle->stripe_count; r++) {
+			if (r != handle->common.gah.root)
+				stripe_close(fs_handle, &handle->stripe_gah[r]);
+		}
+		D_FREE(handle->stripe_gah);
+	}
+
+	atomic_store_release(&handle->stripe_state, IOC_STRIPE_NONE);
+}
+
+/* Pick the rank for a directory entry, FNV-1a over the parent inode and
+ * name.
+ */
+d_rank_t
+ioc_md_rank(struct iof_projection_info *fs_handle, fuse_ino_t parent,
+	    const char *name)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	int i;
+
+	for (i = 0; i < (int)sizeof(parent); i++) {
+		hash ^= (parent >> (i * 8)) & 0xff;
+		hash *= 0x100000001b3ULL;
+	}
+	for (; *name; name++) {
+		hash ^= (unsigned char)*name;
+		hash *= 0x100000001b3ULL;
+	}
+
+	return hash % fs_handle->stripe_count;
+}
+
+/* Open a directory on a rank other than the one its GAH is from, using an
+ * O_PATH open so the server returns an inode handle.  Returns a CaRT error
+ * code.
+ */
+static int
+md_open(struct iof_projection_info *fs_handle, struct ios_gah *gah,
+	ino_t ino, d_rank_t rank, struct ios_gah *md_gah)
+{
+	struct stripe_cb_r reply = {0};
+	struct iof_open_path_in *in;
+	struct iof_string_out *path;
+	struct iof_entry_out *out;
+	struct iof_tracker tracker;
+	crt_rpc_t *path_rpc = NULL;
+	crt_rpc_t *rpc = NULL;
+	int rc;
+
+	rc = stripe_getpath(fs_handle, gah, &path_rpc);
+	if (rc)
+		return rc;
+
+	path = crt_reply_get(path_rpc);
+
+	rc = stripe_create(fs_handle, rank, FS_TO_OP(fs_handle, open_path),
+			   &rpc);
+	if (rc)
+		D_GOTO(out, 0);
+
+	in = crt_req_get(rpc);
+	in->gah = fs_handle->stripe_root[rank];
+	in->path = path->path;
+	in->flags = O_PATH;
+
+	iof_tracker_init(&tracker, 1);
+	stripe_send(rpc, &tracker, &reply);
+	iof_fs_wait(&fs_handle->proj, &tracker);
+
+	if (reply.rc)
+		D_GOTO(out, rc = reply.rc);
+
+	out = crt_reply_get(reply.rpc);
+	if (out->err || out->rc) {
+		IOF_TRACE_INFO(fs_handle, "Rank %u failed, rc = %d err = %d",
+			       rank, out->rc, out->err);
+		rc = out->err ? out->err : -DER_NONEXIST;
+	} else if (out->stat.st_ino != ino || !S_ISDIR(out->stat.st_mode)) {
+		IOF_TRACE_WARNING(fs_handle, "Rank %u opened a different file",
+				  rank);
+		stripe_close(fs_handle, &out->gah);
+		rc = -DER_MISMATCH;
+	} else {
+		*md_gah = out->gah;
+	}
+
+	crt_req_decref(reply.rpc);
+
+out:
+	crt_req_decref(path_rpc);
+	return rc;
+}
+
+/* Find the GAH of a directory on a rank, opening it there if needed.
+ * Returns 0 or an errno.
+ */
+static int
+md_find_gah(struct iof_projection_info *fs_handle, struct ioc_inode_entry *ie,
+	    d_rank_t rank, struct ios_gah *gah)
+{
+	struct ioc_md_gah *md;
+	struct ios_gah parent;
+	struct ios_gah new_gah;
+	bool found = false;
+	bool keep = false;
+	int rc = 0;
+
+	if (!H_GAH_IS_VALID(ie))
+		return EHOSTDOWN;
+
+	D_MUTEX_LOCK(&fs_handle->gah_lock);
+	parent = ie->gah;
+	if (parent.root == rank) {
+		*gah = parent;
+		found = true;
+	} else if (ie->ie_md_gah && ie->ie_md_gah[rank].valid) {
+		*gah = ie->ie_md_gah[rank].gah;
+		found = true;
+	}
+	D_MUTEX_UNLOCK(&fs_handle->gah_lock);
+
+	if (found)
+		return 0;
+
+	rc = md_open(fs_handle, &parent, ie->stat.st_ino, rank, &new_gah);
+	if (rc) {
+		IOF_TRACE_WARNING(ie, "Could not open on rank %u, rc = %d",
+				  rank, rc);
+		return EIO;
+	}
+
+	D_MUTEX_LOCK(&fs_handle->gah_lock);
+	if (!ie->ie_md_gah)
+		D_ALLOC_ARRAY(ie->ie_md_gah, fs_handle->stripe_count);
+	if (ie->ie_md_gah) {
+		md = &ie->ie_md_gah[rank];
+		if (!md->valid) {
+			md->gah = new_gah;
+			md->valid = true;
+			keep = true;
+		}
+		*gah = md->gah;
+	} else {
+		rc = ENOMEM;
+	}
+	D_MUTEX_UNLOCK(&fs_handle->gah_lock);
+
+	/* Another thread opened it first, or it could not be saved */
+	if (!keep)
+		stripe_close(fs_handle, &new_gah);
+
+	return rc;
+}
+
+/* Find the GAH of a directory inode on a rank.  Returns 0 or an errno */
+int
+ioc_md_find_gah(struct iof_projection_info *fs_handle, fuse_ino_t ino,
+		d_rank_t rank, struct ios_gah *gah)
+{
+	struct ioc_inode_entry *ie;
+	d_list_t *rlink;
+	int rc;
+
+	if (ino == 1) {
+		*gah = fs_handle->stripe_root[rank];
+		return 0;
+	}
+
+	rlink = d_hash_rec_find(&fs_handle->inode_ht, &ino, sizeof(ino));
+	if (!rlink)
+		return ENOENT;
+
+	ie = container_of(rlink, struct ioc_inode_entry, ie_htl);
+
+	rc = md_find_gah(fs_handle, ie, rank, gah);
+
+	d_hash_rec_decref(&fs_handle->inode_ht, rlink);
+	return rc;
+}
+
+static uint64_t
+load_now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Save the load reported by a rank.  Ranks which do not reply are given
+ * the highest possible load so they are only used if every rank fails.
+ */
+static void
+load_cb(const struct crt_cb_info *cb_info)
+{
+	struct iof_projection_info *fs_handle = cb_info->cci_arg;
+	struct iof_load_out *out = crt_reply_get(cb_info->cci_rpc);
+	d_rank_t rank = cb_info->cci_rpc->cr_ep.ep_rank;
+	uint32_t load = UINT32_MAX;
+
+	if (cb_info->cci_rc == 0 && out->rc == 0 && out->err == 0)
+		load = out->open_handles + LOAD_IO_WEIGHT *
+			(out->active_reads + out->active_writes + out->queued);
+	else
+		IOF_TRACE_WARNING(fs_handle, "No load from rank %u, rc = %d",
+				  rank, cb_info->cci_rc);
+
+	IOF_TRACE_DEBUG(fs_handle, "Rank %u load %u", rank, load);
+
+	atomic_store_release(&fs_handle->rank_load[rank].load, load);
+	atomic_store_release(&fs_handle->rank_load[rank].assigned, 0);
+	atomic_dec_release(&fs_handle->load_pending);
+}
+
+/* Fetch the load of every rank if it is out of date, without waiting */
+static void
+load_refresh(struct iof_projection_info *fs_handle)
+{
+	struct iof_gah_in *in;
+	crt_rpc_t *rpc;
+	uint64_t now = load_now_ms();
+	int pending = 0;
+	uint32_t r;
+	int rc;
+
+	if (now - atomic_load_consume(&fs_handle->load_time) < LOAD_REFRESH_MS)
+		return;
+
+	if (!atomic_compare_exchange(&fs_handle->load_pending, pending,
+				     fs_handle->stripe_count))
+		return;
+
+	atomic_store_release(&fs_handle->load_time, now);
+
+	for (r = 0; r < fs_handle->stripe_count; r++) {
+		rpc = NULL;
+		rc = stripe_create(fs_handle, r, FS_TO_OP(fs_handle, load),
+				   &rpc);
+		if (rc == -DER_SUCCESS) {
+			in = crt_req_get(rpc);
+			in->gah = fs_handle->stripe_root[r];
+			rc = crt_req_send(rpc, load_cb, fs_handle);
+		}
+		if (rc) {
+			IOF_TRACE_ERROR(fs_handle,
+					"Could not send load rpc, rc = %d", rc);
+			atomic_dec_release(&fs_handle->load_pending);
+		}
+	}
+}
+
+/* Choose the least loaded rank for a new lookup in the projection root */
+static d_rank_t
+load_rank(struct iof_projection_info *fs_handle)
+{
+	uint64_t best_load = UINT64_MAX;
+	uint64_t load;
+	d_rank_t best = 0;
+	uint32_t r;
+
+	load_refresh(fs_handle);
+
+	for (r = 0; r < fs_handle->stripe_count; r++) {
+		load = atomic_load_consume(&fs_handle->rank_load[r].load);
+		load += atomic_load_consume(&fs_handle->rank_load[r].assigned);
+		if (load < best_load) {
+			best_load = load;
+			best = r;
+		}
+	}
+
+	atomic_inc(&fs_handle->rank_load[best].assigned);
+
+	return best;
+}
+
+/* Choose the rank for a request on a directory entry from ir_md_name, and
+ * set ir_md_gah to the GAH of the parent on that rank.  Without striped
+ * metadata only requests flagged with ir_balance in the projection root
+ * are routed, to the least loaded rank.
+ *
+ * Called after the parent has been resolved.  Returns 0 or an errno.
+ */
+int
+ioc_md_route(struct ioc_request *request)
+{
+	struct iof_projection_info *fs_handle = request->fsh;
+	d_rank_t rank;
+	int rc;
+
+	if (!(fs_handle->flags & IOF_STRIPED_METADATA)) {
+		if (!(fs_handle->flags & IOF_LOAD_BALANCE) ||
+		    !request->ir_balance || request->ir_ht != RHS_ROOT)
+			return 0;
+
+		rank = load_rank(fs_handle);
+		request->ir_md_gah = fs_handle->stripe_root[rank];
+		IOF_TRACE_DEBUG(request, "'%s' balanced to rank %u",
+				request->ir_md_name, rank);
+		request->ir_md = true;
+		return 0;
+	}
+
+	switch (request->ir_ht) {
+	case RHS_ROOT:
+		rank = ioc_md_rank(fs_handle, 1, request->ir_md_name);
+		request->ir_md_gah = fs_handle->stripe_root[rank];
+		break;
+	case RHS_INODE:
+		rank = ioc_md_rank(fs_handle, request->ir_inode->stat.st_ino,
+				   request->ir_md_name);
+		rc = md_find_gah(fs_handle, request->ir_inode, rank,
+				 &request->ir_md_gah);
+		if (rc)
+			return rc;
+		break;
+	default:
+		return 0;
+	}
+
+	IOF_TRACE_DEBUG(request, "'%s' on rank %u", request->ir_md_name, rank);
+
+	request->ir_md = true;
+	return 0;
+}
+
+/* Close the handles for a directory on other ranks */
+void
+ioc_md_close(struct iof_projection_info *fs_handle, struct ioc_inode_entry *ie)
+{
+	uint32_t r;
+
+	if (!ie->ie_md_gah)
+		return;
+
+	for (r = 0; r < fs_handle->stripe_count; r++) {
+		if (ie->ie_md_gah[r].valid && !FS_IS_OFFLINE(fs_handle))
+			stripe_close(fs_handle, &ie->ie_md_gah[r].gah);
+	}
+
+	D_FREE(ie->ie_md_gah);
+}
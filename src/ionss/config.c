@@ -79,8 +79,15 @@
 	X(cnss_threads, set_flag)		\
 	X(fuse_read_buf, set_flag)		\
 	X(fuse_write_buf, set_flag)		\
+	X(stripe_size, set_size)		\
+	X(direct_io_size, set_size)		\
 	X(failover, set_feature)		\
-	X(writeable, set_feature)
+	X(writeable, set_feature)		\
+	X(striped_data, set_feature)		\
+	X(striped_metadata, set_feature)	\
+	X(load_balance, set_feature)		\
+	X(dw_cache, set_feature)		\
+	X(dw_scratch, set_feature)
 
 #define GLOBAL_OPTIONS				\
 	X(group_name, set_string)		\
@@ -114,11 +121,18 @@ const uint32_t	default_max_write_count		= 3;
 const uint32_t	default_inode_htable_size	= 5;
 const uint32_t	default_cnss_thread_count	= 0;
 const uint32_t	default_cnss_timeout		= 60;
+const uint32_t	default_stripe_size		= (1024 * 1024);
+const uint32_t	default_direct_io_size		= 0;
 const bool	default_cnss_threads		= true;
 const bool	default_fuse_read_buf		= true;
 const bool	default_fuse_write_buf		= true;
 const bool	default_failover		= true;
 const bool	default_writeable		= true;
+const bool	default_striped_data		= false;
+const bool	default_striped_metadata	= false;
+const bool	default_load_balance		= false;
+const bool	default_dw_cache		= false;
+const bool	default_dw_scratch		= false;
 
 struct parsed_option_s {
 	const char *key;
@@ -65,6 +65,8 @@ int ios_fh_alloc(struct ios_projection *projection,
 
 	IOF_TRACE_UP(fh, projection, "file_handle");
 
+	atomic_inc(&projection->open_handles);
+
 	*fhp = fh;
 
 	D_RWLOCK_UNLOCK(&base->gah_rwlock);
@@ -99,12 +101,21 @@ void ios_fh_decref(struct ionss_file_handle *fh, int count)
 	if (rc != 0)
 		IOF_TRACE_ERROR(fh, "Failed to close file %d", fh->fd);
 
+	if (fh->direct_fd >= 0) {
+		rc = close(fh->direct_fd);
+		if (rc != 0)
+			IOF_TRACE_ERROR(fh, "Failed to close file %d",
+					fh->direct_fd);
+	}
+
 	rc = ios_gah_deallocate(base->gs, &fh->gah);
 	if (rc)
 		IOF_TRACE_ERROR(fh, "Failed to deallocate GAH %d", rc);
 
 	iof_pool_release(projection->fh_pool, fh);
 
+	atomic_dec_release(&projection->open_handles);
+
 out:
 	D_RWLOCK_UNLOCK(&base->gah_rwlock);
 }
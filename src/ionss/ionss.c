@@ -1074,6 +1074,143 @@ out:
 	D_FREE(path);
 }
 
+/* Open a file by a path relative to a directory in a single RPC.  Each
+ * component is checked to be a directory on the projection, and symbolic
+ * links are not followed so that the client can resolve them itself.
+ * ELOOP is returned for a symbolic link or anything else that the client
+ * should open through the kernel.
+ */
+static void
+iof_open_path_handler(crt_rpc_t *rpc)
+{
+	struct iof_open_path_in		*in = crt_req_get(rpc);
+	struct iof_entry_out		*out = crt_reply_get(rpc);
+	struct ionss_file_handle	*parent;
+	struct ios_projection		*projection = NULL;
+	struct ionss_mini_file		mf = {.type = open_handle};
+	struct stat			stbuf;
+	char				*path = NULL;
+	char				*name;
+	char				*next;
+	int				dirfd = -1;
+	int				fd;
+	int				rc;
+
+	VALIDATE_ARGS_GAH_FILE(rpc, in, out, parent);
+	if (out->err)
+		goto out;
+
+	projection = parent->projection;
+
+	if (!in->path || in->path[0] == '\0') {
+		IOF_TRACE_ERROR(rpc, "Missing inputs.");
+		D_GOTO(out, out->err = -DER_INVAL);
+	}
+
+	if (in->flags & (O_WRONLY | O_RDWR | O_CREAT | O_TRUNC)) {
+		VALIDATE_WRITE(projection, out);
+		if (out->err || out->rc)
+			goto out;
+	}
+
+	D_STRNDUP(path, in->path, IOF_MAX_PATH_LEN);
+	if (!path)
+		D_GOTO(out, out->err = -DER_NOMEM);
+
+	IOF_TRACE_DEBUG(parent, "path '%s' flags 0%o mode 0%o", path,
+			in->flags, in->mode);
+
+	dirfd = parent->fd;
+	name = path;
+	for (;;) {
+		next = strchr(name, '/');
+		if (next)
+			*next = '\0';
+
+		if (name[0] == '\0' || strcmp(name, ".") == 0 ||
+		    strcmp(name, "..") == 0)
+			D_GOTO(out, out->rc = EINVAL);
+
+		if (!next)
+			break;
+
+		errno = 0;
+		fd = openat(dirfd, name, O_PATH | O_NOATIME | O_NOFOLLOW);
+		if (fd == -1)
+			D_GOTO(out, out->rc = errno);
+
+		if (dirfd != parent->fd)
+			close(dirfd);
+		dirfd = fd;
+
+		rc = fstat(dirfd, &stbuf);
+		if (rc)
+			D_GOTO(out, out->rc = errno);
+
+		if (S_ISLNK(stbuf.st_mode))
+			D_GOTO(out, out->rc = ELOOP);
+
+		if (!S_ISDIR(stbuf.st_mode))
+			D_GOTO(out, out->rc = ENOTDIR);
+
+		if (stbuf.st_dev != projection->dev_no)
+			D_GOTO(out, out->rc = EACCES);
+
+		name = next + 1;
+	}
+
+	/* Path only opens return an inode handle, as lookup does, which
+	 * may be of any type.  These are used by clients to get a handle
+	 * for a directory on another rank.
+	 */
+	if (in->flags & O_PATH) {
+		mf.type = inode_handle;
+		mf.flags = O_PATH | O_NOATIME | O_NOFOLLOW | O_RDONLY;
+
+		errno = 0;
+		fd = openat(dirfd, name, mf.flags);
+		if (fd == -1)
+			D_GOTO(out, out->rc = errno);
+
+		find_and_insert_lookup(projection, fd, &mf, out);
+		goto out;
+	}
+
+	/* Anything but a regular file is left to the client, which also
+	 * avoids blocking here opening a FIFO.
+	 */
+	rc = fstatat(dirfd, name, &stbuf, AT_SYMLINK_NOFOLLOW);
+	if (rc == 0 && !S_ISREG(stbuf.st_mode))
+		D_GOTO(out, out->rc = ELOOP);
+
+	errno = 0;
+	fd = openat(dirfd, name, in->flags | O_NOFOLLOW, in->mode);
+	if (fd == -1)
+		D_GOTO(out, out->rc = errno);
+
+	mf.flags = in->flags;
+	find_and_insert_lookup(projection, fd, &mf, out);
+
+out:
+	if (parent && dirfd != -1 && dirfd != parent->fd)
+		close(dirfd);
+
+	IOF_TRACE_INFO(rpc, "path '%s' result " GAH_PRINT_STR " err %d rc %d",
+		       in->path, GAH_PRINT_VAL(out->gah), out->err, out->rc);
+
+	rc = crt_reply_send(rpc);
+	if (rc)
+		IOF_TRACE_ERROR(rpc, "response not sent, ret = %d", rc);
+
+	if (projection)
+		iof_pool_restock(projection->fh_pool);
+
+	if (parent)
+		ios_fh_decref(parent, 1);
+
+	D_FREE(path);
+}
+
 static void
 iof_imigrate_handler(crt_rpc_t *rpc)
 {
@@ -1255,9 +1392,73 @@ _Static_assert(sizeof(struct ionss_io_req_desc) <=
 	       "struct iof_readx_out needs to be large enough to contain"
 	       " struct ionss_io_req_desc");
 
+/* Return the descriptor to use for len bytes of I/O at offset.
+ *
+ * Large aligned I/O goes through a second descriptor opened with O_DIRECT so
+ * that streaming reads and writes do not fill, and evict other data from,
+ * the page cache.  The kernel writes back and invalidates any cached pages
+ * in the range so the two descriptors stay coherent.  The descriptor is
+ * opened on first use, and not tried again if the backend refuses it.
+ */
+static int
+ionss_io_fd(struct ionss_file_handle *handle, off_t offset, size_t len)
+{
+	struct ios_projection *projection = handle->projection;
+	int expected = IONSS_DIRECT_FD_UNSET;
+	int fd;
+
+	if (projection->direct_io_size == 0 ||
+	    len < projection->direct_io_size ||
+	    (offset % IONSS_DIRECT_ALIGN) != 0 ||
+	    (len % IONSS_DIRECT_ALIGN) != 0 ||
+	    (handle->mf.flags & O_APPEND))
+		return handle->fd;
+
+	fd = atomic_load_consume(&handle->direct_fd);
+	if (fd >= 0)
+		return fd;
+	if (fd == IONSS_DIRECT_FD_FAILED)
+		return handle->fd;
+
+	errno = 0;
+	fd = open(handle->proc_fd_name,
+		  (handle->mf.flags & O_ACCMODE) | O_DIRECT);
+	if (fd == -1) {
+		IOF_TRACE_INFO(handle, "Could not open O_DIRECT, errno %d",
+			       errno);
+		fd = IONSS_DIRECT_FD_FAILED;
+	}
+
+	/* Another thread may have opened it first */
+	if (!atomic_compare_exchange(&handle->direct_fd, expected, fd)) {
+		if (fd >= 0)
+			close(fd);
+		fd = atomic_load_consume(&handle->direct_fd);
+	}
+
+	if (fd < 0)
+		return handle->fd;
+
+	return fd;
+}
+
 static int iof_read_bulk_cb(const struct crt_bulk_cb_info *cb_info);
 static void iof_process_read_bulk(struct ionss_active_read *ard);
 
+/* The descriptor pools for RPCs received on a context */
+static struct ios_ctx_pools *
+ios_ctx_pools(struct ios_projection *projection, crt_context_t ctx)
+{
+	uint32_t i;
+
+	for (i = 1; i < base.ctx_count; i++) {
+		if (base.ctx_array[i] == ctx)
+			return &projection->ctx_pools[i];
+	}
+
+	return &projection->ctx_pools[0];
+}
+
 void iof_read_check_and_send(struct ios_projection *projection)
 {
 	struct ionss_io_req_desc *rrd;
@@ -1273,7 +1474,11 @@ void iof_read_check_and_send(struct ios_projection *projection)
 		return;
 	}
 
-	ard = iof_pool_acquire(projection->ar_pool);
+	rrd = d_list_entry(projection->read_list.next,
+			   struct ionss_io_req_desc, list);
+
+	ard = iof_pool_acquire(ios_ctx_pools(projection,
+					     rrd->rpc->cr_ctx)->ar_pool);
 	if (!ard) {
 		projection->current_read_count--;
 		IOF_TRACE_DEBUG(projection,
@@ -1284,8 +1489,8 @@ void iof_read_check_and_send(struct ios_projection *projection)
 		return;
 	}
 
-	rrd = d_list_pop_entry(&projection->read_list,
-			       struct ionss_io_req_desc, list);
+	d_list_del(&rrd->list);
+	projection->queued_read_count--;
 
 	IOF_TRACE_UP(ard, rrd->handle, "ard");
 	IOF_TRACE_DEBUG(ard, "Submiting new read (%d/%d)",
@@ -1303,6 +1508,144 @@ void iof_read_check_and_send(struct ios_projection *projection)
 	iof_process_read_bulk(ard);
 }
 
+/* Sharing of reads.
+ *
+ * When many clients read the same part of a file at once, for example input
+ * files at the start of a job, each read is only done once.  A read which is
+ * in progress, or whose buffer has not yet been sent, is kept on the
+ * projection share_list.  Later reads of the same inode which fall within
+ * its range copy the data from its buffer instead of reading the file, or
+ * wait on it if the read has not yet completed.  Each request still has its
+ * own bulk transfer to the client.
+ *
+ * write_gen is bumped after every change to file data, and reads are only
+ * shared if there has been no change since they started, so a read never
+ * returns data older than a write which completed before it arrived.
+ */
+enum ionss_read_share {
+	READ_SHARE_NONE,	/* Read the file, and share the result */
+	READ_SHARE_WAIT,	/* Waiting for another read to complete */
+	READ_SHARE_COPIED,	/* Copied from another read */
+};
+
+/* Copy the part of a completed read that ard requested into its buffer */
+static void
+iof_read_copy(struct ionss_active_read *ard, struct ionss_active_read *from,
+	      off_t offset)
+{
+	off_t delta = offset - from->share_off;
+	ssize_t len;
+
+	ard->read_rc = from->read_rc;
+	if (from->read_len == -1) {
+		ard->read_len = -1;
+		return;
+	}
+
+	len = from->read_len - delta;
+	if (len < 0)
+		len = 0;
+	if (len > (ssize_t)ard->req_len)
+		len = ard->req_len;
+
+	memcpy(ard->local_bulk.buf, from->local_bulk.buf + delta, len);
+	ard->read_len = len;
+
+	IOF_TRACE_DEBUG(ard, "Shared %#zx bytes with %p", len, from);
+}
+
+static enum ionss_read_share
+iof_read_share(struct ionss_active_read *ard, off_t offset, size_t count)
+{
+	struct ios_projection *projection = ard->handle->projection;
+	struct ionss_active_read *from;
+	enum ionss_read_share share = READ_SHARE_NONE;
+	uint gen;
+
+	D_MUTEX_LOCK(&projection->lock);
+	gen = atomic_load_consume(&projection->write_gen);
+	d_list_for_each_entry(from, &projection->share_list, share_link) {
+		if (from->handle->mf.inode_no != ard->handle->mf.inode_no ||
+		    from->share_gen != gen ||
+		    offset < from->share_off ||
+		    offset + (off_t)count >
+		    from->share_off + (off_t)from->req_len)
+			continue;
+
+		if (from->filling) {
+			d_list_add_tail(&ard->list, &from->waiters);
+			share = READ_SHARE_WAIT;
+		} else {
+			iof_read_copy(ard, from, offset);
+			share = READ_SHARE_COPIED;
+		}
+		break;
+	}
+
+	/* The handle is kept open while shared, so the inode number cannot be
+	 * reused for another file.
+	 */
+	if (share == READ_SHARE_NONE) {
+		atomic_inc(&ard->handle->ref);
+		ard->share_off = offset;
+		ard->share_gen = gen;
+		ard->filling = true;
+		ard->shared = true;
+		d_list_add_tail(&ard->share_link, &projection->share_list);
+	}
+	D_MUTEX_UNLOCK(&projection->lock);
+
+	return share;
+}
+
+/* Stop sharing the buffer, before it is reused or released */
+static void
+iof_read_unshare(struct ionss_active_read *ard)
+{
+	struct ios_projection *projection = ard->projection;
+
+	if (!ard->shared)
+		return;
+
+	D_MUTEX_LOCK(&projection->lock);
+	d_list_del_init(&ard->share_link);
+	ard->shared = false;
+	D_MUTEX_UNLOCK(&projection->lock);
+
+	ios_fh_decref(ard->handle, 1);
+}
+
+static void iof_read_send(struct ionss_active_read *ard);
+
+/* Mark a shared read as complete and pass the data to any waiting reads.
+ * This is done before the bulk transfer for ard is started, as the buffer
+ * can be reused for the next segment as soon as that completes.
+ */
+static void
+iof_read_filled(struct ionss_active_read *ard)
+{
+	struct ios_projection *projection = ard->projection;
+	struct ionss_active_read *waiter;
+	struct ionss_active_read *next;
+	struct iof_readx_in *in;
+	d_list_t waiters;
+
+	D_INIT_LIST_HEAD(&waiters);
+
+	D_MUTEX_LOCK(&projection->lock);
+	ard->filling = false;
+	d_list_splice_init(&ard->waiters, &waiters);
+	D_MUTEX_UNLOCK(&projection->lock);
+
+	d_list_for_each_entry_safe(waiter, next, &waiters, list) {
+		d_list_del_init(&waiter->list);
+		in = crt_req_get(waiter->rpc);
+		iof_read_copy(waiter, ard,
+			      in->xtvec.xt_off + waiter->segment_offset);
+		iof_read_send(waiter);
+	}
+}
+
 /* Process a read request
  *
  * This function processes a single rrd and either submits a bulk read with
@@ -1313,13 +1656,14 @@ iof_process_read_bulk(struct ionss_active_read *ard)
 {
 	struct ionss_file_handle *handle = ard->handle;
 	struct iof_readx_in *in = crt_req_get(ard->rpc);
-	struct iof_readx_out *out = crt_reply_get(ard->rpc);
 	struct ios_projection *projection = ard->handle->projection;
-	struct crt_bulk_desc bulk_desc = {0};
+	enum ionss_read_share share;
 	size_t count;
 	off_t offset;
-	bool more_to_do = false;
-	int rc;
+	int fd;
+
+	/* The buffer is about to be overwritten */
+	iof_read_unshare(ard);
 
 	count = in->xtvec.xt_len - ard->segment_offset;
 	/* Only read max_read_size at a time */
@@ -1328,13 +1672,40 @@ iof_process_read_bulk(struct ionss_active_read *ard)
 	ard->req_len = count;
 	offset = in->xtvec.xt_off + ard->segment_offset;
 
-	IOF_TRACE_DEBUG(ard, "Reading from fd=%d %#zx-%#zx", handle->fd, offset,
-			offset + count - 1);
+	share = iof_read_share(ard, offset, count);
+	if (share == READ_SHARE_WAIT)
+		return;
+
+	if (share == READ_SHARE_NONE) {
+		fd = ionss_io_fd(handle, offset, count);
+
+		IOF_TRACE_DEBUG(ard, "Reading from fd=%d %#zx-%#zx", fd,
+				offset, offset + count - 1);
+
+		errno = 0;
+		ard->read_len = pread(fd, ard->local_bulk.buf, count, offset);
+		ard->read_rc = (ard->read_len == -1) ? errno : 0;
+
+		iof_read_filled(ard);
+	}
+
+	iof_read_send(ard);
+}
+
+/* Reply to a read, or send the data read to the client */
+static void
+iof_read_send(struct ionss_active_read *ard)
+{
+	struct ionss_file_handle *handle = ard->handle;
+	struct iof_readx_in *in = crt_req_get(ard->rpc);
+	struct iof_readx_out *out = crt_reply_get(ard->rpc);
+	struct ios_projection *projection = ard->handle->projection;
+	struct crt_bulk_desc bulk_desc = {0};
+	bool more_to_do = false;
+	int rc;
 
-	errno = 0;
-	ard->read_len = pread(handle->fd, ard->local_bulk.buf, count, offset);
 	if (ard->read_len == -1) {
-		out->rc = errno;
+		out->rc = ard->read_rc;
 		goto out;
 	} else if (ard->read_len <= projection->max_iov_read_size) {
 		/* Can send last bit in immediate data */
@@ -1347,7 +1718,7 @@ iof_process_read_bulk(struct ionss_active_read *ard)
 	bulk_desc.bd_rpc = ard->rpc;
 	bulk_desc.bd_bulk_op = CRT_BULK_PUT;
 	bulk_desc.bd_remote_hdl = in->data_bulk;
-	bulk_desc.bd_remote_off = ard->data_offset;
+	bulk_desc.bd_remote_off = in->bulk_off + ard->data_offset;
 	bulk_desc.bd_local_hdl = ard->local_bulk.handle;
 	bulk_desc.bd_len = ard->read_len;
 
@@ -1387,7 +1758,8 @@ out:
 
 	crt_req_decref(ard->rpc);
 
-	iof_pool_release(projection->ar_pool, ard);
+	iof_read_unshare(ard);
+	iof_pool_release(ard->pools->ar_pool, ard);
 
 	ios_fh_decref(handle, 1);
 
@@ -1429,7 +1801,8 @@ iof_read_bulk_cb(const struct crt_bulk_cb_info *cb_info)
 
 	crt_req_decref(ard->rpc);
 
-	iof_pool_release(projection->ar_pool, ard);
+	iof_read_unshare(ard);
+	iof_pool_release(ard->pools->ar_pool, ard);
 
 	iof_read_check_and_send(projection);
 	return 0;
@@ -1475,7 +1848,10 @@ iof_readx_handler(crt_rpc_t *rpc)
 	/* Try and acquire a active read descriptor, if one is available then
 	 * start the read, else add it to the list
 	 */
-	ard = iof_pool_acquire(projection->ar_pool);
+	ard = NULL;
+	if (projection->current_read_count < projection->max_read_count)
+		ard = iof_pool_acquire(ios_ctx_pools(projection,
+						     rpc->cr_ctx)->ar_pool);
 	if (ard) {
 		projection->current_read_count++;
 		IOF_TRACE_UP(ard, handle, "ard");
@@ -1495,6 +1871,7 @@ iof_readx_handler(crt_rpc_t *rpc)
 		rrd->rpc = rpc;
 		rrd->handle = handle;
 		d_list_add_tail(&rrd->list, &projection->read_list);
+		projection->queued_read_count++;
 		D_MUTEX_UNLOCK(&projection->lock);
 	}
 
@@ -1677,6 +2054,219 @@ out:
 	D_FREE(reply);
 }
 
+/* Return the path of a handle relative to the projection root.
+ *
+ * Used by clients to open a file on other ranks which do not have a handle
+ * for it, the path is taken from the open descriptor so is correct even if
+ * the file has been renamed since it was opened.
+ */
+static void
+iof_getpath_handler(crt_rpc_t *rpc)
+{
+	struct iof_gah_in *in = crt_req_get(rpc);
+	struct iof_string_out *out = crt_reply_get(rpc);
+	struct ionss_file_handle *file = NULL;
+	char *root;
+	char *reply = NULL;
+	size_t len;
+	ssize_t rc;
+
+	VALIDATE_ARGS_GAH_FILE(rpc, in, out, file);
+	if (out->err)
+		goto out;
+
+	D_ALLOC(reply, IOF_MAX_PATH_LEN);
+	if (!reply)
+		D_GOTO(out, out->err = -DER_NOMEM);
+
+	errno = 0;
+	rc = readlink(file->proc_fd_name, reply, IOF_MAX_PATH_LEN - 1);
+	if (rc < 0)
+		D_GOTO(out, out->rc = errno);
+	if (rc == IOF_MAX_PATH_LEN - 1)
+		D_GOTO(out, out->rc = ENAMETOOLONG);
+
+	root = file->projection->full_path;
+	len = strlen(root);
+	while (len > 0 && root[len - 1] == '/')
+		len--;
+
+	if (strncmp(reply, root, len) != 0 || reply[len] != '/' ||
+	    reply[len + 1] == '\0')
+		D_GOTO(out, out->rc = ENOENT);
+
+	out->path = reply + len + 1;
+
+out:
+	IOF_TRACE_DEBUG(rpc, "path '%s' rc %d err %d",
+			out->path ? out->path : "", out->rc, out->err);
+
+	rc = crt_reply_send(rpc);
+	if (rc)
+		IOF_TRACE_ERROR(rpc, "response not sent, ret = %zi", rc);
+
+	if (file)
+		ios_fh_decref(file, 1);
+
+	D_FREE(reply);
+}
+
+/* Report the current load of a projection on this rank.
+ *
+ * Used by clients with load_balance enabled to choose the rank to send new
+ * lookups and creates in the projection root to.
+ */
+static void
+iof_load_handler(crt_rpc_t *rpc)
+{
+	struct iof_gah_in *in = crt_req_get(rpc);
+	struct iof_load_out *out = crt_reply_get(rpc);
+	struct ios_projection *projection;
+	struct ionss_file_handle *file = NULL;
+	int rc;
+
+	VALIDATE_ARGS_GAH_FILE(rpc, in, out, file);
+	if (out->err)
+		goto out;
+
+	projection = file->projection;
+
+	D_MUTEX_LOCK(&projection->lock);
+	out->active_reads = projection->current_read_count;
+	out->active_writes = projection->current_write_count;
+	out->queued = projection->queued_read_count +
+		projection->queued_write_count;
+	D_MUTEX_UNLOCK(&projection->lock);
+
+	out->open_handles = atomic_load_consume(&projection->open_handles);
+
+	IOF_TRACE_DEBUG(rpc, "reads %u writes %u queued %u handles %u",
+			out->active_reads, out->active_writes, out->queued,
+			out->open_handles);
+
+out:
+	rc = crt_reply_send(rpc);
+	if (rc)
+		IOF_TRACE_ERROR(rpc, "response not sent, ret = %d", rc);
+
+	if (file)
+		ios_fh_decref(file, 1);
+}
+
+/* Copy a range from one file to another with copy_file_range(), which shares
+ * the blocks on filesystems which support reflinks, and otherwise copies them
+ * without the data passing through the client.
+ *
+ * At most IONSS_COPY_MAX bytes are copied per RPC, so the client may see a
+ * short copy.  If the backend cannot copy between the files then EXDEV is
+ * returned, and the client copies the data itself.
+ */
+static void
+iof_copy_handler(crt_rpc_t *rpc)
+{
+	struct iof_copy_in *in = crt_req_get(rpc);
+	struct iof_copy_out *out = crt_reply_get(rpc);
+	struct ionss_file_handle *src = NULL;
+	struct ionss_file_handle *dst = NULL;
+	loff_t src_off = in->src_off;
+	loff_t dst_off = in->dst_off;
+	size_t len = in->len;
+	ssize_t bytes;
+	int rc;
+
+	VALIDATE_ARGS_GAH_FILE(rpc, in, out, src);
+	if (out->err)
+		goto out;
+
+	dst = ios_fh_find(&base, &in->dst_gah);
+	if (!dst) {
+		IOF_TRACE_INFO(rpc, "Failed to find handle from "
+			       GAH_PRINT_STR, GAH_PRINT_VAL(in->dst_gah));
+		D_GOTO(out, out->err = -DER_NONEXIST);
+	}
+
+	VALIDATE_WRITE(dst->projection, out);
+	if (out->err || out->rc)
+		goto out;
+
+	if (len > IONSS_COPY_MAX)
+		len = IONSS_COPY_MAX;
+
+	errno = 0;
+#ifdef SYS_copy_file_range
+	bytes = syscall(SYS_copy_file_range, src->fd, &src_off, dst->fd,
+			&dst_off, len, 0);
+#else
+	bytes = -1;
+	errno = ENOSYS;
+#endif
+	atomic_inc(&dst->projection->write_gen);
+	if (bytes < 0) {
+		out->rc = errno;
+		if (out->rc == ENOSYS || out->rc == EOPNOTSUPP)
+			out->rc = EXDEV;
+	} else {
+		out->len = bytes;
+	}
+
+	IOF_TRACE_DEBUG(rpc, "Copied %zi of %zu bytes, rc %d", bytes, len,
+			out->rc);
+
+out:
+	rc = crt_reply_send(rpc);
+	if (rc)
+		IOF_TRACE_ERROR(rpc, "response not sent, ret = %d", rc);
+
+	if (src)
+		ios_fh_decref(src, 1);
+	if (dst)
+		ios_fh_decref(dst, 1);
+}
+
+/* Preallocate, punch or zero a range of a file.  Only the modes which
+ * applications use through posix_fallocate() and the hole punching
+ * interfaces are accepted.
+ */
+#define IONSS_FALLOC_MODES (FALLOC_FL_KEEP_SIZE | FALLOC_FL_PUNCH_HOLE | \
+			    FALLOC_FL_ZERO_RANGE)
+
+static void
+iof_fallocate_handler(crt_rpc_t *rpc)
+{
+	struct iof_fallocate_in *in = crt_req_get(rpc);
+	struct iof_status_out *out = crt_reply_get(rpc);
+	struct ionss_file_handle *handle;
+	int rc;
+
+	VALIDATE_ARGS_GAH_FILE(rpc, in, out, handle);
+	if (out->err)
+		goto out;
+
+	VALIDATE_WRITE(handle->projection, out);
+	if (out->err || out->rc)
+		goto out;
+
+	if (in->mode & ~IONSS_FALLOC_MODES)
+		D_GOTO(out, out->rc = EOPNOTSUPP);
+
+	errno = 0;
+	rc = fallocate(handle->fd, in->mode, in->offset, in->len);
+	if (rc)
+		out->rc = errno;
+	atomic_inc(&handle->projection->write_gen);
+
+	IOF_TRACE_DEBUG(rpc, "mode %#x %#lx-%#lx, rc %d", in->mode,
+			in->offset, in->offset + in->len - 1, out->rc);
+
+out:
+	rc = crt_reply_send(rpc);
+	if (rc)
+		IOF_TRACE_ERROR(rpc, "response not sent, ret = %d", rc);
+
+	if (handle)
+		ios_fh_decref(handle, 1);
+}
+
 static void iof_unlink_handler(crt_rpc_t *rpc)
 {
 	struct iof_unlink_in *in = crt_req_get(rpc);
@@ -1729,7 +2319,8 @@ out:
 			out->err = _rc;					\
 			break;						\
 		}							\
-		if ((in)->bulk_len > bulk_len) {			\
+		if ((in)->bulk_off > bulk_len ||			\
+		    (in)->bulk_len > bulk_len - (in)->bulk_off) {	\
 			out->err = -DER_MISC;				\
 			break;						\
 		}							\
@@ -1760,7 +2351,11 @@ void iof_write_check_and_send(struct ios_projection *projection)
 		return;
 	}
 
-	awd = iof_pool_acquire(projection->aw_pool);
+	wrd = d_list_entry(projection->write_list.next,
+			   struct ionss_io_req_desc, list);
+
+	awd = iof_pool_acquire(ios_ctx_pools(projection,
+					     wrd->rpc->cr_ctx)->aw_pool);
 	if (!awd) {
 		projection->current_write_count--;
 		IOF_TRACE_DEBUG(projection, "No AWD slot available (%d/%d)",
@@ -1770,8 +2365,8 @@ void iof_write_check_and_send(struct ios_projection *projection)
 		return;
 	}
 
-	wrd = d_list_pop_entry(&projection->write_list,
-			       struct ionss_io_req_desc, list);
+	d_list_del(&wrd->list);
+	projection->queued_write_count--;
 
 	IOF_TRACE_UP(awd, wrd->handle, "awd");
 	IOF_TRACE_DEBUG(awd, "Submiting new write (%d/%d)",
@@ -1825,6 +2420,7 @@ iof_process_write(struct ionss_active_write *awd)
 			out->rc = errno;
 		else
 			out->len += bytes_written;
+		atomic_inc(&projection->write_gen);
 		D_GOTO(out, 0);
 	}
 
@@ -1836,7 +2432,7 @@ iof_process_write(struct ionss_active_write *awd)
 	bulk_desc.bd_rpc = awd->rpc;
 	bulk_desc.bd_bulk_op = CRT_BULK_GET;
 	bulk_desc.bd_remote_hdl = in->data_bulk;
-	bulk_desc.bd_remote_off = awd->data_offset;
+	bulk_desc.bd_remote_off = in->bulk_off + awd->data_offset;
 	bulk_desc.bd_local_hdl = awd->local_bulk.handle;
 	bulk_desc.bd_len = awd->req_len;
 
@@ -1863,7 +2459,7 @@ out:
 
 	crt_req_decref(awd->rpc);
 
-	iof_pool_release(projection->aw_pool, awd);
+	iof_pool_release(awd->pools->aw_pool, awd);
 
 	ios_fh_decref(handle, 1);
 
@@ -1879,17 +2475,19 @@ static int iof_write_bulk(const struct crt_bulk_cb_info *cb_info)
 	struct iof_writex_in *in = crt_req_get(awd->rpc);
 	ssize_t bytes_written;
 	off_t offset;
+	int fd;
 	int rc;
 
 	if (cb_info->bci_rc)
 		D_GOTO(out, out->err = cb_info->bci_rc);
 
 	offset = in->xtvec.xt_off + awd->segment_offset;
-	IOF_TRACE_DEBUG(awd, "Writing to fd=%d %#zx-%#zx", handle->fd,
+	fd = ionss_io_fd(handle, offset, awd->req_len);
+	IOF_TRACE_DEBUG(awd, "Writing to fd=%d %#zx-%#zx", fd,
 			offset, offset + awd->req_len - 1);
 	errno = 0;
-	bytes_written = pwrite(handle->fd, awd->local_bulk.buf,
-			       awd->req_len, offset);
+	bytes_written = pwrite(fd, awd->local_bulk.buf, awd->req_len, offset);
+	atomic_inc(&projection->write_gen);
 	if (bytes_written == -1) {
 		D_GOTO(out, out->rc = errno);
 	} else {
@@ -1910,7 +2508,7 @@ out:
 
 	crt_req_decref(awd->rpc);
 
-	iof_pool_release(projection->aw_pool, awd);
+	iof_pool_release(awd->pools->aw_pool, awd);
 
 	ios_fh_decref(handle, 1);
 
@@ -1959,7 +2557,10 @@ iof_writex_handler(crt_rpc_t *rpc)
 	/* Try and acquire a active write descriptor, if one is available then
 	 * start the write, else add it to the list
 	 */
-	awd = iof_pool_acquire(projection->aw_pool);
+	awd = NULL;
+	if (projection->current_write_count < projection->max_write_count)
+		awd = iof_pool_acquire(ios_ctx_pools(projection,
+						     rpc->cr_ctx)->aw_pool);
 	if (awd) {
 		projection->current_write_count++;
 		IOF_TRACE_UP(awd, handle, "awd");
@@ -1979,6 +2580,7 @@ iof_writex_handler(crt_rpc_t *rpc)
 		wrd->rpc = rpc;
 		wrd->handle = handle;
 		d_list_add_tail(&wrd->list, &projection->write_list);
+		projection->queued_write_count++;
 		D_MUTEX_UNLOCK(&projection->lock);
 	}
 	/* Do not call crt_reply_send() in this case as it'll be done in
@@ -2097,6 +2699,7 @@ static void iof_setattr_handler(crt_rpc_t *rpc)
 				in->stat.st_size);
 		errno = 0;
 		rc = ftruncate(fd, in->stat.st_size);
+		atomic_inc(&handle->projection->write_gen);
 		if (rc)
 			D_GOTO(out, out->rc = errno);
 
@@ -2225,6 +2828,7 @@ iof_query_handler(crt_rpc_t *query_rpc)
 
 	query->poll_interval = base.cnss_poll_interval;
 	query->progress_callback = base.progress_callback;
+	query->ctx_count = base.ctx_count;
 	query->info.ca_count = base.projection_count;
 	query->info.ca_arrays = base.fs_list;
 
@@ -2266,7 +2870,7 @@ int ionss_register(void)
 		return ret;
 	}
 
-	ret = iof_write_register(write_handlers);
+	ret = iof_write_register(NULL, write_handlers);
 	if (ret) {
 		IOF_LOG_ERROR("RPC server handler registration failed,"
 			      " ret = %d", ret);
@@ -2299,12 +2903,12 @@ static int check_shutdown(void *arg)
 static void *progress_thread(void *arg)
 {
 	int			rc;
-	struct ios_base *b = (struct ios_base *)arg;
+	crt_context_t		crt_ctx = *(crt_context_t *)arg;
 
 	/* progress loop */
 	do {
-		rc = crt_progress(b->crt_ctx, b->poll_interval,
-				  b->callback_fn, &shutdown);
+		rc = crt_progress(crt_ctx, base.poll_interval,
+				  base.callback_fn, &shutdown);
 		if (rc != 0 && rc != -DER_TIMEDOUT) {
 			IOF_LOG_ERROR("crt_progress failed rc: %d", rc);
 			break;
@@ -2319,7 +2923,7 @@ static void *progress_thread(void *arg)
 	 * the sender.
 	 */
 	for (;;) {
-		rc = crt_progress(b->crt_ctx, 1000, NULL, NULL);
+		rc = crt_progress(crt_ctx, 1000, NULL, NULL);
 		if (rc == -DER_TIMEDOUT)
 			break;
 		if (rc != 0) {
@@ -2496,7 +3100,8 @@ static void show_help(const char *prog)
 	"# CNSS polling interval (in microseconds) for CART progress\n"
 	"cnss_poll_interval:     10000\n"
 	"\n"
-	"# Number of threads to be used on the IONSS\n"
+	"# Number of threads to be used on the IONSS.  Each thread has its\n"
+	"# own CART context and clients spread requests over all of them\n"
 	"thread_count:           2\n"
 	"\n"
 	"# Enable/disable use of CART progress callback function on IONSS and CNSS\n"
@@ -2523,6 +3128,9 @@ static void show_help(const char *prog)
 	"\n"
 	"# Select FUSE API to use on the client while reading:\n"
 	"# true: 'fuse_reply_buf'; false: 'fuse_reply_data'\n"
+	"# This is the initial setting only, it can be changed per projection\n"
+	"# on the client through the 'read_reply' ctrl file, which also accepts\n"
+	"# 'splice' and 'auto' to time all methods and use the fastest\n"
 	"fuse_read_buf:          true\n"
 	"\n"
 	"# Select FUSE API to use on the client while writing:\n"
@@ -2535,6 +3143,55 @@ static void show_help(const char *prog)
 	"# is enabled only if available for the file system being projected.\n"
 	"failover:               auto\n"
 	"\n"
+	"# Whether file data is striped across IONSS ranks.  Valid values are\n"
+	"# \"auto\" and \"disable\".  If \"auto\" is specified and there is more\n"
+	"# than one IONSS then file offsets are distributed round robin over\n"
+	"# all ranks in units of stripe_size, and clients send reads and\n"
+	"# writes for each stripe to the rank that serves it.\n"
+	"striped_data:           disable\n"
+	"\n"
+	"# Size of each stripe when striped_data is enabled\n"
+	"stripe_size:            1M\n"
+	"\n"
+	"# Minimum size of reads and writes which bypass the page cache on\n"
+	"# the IONSS, using a second descriptor opened with O_DIRECT.  Only\n"
+	"# I/O with 4K aligned offsets and lengths is eligible, so this\n"
+	"# should be no larger than max_read_size and max_write_size.  Set\n"
+	"# to 0 to always use the page cache.\n"
+	"direct_io_size:         0\n"
+	"\n"
+	"# Whether directory entries are distributed across IONSS ranks.\n"
+	"# Valid values are \"auto\" and \"disable\".  If \"auto\" is\n"
+	"# specified and there is more than one IONSS then clients send\n"
+	"# lookup, create and unlink requests to a rank chosen by hashing\n"
+	"# the parent directory and name.\n"
+	"striped_metadata:       disable\n"
+	"\n"
+	"# Whether clients balance lookups and creates in the projection\n"
+	"# root across IONSS ranks.  Valid values are \"auto\" and\n"
+	"# \"disable\".  If \"auto\" is specified and there is more than\n"
+	"# one IONSS then clients periodically fetch the number of active\n"
+	"# and queued I/O requests and open handles from every rank, and\n"
+	"# send each new lookup to the least loaded rank.  Has no effect\n"
+	"# when striped_metadata is enabled.\n"
+	"load_balance:           disable\n"
+	"\n"
+	"# Whether clients keep a cache of file data on local storage, as\n"
+	"# with a DataWarp cache mode projection.  Valid values are \"auto\"\n"
+	"# and \"disable\".  If \"auto\" is specified then clients which\n"
+	"# have CNSS_CACHE_DIR set in their environment store data read from\n"
+	"# files opened read-only under that directory, up to CNSS_CACHE_SIZE\n"
+	"# bytes, and use it for later reads if the file is unchanged.\n"
+	"dw_cache:               disable\n"
+	"\n"
+	"# Whether clients absorb writes on local storage, as with a DataWarp\n"
+	"# scratch mode projection.  Valid values are \"auto\" and\n"
+	"# \"disable\".  If \"auto\" is specified then clients which have\n"
+	"# CNSS_SCRATCH_DIR set in their environment acknowledge writes\n"
+	"# once they are stored under that directory, and send them to the\n"
+	"# IONSS in the background.  Takes precedence over dw_cache.\n"
+	"dw_scratch:             disable\n"
+	"\n"
 	"# Whether the projection is writeable.  Valid values are \"auto\"\n"
 	"# and \"disable\". If \"disable\" is specified, the projection\n"
 	"# is treated as read-only even if the directory being projected\n"
@@ -2588,6 +3245,7 @@ fh_reset(void *arg)
 
 	fh->ht_ref = 0;
 	fh->ref = 0;
+	fh->direct_fd = IONSS_DIRECT_FD_UNSET;
 	atomic_fetch_add(&fh->ref, 1);
 	memset(&fh->proc_fd_name, 0, 64);
 
@@ -2598,8 +3256,13 @@ static void
 ar_init(void *arg, void *handle)
 {
 	struct ionss_active_read *ard = arg;
+	struct ios_ctx_pools *pools = handle;
 
-	ard->projection = handle;
+	ard->pools = pools;
+	ard->projection = pools->projection;
+	D_INIT_LIST_HEAD(&ard->list);
+	D_INIT_LIST_HEAD(&ard->share_link);
+	D_INIT_LIST_HEAD(&ard->waiters);
 }
 
 static bool
@@ -2616,7 +3279,7 @@ ar_reset(void *arg)
 	}
 
 	if (!ard->local_bulk.buf) {
-		IOF_BULK_ALLOC(ard->projection->base->crt_ctx,
+		IOF_BULK_ALLOC(ard->pools->crt_ctx,
 			       ard,
 			       local_bulk,
 			       ard->projection->max_read_size,
@@ -2640,8 +3303,10 @@ static void
 aw_init(void *arg, void *handle)
 {
 	struct ionss_active_write *awd = arg;
+	struct ios_ctx_pools *pools = handle;
 
-	awd->projection = handle;
+	awd->pools = pools;
+	awd->projection = pools->projection;
 }
 
 static bool
@@ -2658,7 +3323,7 @@ aw_reset(void *arg)
 	}
 
 	if (!awd->local_bulk.buf) {
-		IOF_BULK_ALLOC(awd->projection->base->crt_ctx,
+		IOF_BULK_ALLOC(awd->pools->crt_ctx,
 			       awd,
 			       local_bulk,
 			       awd->projection->max_write_size,
@@ -2856,6 +3521,7 @@ int main(int argc, char **argv)
 
 		D_INIT_LIST_HEAD(&projection->read_list);
 		D_INIT_LIST_HEAD(&projection->write_list);
+		D_INIT_LIST_HEAD(&projection->share_list);
 
 		errno = 0;
 		rc = fstat(fd, &buf);
@@ -2923,11 +3589,19 @@ int main(int argc, char **argv)
 		D_GOTO(shutdown, exit_rc = -DER_MISC);
 	}
 
-	ret = crt_context_create(&base.crt_ctx);
-	if (ret) {
-		IOF_LOG_ERROR("Could not create context");
-		D_GOTO(shutdown, exit_rc = ret);
+	base.ctx_count = base.thread_count > 1 ? base.thread_count : 1;
+	D_ALLOC_ARRAY(base.ctx_array, base.ctx_count);
+	if (!base.ctx_array)
+		D_GOTO(shutdown, exit_rc = -DER_NOMEM);
+
+	for (i = 0; i < base.ctx_count; i++) {
+		ret = crt_context_create(&base.ctx_array[i]);
+		if (ret) {
+			IOF_LOG_ERROR("Could not create context %d", i);
+			D_GOTO(shutdown, exit_rc = ret);
+		}
 	}
+	base.crt_ctx = base.ctx_array[0];
 
 	for (i = 0; i < base.projection_count; i++) {
 		struct ios_projection *projection = &base.projection_array[i];
@@ -2944,18 +3618,35 @@ int main(int argc, char **argv)
 					   .max_desc = projection->max_write_count,
 					   POOL_TYPE_INIT(ionss_active_write,
 							  list)};
+		struct ios_ctx_pools *pools;
+		uint32_t c;
 
 		if (!projection->active)
 			continue;
-		projection->ar_pool = iof_pool_register(&projection->pool,
-							&arp);
-		if (!projection->ar_pool) {
-			D_GOTO(shutdown, exit_rc = -DER_NOMEM);
-		}
-		projection->aw_pool = iof_pool_register(&projection->pool,
-							&awp);
-		if (!projection->aw_pool) {
+
+		/* Descriptors are kept per context so their buffers are only
+		 * registered once.  The projection counts limit how many are
+		 * in use across all contexts.
+		 */
+		D_ALLOC_ARRAY(projection->ctx_pools, base.ctx_count);
+		if (!projection->ctx_pools)
 			D_GOTO(shutdown, exit_rc = -DER_NOMEM);
+
+		for (c = 0; c < base.ctx_count; c++) {
+			pools = &projection->ctx_pools[c];
+			pools->crt_ctx = base.ctx_array[c];
+
+			ret = iof_pool_init(&pools->pool, pools);
+			if (ret != -DER_SUCCESS)
+				D_GOTO(shutdown, exit_rc = ret);
+			pools->projection = projection;
+
+			pools->ar_pool = iof_pool_register(&pools->pool, &arp);
+			if (!pools->ar_pool)
+				D_GOTO(shutdown, exit_rc = -DER_NOMEM);
+			pools->aw_pool = iof_pool_register(&pools->pool, &awp);
+			if (!pools->aw_pool)
+				D_GOTO(shutdown, exit_rc = -DER_NOMEM);
 		}
 	}
 
@@ -2994,6 +3685,41 @@ int main(int argc, char **argv)
 			base.fs_list[i].flags |= IOF_FUSE_READ_BUF;
 		if (projection->fuse_write_buf)
 			base.fs_list[i].flags |= IOF_FUSE_WRITE_BUF;
+		if (projection->striped_data && projection->stripe_size &&
+		    base.num_ranks > 1) {
+			base.fs_list[i].flags |= IOF_STRIPED_DATA;
+			base.fs_list[i].stripe_size = projection->stripe_size;
+			base.fs_list[i].stripe_count = base.num_ranks;
+			IOF_LOG_INFO("Striping '%s' over %d ranks in %#x blocks",
+				     projection->full_path, base.num_ranks,
+				     projection->stripe_size);
+		}
+		if (projection->striped_metadata && base.num_ranks > 1) {
+			base.fs_list[i].flags |= IOF_STRIPED_METADATA;
+			base.fs_list[i].stripe_count = base.num_ranks;
+			IOF_LOG_INFO("Striping '%s' metadata over %d ranks",
+				     projection->full_path, base.num_ranks);
+		}
+		if (projection->load_balance && base.num_ranks > 1) {
+			base.fs_list[i].flags |= IOF_LOAD_BALANCE;
+			base.fs_list[i].stripe_count = base.num_ranks;
+			IOF_LOG_INFO("Balancing '%s' lookups over %d ranks",
+				     projection->full_path, base.num_ranks);
+		}
+		if (projection->direct_io_size)
+			IOF_LOG_INFO("Bypassing page cache for I/O of %#x bytes"
+				     " or more on '%s'",
+				     projection->direct_io_size,
+				     projection->full_path);
+		if (projection->dw_scratch && projection->writeable) {
+			base.fs_list[i].flags |= IOF_DW_SCRATCH;
+			IOF_LOG_INFO("Client write absorption enabled for '%s'",
+				     projection->full_path);
+		} else if (projection->dw_cache) {
+			base.fs_list[i].flags |= IOF_DW_CACHE;
+			IOF_LOG_INFO("Client caching enabled for '%s'",
+				     projection->full_path);
+		}
 
 		base.fs_list[i].gah = projection->root->gah;
 		base.fs_list[i].id = projection->id;
@@ -3050,7 +3776,8 @@ int main(int argc, char **argv)
 		for (thread = 0; thread < base.thread_count; thread++) {
 			IOF_LOG_INFO("Starting thread %d", thread);
 			ret = pthread_create(&progress_tids[thread], NULL,
-					     progress_thread, &base);
+					     progress_thread,
+					     &base.ctx_array[thread]);
 		}
 
 		for (thread = 0; thread < base.thread_count; thread++) {
@@ -3074,6 +3801,8 @@ shutdown:
 	 */
 	for (i = 0; i < base.projection_count; i++) {
 		struct ios_projection *projection = &base.projection_array[i];
+		struct ios_ctx_pools *pools;
+		uint32_t c;
 		int rc;
 
 		/* Close all file handles associated with a projection.
@@ -3091,6 +3820,14 @@ shutdown:
 			IOF_TRACE_WARNING(projection,
 					  "Problem closing lock");
 
+		for (c = 0; projection->ctx_pools && c < base.ctx_count;
+		     c++) {
+			pools = &projection->ctx_pools[c];
+			if (pools->projection)
+				iof_pool_destroy(&pools->pool);
+		}
+		D_FREE(projection->ctx_pools);
+
 		iof_pool_destroy(&projection->pool);
 
 		IOF_TRACE_DOWN(projection);
@@ -3100,23 +3837,30 @@ shutdown_no_proj:
 
 	D_RWLOCK_DESTROY(&base.gah_rwlock);
 
-	ret = crt_context_destroy(base.crt_ctx, false);
-	if (ret != -DER_SUCCESS) {
-		IOF_LOG_INFO("Could not destroy context, trying force %d",
-			      ret);
-		if (ret == -DER_TIMEDOUT) {
-			ret = crt_context_destroy(base.crt_ctx, true);
-			if (ret != -DER_SUCCESS) {
-				IOF_LOG_ERROR("Could not destroy context, giving up %d",
-					      ret);
-			}
-		}
+	for (i = 0; base.ctx_array && i < base.ctx_count; i++) {
+		if (!base.ctx_array[i])
+			continue;
+
+		ret = crt_context_destroy(base.ctx_array[i], false);
 		if (ret != -DER_SUCCESS) {
-			if (exit_rc == -DER_SUCCESS) {
-				exit_rc = ret;
+			IOF_LOG_INFO("Could not destroy context, trying force %d",
+				     ret);
+			if (ret == -DER_TIMEDOUT) {
+				ret = crt_context_destroy(base.ctx_array[i],
+							  true);
+				if (ret != -DER_SUCCESS) {
+					IOF_LOG_ERROR("Could not destroy context, giving up %d",
+						      ret);
+				}
+			}
+			if (ret != -DER_SUCCESS) {
+				if (exit_rc == -DER_SUCCESS) {
+					exit_rc = ret;
+				}
 			}
 		}
 	}
+	D_FREE(base.ctx_array);
 
 	ret = crt_finalize();
 	if (ret) {
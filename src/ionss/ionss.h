@@ -61,6 +61,11 @@ struct ios_base {
 	d_rank_t		my_rank;
 	uint32_t		num_ranks;
 	crt_context_t		crt_ctx;
+	/* One context per progress thread, clients pick one with the endpoint
+	 * tag.  crt_ctx is the first of these.
+	 */
+	crt_context_t		*ctx_array;
+	uint32_t		ctx_count;
 	pthread_rwlock_t	gah_rwlock;
 	/* Global tunable options */
 	char			*group_name;
@@ -121,18 +126,34 @@ struct ionss_file_handle {
 	struct ionss_mini_file	 mf;
 	char			 proc_fd_name[64];
 	uint			 fd;
+	/* Second descriptor opened with O_DIRECT for large I/O, or one of
+	 * IONSS_DIRECT_FD_UNSET or IONSS_DIRECT_FD_FAILED.
+	 */
+	ATOMIC int		 direct_fd;
 	ATOMIC uint		 ht_ref;
 	ATOMIC uint		 ref;
 };
 
+/* Read and write descriptors for RPCs received on one context.  The bulk
+ * buffer of a descriptor is registered with the context, so can only be used
+ * for transfers on it.
+ */
+struct ios_ctx_pools {
+	struct ios_projection	*projection;
+	crt_context_t		crt_ctx;
+	struct iof_pool		pool;
+	struct iof_pool_type	*ar_pool;
+	struct iof_pool_type	*aw_pool;
+};
+
 struct ios_projection {
 	struct ios_base		*base;
 	char			*full_path;
 	char			fs_type[IOF_MAX_FSTYPE_LEN];
 	struct iof_pool		pool;
 	struct iof_pool_type	*fh_pool;
-	struct iof_pool_type	*ar_pool;
-	struct iof_pool_type	*aw_pool;
+	/* One per context in the base ctx_array */
+	struct ios_ctx_pools	*ctx_pools;
 	struct ionss_file_handle	*root;
 	struct d_hash_table	file_ht;
 	uint32_t		id;
@@ -148,6 +169,11 @@ struct ios_projection {
 	uint32_t		readdir_size;
 	uint32_t		cnss_timeout;
 	uint32_t		cnss_thread_count;
+	uint32_t		stripe_size;
+	/* Minimum size of reads and writes which bypass the page cache,
+	 * 0 to disable.
+	 */
+	uint32_t		direct_io_size;
 	char			*mount_path;
 
 	/* Per-projection tunable flags */
@@ -156,6 +182,11 @@ struct ios_projection {
 	bool			fuse_write_buf;
 	bool			writeable;
 	bool			failover;
+	bool			striped_data;
+	bool			striped_metadata;
+	bool			load_balance;
+	bool			dw_cache;
+	bool			dw_scratch;
 
 	bool			active;
 	uint64_t		dev_no;
@@ -164,6 +195,15 @@ struct ios_projection {
 	d_list_t		read_list;
 	int			current_write_count;
 	d_list_t		write_list;
+	/* Length of read_list and write_list, reported to clients as load */
+	int			queued_read_count;
+	int			queued_write_count;
+	/* Reads whose data can be shared, and a count of changes to file
+	 * data used to check it is still current.
+	 */
+	d_list_t		share_list;
+	ATOMIC uint		write_gen;
+	ATOMIC uint		open_handles;
 };
 
 struct ionss_dir_handle {
@@ -175,6 +215,19 @@ struct ionss_dir_handle {
 
 #define IONSS_READDIR_ENTRIES_PER_RPC (2)
 
+/* Maximum bytes copied by a single copy RPC, so a large copy does not hold
+ * up other RPCs for the context for too long.
+ */
+#define IONSS_COPY_MAX (64 * 1024 * 1024)
+
+/* Alignment of file offsets and lengths for O_DIRECT I/O.  Bulk buffers are
+ * allocated with mmap() so are always page aligned.
+ */
+#define IONSS_DIRECT_ALIGN (4096)
+
+#define IONSS_DIRECT_FD_UNSET (-1)
+#define IONSS_DIRECT_FD_FAILED (-2)
+
 /*
  * Pipelining reads.
  *
@@ -198,6 +251,7 @@ struct ionss_io_req_desc {
  */
 struct ionss_active_read {
 	struct ios_projection		*projection;
+	struct ios_ctx_pools		*pools;
 	crt_rpc_t			*rpc;
 	struct ionss_file_handle	*handle;
 	struct iof_local_bulk		local_bulk;
@@ -206,6 +260,14 @@ struct ionss_active_read {
 	uint64_t			data_offset;
 	uint64_t			req_len;
 	uint64_t			segment_offset;
+	/* Sharing of the data read, see iof_read_share() */
+	d_list_t			share_link;
+	d_list_t			waiters;
+	off_t				share_off;
+	uint				share_gen;
+	int				read_rc;
+	bool				shared;
+	bool				filling;
 	bool				failed;
 };
 
@@ -216,6 +278,7 @@ struct ionss_active_read {
  */
 struct ionss_active_write {
 	struct ios_projection		*projection;
+	struct ios_ctx_pools		*pools;
 	crt_rpc_t			*rpc;
 	struct ionss_file_handle	*handle;
 	struct iof_local_bulk		local_bulk;
@@ -44,6 +44,8 @@
 #include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
 #include <unistd.h>
 #include <stdbool.h>
 #include <fcntl.h>
@@ -53,6 +55,7 @@
 #include "iof_ctrl_util.h"
 #include "iof_ioctl.h"
 #include "iof_api.h"
+#include "iof_aio.h"
 
 static const char *cnss_prefix;
 static char *mount_dir;
@@ -159,6 +162,14 @@ static void gah_test(void)
 		return;
 	}
 
+	/* A file opened with an RPC has an O_PATH fd in the kernel, which
+	 * ioctl() can't be used on.
+	 */
+	if (getenv("IOIL_DIRECT_OPEN") != NULL) {
+		printf("Direct open, skipping ioctl test of IOF file\n");
+		goto out;
+	}
+
 	WRITE_LOG("calling ioctl on iof file");
 	rc = ioctl(fd, IOF_IOCTL_GAH, &gah_info);
 
@@ -171,6 +182,7 @@ static void gah_test(void)
 		printf("ioctl returned " GAH_PRINT_STR "\n",
 		       GAH_PRINT_VAL(gah_info.gah));
 
+out:
 	rc = close(fd);
 	CU_ASSERT_EQUAL(rc, 0);
 
@@ -225,6 +237,18 @@ static void do_write_tests(int fd, char *buf, size_t len)
 	printf("Seek offset is %zd, expected %zu\n", offset, len * 4);
 	CU_ASSERT_EQUAL(offset, len * 4);
 
+	/* A vector with no data writes nothing */
+	iov[0].iov_len = 0;
+	iov[1].iov_len = 0;
+
+	bytes = pwritev(fd, iov, 2, len * 4);
+	printf("Wrote %zd bytes, expected 0\n", bytes);
+	CU_ASSERT_EQUAL(bytes, 0);
+
+	offset = lseek(fd, 0, SEEK_END);
+	printf("Seek offset is %zd, expected %zu\n", offset, len * 4);
+	CU_ASSERT_EQUAL(offset, len * 4);
+
 	memset(big_string, 'a', BUF_SIZE - 1);
 	big_string[BUF_SIZE - 1] = 0;
 	bytes = write(fd, big_string, BUF_SIZE);
@@ -300,6 +324,18 @@ static void do_read_tests(const char *fname, size_t len)
 	CU_ASSERT_STRING_EQUAL(fname, buf);
 	CU_ASSERT_STRING_EQUAL(fname, buf2);
 
+	/* A vector with no space reads nothing */
+	iov[0].iov_len = 0;
+	iov[1].iov_len = 0;
+
+	bytes = preadv(fd, iov, 2, 0);
+	printf("Read %zd bytes, expected 0\n", bytes);
+	CU_ASSERT_EQUAL(bytes, 0);
+
+	offset = lseek(fd, 0, SEEK_CUR);
+	printf("Seek offset is %zd, expected %zu\n", offset, len * 2);
+	CU_ASSERT_EQUAL(offset, len * 2);
+
 	free(buf);
 
 	rc = close(fd);
@@ -308,6 +344,210 @@ static void do_read_tests(const char *fname, size_t len)
 	WRITE_LOG("end read test");
 }
 
+static void do_read_cache_tests(const char *fname, size_t len)
+{
+	struct iof_read_cache_stats stats;
+	char buf[len + 1];
+	ssize_t bytes;
+	int fd;
+	int rc;
+
+	WRITE_LOG("starting read cache test");
+
+	fd = open(fname, O_RDWR);
+	printf("Opened %s, fd = %d\n", fname, fd);
+	CU_ASSERT_NOT_EQUAL_FATAL(fd, -1);
+
+	rc = iof_get_read_cache_stats(fd, &stats);
+	if (rc != 0 && errno == ENOTSUP) {
+		printf("Read cache disabled, skipping\n");
+		goto out;
+	}
+	CU_ASSERT_EQUAL(rc, 0);
+	CU_ASSERT_EQUAL(stats.hits, 0);
+
+	/* The first read fills the cache, the second is served from it */
+	memset(buf, 0, len + 1);
+	bytes = read(fd, buf, len);
+	CU_ASSERT_EQUAL(bytes, len);
+	CU_ASSERT_STRING_EQUAL(fname, buf);
+
+	memset(buf, 0, len + 1);
+	bytes = read(fd, buf, len);
+	CU_ASSERT_EQUAL(bytes, len);
+	CU_ASSERT_STRING_EQUAL(fname, buf);
+
+	rc = iof_get_read_cache_stats(fd, &stats);
+	CU_ASSERT_EQUAL(rc, 0);
+	printf("Read cache hits %" PRIu64 ", misses %" PRIu64 "\n",
+	       stats.hits, stats.misses);
+	CU_ASSERT_EQUAL(stats.fills, 1);
+	CU_ASSERT_EQUAL(stats.hits, 1);
+
+	/* Writing through the file discards the cached data */
+	bytes = pwrite(fd, fname, len, 0);
+	CU_ASSERT_EQUAL(bytes, len);
+
+	rc = iof_get_read_cache_stats(fd, &stats);
+	CU_ASSERT_EQUAL(rc, 0);
+	CU_ASSERT_EQUAL(stats.invalidations, 1);
+
+out:
+	rc = close(fd);
+	printf("Closed file, rc = %d\n", rc);
+	CU_ASSERT_EQUAL(rc, 0);
+	WRITE_LOG("end read cache test");
+}
+
+#define AIO_DEPTH 32
+
+/* Read the file with a full queue, collect the results with a timeout,
+ * then destroy a queue with a read still outstanding.
+ */
+static bool do_aio_child(int fd, const char *fname, size_t len)
+{
+	struct iof_aio_req reqs[AIO_DEPTH];
+	struct iof_aio_req *batch[AIO_DEPTH];
+	struct iof_aio_queue *queue;
+	struct timespec timeout = {.tv_sec = 10};
+	char bufs[AIO_DEPTH][len + 1];
+	bool ok = true;
+	int rc;
+	int i;
+
+	queue = iof_aio_queue_create(AIO_DEPTH);
+	if (queue == NULL)
+		return false;
+
+	memset(bufs, 0, sizeof(bufs));
+	for (i = 0; i < AIO_DEPTH; i++) {
+		memset(&reqs[i], 0, sizeof(reqs[i]));
+		reqs[i].fd = fd;
+		reqs[i].op = IOF_AIO_READ;
+		reqs[i].buf = bufs[i];
+		reqs[i].len = len;
+		batch[i] = &reqs[i];
+	}
+
+	rc = iof_aio_submit(queue, batch, AIO_DEPTH);
+	if (rc != AIO_DEPTH)
+		ok = false;
+
+	rc = iof_aio_getevents(queue, AIO_DEPTH, AIO_DEPTH, batch, &timeout);
+	if (rc != AIO_DEPTH)
+		ok = false;
+	for (i = 0; i < rc; i++) {
+		if (batch[i]->result != len ||
+		    strcmp(fname, batch[i]->buf) != 0)
+			ok = false;
+	}
+
+	batch[0] = &reqs[0];
+	rc = iof_aio_submit(queue, batch, 1);
+	if (rc != 1)
+		ok = false;
+
+	if (iof_aio_queue_destroy(queue) != 0)
+		ok = false;
+
+	return ok;
+}
+
+static void do_aio_tests(const char *fname, size_t len)
+{
+	struct iof_aio_req reqs[AIO_DEPTH];
+	struct iof_aio_req *batch[AIO_DEPTH];
+	struct iof_aio_queue *queue;
+	char bufs[AIO_DEPTH][len + 1];
+	pid_t pid;
+	int status;
+	int fd;
+	int rc;
+	int i;
+
+	WRITE_LOG("starting aio test");
+
+	queue = iof_aio_queue_create(AIO_DEPTH);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(queue);
+
+	fd = open(fname, O_RDWR);
+	printf("Opened %s, fd = %d\n", fname, fd);
+	CU_ASSERT_NOT_EQUAL_FATAL(fd, -1);
+
+	/* A full queue of reads of the same data, all in flight at once */
+	memset(bufs, 0, sizeof(bufs));
+	for (i = 0; i < AIO_DEPTH; i++) {
+		memset(&reqs[i], 0, sizeof(reqs[i]));
+		reqs[i].fd = fd;
+		reqs[i].op = IOF_AIO_READ;
+		reqs[i].buf = bufs[i];
+		reqs[i].len = len;
+		batch[i] = &reqs[i];
+	}
+
+	rc = iof_aio_submit(queue, batch, AIO_DEPTH);
+	CU_ASSERT_EQUAL(rc, AIO_DEPTH);
+
+	/* The queue is full so nothing more can be submitted */
+	rc = iof_aio_submit(queue, batch, 1);
+	CU_ASSERT_EQUAL(rc, -1);
+	CU_ASSERT_EQUAL(errno, EAGAIN);
+
+	memset(batch, 0, sizeof(batch));
+	rc = iof_aio_getevents(queue, AIO_DEPTH, AIO_DEPTH, batch, NULL);
+	CU_ASSERT_EQUAL(rc, AIO_DEPTH);
+	for (i = 0; i < rc; i++) {
+		CU_ASSERT_EQUAL(batch[i]->result, len);
+		CU_ASSERT_STRING_EQUAL(fname, batch[i]->buf);
+	}
+
+	/* Write at an offset then read it back */
+	reqs[0].op = IOF_AIO_WRITE;
+	reqs[0].buf = (void *)fname;
+	reqs[0].offset = len;
+	batch[0] = &reqs[0];
+	rc = iof_aio_submit(queue, batch, 1);
+	CU_ASSERT_EQUAL(rc, 1);
+	rc = iof_aio_getevents(queue, 1, 1, batch, NULL);
+	CU_ASSERT_EQUAL(rc, 1);
+	CU_ASSERT_EQUAL(reqs[0].result, len);
+
+	memset(bufs[1], 0, len + 1);
+	reqs[1].offset = len;
+	batch[0] = &reqs[1];
+	rc = iof_aio_submit(queue, batch, 1);
+	CU_ASSERT_EQUAL(rc, 1);
+	rc = iof_aio_getevents(queue, 1, 1, batch, NULL);
+	CU_ASSERT_EQUAL(rc, 1);
+	CU_ASSERT_EQUAL(reqs[1].result, len);
+	CU_ASSERT_STRING_EQUAL(fname, bufs[1]);
+
+	rc = iof_aio_queue_destroy(queue);
+	CU_ASSERT_EQUAL(rc, 0);
+
+	/* A forked child has no progress thread, so waiting for requests
+	 * progresses them inline.  The alarm turns a hang into a failure.
+	 */
+	pid = fork();
+	CU_ASSERT_NOT_EQUAL(pid, -1);
+	if (pid == 0) {
+		alarm(30);
+		_exit(do_aio_child(fd, fname, len) ? 0 : 1);
+	}
+
+	if (pid != -1) {
+		rc = waitpid(pid, &status, 0);
+		CU_ASSERT_EQUAL(rc, pid);
+		printf("aio child exited with status %#x\n", status);
+		CU_ASSERT(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	}
+
+	rc = close(fd);
+	printf("Closed file, rc = %d\n", rc);
+	CU_ASSERT_EQUAL(rc, 0);
+	WRITE_LOG("end aio test");
+}
+
 #define CU_ASSERT_GOTO(cond, target)  \
 	do {                          \
 		CU_ASSERT(cond);      \
@@ -378,15 +618,95 @@ static void do_large_io_test(const char *fname, size_t len)
 	do_large_read(fname, buf, buf2, test3_size);
 	do_large_read(fname, buf, buf2, test1_size);
 	do_large_read(fname, buf, buf2, test2_size);
+
+	/* A reallocated buffer must not be served by a stale bulk handle */
+	free(buf2);
+	buf2 = malloc(buf_size);
+	CU_ASSERT_GOTO(buf2 != NULL, done);
+	do_large_read(fname, buf, buf2, test3_size);
 done:
 	free(buf);
 	free(buf2);
 	WRITE_LOG("end large io test");
 }
 
+/* Read-only private mappings are filled over RPC where userfaultfd is
+ * available, except for directly opened files.  Only then do they keep
+ * bypass, so check that the bypass was used rather than accept either.
+ */
+static void do_map_tests(const char *fname, off_t size)
+{
+	char expected[BUF_SIZE];
+	char *address;
+	bool uffd_ok = false;
+	pid_t pid;
+	int status;
+	int rc;
+	int fd;
+
+#ifdef __NR_userfaultfd
+	fd = syscall(__NR_userfaultfd, O_CLOEXEC);
+	if (fd != -1) {
+		close(fd);
+		uffd_ok = getenv("IOIL_DIRECT_OPEN") == NULL;
+	}
+#endif
+
+	if (size > BUF_SIZE)
+		size = BUF_SIZE;
+
+	fd = open(fname, O_RDONLY);
+	printf("Opened %s, fd = %d\n", fname, fd);
+	CU_ASSERT_NOT_EQUAL_FATAL(fd, -1);
+
+	memset(expected, 0, sizeof(expected));
+	rc = pread(fd, expected, size, 0);
+	CU_ASSERT_EQUAL(rc, size);
+
+	address = mmap(NULL, BUF_SIZE, PROT_READ, MAP_PRIVATE, fd, 0);
+	printf("mmap returned %p\n", address);
+	CU_ASSERT_PTR_NOT_EQUAL_FATAL(address, MAP_FAILED);
+
+	status = iof_get_bypass_status(fd);
+	printf("status = %d, userfaultfd %savailable\n", status,
+	       uffd_ok ? "" : "not ");
+	if (uffd_ok)
+		CU_ASSERT_EQUAL(status, IOF_IO_BYPASS);
+
+	/* A child forked before any page is read sees the file contents,
+	 * and the parent still fills the mapping afterwards.
+	 */
+	pid = fork();
+	CU_ASSERT_NOT_EQUAL(pid, -1);
+	if (pid == 0)
+		_exit(memcmp(address, expected, BUF_SIZE) == 0 ? 0 : 1);
+
+	if (pid != -1) {
+		rc = waitpid(pid, &status, 0);
+		CU_ASSERT_EQUAL(rc, pid);
+		CU_ASSERT(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	}
+
+	CU_ASSERT(memcmp(address, expected, BUF_SIZE) == 0);
+
+	rc = munmap(address, BUF_SIZE);
+	printf("munmap returned %d\n", rc);
+	CU_ASSERT_EQUAL(rc, 0);
+
+	status = iof_get_bypass_status(fd);
+	if (uffd_ok)
+		CU_ASSERT_EQUAL(status, IOF_IO_BYPASS);
+
+	rc = close(fd);
+	printf("close returned %d\n", rc);
+	CU_ASSERT_EQUAL(rc, 0);
+}
+
 static void do_misc_tests(const char *fname, size_t len)
 {
 	struct stat stat_info;
+	struct stat new_info;
+	bool stream_bypass = getenv("IOIL_STREAM_BYPASS") != NULL;
 	void *address;
 	FILE *fp = NULL;
 	size_t items;
@@ -518,8 +838,17 @@ skip_mmap:
 	printf("fdopen returned %p\n", fp);
 	CU_ASSERT_PTR_NOT_EQUAL(fp, NULL);
 
+	/* With stream bypass the FILE does its I/O through the interception
+	 * library, so it has no kernel fd and the fd keeps bypass.
+	 */
 	status = iof_get_bypass_status(fd);
-	CU_ASSERT_EQUAL(status, IOF_IO_DIS_STREAM);
+	if (stream_bypass) {
+		CU_ASSERT_EQUAL(status, IOF_IO_BYPASS);
+		if (fp != NULL)
+			CU_ASSERT_EQUAL(fileno(fp), -1);
+	} else {
+		CU_ASSERT_EQUAL(status, IOF_IO_DIS_STREAM);
+	}
 
 	if (fp != NULL) {
 		char buf[16];
@@ -538,6 +867,56 @@ skip_mmap:
 	}
 	CU_ASSERT_EQUAL(rc, 0);
 
+	fp = fopen(fname, "r");
+	printf("fopen returned %p\n", fp);
+	CU_ASSERT_PTR_NOT_EQUAL(fp, NULL);
+	if (fp != NULL) {
+		char buf[16];
+
+		if (stream_bypass)
+			CU_ASSERT_EQUAL(fileno(fp), -1);
+		else
+			CU_ASSERT_NOT_EQUAL(fileno(fp), -1);
+
+		items = fread(buf, 1, 8, fp);
+		printf("Read %zd items, expected 8\n", items);
+		CU_ASSERT_EQUAL(items, 8);
+		buf[8] = 0;
+		CU_ASSERT_STRING_EQUAL(buf, "@@@@@@@@");
+
+		rc = fclose(fp);
+		printf("fclose returned %d\n", rc);
+		CU_ASSERT_EQUAL(rc, 0);
+	}
+
+	do_map_tests(fname, stat_info.st_size);
+
+	/* fstat() and ftruncate() see data which is still buffered */
+	fd = open(fname, O_RDWR);
+	printf("Opened %s, fd = %d\n", fname, fd);
+	CU_ASSERT_NOT_EQUAL(fd, -1);
+
+	rc = pwrite(fd, "@@@@@@@@", 8, stat_info.st_size);
+	printf("pwrite returned %d\n", rc);
+	CU_ASSERT_EQUAL(rc, 8);
+
+	rc = fstat(fd, &new_info);
+	printf("fstat returned %d, size %zd\n", rc, new_info.st_size);
+	CU_ASSERT_EQUAL(rc, 0);
+	CU_ASSERT_EQUAL(new_info.st_size, stat_info.st_size + 8);
+
+	rc = ftruncate(fd, stat_info.st_size);
+	printf("ftruncate returned %d\n", rc);
+	CU_ASSERT_EQUAL(rc, 0);
+
+	rc = fstat(fd, &new_info);
+	CU_ASSERT_EQUAL(rc, 0);
+	CU_ASSERT_EQUAL(new_info.st_size, stat_info.st_size);
+
+	rc = close(fd);
+	printf("close returned %d\n", rc);
+	CU_ASSERT_EQUAL(rc, 0);
+
 	fd = open(fname, O_RDWR);
 	printf("Opened %s, fd = %d\n", fname, fd);
 	CU_ASSERT_NOT_EQUAL(fd, -1);
@@ -571,6 +950,67 @@ skip_mmap:
 	CU_ASSERT_EQUAL(status, IOF_IO_EXTERNAL);
 }
 
+#if __GLIBC_PREREQ(2, 27)
+static void do_copy_tests(const char *fname, size_t len)
+{
+	char *dst_name;
+	char buf[len + 1];
+	ssize_t bytes;
+	loff_t src_off;
+	off_t offset;
+	int src_fd;
+	int dst_fd;
+	int rc;
+
+	WRITE_LOG("starting copy test");
+	rc = asprintf(&dst_name, "%s.copy", fname);
+	CU_ASSERT_NOT_EQUAL_FATAL(rc, -1);
+
+	unlink(dst_name);
+
+	src_fd = open(fname, O_RDONLY);
+	printf("Opened %s, fd = %d\n", fname, src_fd);
+	CU_ASSERT_NOT_EQUAL_FATAL(src_fd, -1);
+
+	dst_fd = open(dst_name, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	printf("Opened %s, fd = %d\n", dst_name, dst_fd);
+	CU_ASSERT_NOT_EQUAL_FATAL(dst_fd, -1);
+
+	/* The file starts with the name repeated */
+	src_off = len;
+	bytes = copy_file_range(src_fd, &src_off, dst_fd, NULL, len, 0);
+	printf("Copied %zd bytes, expected %zu\n", bytes, len);
+	CU_ASSERT_EQUAL(bytes, len);
+	CU_ASSERT_EQUAL(src_off, len * 2);
+
+	offset = lseek(src_fd, 0, SEEK_CUR);
+	printf("Source offset is %zd, expected 0\n", offset);
+	CU_ASSERT_EQUAL(offset, 0);
+
+	offset = lseek(dst_fd, 0, SEEK_CUR);
+	printf("Destination offset is %zd, expected %zu\n", offset, len);
+	CU_ASSERT_EQUAL(offset, len);
+
+	memset(buf, 0, len + 1);
+	bytes = pread(dst_fd, buf, len, 0);
+	printf("Read %zd bytes, expected %zu\n", bytes, len);
+	CU_ASSERT_EQUAL(bytes, len);
+	CU_ASSERT_STRING_EQUAL(fname, buf);
+
+	rc = close(dst_fd);
+	printf("Closed file, rc = %d\n", rc);
+	CU_ASSERT_EQUAL(rc, 0);
+
+	rc = close(src_fd);
+	printf("Closed file, rc = %d\n", rc);
+	CU_ASSERT_EQUAL(rc, 0);
+
+	unlink(dst_name);
+	free(dst_name);
+	WRITE_LOG("end copy test");
+}
+#endif
+
 /* Simple sanity test to ensure low-level POSIX APIs work */
 void sanity(void)
 {
@@ -590,7 +1030,12 @@ void sanity(void)
 
 	do_write_tests(fd, buf, len);
 	do_read_tests(buf, len);
+	do_read_cache_tests(buf, len);
+	do_aio_tests(buf, len);
 	do_misc_tests(buf, len);
+#if __GLIBC_PREREQ(2, 27)
+	do_copy_tests(buf, len);
+#endif
 	do_large_io_test(buf, len);
 	free(buf);
 }
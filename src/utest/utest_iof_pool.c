@@ -0,0 +1,275 @@
+/* Copyright (C) 2018 Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted for any purpose (including commercial purposes)
+ * provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the
+ *    documentation and/or materials provided with the distribution.
+ *
+ * 3. In addition, redistributions of modified forms of the source or binary
+ *    code must carry prominent notices stating that the original code was
+ *    changed and the date of the change.
+ *
+ *  4. All publications or advertising materials mentioning features or use of
+ *     this software are asked, but not required, to acknowledge that it was
+ *     developed by Intel Corporation and credit the contributors.
+ *
+ * 5. Neither the name of Intel Corporation, nor the name of any Contributor
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <pthread.h>
+#include <gurt/common.h>
+#include <CUnit/Basic.h>
+
+#include <iof_atomic.h>
+#include <iof_pool.h>
+
+int init_suite(void)
+{
+	return CUE_SUCCESS;
+}
+
+int clean_suite(void)
+{
+	return CUE_SUCCESS;
+}
+
+#define NUM_THREADS 4
+#define ITERATIONS 2048
+#define BATCH 8
+
+struct item {
+	d_list_t link;
+	int value;
+	ATOMIC uint64_t *resets;
+};
+
+static void item_init(void *arg, void *handle)
+{
+	struct item *item = arg;
+
+	item->resets = handle;
+}
+
+static bool item_reset(void *arg)
+{
+	struct item *item = arg;
+
+	item->value = 0;
+	atomic_inc(item->resets);
+	return true;
+}
+
+static struct iof_pool_reg item_reg = {.init = item_init,
+				       .reset = item_reset,
+				       POOL_TYPE_INIT(item, link)};
+
+/** Single threaded acquire/release/restock/reclaim */
+static void test_iof_pool(void)
+{
+	struct iof_pool pool;
+	struct iof_pool_type *type;
+	struct item *items[IOF_POOL_MAG_SIZE * 4];
+	ATOMIC uint64_t resets = 0;
+	int i;
+
+	CU_ASSERT(iof_pool_init(&pool, (void *)&resets) == 0);
+
+	type = iof_pool_register(&pool, &item_reg);
+	CU_ASSERT_FATAL(type != NULL);
+
+	for (i = 0; i < IOF_POOL_MAG_SIZE * 4; i++) {
+		items[i] = iof_pool_acquire(type);
+		CU_ASSERT_FATAL(items[i] != NULL);
+		CU_ASSERT(items[i]->value == 0);
+		items[i]->value = i + 1;
+	}
+
+	for (i = 0; i < IOF_POOL_MAG_SIZE * 4; i++)
+		iof_pool_release(type, items[i]);
+
+	iof_pool_restock(type);
+
+	/* Everything released should be handed back reset */
+	for (i = 0; i < IOF_POOL_MAG_SIZE * 4; i++) {
+		items[i] = iof_pool_acquire(type);
+		CU_ASSERT_FATAL(items[i] != NULL);
+		CU_ASSERT(items[i]->value == 0);
+	}
+
+	/* In-use objects are reported by reclaim */
+	CU_ASSERT(iof_pool_reclaim(&pool));
+
+	for (i = 0; i < IOF_POOL_MAG_SIZE * 4; i++)
+		iof_pool_release(type, items[i]);
+
+	CU_ASSERT(!iof_pool_reclaim(&pool));
+	CU_ASSERT(type->count == 0);
+
+	iof_pool_destroy(&pool);
+}
+
+/** Bounded types must never exceed max_desc */
+static void test_iof_pool_limit(void)
+{
+	struct iof_pool pool;
+	struct iof_pool_type *type;
+	struct iof_pool_reg reg = item_reg;
+	struct item *items[BATCH];
+	ATOMIC uint64_t resets = 0;
+	int i;
+
+	reg.max_desc = BATCH;
+
+	CU_ASSERT(iof_pool_init(&pool, (void *)&resets) == 0);
+
+	type = iof_pool_register(&pool, &reg);
+	CU_ASSERT_FATAL(type != NULL);
+	CU_ASSERT(type->mags == NULL);
+
+	for (i = 0; i < BATCH; i++) {
+		items[i] = iof_pool_acquire(type);
+		CU_ASSERT_FATAL(items[i] != NULL);
+	}
+
+	CU_ASSERT(iof_pool_acquire(type) == NULL);
+
+	iof_pool_release(type, items[0]);
+	items[0] = iof_pool_acquire(type);
+	CU_ASSERT(items[0] != NULL);
+
+	for (i = 0; i < BATCH; i++)
+		iof_pool_release(type, items[i]);
+
+	CU_ASSERT(!iof_pool_reclaim(&pool));
+
+	iof_pool_destroy(&pool);
+}
+
+struct thread_info {
+	pthread_barrier_t *barrier;
+	struct iof_pool_type *type;
+	int fails;
+};
+
+static void *thread_func(void *arg)
+{
+	struct thread_info *tpd = arg;
+	struct item *items[BATCH];
+	int i;
+	int j;
+
+	pthread_barrier_wait(tpd->barrier);
+
+	for (i = 0; i < ITERATIONS / BATCH; i++) {
+		for (j = 0; j < BATCH; j++) {
+			items[j] = iof_pool_acquire(tpd->type);
+			if (!items[j]) {
+				tpd->fails++;
+				break;
+			}
+			items[j]->value = j + 1;
+		}
+		while (--j >= 0)
+			iof_pool_release(tpd->type, items[j]);
+		iof_pool_restock(tpd->type);
+	}
+
+	pthread_barrier_wait(tpd->barrier);
+
+	return NULL;
+}
+
+/** Concurrent acquire/release/restock cycles on 1, 2 and 4 threads.  The
+ * timed version is in utest_iof_pool_perf.c.
+ */
+static void test_iof_pool_threaded(void)
+{
+	pthread_barrier_t barrier;
+	pthread_t thread[NUM_THREADS];
+	struct thread_info tpd[NUM_THREADS];
+	struct iof_pool pool;
+	struct iof_pool_type *type;
+	ATOMIC uint64_t resets = 0;
+	int nthreads;
+	int i;
+	int rc;
+
+	for (nthreads = 1; nthreads <= NUM_THREADS; nthreads *= 2) {
+		CU_ASSERT_FATAL(iof_pool_init(&pool, (void *)&resets) == 0);
+
+		type = iof_pool_register(&pool, &item_reg);
+		CU_ASSERT_FATAL(type != NULL);
+
+		pthread_barrier_init(&barrier, NULL, nthreads + 1);
+
+		for (i = 0; i < nthreads; i++) {
+			tpd[i].barrier = &barrier;
+			tpd[i].type = type;
+			tpd[i].fails = 0;
+			rc = pthread_create(&thread[i], NULL, thread_func,
+					    &tpd[i]);
+			CU_ASSERT_FATAL(rc == 0);
+		}
+
+		pthread_barrier_wait(&barrier);
+		pthread_barrier_wait(&barrier);
+
+		for (i = 0; i < nthreads; i++) {
+			rc = pthread_join(thread[i], NULL);
+			CU_ASSERT(rc == 0);
+			CU_ASSERT(tpd[i].fails == 0);
+		}
+
+		CU_ASSERT(!iof_pool_reclaim(&pool));
+		iof_pool_destroy(&pool);
+		pthread_barrier_destroy(&barrier);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	CU_pSuite pSuite = NULL;
+
+	if (CU_initialize_registry() != CUE_SUCCESS)
+		return CU_get_error();
+	pSuite = CU_add_suite("iof_pool API test", init_suite, clean_suite);
+	if (!pSuite) {
+		CU_cleanup_registry();
+		return CU_get_error();
+	}
+
+	if (!CU_add_test(pSuite, "iof_pool test",
+			 test_iof_pool) ||
+	    !CU_add_test(pSuite, "iof_pool limit test",
+			 test_iof_pool_limit) ||
+	    !CU_add_test(pSuite, "iof_pool threaded test",
+			 test_iof_pool_threaded)) {
+		CU_cleanup_registry();
+		return CU_get_error();
+	}
+
+	CU_basic_set_mode(CU_BRM_VERBOSE);
+	CU_basic_run_tests();
+	CU_cleanup_registry();
+
+	return CU_get_error();
+}
@@ -383,6 +383,45 @@ static void test_iof_vector_invalid(void)
 	CU_ASSERT(rc == -DER_INVAL);
 }
 
+static int released;
+
+static void release_cb(void *entry)
+{
+	released += *(int *)entry;
+}
+
+static void test_iof_vector_release(void)
+{
+	vector_t vector;
+	int value = 1;
+	int *x;
+
+	CU_ASSERT(vector_init(&vector, sizeof(int), 10) == 0);
+	CU_ASSERT(vector_set_release(&vector, release_cb) == 0);
+
+	released = 0;
+
+	/* Replacing an entry releases the old one */
+	CU_ASSERT(vector_set(&vector, 0, &value) == 0);
+	CU_ASSERT(vector_set(&vector, 0, &value) == 0);
+	CU_ASSERT(released == 1);
+
+	/* Duplicated entries are released on the last reference */
+	CU_ASSERT(vector_dup(&vector, 0, 1, &x) == 0);
+	CU_ASSERT(vector_decref(&vector, x) == 0);
+	CU_ASSERT(vector_remove(&vector, 0, NULL) == 0);
+	CU_ASSERT(released == 1);
+	CU_ASSERT(vector_remove(&vector, 1, &x) == 0);
+	CU_ASSERT(released == 1);
+	CU_ASSERT(vector_decref(&vector, x) == 0);
+	CU_ASSERT(released == 2);
+
+	/* Entries still in the vector are released on destroy */
+	CU_ASSERT(vector_set(&vector, 5, &value) == 0);
+	CU_ASSERT(vector_destroy(&vector) == 0);
+	CU_ASSERT(released == 3);
+}
+
 int main(int argc, char **argv)
 {
 	CU_pSuite pSuite = NULL;
@@ -400,7 +439,9 @@ int main(int argc, char **argv)
 	    !CU_add_test(pSuite, "iof_vector threaded test",
 		    test_iof_vector_threaded) ||
 	    !CU_add_test(pSuite, "iof_vector invalid test",
-		    test_iof_vector_invalid)) {
+		    test_iof_vector_invalid) ||
+	    !CU_add_test(pSuite, "iof_vector release test",
+		    test_iof_vector_release)) {
 		CU_cleanup_registry();
 		return CU_get_error();
 	}
@@ -0,0 +1,289 @@
+/* Copyright (C) 2019 Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted for any purpose (including commercial purposes)
+ * provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the
+ *    documentation and/or materials provided with the distribution.
+ *
+ * 3. In addition, redistributions of modified forms of the source or binary
+ *    code must carry prominent notices stating that the original code was
+ *    changed and the date of the change.
+ *
+ *  4. All publications or advertising materials mentioning features or use of
+ *     this software are asked, but not required, to acknowledge that it was
+ *     developed by Intel Corporation and credit the contributors.
+ *
+ * 5. Neither the name of Intel Corporation, nor the name of any Contributor
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Multithreaded microbenchmark for the vector used as the interception
+ * library fd table.  Readers look up a mix of set and unset indices, as
+ * the library does for IOF and non-IOF descriptors, while a writer keeps
+ * replacing and removing entries.  The iteration count can be changed with
+ * VECTOR_PERF_ITERATIONS.  It is built with the unit tests but is not part
+ * of the utest run, so run it by hand.
+ */
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include <CUnit/Basic.h>
+
+#include <iof_atomic.h>
+#include <iof_vector.h>
+
+int init_suite(void)
+{
+	return CUE_SUCCESS;
+}
+
+int clean_suite(void)
+{
+	return CUE_SUCCESS;
+}
+
+#define ENTRIES 1024
+#define NUM_READERS 8
+#define DEFAULT_ITERATIONS 200000
+
+/* Every fourth index is set, the rest are never touched */
+#define IS_SET(index) (((index) & 3) == 0)
+
+struct perf_entry {
+	int index;
+	int check;
+};
+
+struct perf_args {
+	pthread_barrier_t *barrier;
+	vector_t *vector;
+	ATOMIC int *stop;
+	long iterations;
+	long found;
+	int fail;
+	int seed;
+	double nsec;
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+#define LOCKED_ASSERT(cond)                  \
+	do {                                 \
+		pthread_mutex_lock(&lock);   \
+		CU_ASSERT(cond)              \
+		pthread_mutex_unlock(&lock); \
+	} while (0)
+
+static double elapsed_ns(struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - start->tv_sec) * 1e9 +
+		(now.tv_nsec - start->tv_nsec);
+}
+
+static void *reader_func(void *arg)
+{
+	struct perf_args *args = arg;
+	struct perf_entry *entry;
+	struct timespec start;
+	unsigned int index;
+	unsigned int seed = args->seed;
+	long i;
+	int rc;
+
+	pthread_barrier_wait(args->barrier);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < args->iterations; i++) {
+		index = rand_r(&seed) % ENTRIES;
+		rc = vector_get(args->vector, index, &entry);
+		if (rc == -DER_NONEXIST)
+			continue;
+		if (rc != 0 || !IS_SET(index) || entry->index != index ||
+		    entry->check != ~entry->index) {
+			args->fail++;
+			if (rc == 0)
+				vector_decref(args->vector, entry);
+			continue;
+		}
+		args->found++;
+		vector_decref(args->vector, entry);
+	}
+
+	args->nsec = elapsed_ns(&start);
+
+	return NULL;
+}
+
+/* Replace and remove set entries until the readers finish */
+static void *writer_func(void *arg)
+{
+	struct perf_args *args = arg;
+	struct perf_entry entry;
+	unsigned int index;
+	unsigned int seed = args->seed;
+
+	pthread_barrier_wait(args->barrier);
+
+	while (!atomic_load_acquire(args->stop)) {
+		index = (rand_r(&seed) % ENTRIES) & ~3;
+		if (rand_r(&seed) & 1) {
+			entry.index = index;
+			entry.check = ~index;
+			if (vector_set(args->vector, index, &entry) != 0)
+				args->fail++;
+		} else {
+			vector_remove(args->vector, index, NULL);
+		}
+		args->iterations++;
+	}
+
+	return NULL;
+}
+
+static void run_perf(const char *name, int num_readers, bool writer)
+{
+	pthread_barrier_t barrier;
+	pthread_t reader[NUM_READERS];
+	pthread_t writer_thread;
+	struct perf_args args[NUM_READERS];
+	struct perf_args wargs = {0};
+	struct perf_entry entry;
+	vector_t vector;
+	ATOMIC int stop = 0;
+	const char *env;
+	long iterations = DEFAULT_ITERATIONS;
+	long found = 0;
+	double nsec = 0;
+	int i;
+	int rc;
+
+	env = getenv("VECTOR_PERF_ITERATIONS");
+	if (env != NULL && atol(env) > 0)
+		iterations = atol(env);
+
+	CU_ASSERT(vector_init(&vector, sizeof(entry), ENTRIES) == 0);
+
+	for (i = 0; i < ENTRIES; i++) {
+		if (!IS_SET(i))
+			continue;
+		entry.index = i;
+		entry.check = ~i;
+		CU_ASSERT(vector_set(&vector, i, &entry) == 0);
+	}
+
+	pthread_barrier_init(&barrier, NULL, num_readers + (writer ? 1 : 0));
+
+	if (writer) {
+		wargs.barrier = &barrier;
+		wargs.vector = &vector;
+		wargs.stop = &stop;
+		wargs.seed = 0xf00d;
+		rc = pthread_create(&writer_thread, NULL, writer_func, &wargs);
+		LOCKED_ASSERT(rc == 0);
+	}
+
+	for (i = 0; i < num_readers; i++) {
+		memset(&args[i], 0, sizeof(args[i]));
+		args[i].barrier = &barrier;
+		args[i].vector = &vector;
+		args[i].iterations = iterations;
+		args[i].seed = i + 1;
+		rc = pthread_create(&reader[i], NULL, reader_func, &args[i]);
+		LOCKED_ASSERT(rc == 0);
+	}
+
+	for (i = 0; i < num_readers; i++) {
+		rc = pthread_join(reader[i], NULL);
+		LOCKED_ASSERT(rc == 0);
+		CU_ASSERT(args[i].fail == 0);
+		found += args[i].found;
+		nsec += args[i].nsec;
+	}
+
+	if (writer) {
+		atomic_store_release(&stop, 1);
+		rc = pthread_join(writer_thread, NULL);
+		LOCKED_ASSERT(rc == 0);
+		CU_ASSERT(wargs.fail == 0);
+	}
+
+	pthread_barrier_destroy(&barrier);
+	CU_ASSERT(vector_destroy(&vector) == 0);
+
+	printf("\n%s: %d readers, %.1f ns/lookup, %ld/%ld found",
+	       name, num_readers, nsec / (iterations * num_readers),
+	       found, iterations * num_readers);
+	if (writer)
+		printf(", %ld writer updates", wargs.iterations);
+	printf("\n");
+}
+
+static void test_vector_perf_single(void)
+{
+	run_perf("lookup", 1, false);
+}
+
+static void test_vector_perf_readers(void)
+{
+	run_perf("lookup", NUM_READERS, false);
+}
+
+static void test_vector_perf_writer(void)
+{
+	run_perf("lookup with writer", NUM_READERS, true);
+}
+
+int main(int argc, char **argv)
+{
+	CU_pSuite pSuite = NULL;
+
+	if (CU_initialize_registry() != CUE_SUCCESS)
+		return CU_get_error();
+	pSuite = CU_add_suite("iof_vector performance test", init_suite,
+			      clean_suite);
+	if (!pSuite) {
+		CU_cleanup_registry();
+		return CU_get_error();
+	}
+
+	if (!CU_add_test(pSuite, "iof_vector single reader",
+			 test_vector_perf_single) ||
+	    !CU_add_test(pSuite, "iof_vector concurrent readers",
+		    test_vector_perf_readers) ||
+	    !CU_add_test(pSuite, "iof_vector readers and writer",
+		    test_vector_perf_writer)) {
+		CU_cleanup_registry();
+		return CU_get_error();
+	}
+
+	CU_basic_set_mode(CU_BRM_VERBOSE);
+	CU_basic_run_tests();
+	CU_cleanup_registry();
+
+	return CU_get_error();
+}
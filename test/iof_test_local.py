@@ -50,6 +50,7 @@ python3 -m unittest -c iof_test_local.Testlocal.test_ionss_link
 
 import os
 import sys
+import ctypes
 import stat
 import time
 import shutil
@@ -102,6 +103,21 @@ def unlink_file(file_name):
     except FileNotFoundError:
         pass
 
+# Modes for fallocate(), from linux/falloc.h
+FALLOC_FL_KEEP_SIZE = 0x01
+FALLOC_FL_PUNCH_HOLE = 0x02
+FALLOC_FL_ZERO_RANGE = 0x10
+
+def fallocate(fd, mode, offset, length):
+    """Call fallocate() with a mode, returning 0 or an errno"""
+
+    libc = ctypes.CDLL(None, use_errno=True)
+    libc.fallocate.argtypes = [ctypes.c_int, ctypes.c_int,
+                               ctypes.c_int64, ctypes.c_int64]
+    if libc.fallocate(fd, mode, offset, length) != 0:
+        return ctypes.get_errno()
+    return 0
+
 def create_file(directory, fname):
     """Create a empty file in the directory"""
 
@@ -134,6 +150,13 @@ class Testlocal(unittest.TestCase,
     cnss_valgrind = False
     ionss_valgrind = False
     failover_test = False
+    striped_test = False
+    balance_test = False
+    cache_test = False
+    cache_dir = None
+    scratch_test = False
+    scratch_dir = None
+    scratch_size = None
 
     @classmethod
     def setUpClass(cls):
@@ -209,6 +232,16 @@ class Testlocal(unittest.TestCase,
         if test_name.split('.')[2].startswith('test_failover'):
             self.failover_test = True
             valgrind_cnss_only = True
+        if test_name.split('.')[2].startswith('test_striped'):
+            self.striped_test = True
+        if test_name.split('.')[2].startswith('test_balance'):
+            self.balance_test = True
+        if test_name.split('.')[2].startswith('test_dw_cache'):
+            self.cache_test = True
+        if test_name.split('.')[2].startswith('test_dw_scratch'):
+            self.scratch_test = True
+        if test_name.split('.')[2].startswith('test_dw_scratch_full'):
+            self.scratch_size = '256K'
 
         # set the standalone test flag
         self.test_local = True
@@ -270,6 +303,20 @@ class Testlocal(unittest.TestCase,
         config['cnss_timeout'] = 5
         if self.failover_test:
             config['projections'][0]['failover'] = 'auto'
+        if self.striped_test:
+            config['projections'][0]['striped_data'] = 'auto'
+            config['projections'][0]['striped_metadata'] = 'auto'
+            config['projections'][0]['stripe_size'] = '64K'
+        if self.balance_test:
+            config['projections'][0]['load_balance'] = 'auto'
+        if self.cache_test:
+            config['projections'][0]['dw_cache'] = 'auto'
+            self.cache_dir = tempfile.mkdtemp(prefix='tmp_iof_test_cache_',
+                                              dir=export_tmp_dir)
+        if self.scratch_test:
+            config['projections'][0]['dw_scratch'] = 'auto'
+            self.scratch_dir = tempfile.mkdtemp(
+                prefix='tmp_iof_test_scratch_', dir=export_tmp_dir)
 
         config_file = tempfile.NamedTemporaryFile(suffix='.cfg',
                                                   prefix="ionss_",
@@ -334,6 +381,12 @@ class Testlocal(unittest.TestCase,
         cnss_file = os.path.join(self.log_path, 'cnss.log')
         unlink_file(cnss_file)
         cmd.extend(['-x', 'D_LOG_FILE=%s' % cnss_file])
+        if self.cache_dir:
+            cmd.extend(['-x', 'CNSS_CACHE_DIR=%s' % self.cache_dir])
+        if self.scratch_dir:
+            cmd.extend(['-x', 'CNSS_SCRATCH_DIR=%s' % self.scratch_dir])
+        if self.scratch_size:
+            cmd.extend(['-x', 'CNSS_SCRATCH_SIZE=%s' % self.scratch_size])
 
         if self.cnss_valgrind:
             cmd.extend(valgrind)
@@ -579,6 +632,10 @@ class Testlocal(unittest.TestCase,
         os.unlink(self.ionss_config_file)
         os.rmdir(self.cnss_prefix)
         shutil.rmtree(self.export_dir)
+        if self.cache_dir:
+            shutil.rmtree(self.cache_dir)
+        if self.scratch_dir:
+            shutil.rmtree(self.scratch_dir)
 
         print("Log dir is %s" % self.log_path)
 
@@ -736,6 +793,313 @@ class Testlocal(unittest.TestCase,
             fd.write('World')
             fd.close()
 
+    def test_file_fallocate(self):
+        """Preallocate a file and check the size on the backend"""
+
+        size = 16 * 1024 * 1024
+        filename = os.path.join(self.import_dir, 'falloc_file')
+        with open(filename, 'w') as fd:
+            os.posix_fallocate(fd.fileno(), 0, size)
+
+        stat_info = os.stat(os.path.join(self.export_dir, 'falloc_file'))
+        if stat_info.st_size != size:
+            self.fail('Size is %d, expected %d' % (stat_info.st_size, size))
+
+    def test_file_fallocate_modes(self):
+        """Keep the size, punch holes and zero ranges of a file"""
+
+        chunk = 64 * 1024
+        data = bytearray(os.urandom(16 * chunk))
+        filename = os.path.join(self.import_dir, 'falloc_modes')
+        with open(filename, 'wb') as fd:
+            fd.write(data)
+
+        fd = os.open(filename, os.O_RDWR)
+        try:
+            # Allocating past the end keeps the size with KEEP_SIZE.
+            rc = fallocate(fd, FALLOC_FL_KEEP_SIZE, len(data), 4 * chunk)
+            if rc != 0:
+                self.fail('fallocate KEEP_SIZE failed %s' % os.strerror(rc))
+            if os.fstat(fd).st_size != len(data):
+                self.fail('KEEP_SIZE changed the size to %d' %
+                          os.fstat(fd).st_size)
+
+            # Punched and zeroed ranges read back as zeros.  The kernel or
+            # the backend file system may not support every mode.
+            for (mode, offset) in [(FALLOC_FL_PUNCH_HOLE |
+                                    FALLOC_FL_KEEP_SIZE, 2 * chunk),
+                                   (FALLOC_FL_ZERO_RANGE, 8 * chunk)]:
+                rc = fallocate(fd, mode, offset, chunk)
+                if rc == errno.EOPNOTSUPP:
+                    self.logger.info('fallocate mode %#x not supported',
+                                     mode)
+                    continue
+                if rc != 0:
+                    self.fail('fallocate mode %#x failed %s' %
+                              (mode, os.strerror(rc)))
+                data[offset:offset + chunk] = bytes(chunk)
+        finally:
+            os.close(fd)
+
+        for (where, path) in [('projection', filename),
+                              ('backend', os.path.join(self.export_dir,
+                                                       'falloc_modes'))]:
+            with open(path, 'rb') as fd:
+                if fd.read() != data:
+                    self.fail('Contents incorrect on %s' % where)
+            if os.stat(path).st_size != len(data):
+                self.fail('Size changed on %s' % where)
+
+        os.unlink(filename)
+
+    def test_striped_io(self):
+        """Write and read back a file striped over all IONSS ranks"""
+
+        stripe = 64 * 1024
+        data = os.urandom(16 * stripe + 1234)
+
+        filename = os.path.join(self.import_dir, 'striped_file')
+        with open(filename, 'wb') as fd:
+            fd.write(data)
+
+        with open(os.path.join(self.export_dir, 'striped_file'), 'rb') as fd:
+            if fd.read() != data:
+                self.fail('Data mismatch on backend')
+
+        with open(filename, 'rb') as fd:
+            if fd.read() != data:
+                self.fail('Data mismatch reading back')
+
+            # A short read which spans a stripe boundary.
+            fd.seek(3 * stripe - 100)
+            if fd.read(200) != data[3 * stripe - 100:3 * stripe + 100]:
+                self.fail('Data mismatch across stripe boundary')
+
+    def test_striped_metadata(self):
+        """Create, rename and remove entries spread over all IONSS ranks"""
+
+        names = ['file_%d' % i for i in range(64)]
+
+        sub_dir = os.path.join(self.import_dir, 'striped_dir')
+        os.mkdir(sub_dir)
+        os.mkdir(os.path.join(sub_dir, 'inner'))
+
+        for name in names:
+            with open(os.path.join(sub_dir, name), 'w') as fd:
+                fd.write(name)
+
+        if sorted(os.listdir(os.path.join(self.export_dir, 'striped_dir'))) \
+           != sorted(names + ['inner']):
+            self.fail('Directory contents incorrect on backend')
+
+        for name in names:
+            with open(os.path.join(sub_dir, name), 'r') as fd:
+                if fd.read() != name:
+                    self.fail('Contents of %s incorrect' % name)
+
+        for name in names[:16]:
+            os.rename(os.path.join(sub_dir, name),
+                      os.path.join(sub_dir, 'inner', name))
+
+        if sorted(os.listdir(os.path.join(sub_dir, 'inner'))) != \
+           sorted(names[:16]):
+            self.fail('Renamed files missing')
+
+        for name in names[:16]:
+            os.unlink(os.path.join(sub_dir, 'inner', name))
+        for name in names[16:]:
+            os.unlink(os.path.join(sub_dir, name))
+        os.rmdir(os.path.join(sub_dir, 'inner'))
+        os.rmdir(sub_dir)
+
+        if os.path.exists(os.path.join(self.export_dir, 'striped_dir')):
+            self.fail('Directory not removed on backend')
+
+    def test_balance_root(self):
+        """Create and read back files in the root over all IONSS ranks"""
+
+        ctrl_file = os.path.join(self.cnss_prefix, '.ctrl', 'iof',
+                                 'projections', '0', 'load_balance')
+        with open(ctrl_file, 'r') as fd:
+            if fd.read().rstrip('\n') != 'enabled':
+                self.fail('Load balancing not enabled')
+
+        names = ['balance_%d' % i for i in range(32)]
+
+        for name in names:
+            with open(os.path.join(self.import_dir, name), 'w') as fd:
+                fd.write(name)
+
+        for name in names:
+            with open(os.path.join(self.import_dir, name), 'r') as fd:
+                if fd.read() != name:
+                    self.fail('Contents of %s incorrect' % name)
+            with open(os.path.join(self.export_dir, name), 'r') as fd:
+                if fd.read() != name:
+                    self.fail('Contents of %s incorrect on backend' % name)
+
+        for name in names:
+            os.unlink(os.path.join(self.import_dir, name))
+
+    def _cache_stats(self):
+        """Return the local data cache statistics as a dict"""
+
+        stats_file = os.path.join(self.cnss_prefix, '.ctrl', 'iof',
+                                  'projections', '0', 'stats', 'cache')
+        with open(stats_file, 'r') as fd:
+            return dict((k, int(v)) for (k, v) in
+                        [f.split('=') for f in fd.read().split()])
+
+    def test_dw_cache_read(self):
+        """Read a file twice, with the second read from the local cache"""
+
+        data = os.urandom(3 * 1024 * 1024 + 100)
+        name = 'dw_cache_file'
+        with open(os.path.join(self.export_dir, name), 'wb') as fd:
+            fd.write(data)
+
+        # Reads are only cached once the file has been checked after open,
+        # and the cache is filled in the background, so read the file until
+        # all 49 blocks have been written.
+        for _ in range(10):
+            with open(os.path.join(self.import_dir, name), 'rb') as fd:
+                if fd.read() != data:
+                    self.fail('Contents of %s incorrect' % name)
+            time.sleep(1)
+            if self._cache_stats()['fills'] >= 49:
+                break
+        else:
+            self.fail('Cache not filled %s' % self._cache_stats())
+
+        hits = self._cache_stats()['hits']
+        with open(os.path.join(self.import_dir, name), 'rb') as fd:
+            if fd.read() != data:
+                self.fail('Contents of %s incorrect from cache' % name)
+        if self._cache_stats()['hits'] == hits:
+            self.fail('Read not from cache %s' % self._cache_stats())
+
+        # Change the file on the backend, the next open should notice and
+        # return the new contents.
+        data = os.urandom(2 * 1024 * 1024)
+        with open(os.path.join(self.export_dir, name), 'wb') as fd:
+            fd.write(data)
+
+        with open(os.path.join(self.import_dir, name), 'rb') as fd:
+            if fd.read() != data:
+                self.fail('Stale contents of %s from cache' % name)
+
+        os.unlink(os.path.join(self.import_dir, name))
+
+    def _scratch_stats(self):
+        """Return the write absorption statistics as a dict"""
+
+        stats_file = os.path.join(self.cnss_prefix, '.ctrl', 'iof',
+                                  'projections', '0', 'stats', 'scratch')
+        with open(stats_file, 'r') as fd:
+            return dict((k, int(v)) for (k, v) in
+                        [f.split('=') for f in fd.read().split()])
+
+    def test_dw_scratch_write(self):
+        """Write a file through the local scratch log"""
+
+        data = os.urandom(3 * 1024 * 1024 + 100)
+        name = 'dw_scratch_file'
+        with open(os.path.join(self.import_dir, name), 'wb') as fd:
+            for off in range(0, len(data), 64 * 1024):
+                fd.write(data[off:off + 64 * 1024])
+            fd.flush()
+            if os.fstat(fd.fileno()).st_size != len(data):
+                self.fail('Size of %s incorrect before drain' % name)
+
+        # In the default drain mode close() waits for the data to reach the
+        # IONSS.
+        stats = self._scratch_stats()
+        if stats['absorbed'] != len(data) or stats['backlog'] != 0:
+            self.fail('Writes not absorbed %s' % stats)
+
+        with open(os.path.join(self.export_dir, name), 'rb') as fd:
+            if fd.read() != data:
+                self.fail('Contents of %s incorrect on backend' % name)
+
+        # Reads wait for absorbed data to be drained.
+        with open(os.path.join(self.import_dir, name), 'r+b') as fd:
+            fd.seek(100)
+            fd.write(b'scratch')
+            fd.flush()
+            fd.seek(0)
+            data = data[:100] + b'scratch' + data[107:]
+            if fd.read() != data:
+                self.fail('Contents of %s incorrect after write' % name)
+
+        os.unlink(os.path.join(self.import_dir, name))
+
+    def test_dw_scratch_async(self):
+        """Write a file through the scratch log without waiting on close"""
+
+        ctrl_file = os.path.join(self.cnss_prefix, '.ctrl', 'iof',
+                                 'projections', '0', 'scratch_drain')
+        with open(ctrl_file, 'w') as fd:
+            fd.write('async')
+        with open(ctrl_file, 'r') as fd:
+            if fd.read().rstrip('\n') != 'async':
+                self.fail('Could not set scratch drain mode')
+
+        data = os.urandom(4 * 1024 * 1024)
+        name = 'dw_scratch_async'
+        with open(os.path.join(self.import_dir, name), 'wb') as fd:
+            for off in range(0, len(data), 64 * 1024):
+                fd.write(data[off:off + 64 * 1024])
+
+        stats = self._scratch_stats()
+        if stats['absorbed'] != len(data):
+            self.fail('Writes not absorbed %s' % stats)
+
+        # Reads wait for the data to be drained even though close() did not.
+        with open(os.path.join(self.import_dir, name), 'rb') as fd:
+            if fd.read() != data:
+                self.fail('Contents of %s incorrect after close' % name)
+
+        # The handle is released in the background once its log is empty.
+        for _ in range(300):
+            stats = self._scratch_stats()
+            if stats['backlog'] == 0 and stats['releasing'] == 0:
+                break
+            time.sleep(0.1)
+        else:
+            self.fail('Log not drained %s' % stats)
+
+        if stats['drained'] != len(data) or stats['errors'] != 0:
+            self.fail('Drain incomplete %s' % stats)
+
+        with open(os.path.join(self.export_dir, name), 'rb') as fd:
+            if fd.read() != data:
+                self.fail('Contents of %s incorrect on backend' % name)
+
+        os.unlink(os.path.join(self.import_dir, name))
+
+    def test_dw_scratch_full(self):
+        """Write more than the capacity of the scratch log"""
+
+        # CNSS_SCRATCH_SIZE is 256K for this test, so writes have to wait
+        # for earlier ones to drain.
+        data = os.urandom(3 * 1024 * 1024)
+        name = 'dw_scratch_full'
+        with open(os.path.join(self.import_dir, name), 'wb') as fd:
+            for off in range(0, len(data), 64 * 1024):
+                fd.write(data[off:off + 64 * 1024])
+
+        stats = self._scratch_stats()
+        if stats['absorbed'] != len(data) or stats['backlog'] != 0:
+            self.fail('Writes not absorbed %s' % stats)
+        if stats['waits'] == 0:
+            self.fail('Writes did not wait for space %s' % stats)
+
+        with open(os.path.join(self.export_dir, name), 'rb') as fd:
+            if fd.read() != data:
+                self.fail('Contents of %s incorrect on backend' % name)
+
+        os.unlink(os.path.join(self.import_dir, name))
+
     def test_ro_listdir(self):
         """Read directory contents"""
 
@@ -841,12 +1205,32 @@ class Testlocal(unittest.TestCase,
         environ['D_LOG_MASK'] = self.log_mask
         environ['CRT_PHY_ADDR_STR'] = self.crt_phy_addr
         environ['OFI_INTERFACE'] = self.ofi_interface
-        for tname in ['s_test_ioil', 'lf_s_test_ioil']:
+        # Run the shared library test again with the optional features on.
+        # Open files with RPCs rather than through the kernel and with the
+        # read cache on, then with stdio streams over bypassed fds, then
+        # with the write-behind cache on.
+        runs = [('s_test_ioil', '', {}),
+                ('lf_s_test_ioil', '', {}),
+                ('s_test_ioil', '_direct',
+                 {'IOIL_DIRECT_OPEN': '1',
+                  'IOIL_READ_CACHE_SIZE': str(64 * 1024)}),
+                ('s_test_ioil', '_stream', {'IOIL_STREAM_BYPASS': '1'}),
+                ('s_test_ioil', '_write_cache',
+                 {'IOIL_WRITE_CACHE_SIZE': str(64 * 1024)})]
+        ioil_vars = set()
+        for (_, _, options) in runs:
+            ioil_vars.update(options.keys())
+
+        for (tname, suffix, options) in runs:
             testname = os.path.join(test_path, tname)
             if not os.path.exists(testname):
                 self.skipTest("%s executable not found" % tname)
 
-            ioil_file = os.path.join(self.log_path, '%s.log' % tname)
+            for var in ioil_vars:
+                environ.pop(var, None)
+            environ.update(options)
+            ioil_file = os.path.join(self.log_path,
+                                     '%s%s.log' % (tname, suffix))
             unlink_file(ioil_file)
             environ['D_LOG_FILE'] = ioil_file
             self.logger.info("libioil test - input string:\n %s\n", testname)
@@ -860,6 +1244,9 @@ class Testlocal(unittest.TestCase,
             if procrtn != 0:
                 self.fail("IO interception test failed: %s" % procrtn)
 
+        for var in ioil_vars:
+            environ.pop(var, None)
+
         # Check the value of il_ioctl after execution
         f = open(stat_file, 'r')
         data = f.read()